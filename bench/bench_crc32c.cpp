@@ -0,0 +1,112 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "pfs_common/pfs_config.hpp"
+#include "pfs_common/pfs_crc32c.hpp"
+
+/*
+    CRC32C microbenchmark: throughput of the table-driven and SSE4.2 implementations,
+    per PFS_BLOCK_SIZE block as the client and fileserver compute them, next to memcpy
+    of the same data as a yardstick for how much a checksum adds to moving the bytes.
+    Before timing anything it checks the SSE4.2 and dispatched checksums against the portable
+    one on random data, and exits with 1 if they differ.
+
+    Usage: ./bench_crc32c [MB per run]
+ */
+
+using Clock = std::chrono::steady_clock;
+
+template <typename F>
+static double run(const char* name, size_t total_bytes, F&& body) {
+    body(); // warm up
+    auto start = Clock::now();
+    uint64_t sink = body();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    double gbps = total_bytes / seconds / 1e9;
+    printf("%-28s %8.2f GB/s   (%llx)\n", name, gbps, (unsigned long long) sink);
+    return gbps;
+}
+
+/* The fast paths against crc32c_portable: random lengths, alignments and starting crcs. False on a mismatch */
+static bool verify() {
+    const char check[] = "123456789";
+    if (crc32c_portable(check, 9) != 0xe3069283) {
+        fprintf(stderr, "crc32c_portable(\"123456789\") = %08x, not e3069283\n", crc32c_portable(check, 9));
+        return false;
+    }
+    std::mt19937_64 random(1);
+    std::vector<char> buf(4 * PFS_BLOCK_SIZE + 64);
+    for (char& c : buf) c = (char) random();
+    for (int i = 0; i < 10000; i++) {
+        size_t start = random() % 64;
+        size_t len = random() % (buf.size() - start + 1);
+        uint32_t seed = i % 2 ? (uint32_t) random() : 0;
+        uint32_t expected = crc32c_portable(&buf[start], len, seed);
+        if (crc32c(&buf[start], len, seed) != expected || (crc32c_hw_available() && crc32c_hw(&buf[start], len, seed) != expected)) {
+            fprintf(stderr, "CRC32C mismatch: %zu bytes at %zu, crc %08x\n", len, start, seed);
+            return false;
+        }
+        // Pieces between block boundaries of a range at a random file offset
+        uint64_t offset = random() % (4 * PFS_BLOCK_SIZE);
+        std::vector<uint32_t> blocks = crc32c_blocks(&buf[start], len, offset);
+        size_t pos = 0, piece = 0;
+        while (pos < len) {
+            size_t n = std::min(len - pos, (size_t) (PFS_BLOCK_SIZE - (offset + pos) % PFS_BLOCK_SIZE));
+            if (piece >= blocks.size() || blocks[piece] != crc32c_portable(&buf[start + pos], n)) {
+                fprintf(stderr, "crc32c_blocks mismatch: %zu bytes at file offset %lu, piece %zu\n", len, (unsigned long) offset, piece);
+                return false;
+            }
+            pos += n;
+            piece++;
+        }
+        if (piece != blocks.size()) {
+            fprintf(stderr, "crc32c_blocks returned %zu pieces for %zu\n", blocks.size(), piece);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    if (!verify()) return 1;
+
+    size_t mb = argc > 1 ? std::atoi(argv[1]) : 256;
+    size_t total = mb * 1024 * 1024;
+    std::vector<char> data(total), copy(total);
+    for (size_t i = 0; i < total; i++) data[i] = (char) (i * 2654435761u >> 24);
+
+    printf("CRC32C over %zu MB in %d-byte blocks, SSE4.2 %s\n", mb, PFS_BLOCK_SIZE,
+           crc32c_hw_available() ? "available" : "not available");
+
+    double memcpy_gbps = run("memcpy", total, [&]() -> uint64_t {
+        for (size_t off = 0; off < total; off += PFS_BLOCK_SIZE) std::memcpy(&copy[off], &data[off], PFS_BLOCK_SIZE);
+        return copy[total / 2];
+    });
+    double portable_gbps = run("crc32c_portable (per block)", total, [&]() -> uint64_t {
+        uint64_t acc = 0;
+        for (size_t off = 0; off < total; off += PFS_BLOCK_SIZE) acc += crc32c_portable(&data[off], PFS_BLOCK_SIZE);
+        return acc;
+    });
+    double hw_gbps = 0;
+    if (crc32c_hw_available()) {
+        hw_gbps = run("crc32c_hw (per block)", total, [&]() -> uint64_t {
+            uint64_t acc = 0;
+            for (size_t off = 0; off < total; off += PFS_BLOCK_SIZE) acc += crc32c_hw(&data[off], PFS_BLOCK_SIZE);
+            return acc;
+        });
+    }
+    run("crc32c_blocks (dispatch)", total, [&]() -> uint64_t {
+        return crc32c_blocks(data.data(), total, 0).size();
+    });
+
+    // Cost of checksumming relative to copying the data once, as every write and read does
+    double best = hw_gbps > 0 ? hw_gbps : portable_gbps;
+    printf("Checksum cost relative to memcpy: %.1f%%\n", 100.0 * memcpy_gbps / best);
+    return 0;
+}
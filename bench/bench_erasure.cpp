@@ -0,0 +1,171 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "pfs_common/pfs_config.hpp"
+#include "pfs_common/pfs_erasure.hpp"
+
+/*
+    Erasure coding microbenchmark: GF(2^8) multiply-accumulate throughput of each kernel,
+    then Reed-Solomon encode and worst-case decode (m data shards lost) of k + m stripes
+    of chunk-sized shards, as the client runs them. Throughput counts data bytes. Before
+    timing anything it checks the SSSE3 and AVX2 kernels against the portable one and that
+    reconstruct() gives back what encode() was given, and exits with 1 if not.
+
+    Usage: ./bench_erasure [k] [m] [MB per run]
+ */
+
+using Clock = std::chrono::steady_clock;
+
+template <typename F>
+static double run(const char* name, size_t total_bytes, F&& body) {
+    body(); // warm up
+    auto start = Clock::now();
+    uint64_t sink = body();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    double gbps = total_bytes / seconds / 1e9;
+    printf("%-28s %8.2f GB/s   (%llx)\n", name, gbps, (unsigned long long) sink);
+    return gbps;
+}
+
+/* The SIMD kernels against gf_mul_add_portable, every coefficient, random lengths and alignments */
+static bool verify_kernels(std::mt19937_64& random) {
+    std::vector<uint8_t> src(4096 + 64), expected(src.size()), dst(src.size());
+    for (uint8_t& b : src) b = (uint8_t) random();
+    struct Kernel { const char* name; bool available; void (*fn)(uint8_t, const uint8_t*, uint8_t*, size_t); };
+    const Kernel kernels[] = {
+        {"gf_mul_add", true, gf_mul_add},
+        {"gf_mul_add_ssse3", gf_ssse3_available(), gf_mul_add_ssse3},
+        {"gf_mul_add_avx2", gf_avx2_available(), gf_mul_add_avx2},
+    };
+    for (int c = 0; c < 256; c++) {
+        size_t start = random() % 64;
+        size_t len = random() % (src.size() - start + 1);
+        for (uint8_t& b : expected) b = (uint8_t) random();
+        std::vector<uint8_t> before = expected;
+        gf_mul_add_portable((uint8_t) c, &src[start], &expected[start], len);
+        for (const Kernel& kernel : kernels) {
+            if (!kernel.available) continue;
+            dst = before;
+            kernel.fn((uint8_t) c, &src[start], &dst[start], len);
+            if (dst != expected) {
+                fprintf(stderr, "%s differs from gf_mul_add_portable: c = %d, %zu bytes at %zu\n", kernel.name, c, len, start);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* Encodes random stripes, erases up to m random shards and checks reconstruct() restores them */
+static bool verify_reed_solomon(std::mt19937_64& random, int k, int m) {
+    ReedSolomon rs(k, m);
+    for (int round = 0; round < 200; round++) {
+        size_t len = 1 + random() % 300;
+        std::vector<std::vector<uint8_t>> original(k + m, std::vector<uint8_t>(len));
+        for (int j = 0; j < k; j++) {
+            for (uint8_t& b : original[j]) b = (uint8_t) random();
+        }
+        std::vector<const uint8_t*> data;
+        std::vector<uint8_t*> parity;
+        for (int j = 0; j < k; j++) data.push_back(original[j].data());
+        for (int i = 0; i < m; i++) parity.push_back(original[k + i].data());
+        rs.encode(data, parity, len);
+
+        std::vector<std::vector<uint8_t>> shards = original;
+        std::vector<bool> present(k + m, true);
+        int erase = round == 0 ? m : (int) (random() % (m + 1));
+        for (int e = 0; e < erase; e++) {
+            int victim = random() % (k + m);
+            present[victim] = false;
+            std::fill(shards[victim].begin(), shards[victim].end(), 0);
+        }
+        std::vector<uint8_t*> pointers;
+        for (auto& shard : shards) pointers.push_back(shard.data());
+        if (!rs.reconstruct(pointers, present, len) || shards != original) {
+            fprintf(stderr, "Reed-Solomon %d+%d failed to reconstruct %d erased shards of %zu bytes\n", k, m, erase, len);
+            return false;
+        }
+    }
+    // One shard fewer than k can't be enough
+    std::vector<std::vector<uint8_t>> shards(k + m, std::vector<uint8_t>(16));
+    std::vector<uint8_t*> pointers;
+    for (auto& shard : shards) pointers.push_back(shard.data());
+    std::vector<bool> present(k + m, false);
+    for (int j = 0; j < k - 1; j++) present[j] = true;
+    if (rs.reconstruct(pointers, present, 16)) {
+        fprintf(stderr, "Reed-Solomon %d+%d reconstructed from %d shards\n", k, m, k - 1);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    int k = argc > 1 ? std::atoi(argv[1]) : 3;
+    int m = argc > 2 ? std::atoi(argv[2]) : 1;
+    size_t mb = argc > 3 ? std::atoi(argv[3]) : 256;
+    size_t total = mb * 1024 * 1024;
+    size_t shard = PFS_BLOCK_SIZE * STRIPE_BLOCKS;
+
+    std::mt19937_64 random(1);
+    if (!verify_kernels(random) || !verify_reed_solomon(random, k, m)) return 1;
+
+    std::vector<uint8_t> data(total), out(total);
+    for (size_t i = 0; i < total; i++) data[i] = (uint8_t) (i * 2654435761u >> 24);
+
+    printf("GF(2^8) over %zu MB, kernel %s\n", mb, gf_kernel_name());
+    run("gf_mul_add_portable", total, [&]() -> uint64_t {
+        gf_mul_add_portable(0x53, data.data(), out.data(), total);
+        return out[total / 2];
+    });
+    if (gf_ssse3_available()) {
+        run("gf_mul_add_ssse3", total, [&]() -> uint64_t {
+            gf_mul_add_ssse3(0x53, data.data(), out.data(), total);
+            return out[total / 2];
+        });
+    }
+    if (gf_avx2_available()) {
+        run("gf_mul_add_avx2", total, [&]() -> uint64_t {
+            gf_mul_add_avx2(0x53, data.data(), out.data(), total);
+            return out[total / 2];
+        });
+    }
+
+    // Stripes of k chunk-sized data shards, parity in a separate buffer
+    ReedSolomon rs(k, m);
+    size_t stripes = total / (k * shard);
+    std::vector<uint8_t> parity(stripes * m * shard);
+    printf("Reed-Solomon %d+%d, %zu-byte shards\n", k, m, shard);
+    run("encode", stripes * k * shard, [&]() -> uint64_t {
+        for (size_t s = 0; s < stripes; s++) {
+            std::vector<const uint8_t*> d;
+            std::vector<uint8_t*> p;
+            for (int j = 0; j < k; j++) d.push_back(&data[(s * k + j) * shard]);
+            for (int i = 0; i < m; i++) p.push_back(&parity[(s * m + i) * shard]);
+            rs.encode(d, p, shard);
+        }
+        return parity[parity.size() / 2];
+    });
+
+    // Degraded: the first m data shards of every stripe are gone
+    std::vector<uint8_t> lost(m * shard);
+    run("reconstruct (m data lost)", stripes * k * shard, [&]() -> uint64_t {
+        std::vector<bool> present(k + m, true);
+        for (int j = 0; j < m && j < k; j++) present[j] = false;
+        for (size_t s = 0; s < stripes; s++) {
+            std::vector<uint8_t*> shards;
+            for (int j = 0; j < k; j++) {
+                shards.push_back(present[j] ? &data[(s * k + j) * shard] : &lost[j * shard]);
+            }
+            for (int i = 0; i < m; i++) shards.push_back(&parity[(s * m + i) * shard]);
+            rs.reconstruct(shards, present, shard);
+        }
+        return lost[0];
+    });
+    return 0;
+}
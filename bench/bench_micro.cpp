@@ -0,0 +1,192 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <new>
+#include <set>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "pfs_common/pfs_config.hpp"
+#include "pfs_common/pfs_layout.hpp"
+#include "pfs_common/pfs_log.hpp"
+#include "pfs_client/pfs_api.hpp"
+#include "pfs_client/pfs_cache.hpp"
+#include "pfs_client/pfs_tokens.hpp"
+#include "pfs_metaserver/pfs_plan.hpp"
+
+/*
+    Microbenchmarks of the in-process structures on the I/O path, on synthetic data and
+    without a cluster:
+        LRUCache        update_cache(), read() hits and invalidate() of a file cached in
+                        many small blocks, as a client ends up with after many small reads
+        token coverage  pfs_tokens_cover(), the client's check before every read and write,
+                        over a file's fragmented token set
+        token revoke    pfs_revoke_overlapping(), the metaserver's scan for conflicting
+                        tokens on every token request
+        chunk loop      pfs_for_each_chunk() over a large range, with the stripe unit fixed
+                        at compile time and known only at run time
+        read plan       pfs_plan_read(), the metaserver's ReadFile planning, for a file of
+                        many chunks
+    Reports ns, heap allocations and bytes allocated per op. Allocations are counted by
+    replacing the global operator new, so they include those of std containers.
+    The structures log through PFS_LOG_*: debug and info messages land on stdout, which is
+    reopened on /dev/null while they run, and the log ring is flushed after each case so one
+    case's messages aren't written out during the next. Run with PFS_LOG=error to keep
+    warnings off stderr as well.
+
+    Usage: ./bench_micro [scale], scale is the number of ranges/tokens/chunks (100000)
+ */
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<uint64_t> allocations{0};
+static std::atomic<uint64_t> allocated_bytes{0};
+
+static void* counted_alloc(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+// Every form of new and delete, so all of them pair up with malloc() and free()
+void* operator new(size_t size) { return counted_alloc(size); }
+void* operator new[](size_t size) { return counted_alloc(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+static int report_fd = -1;
+
+/* Runs body(), which does ops ops, and prints the cost per op */
+template <typename F>
+static void run(const char* name, uint64_t ops, F&& body) {
+    fflush(stdout);
+    uint64_t allocs_before = allocations.load(), bytes_before = allocated_bytes.load();
+    auto start = Clock::now();
+    uint64_t sink = body();
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    pfs_log_flush();
+    double allocs = (double) (allocations.load() - allocs_before) / ops;
+    double bytes = (double) (allocated_bytes.load() - bytes_before) / ops;
+    dprintf(report_fd, "%-36s %10.1f ns/op %8.2f allocs/op %10.1f B/op   (%llx)\n", name, ns / ops, allocs, bytes,
+            (unsigned long long) sink);
+}
+
+int main(int argc, char *argv[]) {
+    int scale = argc > 1 ? std::atoi(argv[1]) : 100000;
+    if (scale < 1) {
+        fprintf(stderr, "usage: %s [scale]\n", argv[0]);
+        return 1;
+    }
+    // The report goes to the real stdout, the structures' own logging nowhere
+    report_fd = dup(STDOUT_FILENO);
+    if (!freopen("/dev/null", "w", stdout)) return 1;
+    dprintf(report_fd, "Scale %d, block size %d, stripe unit %d\n", scale, PFS_BLOCK_SIZE, PFS_DEFAULT_STRIPE_UNIT);
+
+    // LRUCache: scale blocks of 16 bytes of one file, with a byte between blocks
+    const int block = 16;
+    const std::string data(block, 'x');
+    {
+        LRUCache cache(CLIENT_CACHE_BLOCKS);
+        run("LRUCache update_cache", scale, [&]() -> uint64_t {
+            for (int i = 0; i < scale; i++) cache.update_cache("file", (int64_t) i * (block + 1), (int64_t) i * (block + 1) + block - 1, data);
+            return 0;
+        });
+        // Reads and invalidations scan the file's blocks, a sample of them is enough
+        const int probes = std::min(scale, 1000);
+        run("LRUCache read (hit, 1 block)", probes, [&]() -> uint64_t {
+            uint64_t acc = 0;
+            for (int i = 0; i < probes; i++) {
+                int64_t start = (int64_t) i * scale / probes * (block + 1);
+                std::string result;
+                acc += cache.read("file", start, start + block - 1, result) + result.size();
+            }
+            return acc;
+        });
+        run("LRUCache invalidate (1 block)", probes, [&]() -> uint64_t {
+            for (int i = 0; i < probes; i++) {
+                int64_t start = (int64_t) i * scale / probes * (block + 1);
+                cache.invalidate("file", FileToken{start + 4, start + 8, 2, 1});
+            }
+            return 0;
+        });
+    }
+
+    // Token coverage: scale adjacent write tokens of one byte each, the worst case for a
+    // client that kept being revoked in small pieces
+    std::set<FileToken> tokens;
+    for (int i = 0; i < scale; i++) tokens.insert(FileToken{i, i, 2, 1});
+    const int checks = std::max(1, 10000000 / scale);
+    run("pfs_tokens_cover (whole set)", checks, [&]() -> uint64_t {
+        uint64_t covered = 0;
+        for (int i = 0; i < checks; i++) covered += pfs_tokens_cover(tokens, 0, scale - 1, 1 + i % 2);
+        return covered;
+    });
+    // The same set without its first token, the requested range's first byte is uncovered
+    std::set<FileToken> holed(std::next(tokens.begin()), tokens.end());
+    run("pfs_tokens_cover (miss at start)", checks, [&]() -> uint64_t {
+        uint64_t covered = 0;
+        for (int i = 0; i < checks; i++) covered += pfs_tokens_cover(holed, 0, scale - 1, 1);
+        return covered;
+    });
+
+    // Token revoke: scale tokens of other clients, a request overlapping one of them
+    std::map<FileToken, int> ranges;
+    for (int i = 0; i < scale; i++) ranges[FileToken{i * 10, i * 10 + 9, 2, 2 + i % 8}] = i;
+    const int requests = std::max(1, 10000000 / scale);
+    run("pfs_revoke_overlapping (1 conflict)", requests, [&]() -> uint64_t {
+        uint64_t revoked = 0;
+        for (int i = 0; i < requests; i++) {
+            int target = (int) ((int64_t) i * 7919 % scale);
+            FileToken requested{target * 10 + 3, target * 10 + 5, 2, 1};
+            pfs_revoke_overlapping(ranges, requested, [&](const FileToken& token, int holder, const std::vector<FileToken>& remainders) {
+                revoked += holder + remainders.size();
+                (void) token;
+            });
+            ranges[FileToken{target * 10, target * 10 + 9, 2, 2 + target % 8}] = target; // put it back
+        }
+        return revoked;
+    });
+
+    // Chunk loop: one piece per chunk of a scale-chunk range
+    const int64_t unit_size = pfs_stripe_unit_or_default(0);
+    const int64_t range = unit_size * scale;
+    run("pfs_for_each_chunk (fixed unit)", scale, [&]() -> uint64_t {
+        uint64_t acc = 0;
+        pfs_with_stripe_unit(0, [&](auto unit) {
+            pfs_for_each_chunk(unit, 3, range - 6, [&](int64_t chunk, int64_t start, int64_t end) { acc += chunk + end - start; });
+        });
+        return acc;
+    });
+    run("pfs_for_each_chunk (runtime unit)", scale, [&]() -> uint64_t {
+        uint64_t acc = 0;
+        StripeUnit unit{__builtin_ctzll(unit_size)};
+        pfs_for_each_chunk(unit, 3, range - 6, [&](int64_t chunk, int64_t start, int64_t end) { acc += chunk + end - start; });
+        return acc;
+    });
+
+    // Read plan: a file of scale chunks, a read of 16 chunks in it
+    struct pfs_metadata meta_data{};
+    meta_data.recipe.stripe_width = NUM_FILE_SERVERS;
+    meta_data.recipe.stripe_unit = (int) unit_size;
+    meta_data.recipe.replication = 1;
+    meta_data.file_size = range;
+    for (int i = 0; i < scale; i++) {
+        meta_data.recipe.chunks.push_back(Chunk{i, i % NUM_FILE_SERVERS, i * unit_size, (i + 1) * unit_size - 1});
+    }
+    const int plans = std::max(1, 10000000 / scale);
+    run("pfs_plan_read (16 chunks)", plans, [&]() -> uint64_t {
+        uint64_t acc = 0;
+        for (int i = 0; i < plans; i++) {
+            int64_t offset = (int64_t) i * 7919 % (scale > 16 ? scale - 16 : 1) * unit_size;
+            acc += pfs_plan_read(meta_data, offset, 16 * unit_size).size();
+        }
+        return acc;
+    });
+    return 0;
+}
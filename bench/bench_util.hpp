@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "pfs_common/pfs_log.hpp"
+#include "pfs_common/pfs_trace.hpp"
+#include "pfs_common/pfs_workload.hpp"
+
+/*
+    Helpers of the cluster benchmarks (pfs_ior, pfs_mdtest). Every PFS client is a process of
+    its own, like separate client nodes: the client library keeps one client id, token set and
+    cache per process. The parent forks the workers before touching gRPC, then runs in lockstep
+    with them on a process-shared barrier and times each phase between two barriers. Workers
+    leave their per-op latencies in memory shared with the parent.
+ */
+class WorkerGroup {
+public:
+    /* workers processes, each with shared_bytes_per_worker bytes of memory shared with the parent */
+    WorkerGroup(int workers, size_t shared_bytes_per_worker)
+        : workers_(workers), per_worker_((shared_bytes_per_worker + 63) & ~size_t(63)) {
+        size_ = sizeof(pthread_barrier_t) + 64 + per_worker_ * workers;
+        void* region = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED) {
+            perror("mmap");
+            exit(EXIT_FAILURE);
+        }
+        region_ = (char*) region;
+        pthread_barrierattr_t attr;
+        pthread_barrierattr_init(&attr);
+        pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_barrier_init(barrier(), &attr, workers + 1);
+        pthread_barrierattr_destroy(&attr);
+    }
+
+    ~WorkerGroup() {
+        pthread_barrier_destroy(barrier());
+        munmap(region_, size_);
+    }
+
+    /* Forks the workers, each runs body(rank) and exits with what it returns. body must pass every barrier the parent does */
+    template <typename Body>
+    void start(Body&& body) {
+        for (int rank = 0; rank < workers_; rank++) {
+            pid_t pid = fork();
+            if (pid < 0) {
+                perror("fork");
+                exit(EXIT_FAILURE);
+            }
+            if (pid == 0) {
+                int status = body(rank);
+                pfs_log_flush();
+                fflush(stdout);
+                trace_finish();
+                workload_finish();
+                _exit(status);
+            }
+            pids_.push_back(pid);
+        }
+    }
+
+    /* Parent and workers all wait here */
+    void barrier_wait() { pthread_barrier_wait(barrier()); }
+
+    /* The shared memory of worker rank */
+    void* shared(int rank) { return region_ + sizeof(pthread_barrier_t) + 64 + per_worker_ * rank; }
+
+    /* Waits for the workers to exit, returns how many failed */
+    int wait() {
+        int failed = 0;
+        for (pid_t pid : pids_) {
+            int status = 0;
+            waitpid(pid, &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++;
+        }
+        pids_.clear();
+        return failed;
+    }
+
+private:
+    pthread_barrier_t* barrier() { return (pthread_barrier_t*) region_; }
+
+    int workers_;
+    size_t per_worker_;
+    size_t size_;
+    char* region_;
+    std::vector<pid_t> pids_;
+};
+
+/* Latency distribution of a phase, in microseconds */
+struct LatencySummary {
+    double mean = 0, p50 = 0, p99 = 0, p999 = 0, max = 0;
+};
+
+/* Summarizes op latencies in nanoseconds, sorts them. Percentiles are nearest-rank */
+inline LatencySummary summarize_latencies(std::vector<uint64_t>& ns) {
+    LatencySummary summary;
+    if (ns.empty()) return summary;
+    std::sort(ns.begin(), ns.end());
+    auto rank = [&](double p) { return ns[std::min(ns.size() - 1, (size_t) std::max(0.0, std::ceil(p * ns.size()) - 1))] / 1e3; };
+    double total = 0;
+    for (uint64_t v : ns) total += v;
+    summary.mean = total / ns.size() / 1e3;
+    summary.p50 = rank(0.50);
+    summary.p99 = rank(0.99);
+    summary.p999 = rank(0.999);
+    summary.max = ns.back() / 1e3;
+    return summary;
+}
+
+inline void print_latency_json(FILE* out, const LatencySummary& s) {
+    fprintf(out, "{\"mean\": %.1f, \"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}", s.mean, s.p50, s.p99, s.p999, s.max);
+}
+
+/* "64k", "4m", "1g" or plain bytes, -1 if it doesn't parse */
+inline int64_t parse_size(const char* text) {
+    char* end = nullptr;
+    double value = strtod(text, &end);
+    if (end == text || value < 0) return -1;
+    switch (*end) {
+        case 'k': case 'K': value *= 1024; end++; break;
+        case 'm': case 'M': value *= 1024 * 1024; end++; break;
+        case 'g': case 'G': value *= 1024.0 * 1024 * 1024; end++; break;
+        default: break;
+    }
+    return *end == '\0' ? (int64_t) value : -1;
+}
+
+/* Splits "a,b,c" */
+inline std::vector<std::string> split_list(const std::string& text) {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t comma = text.find(',', start);
+        if (comma == std::string::npos) comma = text.size();
+        if (comma > start) items.push_back(text.substr(start, comma - start));
+        start = comma + 1;
+    }
+    return items;
+}
@@ -0,0 +1,294 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <getopt.h>
+
+#include "pfs_common/pfs_config.hpp"
+#include "pfs_client/pfs_api.hpp"
+#include "bench_util.hpp"
+
+/*
+    IOR-style benchmark of a running PFS cluster. N client processes each move a block of
+    data in transfer-sized pfs_write() calls, then read it back with pfs_read(), for every
+    combination of:
+        mode     shared : one file, process r owns bytes [r * block, (r + 1) * block)
+                 fpp    : a file per process
+        pattern  seq     : the transfers of the block in order
+                 random  : in a shuffled order (seeded, so runs repeat)
+                 strided : every stride-th transfer, then the ones after those, ...
+    PFS files can't have holes, so whoever creates a file first fills it to its full size with
+    zeros, and the write phases overwrite. Each write and read is a phase, timed from the
+    barrier all processes start it on to the one they all finish it on, so open and close are
+    in the phase time but creating, filling and deleting the files are not. Reports MB/s
+    (10^6 bytes), IOPS and the per-call latency distribution of every phase as JSON. With -C
+    processes read another process's data, so a read can't be served by the writer's cache.
+
+    Usage: ./pfs_ior [options], -h lists them. Needs pfs_list.txt or $PFS_LIST, like any client.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    int processes = 4;
+    int64_t transfer = 64 * 1024;
+    int64_t block = 4 * 1024 * 1024;    // bytes per process per phase
+    int stripe_width = NUM_FILE_SERVERS;
+    int64_t stripe_unit = 0;            // 0: the pfs_create() default
+    int stride = 16;                    // transfers
+    uint64_t seed = 1;
+    bool reorder = false;
+    bool fsync = false;
+    bool verify = false;
+    bool verbose = false;
+    std::vector<std::string> modes{"shared", "fpp"};
+    std::vector<std::string> patterns{"seq", "random", "strided"};
+    std::string output;
+};
+
+struct PhaseResult {
+    std::string mode, pattern, op;
+    uint64_t ops = 0, errors = 0;
+    int64_t bytes = 0;
+    double seconds = 0;
+    LatencySummary latency;
+};
+
+static void print_usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -n <procs>      client processes (4)\n"
+            "  -t <size>       transfer size, e.g. 64k (64k)\n"
+            "  -b <size>       bytes per process per phase, a multiple of the transfer size (4m)\n"
+            "  -w <width>      stripe width of the files (NUM_FILE_SERVERS)\n"
+            "  -u <size>       stripe unit of the files (PFS_DEFAULT_STRIPE_UNIT)\n"
+            "  -m <modes>      comma separated: shared,fpp (both)\n"
+            "  -p <patterns>   comma separated: seq,random,strided (all)\n"
+            "  -s <stride>     transfers between the accesses of the strided pattern (16)\n"
+            "  -S <seed>       seed of the random pattern (1)\n"
+            "  -C              read the data of the next process instead of your own\n"
+            "  -e              pfs_fsync() before closing after writes\n"
+            "  -v              verify the data read\n"
+            "  -o <file>       write the JSON report to a file instead of stdout\n"
+            "  -V              keep the client library's output\n",
+            program);
+}
+
+/* Order the count transfers of a block are accessed in */
+static std::vector<int64_t> access_order(const Options& o, const std::string& pattern, int64_t count, uint64_t seed) {
+    std::vector<int64_t> order;
+    order.reserve(count);
+    if (pattern == "strided") {
+        for (int64_t first = 0; first < std::min<int64_t>(o.stride, count); first++) {
+            for (int64_t i = first; i < count; i += o.stride) order.push_back(i);
+        }
+        return order;
+    }
+    for (int64_t i = 0; i < count; i++) order.push_back(i);
+    if (pattern == "random") {
+        std::mt19937_64 rng(seed);
+        std::shuffle(order.begin(), order.end(), rng);
+    }
+    return order;
+}
+
+/* The content of the file at offset: every 8 bytes hold their own offset, so any reader can check it */
+static void fill(char *buf, int64_t length, int64_t offset) {
+    for (int64_t i = 0; i + 8 <= length; i += 8) {
+        uint64_t word = offset + i;
+        memcpy(buf + i, &word, 8);
+    }
+}
+
+static bool check(const char *buf, int64_t length, int64_t offset) {
+    for (int64_t i = 0; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, buf + i, 8);
+        if (word != (uint64_t) (offset + i)) return false;
+    }
+    return true;
+}
+
+static std::string file_name(const std::string& mode, const std::string& pattern, int rank) {
+    std::string name = "ior_" + mode + "_" + pattern;
+    return mode == "fpp" ? name + "_" + std::to_string(rank) : name;
+}
+
+/*
+    One phase of one worker: the block at base of file, written or read. slot[0] gets the
+    number of calls made, slot[1] the failed ones, slot + 2 their latencies in ns. If the file
+    can't be opened no call is made and every one of them counts as failed.
+ */
+static void run_phase(const Options& o, bool ok, bool write, const std::string& file, int64_t base, const std::string& pattern,
+                      uint64_t seed, uint64_t *slot, std::vector<char>& buf) {
+    int64_t count = o.block / o.transfer;
+    slot[0] = 0;
+    slot[1] = 0;
+    int fd = ok ? pfs_open(file.c_str(), write ? 2 : 1) : -1;
+    if (fd < 0) {
+        slot[1] = count;
+        return;
+    }
+    std::vector<int64_t> order = access_order(o, pattern, count, seed);
+    for (int64_t i = 0; i < count; i++) {
+        int64_t offset = base + order[i] * o.transfer;
+        if (write) fill(buf.data(), o.transfer, offset);
+        auto start = Clock::now();
+        ssize_t n = write ? pfs_write(fd, buf.data(), o.transfer, offset) : pfs_read(fd, buf.data(), o.transfer, offset);
+        slot[2 + i] = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        if (n != o.transfer || (!write && o.verify && !check(buf.data(), o.transfer, offset))) slot[1]++;
+        slot[0]++;
+    }
+    if (write && o.fsync && pfs_fsync(fd) == -1) slot[1]++;
+    pfs_close(fd);
+}
+
+/* Creates file and writes size bytes of zeros to it, false if that fails */
+static bool create_filled(const Options& o, const std::string& file, int64_t size) {
+    pfs_create_options options;
+    if (o.stripe_unit > 0) options.stripe_unit = o.stripe_unit;
+    if (pfs_create(file.c_str(), o.stripe_width, options) == -1) return false;
+    int fd = pfs_open(file.c_str(), 2);
+    if (fd < 0) return false;
+    std::vector<char> zeros(std::min<int64_t>(size, 1024 * 1024));
+    bool ok = true;
+    for (int64_t offset = 0; ok && offset < size; offset += zeros.size()) {
+        int64_t n = std::min<int64_t>(zeros.size(), size - offset);
+        ok = pfs_write(fd, zeros.data(), n, offset) == n;
+    }
+    pfs_close(fd);
+    return ok;
+}
+
+static int worker(const Options& o, WorkerGroup& group, int rank) {
+    if (!o.verbose && !freopen("/dev/null", "w", stdout)) return 1;
+    int client_id = pfs_initialize();
+    bool ok = client_id != -1;
+    if (!ok) fprintf(stderr, "worker %d: pfs_initialize() failed\n", rank);
+    uint64_t *slot = (uint64_t *) group.shared(rank);
+    std::vector<char> buf(o.transfer);
+    group.barrier_wait();
+
+    int target = o.reorder ? (rank + 1) % o.processes : rank;
+    for (const std::string& mode : o.modes) {
+        for (const std::string& pattern : o.patterns) {
+            bool shared = mode == "shared";
+            if (ok && (!shared || rank == 0) && !create_filled(o, file_name(mode, pattern, rank), shared ? o.processes * o.block : o.block)) {
+                fprintf(stderr, "worker %d: creating %s failed\n", rank, file_name(mode, pattern, rank).c_str());
+            }
+
+            group.barrier_wait();
+            run_phase(o, ok, true, file_name(mode, pattern, rank), shared ? rank * o.block : 0, pattern, o.seed + rank, slot, buf);
+            group.barrier_wait();
+
+            group.barrier_wait();
+            run_phase(o, ok, false, file_name(mode, pattern, target), shared ? target * o.block : 0, pattern, o.seed + rank + o.processes,
+                      slot, buf);
+            group.barrier_wait();
+
+            if (ok && (!shared || rank == 0)) pfs_delete(file_name(mode, pattern, rank).c_str());
+        }
+    }
+    if (ok) pfs_finish(client_id);
+    return ok ? 0 : 1;
+}
+
+static void print_report(FILE *out, const Options& o, const std::vector<PhaseResult>& results, int failed_workers) {
+    fprintf(out, "{\n  \"benchmark\": \"pfs_ior\",\n");
+    fprintf(out, "  \"config\": {\"processes\": %d, \"transfer_bytes\": %ld, \"block_bytes\": %ld, \"stripe_width\": %d, "
+                 "\"stripe_unit\": %ld, \"stride\": %d, \"seed\": %lu, \"reorder\": %s, \"fsync\": %s, \"verify\": %s},\n",
+            o.processes, (long) o.transfer, (long) o.block, o.stripe_width, (long) (o.stripe_unit > 0 ? o.stripe_unit : PFS_DEFAULT_STRIPE_UNIT),
+            o.stride, (unsigned long) o.seed, o.reorder ? "true" : "false", o.fsync ? "true" : "false", o.verify ? "true" : "false");
+    fprintf(out, "  \"failed_workers\": %d,\n  \"phases\": [\n", failed_workers);
+    for (size_t i = 0; i < results.size(); i++) {
+        const PhaseResult& r = results[i];
+        double seconds = r.seconds > 0 ? r.seconds : 1e-9;
+        fprintf(out, "    {\"mode\": \"%s\", \"pattern\": \"%s\", \"op\": \"%s\", \"ops\": %lu, \"errors\": %lu, \"bytes\": %ld, "
+                     "\"seconds\": %.6f, \"MBps\": %.2f, \"iops\": %.1f, \"latency_us\": ",
+                r.mode.c_str(), r.pattern.c_str(), r.op.c_str(), (unsigned long) r.ops, (unsigned long) r.errors, (long) r.bytes,
+                r.seconds, r.bytes / seconds / 1e6, r.ops / seconds);
+        print_latency_json(out, r.latency);
+        fprintf(out, "}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char *argv[]) {
+    Options o;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:b:w:u:m:p:s:S:Cevo:Vh")) != -1) {
+        switch (opt) {
+            case 'n': o.processes = atoi(optarg); break;
+            case 't': o.transfer = parse_size(optarg); break;
+            case 'b': o.block = parse_size(optarg); break;
+            case 'w': o.stripe_width = atoi(optarg); break;
+            case 'u': o.stripe_unit = parse_size(optarg); break;
+            case 'm': o.modes = split_list(optarg); break;
+            case 'p': o.patterns = split_list(optarg); break;
+            case 's': o.stride = atoi(optarg); break;
+            case 'S': o.seed = strtoull(optarg, nullptr, 10); break;
+            case 'C': o.reorder = true; break;
+            case 'e': o.fsync = true; break;
+            case 'v': o.verify = true; break;
+            case 'o': o.output = optarg; break;
+            case 'V': o.verbose = true; break;
+            default: print_usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (o.processes < 1 || o.transfer < 8 || o.block < o.transfer || o.block % o.transfer != 0 || o.stride < 1) {
+        fprintf(stderr, "%s: need at least 1 process, a transfer size of at least 8 bytes and a block of whole transfers\n", argv[0]);
+        return 1;
+    }
+    for (const std::string& mode : o.modes) {
+        if (mode != "shared" && mode != "fpp") { fprintf(stderr, "%s: unknown mode %s\n", argv[0], mode.c_str()); return 1; }
+    }
+    for (const std::string& pattern : o.patterns) {
+        if (pattern != "seq" && pattern != "random" && pattern != "strided") { fprintf(stderr, "%s: unknown pattern %s\n", argv[0], pattern.c_str()); return 1; }
+    }
+    int64_t count = o.block / o.transfer;
+    WorkerGroup group(o.processes, (2 + count) * sizeof(uint64_t));
+    group.start([&](int rank) { return worker(o, group, rank); });
+
+    // Mirrors the barriers of worker()
+    std::vector<PhaseResult> results;
+    group.barrier_wait();
+    for (const std::string& mode : o.modes) {
+        for (const std::string& pattern : o.patterns) {
+            for (const char *op : {"write", "read"}) {
+                group.barrier_wait();
+                auto start = Clock::now();
+                group.barrier_wait();
+                PhaseResult r;
+                r.mode = mode;
+                r.pattern = pattern;
+                r.op = op;
+                r.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+                std::vector<uint64_t> latencies;
+                for (int rank = 0; rank < o.processes; rank++) {
+                    uint64_t *slot = (uint64_t *) group.shared(rank);
+                    r.ops += count;
+                    r.errors += slot[1];
+                    latencies.insert(latencies.end(), slot + 2, slot + 2 + slot[0]);
+                }
+                r.bytes = (int64_t) (r.ops - r.errors) * o.transfer;
+                r.latency = summarize_latencies(latencies);
+                results.push_back(r);
+                fprintf(stderr, "%s %s %s: %.2f MB/s, %.1f IOPS, %lu errors\n", mode.c_str(), pattern.c_str(), op,
+                        r.bytes / std::max(r.seconds, 1e-9) / 1e6, r.ops / std::max(r.seconds, 1e-9), (unsigned long) r.errors);
+            }
+        }
+    }
+    int failed = group.wait();
+
+    FILE *out = o.output.empty() ? stdout : fopen(o.output.c_str(), "w");
+    if (!out) {
+        perror(o.output.c_str());
+        return 1;
+    }
+    print_report(out, o, results, failed);
+    if (out != stdout) fclose(out);
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,241 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <getopt.h>
+
+#include "pfs_common/pfs_config.hpp"
+#include "pfs_client/pfs_api.hpp"
+#include "pfs_metaserver/pfs_metaserver_api.hpp"
+#include "bench_util.hpp"
+
+/*
+    mdtest-style benchmark of the metaserver. N client processes run the metadata calls
+    phase by phase, every process making `items` calls per phase:
+        create  pfs_create()
+        open    pfs_open(), the descriptors stay open for the next phases
+        fstat   pfs_fstat() of each descriptor
+        close   pfs_close() of each descriptor
+        delete  pfs_delete()
+    on files that are
+        unique  : each process's own files
+        shared  : one set of files, each process creates and deletes its share but opens,
+                  stats and closes the share of the next process
+        single  : a single file, created and deleted by process 0 and opened `items` times
+                  by every process, all contending on one metaserver record
+    Files are never written, so no fileserver is involved. Phases are timed between barriers
+    like pfs_ior. Reports ops/s and the per-call latency distribution of every phase as JSON,
+    along with what the metaserver itself measured during the phase: calls and mean handler
+    time of each RPC it served (from its GetStats RPC), the difference to the client latency
+    being the network and gRPC.
+
+    Usage: ./pfs_mdtest [options], -h lists them. Needs pfs_list.txt or $PFS_LIST, like any client.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+static const char *OPS[] = {"create", "open", "fstat", "close", "delete"};
+
+struct Options {
+    int processes = 4;
+    int items = 1000;               // calls per process per phase
+    int stripe_width = NUM_FILE_SERVERS;
+    bool verbose = false;
+    std::vector<std::string> modes{"unique", "shared", "single"};
+    std::string output;
+};
+
+struct PhaseResult {
+    std::string mode, op;
+    uint64_t ops = 0, errors = 0;
+    double seconds = 0;
+    LatencySummary latency;
+    std::vector<struct pfs_rpc_timing> metaserver; // calls and handler time during the phase
+};
+
+static void print_usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -n <procs>      client processes (4)\n"
+            "  -i <items>      calls per process per phase (1000)\n"
+            "  -w <width>      stripe width of the files (NUM_FILE_SERVERS)\n"
+            "  -m <modes>      comma separated: unique,shared,single (all)\n"
+            "  -o <file>       write the JSON report to a file instead of stdout\n"
+            "  -V              keep the client library's output\n",
+            program);
+}
+
+static std::string file_name(const std::string& mode, int rank, int item, int items) {
+    if (mode == "unique") return "mdtest_u_" + std::to_string(rank) + "_" + std::to_string(item);
+    if (mode == "shared") return "mdtest_s_" + std::to_string(rank * items + item);
+    return "mdtest_single";
+}
+
+/* Records one call of a phase: slot[0] calls, slot[1] failures, slot + 2 latencies in ns */
+template <typename Call>
+static void timed(uint64_t *slot, Call&& call) {
+    auto start = Clock::now();
+    bool ok = call();
+    slot[2 + slot[0]++] = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    if (!ok) slot[1]++;
+}
+
+static int worker(const Options& o, WorkerGroup& group, int rank) {
+    if (!o.verbose && !freopen("/dev/null", "w", stdout)) return 1;
+    int client_id = pfs_initialize();
+    bool ok = client_id != -1;
+    if (!ok) fprintf(stderr, "worker %d: pfs_initialize() failed\n", rank);
+    uint64_t *slot = (uint64_t *) group.shared(rank);
+    group.barrier_wait();
+
+    for (const std::string& mode : o.modes) {
+        // Whose files this process opens, stats and closes
+        int other = mode == "shared" ? (rank + 1) % o.processes : rank;
+        // Files this process creates and deletes
+        int owned = mode == "single" ? (rank == 0 ? 1 : 0) : o.items;
+        std::vector<int> fds;
+        for (const char *op : OPS) {
+            group.barrier_wait();
+            slot[0] = slot[1] = 0; // the parent has read the last phase's by now
+            if (!ok) {
+                slot[1] = strcmp(op, "create") == 0 || strcmp(op, "delete") == 0 ? owned : o.items;
+            } else if (strcmp(op, "create") == 0) {
+                for (int i = 0; i < owned; i++) {
+                    std::string name = file_name(mode, rank, i, o.items);
+                    timed(slot, [&]() { return pfs_create(name.c_str(), o.stripe_width) == 0; });
+                }
+            } else if (strcmp(op, "open") == 0) {
+                for (int i = 0; i < o.items; i++) {
+                    std::string name = file_name(mode, other, i, o.items);
+                    timed(slot, [&]() {
+                        int fd = pfs_open(name.c_str(), 1);
+                        if (fd >= 0) fds.push_back(fd);
+                        return fd >= 0;
+                    });
+                }
+            } else if (strcmp(op, "fstat") == 0) {
+                struct pfs_metadata meta_data;
+                for (int fd : fds) timed(slot, [&]() { return pfs_fstat(fd, &meta_data) == 0; });
+            } else if (strcmp(op, "close") == 0) {
+                for (int fd : fds) timed(slot, [&]() { return pfs_close(fd) == 0; });
+                fds.clear();
+            } else {
+                for (int i = 0; i < owned; i++) {
+                    std::string name = file_name(mode, rank, i, o.items);
+                    timed(slot, [&]() { return pfs_delete(name.c_str()) == 0; });
+                }
+            }
+            group.barrier_wait();
+        }
+    }
+    if (ok) pfs_finish(client_id);
+    return ok ? 0 : 1;
+}
+
+/* What the metaserver served between two GetStats */
+static std::vector<struct pfs_rpc_timing> timing_delta(const std::vector<struct pfs_rpc_timing>& before,
+                                                       const std::vector<struct pfs_rpc_timing>& after) {
+    std::vector<struct pfs_rpc_timing> delta;
+    for (const struct pfs_rpc_timing& a : after) {
+        struct pfs_rpc_timing d = a;
+        for (const struct pfs_rpc_timing& b : before) {
+            if (b.rpc != a.rpc) continue;
+            d.calls -= b.calls;
+            d.total_us -= b.total_us;
+        }
+        if (d.calls > 0) delta.push_back(d);
+    }
+    return delta;
+}
+
+static void print_report(FILE *out, const Options& o, const std::vector<PhaseResult>& results, int failed_workers, bool have_server_stats) {
+    fprintf(out, "{\n  \"benchmark\": \"pfs_mdtest\",\n");
+    fprintf(out, "  \"config\": {\"processes\": %d, \"items\": %d, \"stripe_width\": %d},\n", o.processes, o.items, o.stripe_width);
+    fprintf(out, "  \"failed_workers\": %d,\n  \"metaserver_stats\": %s,\n  \"phases\": [\n", failed_workers, have_server_stats ? "true" : "false");
+    for (size_t i = 0; i < results.size(); i++) {
+        const PhaseResult& r = results[i];
+        fprintf(out, "    {\"mode\": \"%s\", \"op\": \"%s\", \"ops\": %lu, \"errors\": %lu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, \"latency_us\": ",
+                r.mode.c_str(), r.op.c_str(), (unsigned long) r.ops, (unsigned long) r.errors, r.seconds, r.ops / std::max(r.seconds, 1e-9));
+        print_latency_json(out, r.latency);
+        fprintf(out, ", \"metaserver\": [");
+        for (size_t j = 0; j < r.metaserver.size(); j++) {
+            const struct pfs_rpc_timing& t = r.metaserver[j];
+            fprintf(out, "%s{\"rpc\": \"%s\", \"calls\": %lu, \"mean_us\": %.1f}", j > 0 ? ", " : "", t.rpc.c_str(), (unsigned long) t.calls,
+                    (double) t.total_us / t.calls);
+        }
+        fprintf(out, "]}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char *argv[]) {
+    Options o;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:i:w:m:o:Vh")) != -1) {
+        switch (opt) {
+            case 'n': o.processes = atoi(optarg); break;
+            case 'i': o.items = atoi(optarg); break;
+            case 'w': o.stripe_width = atoi(optarg); break;
+            case 'm': o.modes = split_list(optarg); break;
+            case 'o': o.output = optarg; break;
+            case 'V': o.verbose = true; break;
+            default: print_usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (o.processes < 1 || o.items < 1) {
+        fprintf(stderr, "%s: need at least 1 process and 1 item\n", argv[0]);
+        return 1;
+    }
+    for (const std::string& mode : o.modes) {
+        if (mode != "unique" && mode != "shared" && mode != "single") { fprintf(stderr, "%s: unknown mode %s\n", argv[0], mode.c_str()); return 1; }
+    }
+
+    WorkerGroup group(o.processes, (2 + o.items) * sizeof(uint64_t));
+    group.start([&](int rank) { return worker(o, group, rank); });
+
+    // Mirrors the barriers of worker(). gRPC is only used here once the workers are forked,
+    // and the client library's output is kept out of the report
+    int report_fd = dup(STDOUT_FILENO);
+    if (!o.verbose && !freopen("/dev/null", "w", stdout)) return 1;
+    std::vector<PhaseResult> results;
+    bool have_server_stats = true;
+    group.barrier_wait();
+    for (const std::string& mode : o.modes) {
+        for (const char *op : OPS) {
+            std::vector<struct pfs_rpc_timing> before, after;
+            have_server_stats = have_server_stats && metaserver_api_stats(before) == 0;
+            group.barrier_wait();
+            auto start = Clock::now();
+            group.barrier_wait();
+            PhaseResult r;
+            r.mode = mode;
+            r.op = op;
+            r.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            std::vector<uint64_t> latencies;
+            for (int rank = 0; rank < o.processes; rank++) {
+                uint64_t *slot = (uint64_t *) group.shared(rank);
+                r.ops += slot[0];
+                r.errors += slot[1];
+                latencies.insert(latencies.end(), slot + 2, slot + 2 + slot[0]);
+            }
+            r.latency = summarize_latencies(latencies);
+            have_server_stats = have_server_stats && metaserver_api_stats(after) == 0;
+            if (have_server_stats) r.metaserver = timing_delta(before, after);
+            results.push_back(r);
+            fprintf(stderr, "%s %s: %.1f ops/s, p99 %.1f us, %lu errors\n", mode.c_str(), op, r.ops / std::max(r.seconds, 1e-9), r.latency.p99,
+                    (unsigned long) r.errors);
+        }
+    }
+    int failed = group.wait();
+
+    FILE *out = o.output.empty() ? fdopen(report_fd, "w") : fopen(o.output.c_str(), "w");
+    if (!out) {
+        perror(o.output.c_str());
+        return 1;
+    }
+    print_report(out, o, results, failed, have_server_stats);
+    fclose(out);
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,355 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <getopt.h>
+
+#include "pfs_common/pfs_config.hpp"
+#include "pfs_common/pfs_histogram.hpp"
+#include "pfs_common/pfs_workload.hpp"
+#include "pfs_client/pfs_api.hpp"
+#include "bench_util.hpp"
+
+/*
+    Replays workloads recorded with PFS_RECORD (pfs_common/pfs_workload.hpp) against a running
+    PFS cluster. Every recorded process is replayed by a client process of its own and every
+    thread of it by a thread, making the thread's calls in the order it made them. By default
+    each thread goes as fast as the cluster lets it, so only the order within a thread is kept;
+    with -t every call also waits for the time it was made at in the recording, counted from
+    the start of the earliest file, and -s speeds that clock up or slows it down. Descriptors
+    are mapped from the recording's to the replay's as opens return; a call on one the replay
+    hasn't opened yet waits REPLAY_WAIT_MS for another thread to open it, and so does an open
+    that failed but succeeded in the recording, the file may be another process's to create.
+    Writes send a random pattern of the recorded size.
+
+    Reports as JSON, per op: the calls, how many failed, how many came out differently than in
+    the recording (success or failure, or the bytes of a read, write or copy), the bytes moved,
+    and the replayed next to the recorded latency distribution; with -t also how late calls
+    started against the recording's clock.
+
+    Usage: ./pfs_replay [options] pfs_workload_<pid>.bin ..., -h lists them. Needs pfs_list.txt
+    or $PFS_LIST, like any client.
+ */
+
+#define REPLAY_WAIT_MS 2000
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    bool timed = false;
+    double speed = 1.0;
+    std::string prefix;
+    std::string output;
+    bool verbose = false;
+};
+
+struct OpStats {
+    uint64_t calls = 0, failures = 0, mismatches = 0, bytes = 0;
+    LatencyHistogram replayed;
+    LatencyHistogram recorded;
+};
+
+/* What a replaying process leaves in the memory it shares with the parent */
+struct ReplayStats {
+    OpStats ops[PFS_OP_COUNT];
+    LatencyHistogram lag;       // calls started this late against the recording's clock, -t only
+
+    void merge(const ReplayStats& other) {
+        for (int op = 0; op < PFS_OP_COUNT; op++) {
+            ops[op].calls += other.ops[op].calls;
+            ops[op].failures += other.ops[op].failures;
+            ops[op].mismatches += other.ops[op].mismatches;
+            ops[op].bytes += other.ops[op].bytes;
+            ops[op].replayed.merge(other.ops[op].replayed);
+            ops[op].recorded.merge(other.ops[op].recorded);
+        }
+        lag.merge(other.lag);
+    }
+};
+
+/* The recorded descriptors of one process and what the replay got for them */
+class FdMap {
+public:
+    void add(int64_t recorded, int fd) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        fds_[recorded] = fd;
+        opened_.notify_all();
+    }
+
+    /* The replay's descriptor for recorded, -1 if no thread opened it within REPLAY_WAIT_MS */
+    int find(int64_t recorded) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        opened_.wait_for(lock, std::chrono::milliseconds(REPLAY_WAIT_MS), [&] { return fds_.count(recorded) > 0; });
+        auto it = fds_.find(recorded);
+        return it == fds_.end() ? -1 : it->second;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable opened_;
+    std::unordered_map<int64_t, int> fds_;
+};
+
+static void print_usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [options] pfs_workload_<pid>.bin ...\n"
+            "  -t              keep the recorded timing instead of going as fast as possible\n"
+            "  -s <factor>     with -t, replay this many times faster than recorded (1)\n"
+            "  -P <prefix>     put prefix in front of every file name, to replay next to the original files\n"
+            "  -o <file>       write the JSON report to a file instead of stdout\n"
+            "  -V              keep the client library's output\n",
+            program);
+}
+
+static int64_t arg(const WorkloadRecord& record, size_t i) {
+    return i < record.args.size() ? record.args[i] : 0;
+}
+
+static std::string name(const Options& o, const WorkloadRecord& record, size_t i) {
+    return o.prefix + (i < record.names.size() ? record.names[i] : "");
+}
+
+/* Makes the call of record, returns its result */
+static int64_t issue(const Options& o, const WorkloadRecord& record, FdMap& fds, std::vector<char>& buf, std::mt19937& random) {
+    int64_t size = 0;
+    if (record.op == PFS_OP_READ || record.op == PFS_OP_WRITE) size = arg(record, 2);
+    if (record.op == PFS_OP_COPY) size = arg(record, 4);
+    if (size > (int64_t) buf.size()) {
+        size_t old = buf.size();
+        buf.resize(size);
+        for (size_t i = old; i < buf.size(); i++) buf[i] = (char) random();
+    }
+
+    switch (record.op) {
+        case PFS_OP_CREATE: {
+            pfs_create_options options;
+            if (record.args.size() >= 6) {
+                options.compression = arg(record, 1);
+                options.replication = arg(record, 2);
+                options.ec_parity = arg(record, 3);
+                options.stripe_unit = arg(record, 4);
+                options.placement = arg(record, 5);
+            }
+            return pfs_create(name(o, record, 0).c_str(), arg(record, 0), options);
+        }
+        case PFS_OP_OPEN: {
+            auto deadline = Clock::now() + std::chrono::milliseconds(REPLAY_WAIT_MS);
+            int fd = pfs_open(name(o, record, 0).c_str(), arg(record, 0));
+            while (fd < 0 && record.result >= 0 && Clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                fd = pfs_open(name(o, record, 0).c_str(), arg(record, 0));
+            }
+            if (fd >= 0 && record.result >= 0) fds.add(record.result, fd);
+            return fd;
+        }
+        case PFS_OP_READ: {
+            int fd = fds.find(arg(record, 0));
+            return fd < 0 ? -1 : pfs_read(fd, buf.data(), size, arg(record, 1));
+        }
+        case PFS_OP_WRITE: {
+            int fd = fds.find(arg(record, 0));
+            return fd < 0 ? -1 : pfs_write(fd, buf.data(), size, arg(record, 1));
+        }
+        case PFS_OP_CLOSE: {
+            int fd = fds.find(arg(record, 0));
+            return fd < 0 ? -1 : pfs_close(fd);
+        }
+        case PFS_OP_DELETE:
+            return pfs_delete(name(o, record, 0).c_str());
+        case PFS_OP_FSTAT: {
+            int fd = fds.find(arg(record, 0));
+            struct pfs_metadata meta_data;
+            return fd < 0 ? -1 : pfs_fstat(fd, &meta_data);
+        }
+        case PFS_OP_FSYNC: {
+            int fd = fds.find(arg(record, 0));
+            return fd < 0 ? -1 : pfs_fsync(fd);
+        }
+        case PFS_OP_SET_DURABILITY:
+            return pfs_set_durability(arg(record, 0));
+        case PFS_OP_COPY: {
+            int src_fd = fds.find(arg(record, 0)), dst_fd = fds.find(arg(record, 2));
+            return src_fd < 0 || dst_fd < 0 ? -1 : pfs_copy(src_fd, arg(record, 1), dst_fd, arg(record, 3), size);
+        }
+        case PFS_OP_CLONE:
+            return pfs_clone(name(o, record, 0).c_str(), name(o, record, 1).c_str());
+        case PFS_OP_SNAPSHOT:
+            return pfs_snapshot(name(o, record, 0).c_str(), name(o, record, 1).c_str());
+        default:
+            return -1;
+    }
+}
+
+/* Replays the calls of one recorded thread, offset_us is when its process started recording */
+static void replay_thread(const Options& o, const std::vector<const WorkloadRecord*>& records, int64_t offset_us, Clock::time_point origin,
+                          FdMap& fds, ReplayStats& stats, uint32_t seed) {
+    std::vector<char> buf;
+    std::mt19937 random(seed);
+    for (const WorkloadRecord *record : records) {
+        if (o.timed) {
+            auto due = origin + std::chrono::microseconds((int64_t) ((offset_us + record->start_us) / o.speed));
+            std::this_thread::sleep_until(due);
+            stats.lag.record(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - due).count()));
+        }
+        auto start = Clock::now();
+        int64_t result = issue(o, *record, fds, buf, random);
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+        OpStats& op = stats.ops[record->op];
+        op.calls++;
+        op.replayed.record(ns);
+        op.recorded.record(record->duration_us * 1000);
+        if (result < 0) op.failures++;
+        bool moves_data = record->op == PFS_OP_READ || record->op == PFS_OP_WRITE || record->op == PFS_OP_COPY;
+        if (moves_data && result > 0) op.bytes += result;
+        if ((result < 0) != (record->result < 0) || (moves_data && result != record->result)) op.mismatches++;
+    }
+}
+
+static int worker(const Options& o, WorkerGroup& group, int rank, const WorkloadFile& file, int64_t offset_us) {
+    if (!o.verbose && !freopen("/dev/null", "w", stdout)) return 1;
+    int client_id = pfs_initialize();
+    bool ok = client_id != -1;
+    if (!ok) fprintf(stderr, "worker %d: pfs_initialize() failed\n", rank);
+
+    // Each recorded thread's calls in the order it made them
+    std::map<uint32_t, std::vector<const WorkloadRecord*>> threads;
+    for (const WorkloadRecord& record : file.records) threads[record.thread].push_back(&record);
+    for (auto& [thread, records] : threads) {
+        std::stable_sort(records.begin(), records.end(),
+                         [](const WorkloadRecord *a, const WorkloadRecord *b) { return a->start_us < b->start_us; });
+    }
+    std::vector<std::unique_ptr<ReplayStats>> stats;
+    for (size_t i = 0; i < threads.size(); i++) stats.push_back(std::make_unique<ReplayStats>());
+    FdMap fds;
+    group.barrier_wait();
+
+    auto origin = Clock::now();
+    std::vector<std::thread> replayers;
+    size_t i = 0;
+    for (auto& [thread, records] : threads) {
+        if (!ok) break;
+        replayers.emplace_back(replay_thread, std::cref(o), std::cref(records), offset_us, origin, std::ref(fds), std::ref(*stats[i]),
+                               (uint32_t) (rank * 1000 + i));
+        i++;
+    }
+    for (std::thread& replayer : replayers) replayer.join();
+    ReplayStats *shared = new (group.shared(rank)) ReplayStats();
+    for (const auto& thread_stats : stats) shared->merge(*thread_stats);
+    group.barrier_wait();
+
+    if (ok) pfs_finish(client_id);
+    return ok ? 0 : 1;
+}
+
+static LatencySummary summarize(const LatencyHistogram& histogram) {
+    LatencySummary summary;
+    summary.mean = histogram.mean_ns() / 1e3;
+    summary.p50 = histogram.percentile_ns(0.50) / 1e3;
+    summary.p99 = histogram.percentile_ns(0.99) / 1e3;
+    summary.p999 = histogram.percentile_ns(0.999) / 1e3;
+    summary.max = histogram.max_ns / 1e3;
+    return summary;
+}
+
+static void print_report(FILE *out, const Options& o, size_t files, const ReplayStats& stats, double seconds, double recorded_seconds,
+                         int failed_workers) {
+    fprintf(out, "{\n  \"benchmark\": \"pfs_replay\",\n");
+    fprintf(out, "  \"config\": {\"files\": %zu, \"timed\": %s, \"speed\": %.3f, \"prefix\": \"%s\"},\n", files, o.timed ? "true" : "false",
+            o.speed, o.prefix.c_str());
+    fprintf(out, "  \"failed_workers\": %d,\n  \"seconds\": %.6f,\n  \"recorded_seconds\": %.6f,\n", failed_workers, seconds, recorded_seconds);
+    if (o.timed) {
+        fprintf(out, "  \"start_lag_us\": ");
+        print_latency_json(out, summarize(stats.lag));
+        fprintf(out, ",\n");
+    }
+    fprintf(out, "  \"ops\": [\n");
+    const char *separator = "";
+    for (int op = 1; op < PFS_OP_COUNT; op++) {
+        const OpStats& s = stats.ops[op];
+        if (s.calls == 0) continue;
+        fprintf(out, "%s    {\"op\": \"%s\", \"calls\": %lu, \"failures\": %lu, \"mismatches\": %lu, \"bytes\": %lu, \"MBps\": %.2f, "
+                     "\"latency_us\": ",
+                separator, PFS_OP_NAMES[op], (unsigned long) s.calls, (unsigned long) s.failures, (unsigned long) s.mismatches,
+                (unsigned long) s.bytes, s.bytes / std::max(seconds, 1e-9) / 1e6);
+        print_latency_json(out, summarize(s.replayed));
+        fprintf(out, ", \"recorded_latency_us\": ");
+        print_latency_json(out, summarize(s.recorded));
+        fprintf(out, "}");
+        separator = ",\n";
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+int main(int argc, char *argv[]) {
+    Options o;
+    int opt;
+    while ((opt = getopt(argc, argv, "ts:P:o:Vh")) != -1) {
+        switch (opt) {
+            case 't': o.timed = true; break;
+            case 's': o.speed = atof(optarg); break;
+            case 'P': o.prefix = optarg; break;
+            case 'o': o.output = optarg; break;
+            case 'V': o.verbose = true; break;
+            default: print_usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind == argc || o.speed <= 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // Read before forking, a bad file stops the replay before it starts
+    std::vector<WorkloadFile> files(argc - optind);
+    for (size_t f = 0; f < files.size(); f++) {
+        if (workload_read_file(argv[optind + f], files[f]) == -1) return 1;
+    }
+    int64_t earliest_ns = INT64_MAX;
+    for (const WorkloadFile& file : files) earliest_ns = std::min(earliest_ns, file.start_ns);
+    double recorded_seconds = 0;
+    for (const WorkloadFile& file : files) {
+        for (const WorkloadRecord& record : file.records) {
+            double end = (file.start_ns - earliest_ns) / 1e9 + (record.start_us + record.duration_us) / 1e6;
+            recorded_seconds = std::max(recorded_seconds, end);
+        }
+    }
+
+    WorkerGroup group(files.size(), sizeof(ReplayStats));
+    group.start([&](int rank) { return worker(o, group, rank, files[rank], (files[rank].start_ns - earliest_ns) / 1000); });
+
+    // Mirrors the barriers of worker()
+    group.barrier_wait();
+    auto start = Clock::now();
+    group.barrier_wait();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    int failed = group.wait();
+
+    auto stats = std::make_unique<ReplayStats>();
+    for (size_t rank = 0; rank < files.size(); rank++) stats->merge(*(const ReplayStats *) group.shared(rank));
+    for (int op = 1; op < PFS_OP_COUNT; op++) {
+        const OpStats& s = stats->ops[op];
+        if (s.calls == 0) continue;
+        fprintf(stderr, "%s: %lu calls, %lu failures, %lu mismatches, mean %.1f us (recorded %.1f us)\n", PFS_OP_NAMES[op],
+                (unsigned long) s.calls, (unsigned long) s.failures, (unsigned long) s.mismatches, s.replayed.mean_ns() / 1e3,
+                s.recorded.mean_ns() / 1e3);
+    }
+
+    FILE *out = o.output.empty() ? stdout : fopen(o.output.c_str(), "w");
+    if (!out) {
+        perror(o.output.c_str());
+        return 1;
+    }
+    print_report(out, o, files.size(), *stats, seconds, recorded_seconds, failed);
+    if (out != stdout) fclose(out);
+    return failed > 0 ? 1 : 0;
+}
@@ -69,7 +69,7 @@ int main(int argc, char *argv[]) {
         return -1;
     } else {
         printf("%s:%s: Read the following %d bytes from the PFS file:\n", __FILE__, __func__, ret);
-        std::cout << "\033[34m" << (std::string(read_content)) << "\033[0m" << std::endl;
+        std::cout << "\033[34m" << (std::string(read_content, ret)) << "\033[0m" << std::endl;
     }
     std::cout << std::endl << std::endl << std::endl << std::endl;
 
@@ -80,7 +80,7 @@ int main(int argc, char *argv[]) {
         return -1;
     } else {
         printf("%s:%s: Read the following %d bytes from the PFS file.\n", __FILE__, __func__, ret);
-        std::cout << "\033[34m" << (std::string(read_content)) << "\033[0m" << std::endl;
+        std::cout << "\033[34m" << (std::string(read_content, ret)) << "\033[0m" << std::endl;
     }
     std::cout << std::endl << std::endl << std::endl << std::endl << std::endl;
 
@@ -91,7 +91,7 @@ int main(int argc, char *argv[]) {
         return -1;
     } else {
         printf("%s:%s: Read the following %d bytes from the PFS file.\n", __FILE__, __func__, ret);
-        std::cout << "\033[34m" << (std::string(read_content)) << "\033[0m" << std::endl;
+        std::cout << "\033[34m" << (std::string(read_content, ret)) << "\033[0m" << std::endl;
     }
     read_content = (char*) malloc(50);
     ret = pfs_read(pfs_fd, (void *)read_content, 50, 1048);
@@ -100,7 +100,7 @@ int main(int argc, char *argv[]) {
         return -1;
     } else {
         printf("%s:%s: Read the following %d bytes from the PFS file.\n", __FILE__, __func__, ret);
-        std::cout << "\033[34m" <<(std::string(read_content)) << "\033[0m" << std::endl;
+        std::cout << "\033[34m" <<(std::string(read_content, ret)) << "\033[0m" << std::endl;
     }
     read_content = (char*) malloc(50);
     ret = pfs_read(pfs_fd, (void *)read_content, 50, 2048);
@@ -109,7 +109,7 @@ int main(int argc, char *argv[]) {
         return -1;
     } else {
         printf("%s:%s: Read the following %d bytes from the PFS file.\n", __FILE__, __func__, ret);
-        std::cout << "\033[34m" <<(std::string(read_content)) << "\033[0m" << std::endl;
+        std::cout << "\033[34m" <<(std::string(read_content, ret)) << "\033[0m" << std::endl;
     }
     // every request's buffer is fresh
     // ret = pfs_write(pfs_fd, (void *)buf, 1000, 1024);
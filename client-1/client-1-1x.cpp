@@ -70,7 +70,7 @@ int main(int argc, char *argv[]) {
         return -1;
     } else {
         printf("%s:%s: Read the following %d bytes from the PFS file.\n", __FILE__, __func__, ret);
-        std::cout << "\033[34m" <<(std::string(read_content)) << "\033[0m" << std::endl;
+        std::cout << "\033[34m" <<(std::string(read_content, ret)) << "\033[0m" << std::endl;
     }
 
     read_content = (char*) malloc(50);
@@ -80,7 +80,7 @@ int main(int argc, char *argv[]) {
         return -1;
     } else {
         printf("%s:%s: Read the following %d bytes from the PFS file.\n", __FILE__, __func__, ret);
-        std::cout << "\033[34m" <<(std::string(read_content)) << "\033[0m" << std::endl;
+        std::cout << "\033[34m" <<(std::string(read_content, ret)) << "\033[0m" << std::endl;
     }
     read_content = (char*) malloc(50);
     ret = pfs_read(pfs_fd, (void *)read_content, 50, 2050);
@@ -89,7 +89,7 @@ int main(int argc, char *argv[]) {
         return -1;
     } else {
         printf("%s:%s: Read the following %d bytes from the PFS file.\n", __FILE__, __func__, ret);
-        std::cout << "\033[34m" <<(std::string(read_content)) << "\033[0m" << std::endl;
+        std::cout << "\033[34m" <<(std::string(read_content, ret)) << "\033[0m" << std::endl;
     }
     read_content = (char*) malloc(50);
     ret = pfs_read(pfs_fd, (void *)read_content, 50, 150);
@@ -98,7 +98,7 @@ int main(int argc, char *argv[]) {
         return -1;
     } else {
         printf("%s:%s: Read the following %d bytes from the PFS file.\n", __FILE__, __func__, ret);
-        std::cout << "\033[34m" <<(std::string(read_content)) << "\033[0m" << std::endl;
+        std::cout << "\033[34m" <<(std::string(read_content, ret)) << "\033[0m" << std::endl;
     }
 
     std::this_thread::sleep_for(std::chrono::seconds(3));
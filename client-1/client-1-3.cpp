@@ -19,6 +19,10 @@ int pfs_print_stat(int client_id) {
         printf("%s: num_evictions: %ld, num_writebacks: %ld, num_invalidations: %ld\n", __func__, mystat.num_evictions, mystat.num_writebacks, mystat.num_invalidations);
         printf("%s: num_close_writebacks: %ld, num_close_evictions: %ld\n", __func__, mystat.num_close_writebacks, mystat.num_close_evictions);
     }
+    struct pfs_execstat_ext extstat;
+    if (ret != -1 && pfs_execstat_ext(&extstat) != -1) {
+        printf("%s: latencies and fileserver traffic:\n%s", __func__, extstat.client.to_string().c_str());
+    }
     return ret;
 }
 
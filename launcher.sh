@@ -40,6 +40,62 @@ execute_server() {
     fi
 }
 
+# Local cluster: a metaserver and N fileservers on localhost, logs (line buffered) and data under $LOCAL_DIR
+LOCAL_DIR="local_cluster"
+
+start_local_cluster() {
+    num_fileservers=${1:-$(grep -oP '#define NUM_FILE_SERVERS \K[0-9]+' pfs_common/pfs_config.hpp)}
+    base_port=${2:-50050}
+    min_fileservers=$(grep -oP '#define NUM_FILE_SERVERS \K[0-9]+' pfs_common/pfs_config.hpp)
+
+    if (( num_fileservers < min_fileservers )); then
+        echo -e "${RED}Clients expect at least NUM_FILE_SERVERS=$min_fileservers fileservers.${RESET}"
+        exit 1
+    fi
+    if [[ -f "$LOCAL_DIR/pids" ]]; then
+        echo -e "${RED}A local cluster is already running, stop it first: $0 stop${RESET}"
+        exit 1
+    fi
+
+    mkdir -p "$LOCAL_DIR"
+    root=$(cd "$LOCAL_DIR" && pwd)
+    list="$root/pfs_list.txt"
+    echo "localhost:$base_port" > "$list"
+    for ((i = 0; i < num_fileservers; i++)); do
+        echo "localhost:$((base_port + 1 + i))" >> "$list"
+    done
+
+    echo -e "${GREEN}Launching the metaserver on localhost:$base_port...${RESET}"
+    stdbuf -oL ./pfs_metaserver/pfs_metaserver --list "$list" --port "$base_port" > "$root/metaserver.log" 2>&1 &
+    echo $! >> "$root/pids"
+
+    for ((i = 0; i < num_fileservers; i++)); do
+        port=$((base_port + 1 + i))
+        echo -e "${GREEN}Launching fileserver $i on localhost:$port...${RESET}"
+        stdbuf -oL ./pfs_fileserver/pfs_fileserver --list "$list" --port "$port" --address "localhost:$port" \
+            --data-dir "$root/fileserver-$i/files" > "$root/fileserver-$i.log" 2>&1 &
+        echo $! >> "$root/pids"
+    done
+
+    echo -e "${BLUE}Logs and data are in $root. Run clients with:${RESET}"
+    echo "    export PFS_LIST=$list"
+    echo -e "${BLUE}Stop the cluster with: $0 stop${RESET}"
+}
+
+stop_local_cluster() {
+    if [[ ! -f "$LOCAL_DIR/pids" ]]; then
+        echo "No local cluster is running."
+        exit 0
+    fi
+    echo -e "${YELLOW}Stopping the local cluster...${RESET}"
+    pids=$(cat "$LOCAL_DIR/pids")
+    kill $pids 2> /dev/null
+    for pid in $pids; do
+        while kill -0 "$pid" 2> /dev/null; do sleep 0.1; done
+    done
+    rm -f "$LOCAL_DIR/pids"
+}
+
 if [[ "$#" -eq 0 ]]; then
     echo -e "${RED}No argument provided. Exiting the script.${RESET}"
     exit 1
@@ -49,3 +105,14 @@ if [[ "$1" == "0" ]]; then
     execute_server
     exit 0
 fi
+
+# ./launcher.sh local [num_fileservers] [base_port]: start a local cluster, fileservers on base_port + 1, ...
+if [[ "$1" == "local" ]]; then
+    start_local_cluster "$2" "$3"
+    exit 0
+fi
+
+if [[ "$1" == "stop" ]]; then
+    stop_local_cluster
+    exit 0
+fi
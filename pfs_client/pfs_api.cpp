@@ -1,5 +1,10 @@
 #include "pfs_api.hpp"
 #include "pfs_cache.hpp"
+#include "pfs_replica.hpp"
+#include "pfs_common/pfs_erasure.hpp"
+#include "pfs_common/pfs_client_stats.hpp"
+#include "pfs_common/pfs_log.hpp"
+#include "pfs_common/pfs_workload.hpp"
 #include "pfs_metaserver/pfs_metaserver_api.hpp"
 #include "pfs_fileserver/pfs_fileserver_api.hpp"
 #include <grpcpp/grpcpp.h>  
@@ -11,6 +16,8 @@
 /* fd --> filename */
 std::unordered_map<int, std::string> fd_to_filename;
 int my_client_id;
+int my_durability = PFS_DEFAULT_DURABILITY;
+ReplicaSelector replica_selector;
 
 /* Given a server address, checks if it's online */
 bool is_server_online(const std::string& server_address, std::string serverType) {
@@ -24,10 +31,10 @@ bool is_server_online(const std::string& server_address, std::string serverType)
 
         grpc::Status status = metadataStub->Ping(&context, request, &response);
         if (status.ok()) {
-            std::cout << serverType << " Server " << server_address << " is online." << std::endl;
+            PFS_LOG_DEBUG("%s Server %s is online.", serverType.c_str(), server_address.c_str());
             return true;
         } else {
-            std::cerr << "Failed to connect to metaserver " << server_address << ": " << status.error_message() << std::endl;
+            PFS_LOG_ERROR("Failed to connect to metaserver %s: %s", server_address.c_str(), status.error_message().c_str());
             return false;
         }
     } else if (serverType == "file") {
@@ -40,21 +47,21 @@ bool is_server_online(const std::string& server_address, std::string serverType)
 
         grpc::Status status = fileserverStub->Ping(&context, request, &response);
         if (status.ok()) {
-            std::cout << serverType << " Server " << server_address << " is online." << std::endl;
+            PFS_LOG_DEBUG("%s Server %s is online.", serverType.c_str(), server_address.c_str());
             return true;
         } else {
-            std::cerr << "Failed to connect to fileserver " << server_address << ": " << status.error_message() << std::endl;
+            PFS_LOG_ERROR("Failed to connect to fileserver %s: %s", server_address.c_str(), status.error_message().c_str());
             return false;
         }
     }
     return false;
 }
 
-/* Reads pfs_list.txt and returns ALL addresses in a vector<string> */
+/* Reads pfs_list.txt (or $PFS_LIST) and returns ALL addresses in a vector<string> */
 std::vector<std::string> get_server_addresses() {
-    std::ifstream pfs_list("pfs_list.txt");
+    std::ifstream pfs_list(pfs_list_path("pfs_list.txt"));
     if (!pfs_list.is_open()) {
-        std::cerr << "Failed to open pfs_list.txt file!" << std::endl;
+        PFS_LOG_ERROR("Failed to open pfs_list.txt file!");
         return {};
     }
 
@@ -70,28 +77,42 @@ std::vector<std::string> get_server_addresses() {
 int verify_all_servers_online() {
     std::vector<std::string> server_addresses = get_server_addresses();
     if (server_addresses.empty()) {
-        std::cerr << "No servers listed in pfs_list.txt!" << std::endl;
+        PFS_LOG_ERROR("No servers listed in pfs_list.txt!");
         return -1;
     }
 
-    std::cout << "Checking if servers are online..." << std::endl;
+    PFS_LOG_DEBUG("Checking if servers are online...");
 
     std::string metaserver_address = server_addresses[0];
     if (!is_server_online(metaserver_address, "meta")) {
-        std::cerr << "Metadata server is not online!" << std::endl;
+        PFS_LOG_ERROR("Metadata server is not online!");
         return -1;
     }
     for (size_t i = 1; i <= NUM_FILE_SERVERS; i++) {
         std::string fileserver_address = server_addresses[i];
         if (!is_server_online(fileserver_address, "file")) {
-            std::cerr << "File server " << fileserver_address << " is not online!" << std::endl;
+            PFS_LOG_ERROR("File server %s is not online!", fileserver_address.c_str());
             return -1;
         }
     }
-    std::cout << "All servers are online!" << std::endl;
+    PFS_LOG_INFO("All servers are online!");
     return 0;
 }
 
+/*
+    The metaserver address, then fileserver i at i + 1 like pfs_list.txt, but from the cluster
+    map so fileservers that joined later are there too. Falls back to pfs_list.txt.
+ */
+std::vector<std::string> get_cluster_addresses(std::vector<int> *states = nullptr) {
+    std::vector<std::string> server_addresses = get_server_addresses();
+    struct pfs_cluster_map map;
+    if (server_addresses.empty() || metaserver_api_cluster_map(map) == -1) return server_addresses;
+    server_addresses.resize(1);
+    server_addresses.insert(server_addresses.end(), map.addresses.begin(), map.addresses.end());
+    if (states) *states = map.states;
+    return server_addresses;
+}
+
 /* Returns name of a file without extension */
 std::string extract_name(std::string filename) {
     size_t dot_pos = filename.find('.');
@@ -99,9 +120,160 @@ std::string extract_name(std::string filename) {
     return filename.substr(0, dot_pos);
 }
 
+/* Size of the file on the metaserver right now, -1 if it can't be fetched */
+static int64_t current_file_size(int fd) {
+    struct pfs_metadata meta_data;
+    if (metaserver_api_fstat(fd, &meta_data, my_client_id) == -1) return -1;
+    return (int64_t) meta_data.file_size;
+}
+
+/*
+    Reads data chunk chunk_number of an erasure-coded file from its server into out, whole:
+    the part beyond the end of the file reads as zeros, as it was when the parity was encoded.
+ */
+static int read_stripe_chunk(const std::vector<std::string> &server_addresses, const std::string &filename,
+                             const struct pfs_filerecipe &layout, int chunk_number, int64_t file_size, std::string &out) {
+    const int chunk_size = layout.stripe_unit;
+    int server = layout.data_server(chunk_number);
+    int64_t start_byte = (int64_t) chunk_number * chunk_size;
+    int64_t end_byte = std::min<int64_t>(start_byte + chunk_size, file_size) - 1;
+    out.assign(chunk_size, '\0');
+    if (end_byte < start_byte) return 0;
+
+    std::string content;
+    std::string chunk_filename = pfs_chunk_filename(server, filename, chunk_number, layout.generation);
+    int r = fileserver_api_read(server_addresses[server + 1], content, chunk_filename, chunk_number, end_byte - start_byte + 1,
+                                start_byte, end_byte, start_byte, layout.compression, layout.stripe_unit);
+    // Everything below the file size was written, a short chunk is a lost one
+    if (r == -1 || (int64_t) content.size() != end_byte - start_byte + 1) return -1;
+    std::memcpy(&out[0], content.data(), content.size());
+    return 0;
+}
+
+/* Reads parity chunk `parity` of a stripe, always written whole */
+static int read_parity_chunk(const std::vector<std::string> &server_addresses, const std::string &filename,
+                             const struct pfs_filerecipe &layout, int stripe, int parity, std::string &out) {
+    const int chunk_size = layout.stripe_unit;
+    int server = layout.parity_server(parity);
+    int64_t start_byte = (int64_t) stripe * chunk_size;
+    std::string chunk_filename = pfs_chunk_filename(server, filename, stripe, layout.generation);
+    int r = fileserver_api_read(server_addresses[server + 1], out, chunk_filename, stripe, chunk_size,
+                                start_byte, start_byte + chunk_size - 1, start_byte, layout.compression, layout.stripe_unit);
+    if (r == -1 || (int) out.size() != chunk_size) return -1;
+    return 0;
+}
+
+/*
+    Re-encodes the parity of every stripe a write of [offset, offset + num_bytes) touched, once
+    the data chunks are on their servers. Chunks the write covered whole come from buf, the
+    others (all of them if buf is null) are read back. Parity chunk p of stripe s is chunk s of the file on parity_server(p).
+ */
+static int ec_update_parity(const std::vector<std::string> &server_addresses, const std::string &filename,
+                            const struct pfs_filerecipe &layout, const char *buf, size_t num_bytes, off_t offset, int64_t file_size) {
+    const int chunk_size = layout.stripe_unit;
+    const int k = layout.stripe_width, m = layout.ec_parity;
+    const int64_t stripe_size = (int64_t) k * chunk_size;
+    ReedSolomon rs(k, m);
+
+    for (int64_t stripe = offset / stripe_size; stripe <= (int64_t) (offset + num_bytes - 1) / stripe_size; stripe++) {
+        std::vector<std::string> data(k);
+        std::vector<int> results(k, 0);
+        std::vector<std::thread> readers;
+        for (int j = 0; j < k; j++) {
+            int chunk_number = stripe * k + j;
+            int64_t chunk_start = (int64_t) chunk_number * chunk_size;
+            if (buf && chunk_start >= offset && chunk_start + chunk_size <= (int64_t) (offset + num_bytes)) {
+                data[j].assign(buf + (chunk_start - offset), chunk_size);
+            } else {
+                readers.push_back(trace_thread([&, j, chunk_number]() {
+                    results[j] = read_stripe_chunk(server_addresses, filename, layout, chunk_number, file_size, data[j]);
+                }));
+            }
+        }
+        for (std::thread &reader : readers) {
+            reader.join();
+        }
+        for (int j = 0; j < k; j++) {
+            if (results[j] == -1) {
+                PFS_LOG_ERROR("Failed to read chunk %ld of %s to encode its stripe", (long) (stripe * k + j), filename.c_str());
+                return -1;
+            }
+        }
+
+        std::vector<std::string> parity(m, std::string(chunk_size, '\0'));
+        std::vector<const uint8_t*> data_ptrs;
+        std::vector<uint8_t*> parity_ptrs;
+        for (int j = 0; j < k; j++) data_ptrs.push_back((const uint8_t*) data[j].data());
+        for (int p = 0; p < m; p++) parity_ptrs.push_back((uint8_t*) &parity[p][0]);
+        rs.encode(data_ptrs, parity_ptrs, chunk_size);
+
+        std::vector<int> writes(m, 0);
+        std::vector<std::thread> writers;
+        for (int p = 0; p < m; p++) {
+            writers.push_back(trace_thread([&, p]() {
+                int server = layout.parity_server(p);
+                int64_t start_byte = stripe * chunk_size;
+                std::string chunk_filename = pfs_chunk_filename(server, filename, stripe, layout.generation);
+                writes[p] = fileserver_api_write(server_addresses[server + 1], parity[p].data(), chunk_filename, stripe, chunk_size,
+                                                 start_byte, start_byte + chunk_size - 1, start_byte, my_durability, layout.compression,
+                                                 layout.stripe_unit);
+            }));
+        }
+        for (std::thread &writer : writers) {
+            writer.join();
+        }
+        for (int w : writes) {
+            if (w == -1) {
+                PFS_LOG_ERROR("Failed to write parity of stripe %ld of %s", (long) stripe, filename.c_str());
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Degraded read: rebuilds a data chunk of an erasure-coded file from the rest of its stripe */
+static int ec_reconstruct_chunk(const std::vector<std::string> &server_addresses, const std::string &filename,
+                                const struct pfs_filerecipe &layout, const struct Chunk &chunk, int64_t file_size, std::string &out) {
+    const int chunk_size = layout.stripe_unit;
+    const int k = layout.stripe_width, m = layout.ec_parity;
+    int stripe = chunk.chunk_number / k;
+    int lost = chunk.chunk_number % k;
+
+    // Everything else in the stripe at once, any k of the k + m shards will do
+    std::vector<std::string> shards(k + m);
+    std::vector<int> results(k + m, -1);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < k + m; i++) {
+        if (i == lost) continue;
+        readers.push_back(trace_thread([&, i]() {
+            results[i] = i < k ? read_stripe_chunk(server_addresses, filename, layout, stripe * k + i, file_size, shards[i])
+                               : read_parity_chunk(server_addresses, filename, layout, stripe, i - k, shards[i]);
+        }));
+    }
+    for (std::thread &reader : readers) {
+        reader.join();
+    }
+
+    std::vector<bool> present(k + m);
+    std::vector<uint8_t*> shard_ptrs;
+    for (int i = 0; i < k + m; i++) {
+        present[i] = results[i] == 0;
+        if (!present[i]) shards[i].assign(chunk_size, '\0');
+        shard_ptrs.push_back((uint8_t*) &shards[i][0]);
+    }
+    if (!ReedSolomon(k, m).reconstruct(shard_ptrs, present, chunk_size)) {
+        PFS_LOG_ERROR("Too many chunks of stripe %d of %s are lost", stripe, filename.c_str());
+        return -1;
+    }
+    int64_t chunk_start = (int64_t) chunk.chunk_number * chunk_size;
+    out = shards[lost].substr(chunk.start_byte - chunk_start, chunk.end_byte - chunk.start_byte + 1);
+    return 0;
+}
+
 int pfs_initialize() {
     if(verify_all_servers_online() == -1){
-        std::cerr << "Servers not online" << std::endl;
+        PFS_LOG_ERROR("Servers not online");
         return -1;
     }
     cache_api_initialize(PFS_BLOCK_SIZE * CLIENT_CACHE_BLOCKS);
@@ -109,7 +281,7 @@ int pfs_initialize() {
     // Connect with metaserver using gRPC
     int ret = metaserver_api_initialize();
     if (ret == -1) {
-        std::cerr << "Failed to initialize" << std::endl;
+        PFS_LOG_ERROR("Failed to initialize");
         return -1;
     } else {
         my_client_id = ret;
@@ -130,14 +302,23 @@ int pfs_finish(int client_id) {
 
 /* I'm not communicating with file servers for creation */
 int pfs_create(const char *filename, int stripe_width) {
-    return metaserver_api_create(filename, stripe_width, my_client_id);
+    return pfs_create(filename, stripe_width, pfs_create_options());
+}
+
+int pfs_create(const char *filename, int stripe_width, const struct pfs_create_options &options) {
+    ClientStatTimer timer(PFS_STAT_CREATE);
+    WorkloadCall call(PFS_OP_CREATE, {stripe_width, options.compression, options.replication, options.ec_parity, options.stripe_unit, options.placement},
+                      filename);
+    return call.done(metaserver_api_create(filename, stripe_width, options, my_client_id));
 }
 
 /* I'm not communicating with file servers for open */
 int pfs_open(const char *filename, int mode) {
+    ClientStatTimer timer(PFS_STAT_OPEN);
+    WorkloadCall call(PFS_OP_OPEN, {mode}, filename);
     int fd = metaserver_api_open(filename, mode, my_client_id);
     fd_to_filename[fd] = filename;
-    return fd;
+    return call.done(fd);
 }
 
 /**
@@ -146,121 +327,420 @@ int pfs_open(const char *filename, int mode) {
     3. Call metaserver to receive read instructions
     4. Send received instructions to respective fileservers, and collect the results, one by one
  */
-int pfs_read(int fd, void *buf, size_t num_bytes, off_t offset) {
+ssize_t pfs_read(int fd, void *buf, size_t num_bytes, off_t offset) {
+    ClientStatTimer timer(PFS_STAT_READ);
+    WorkloadCall call(PFS_OP_READ, {fd, offset, (int64_t) num_bytes});
     // Check client cache
     std::string total_content = "";
-    int s_byte = (int) offset, e_byte = (int) s_byte + (int) num_bytes - 1;
+    int64_t s_byte = offset, e_byte = offset + (int64_t) num_bytes - 1;
     int cache_hit = cache_api_read(fd_to_filename[fd], s_byte, e_byte, total_content);
     if (cache_hit != -1) {
-        std::cout << "Cache Hit!" << std::endl;
-        std::memcpy(buf, total_content.c_str(), total_content.size());
-        total_content += '\0';
-        return total_content.size();
+        PFS_LOG_DEBUG("Cache Hit!");
+        std::memcpy(buf, total_content.data(), total_content.size());
+        return call.done((ssize_t) total_content.size());
     }
 
     if (!metaserver_api_check_tokens(fd, offset, offset + num_bytes - 1, 1, my_client_id)) {
-        std::cout << "I don't have the read token for " << offset << "-" << offset + num_bytes - 1 << " so I'm going to request it" << std::endl;
+        PFS_LOG_DEBUG("I don't have the read token for %ld-%ld so I'm going to request it", (long) offset, (long) (offset + num_bytes - 1));
         metaserver_api_request_token(fd, offset, offset + num_bytes - 1, 1, my_client_id); // 2 = MODE_WRITE
     } 
 
-    std::pair<std::vector<struct Chunk>, std::string> read_instructions = metaserver_api_read(fd, buf, num_bytes, offset, my_client_id);
+    bool inlined = false;
+    std::pair<std::vector<struct Chunk>, std::string> read_instructions = metaserver_api_read(fd, buf, num_bytes, offset, my_client_id,
+                                                                                             &inlined, &total_content);
     if (read_instructions.second == "FAIL") {
-        return -1;
+        return call.done(-1);
+    }
+    if (inlined) {
+        // A small file, the metaserver had all of it
+        ssize_t bytes_read = total_content.size();
+        std::memcpy(buf, total_content.data(), bytes_read);
+        if (bytes_read > 0) cache_api_update(fd_to_filename[fd], offset, offset + bytes_read - 1, total_content);
+        return call.done(bytes_read);
     }
     
     std::string filename = extract_name(read_instructions.second);
-    std::vector<std::string> server_addresses = get_server_addresses();
+    std::vector<std::string> server_addresses = get_cluster_addresses();
 
+    struct pfs_filerecipe layout = metaserver_api_layout(fd);
     total_content = "";
-    int bytes_read = 0;
+    ssize_t bytes_read = 0;
     for(struct Chunk &chunk: read_instructions.first){
+        // Any copy will do: the selector picks the least loaded replica and hedges slow ones
+        std::vector<int> replicas = chunk.servers;
+        for (int r = 0; replicas.empty() && r < layout.replication; r++) {
+            replicas.push_back(layout.replica_server(chunk.chunk_number, r));
+        }
+        auto read_replica = [=](int server, std::string &out) {
+            std::string chunk_filename = pfs_chunk_filename(server, filename, chunk.chunk_number, chunk.version);
+            std::string fileserver_address = server_addresses[server + 1]; // +1 since 0 is metaserver
+            return fileserver_api_read(fileserver_address, out, chunk_filename, chunk.chunk_number, num_bytes,
+                                       chunk.start_byte, chunk.end_byte, offset, layout.compression, layout.stripe_unit);
+        };
+
         std::string cur_content = "";
-        std::string chunk_filename = std::to_string(chunk.server_number) + "_" + filename + "_" + std::to_string(chunk.chunk_number);        
-        std::string fileserver_address = server_addresses[chunk.server_number + 1]; // +1 since 0 is metaserver
-        fileserver_api_read(fileserver_address, 
-                                cur_content, 
-                                chunk_filename, 
-                                chunk.chunk_number, 
-                                num_bytes, 
-                                chunk.start_byte, 
-                                chunk.end_byte,
-                                offset
-        );
+        int r = replicas.size() == 1 ? read_replica(replicas[0], cur_content)
+                                     : replica_read(replica_selector, replicas, read_replica, cur_content);
+        if (r == -1 && layout.ec_parity > 0) {
+            PFS_LOG_WARN("Chunk %d of %s is unavailable, reconstructing it", chunk.chunk_number, filename.c_str());
+            int64_t file_size = current_file_size(fd);
+            r = file_size == -1 ? -1 : ec_reconstruct_chunk(server_addresses, filename, layout, chunk, file_size, cur_content);
+        }
+        if (r == -1) {
+            PFS_LOG_ERROR("Failed to read chunk %d of %s", chunk.chunk_number, filename.c_str());
+            return call.done(-1);
+        }
         bytes_read += cur_content.size();
         total_content += cur_content;
     }
-    total_content += '\0';
-    std::memcpy(buf, total_content.c_str(), total_content.size());
-    cache_api_update(fd_to_filename[fd], offset, offset + num_bytes - 1, total_content);
-    return bytes_read;
+    std::memcpy(buf, total_content.data(), bytes_read);
+    if (bytes_read > 0) cache_api_update(fd_to_filename[fd], offset, offset + bytes_read - 1, total_content);
+    return call.done(bytes_read);
 }
 
 
-int pfs_write(int fd, const void *buf, size_t num_bytes, off_t offset) {
+ssize_t pfs_write(int fd, const void *buf, size_t num_bytes, off_t offset) {
+    ClientStatTimer timer(PFS_STAT_WRITE);
+    WorkloadCall call(PFS_OP_WRITE, {fd, offset, (int64_t) num_bytes});
     // Check client cache
     cache_func_temp();
 
-    if (!metaserver_api_check_tokens(fd, offset, offset + num_bytes - 1, 2, my_client_id)) {
-        std::cout << "I don't have the write token for " << offset << "-" << offset + num_bytes - 1 << " so I'm going to request it" << std::endl;
-        metaserver_api_request_token(fd, offset, offset + num_bytes - 1, 2, my_client_id); // 2 = MODE_WRITE
+    // Parity covers whole stripes, so writers of an erasure-coded file lock whole stripes too
+    struct pfs_filerecipe layout = metaserver_api_layout(fd);
+    int64_t token_start = offset, token_end = offset + num_bytes - 1;
+    if (layout.ec_parity > 0) {
+        int64_t stripe_size = (int64_t) layout.stripe_width * layout.stripe_unit;
+        token_start = token_start / stripe_size * stripe_size;
+        token_end = (token_end / stripe_size + 1) * stripe_size - 1;
+    }
+    if (!metaserver_api_check_tokens(fd, token_start, token_end, 2, my_client_id)) {
+        PFS_LOG_DEBUG("I don't have the write token for %ld-%ld so I'm going to request it", (long) token_start, (long) token_end);
+        metaserver_api_request_token(fd, token_start, token_end, 2, my_client_id); // 2 = MODE_WRITE
         // I will definitely have the token at this point
     } 
     
     // wait for the token to come, won't take too long.
-    std::pair<std::vector<struct Chunk>, std::string> instructions = metaserver_api_write(fd, buf, num_bytes, offset, my_client_id);
+    bool inlined = false;
+    std::pair<std::vector<struct Chunk>, std::string> instructions = metaserver_api_write(fd, buf, num_bytes, offset, my_client_id, &inlined);
     if (instructions.second == "FAIL") {
-        return -1;
+        return call.done(-1);
+    }
+    if (inlined) {
+        return call.done((ssize_t) num_bytes); // the metaserver kept it in the file's record
     }
     
     std::string filename = extract_name(instructions.second);
-    std::vector<std::string> server_addresses = get_server_addresses();
-    int bytes_written = 0;
+    std::vector<std::string> server_addresses = get_cluster_addresses();
+    ssize_t bytes_written = 0;
     for(struct Chunk &chunk: instructions.first){
-        std::string chunk_filename = std::to_string(chunk.server_number) + "_" + filename + "_" + std::to_string(chunk.chunk_number);        
-        std::string fileserver_address = server_addresses[chunk.server_number + 1]; // +1 since 0 is metaserver
-        fileserver_api_write(fileserver_address, 
-                                buf, 
-                                chunk_filename, 
-                                chunk.chunk_number, 
-                                num_bytes, 
-                                chunk.start_byte, 
-                                chunk.end_byte,
-                                offset
-        );
+        // Every replica (and a server the chunk is migrating to) gets the chunk at once, the write only counts if all of them took it
+        std::vector<int> servers = chunk.servers;
+        for (int r = 0; servers.empty() && r < layout.replication; r++) {
+            servers.push_back(layout.replica_server(chunk.chunk_number, r));
+        }
+        std::vector<int> results(servers.size(), 0);
+        auto write_replica = [&](int r) {
+            int server = servers[r];
+            std::string chunk_filename = pfs_chunk_filename(server, filename, chunk.chunk_number, chunk.version);
+            std::string fileserver_address = server_addresses[server + 1]; // +1 since 0 is metaserver
+            results[r] = fileserver_api_write(fileserver_address, buf, chunk_filename, chunk.chunk_number, num_bytes,
+                                              chunk.start_byte, chunk.end_byte, offset, my_durability, layout.compression,
+                                              layout.stripe_unit);
+        };
+        if (servers.size() == 1) {
+            write_replica(0);
+        } else {
+            std::vector<std::thread> writers;
+            for (int r = 0; r < (int) servers.size(); r++) {
+                writers.push_back(trace_thread(write_replica, r));
+            }
+            for (std::thread &writer : writers) {
+                writer.join();
+            }
+        }
+
+        for (int w : results) {
+            if (w == -1) {
+                PFS_LOG_ERROR("Failed to write chunk %d of %s", chunk.chunk_number, filename.c_str());
+                return call.done(-1);
+            }
+        }
         bytes_written += (chunk.end_byte - chunk.start_byte + 1);
     }
-    return bytes_written;
+
+    if (layout.ec_parity > 0) {
+        int64_t file_size = current_file_size(fd);
+        if (file_size == -1 || ec_update_parity(server_addresses, filename, layout, (const char*) buf, num_bytes, offset, file_size) == -1) {
+            return call.done(-1);
+        }
+    }
+    return call.done(bytes_written);
 }
 
 int pfs_close(int fd) {
+    ClientStatTimer timer(PFS_STAT_CLOSE);
+    WorkloadCall call(PFS_OP_CLOSE, {fd});
     cache_api_close(fd_to_filename[fd]);
     fd_to_filename.erase(fd);
-    return metaserver_api_close(fd, my_client_id);
+    return call.done(metaserver_api_close(fd, my_client_id));
 }
 
 int pfs_delete(const char *filename) {
-    int m = metaserver_api_delete(filename, my_client_id);
+    ClientStatTimer timer(PFS_STAT_DELETE);
+    WorkloadCall call(PFS_OP_DELETE, {}, filename);
+    struct pfs_delete_result deleted;
+    int m = metaserver_api_delete(filename, my_client_id, deleted);
     if (m == -1) {
-        std::cerr << "Failed to delete file" << std::endl;
-        return -1;
+        PFS_LOG_ERROR("Failed to delete file");
+        return call.done(-1);
     }
+    if (deleted.inlined) return call.done(0);
 
-    std::vector<std::string> server_addresses = get_server_addresses();
-    for (size_t i = 1; i < NUM_FILE_SERVERS + 1; i++) {
-        std::string filename_string = extract_name(filename);
-        int f = fileserver_api_delete(filename_string, server_addresses[i], i - 1);
+    std::vector<int> states;
+    std::vector<std::string> server_addresses = get_cluster_addresses(&states);
+    int num_servers = server_addresses.size() - 1;
+    std::string filename_string = deleted.storage_name.empty() ? extract_name(filename) : deleted.storage_name;
+    std::vector<int> results(num_servers, 0);
+    std::vector<std::thread> deleters;
+    if (!deleted.storage_deleted && !deleted.storage_name.empty()) {
+        // Snapshots still share the storage, only the chunk versions no one else uses go, every copy is listed
+        std::vector<std::vector<std::pair<std::string, int>>> discards(num_servers);
+        for (const struct Chunk &chunk : deleted.freed_chunks) {
+            if (chunk.server_number >= num_servers) continue;
+            discards[chunk.server_number].push_back({pfs_chunk_filename(chunk.server_number, filename_string, chunk.chunk_number, chunk.version),
+                                                     chunk.chunk_number});
+        }
+        for (int server = 0; server < num_servers; server++) {
+            if (discards[server].empty()) continue;
+            deleters.push_back(trace_thread([&, server]() {
+                results[server] = fileserver_api_discard(server_addresses[server + 1], discards[server]);
+            }));
+        }
+    } else {
+        // Fan the delete out to all fileservers that are up at once, each one only unhooks the file and returns
+        for (int i = 1; i <= num_servers; i++) {
+            if (i - 1 < (int) states.size() && states[i - 1] != PFS_MEMBER_UP) continue;
+            deleters.push_back(trace_thread([&, i]() {
+                results[i - 1] = fileserver_api_delete(filename_string, server_addresses[i], i - 1);
+            }));
+        }
+    }
+    for (std::thread &deleter : deleters) {
+        deleter.join();
+    }
+
+    for (int f : results) {
         if (f == -1) {
-            std::cerr << "Failed to delete some file chunks " << std::endl;
-            return -1;
+            PFS_LOG_ERROR("Failed to delete some file chunks");
+            return call.done(-1);
         }
     }
-    return 0;
+    return call.done(0);
 }
 
 int pfs_fstat(int fd, struct pfs_metadata *meta_data) {
-    return metaserver_api_fstat(fd, meta_data, my_client_id);
+    ClientStatTimer timer(PFS_STAT_FSTAT);
+    WorkloadCall call(PFS_OP_FSTAT, {fd});
+    return call.done(metaserver_api_fstat(fd, meta_data, my_client_id));
 }
 
 int pfs_execstat(struct pfs_execstat *execstat_data) {
     return cache_api_execstat(execstat_data);
 }
+
+int pfs_execstat_ext(struct pfs_execstat_ext *execstat_data) {
+    if (execstat_data == nullptr || cache_api_execstat(&execstat_data->cache) == -1) return -1;
+    client_stats_snapshot(execstat_data->client);
+    return 0;
+}
+
+/* Flush barrier: every write acknowledged so far for the file is on stable storage on all fileservers */
+int pfs_fsync(int fd) {
+    ClientStatTimer timer(PFS_STAT_FSYNC);
+    WorkloadCall call(PFS_OP_FSYNC, {fd});
+    if (fd_to_filename.find(fd) == fd_to_filename.end()) {
+        PFS_LOG_ERROR("Invalid fd %d", fd);
+        return call.done(-1);
+    }
+
+    // A snapshot's chunks are stored under the name of the file it was taken from
+    std::vector<int> states;
+    std::vector<std::string> server_addresses = get_cluster_addresses(&states);
+    std::string filename_string = metaserver_api_layout(fd).storage_name;
+    if (filename_string.empty()) filename_string = extract_name(fd_to_filename[fd]);
+    std::vector<int> results(server_addresses.size() - 1, 0);
+    std::vector<std::thread> flushers;
+    for (size_t i = 1; i < server_addresses.size(); i++) {
+        if (i - 1 < states.size() && states[i - 1] != PFS_MEMBER_UP) continue;
+        flushers.push_back(trace_thread([&, i]() {
+            results[i - 1] = fileserver_api_flush(filename_string, server_addresses[i]);
+        }));
+    }
+    for (std::thread &flusher : flushers) {
+        flusher.join();
+    }
+
+    for (int f : results) {
+        if (f == -1) {
+            PFS_LOG_ERROR("Failed to flush some file chunks");
+            return call.done(-1);
+        }
+    }
+    return call.done(0);
+}
+
+/* Durability of this client's subsequent writes, one of PFS_DURABILITY_* */
+int pfs_set_durability(int mode) {
+    WorkloadCall call(PFS_OP_SET_DURABILITY, {mode});
+    if (mode != PFS_DURABILITY_NONE && mode != PFS_DURABILITY_PER_WRITE && mode != PFS_DURABILITY_GROUP_COMMIT) {
+        PFS_LOG_ERROR("Invalid durability mode %d", mode);
+        return call.done(-1);
+    }
+    my_durability = mode;
+    return call.done(0);
+}
+
+/*
+    Server-side copy of num_bytes from src_fd at src_offset to dst_fd at dst_offset, like
+    copy_file_range(2). The metaserver plans it, then every source fileserver copies its own
+    chunks, locally where source and destination chunk share a server, straight to the
+    destination's fileserver otherwise. Returns the bytes copied, fewer if the source ends first.
+ */
+ssize_t pfs_copy(int src_fd, off_t src_offset, int dst_fd, off_t dst_offset, size_t num_bytes) {
+    ClientStatTimer timer(PFS_STAT_COPY);
+    WorkloadCall call(PFS_OP_COPY, {src_fd, src_offset, dst_fd, dst_offset, (int64_t) num_bytes});
+    if (fd_to_filename.find(src_fd) == fd_to_filename.end() || fd_to_filename.find(dst_fd) == fd_to_filename.end()) {
+        PFS_LOG_ERROR("Invalid fd %d or %d", src_fd, dst_fd);
+        return call.done(-1);
+    }
+    if (num_bytes == 0) return call.done(0);
+
+    struct pfs_filerecipe dst_layout = metaserver_api_layout(dst_fd);
+    int64_t token_start = dst_offset, token_end = dst_offset + num_bytes - 1;
+    if (dst_layout.ec_parity > 0) {
+        int64_t stripe_size = (int64_t) dst_layout.stripe_width * dst_layout.stripe_unit;
+        token_start = token_start / stripe_size * stripe_size;
+        token_end = (token_end / stripe_size + 1) * stripe_size - 1;
+    }
+    if (!metaserver_api_check_tokens(src_fd, src_offset, src_offset + num_bytes - 1, 1, my_client_id)) {
+        metaserver_api_request_token(src_fd, src_offset, src_offset + num_bytes - 1, 1, my_client_id);
+    }
+    if (!metaserver_api_check_tokens(dst_fd, token_start, token_end, 2, my_client_id)) {
+        metaserver_api_request_token(dst_fd, token_start, token_end, 2, my_client_id);
+    }
+
+    std::vector<struct ChunkCopy> plan;
+    std::string src_name, dst_name;
+    bool inlined = false;
+    ssize_t bytes_copied = metaserver_api_copy(src_fd, src_offset, dst_fd, dst_offset, num_bytes, my_client_id, plan, src_name, dst_name, &inlined);
+    if (bytes_copied <= 0) return call.done(bytes_copied);
+    if (inlined) {
+        // The metaserver kept it in the destination's record, there are no chunks and no parity to update
+        cache_api_invalidate(fd_to_filename[dst_fd], FileToken{dst_offset, dst_offset + bytes_copied - 1, 2, my_client_id});
+        return call.done(bytes_copied);
+    }
+
+    // One queue per source server, every copy of a replicated destination is a transfer of its own
+    std::vector<std::string> server_addresses = get_cluster_addresses();
+    int num_servers = server_addresses.size() - 1;
+    int src_stripe_unit = metaserver_api_layout(src_fd).stripe_unit;
+    std::vector<std::vector<struct ChunkTransfer>> transfers(num_servers);
+    for (const struct ChunkCopy &copy : plan) {
+        std::vector<int> dst_servers = copy.dst.servers;
+        for (int r = 0; dst_servers.empty() && r < dst_layout.replication; r++) {
+            dst_servers.push_back(dst_layout.replica_server(copy.dst.chunk_number, r));
+        }
+        for (int dst_server : dst_servers) {
+            struct ChunkTransfer transfer;
+            transfer.src_chunk_filename = pfs_chunk_filename(copy.src.server_number, src_name, copy.src.chunk_number, copy.src.version);
+            transfer.src_chunk_number = copy.src.chunk_number;
+            transfer.src_start_byte = copy.src.start_byte;
+            transfer.src_end_byte = copy.src.end_byte;
+            transfer.dst_chunk_filename = pfs_chunk_filename(dst_server, dst_name, copy.dst.chunk_number, copy.dst.version);
+            transfer.dst_chunk_number = copy.dst.chunk_number;
+            transfer.dst_start_byte = copy.dst.start_byte;
+            transfer.dst_address = dst_server == copy.src.server_number ? "" : server_addresses[dst_server + 1];
+            transfer.src_stripe_unit = src_stripe_unit;
+            transfer.dst_stripe_unit = dst_layout.stripe_unit;
+            transfers[copy.src.server_number].push_back(transfer);
+        }
+    }
+
+    // All source servers at once, each working through its queue in batches
+    std::vector<int> results(num_servers, 0);
+    std::vector<std::thread> copiers;
+    for (int server = 0; server < num_servers; server++) {
+        if (transfers[server].empty()) continue;
+        copiers.push_back(trace_thread([&, server]() {
+            const std::vector<struct ChunkTransfer> &queue = transfers[server];
+            for (size_t i = 0; i < queue.size(); i += COPY_BATCH_RANGES) {
+                std::vector<struct ChunkTransfer> batch(queue.begin() + i, queue.begin() + std::min(queue.size(), i + COPY_BATCH_RANGES));
+                if (fileserver_api_copy(server_addresses[server + 1], batch, my_durability, dst_layout.compression) == -1) {
+                    results[server] = -1;
+                    return;
+                }
+            }
+        }));
+    }
+    for (std::thread &copier : copiers) {
+        copier.join();
+    }
+    for (int c : results) {
+        if (c == -1) {
+            PFS_LOG_ERROR("Failed to copy some chunks of %s to %s", src_name.c_str(), dst_name.c_str());
+            return call.done(-1);
+        }
+    }
+
+    if (dst_layout.ec_parity > 0) {
+        int64_t file_size = current_file_size(dst_fd);
+        if (file_size == -1 || ec_update_parity(server_addresses, dst_name, dst_layout, nullptr, bytes_copied, dst_offset, file_size) == -1) {
+            return call.done(-1);
+        }
+    }
+    cache_api_invalidate(fd_to_filename[dst_fd], FileToken{dst_offset, dst_offset + bytes_copied - 1, 2, my_client_id});
+    return call.done(bytes_copied);
+}
+
+/* Creates dst_filename with the layout of src_filename and copies all of it server-side */
+int pfs_clone(const char *src_filename, const char *dst_filename) {
+    ClientStatTimer timer(PFS_STAT_CLONE);
+    WorkloadCall call(PFS_OP_CLONE, {}, src_filename, dst_filename);
+    int src_fd = pfs_open(src_filename, 1);
+    if (src_fd == -1) return call.done(-1);
+    struct pfs_metadata meta_data;
+    if (pfs_fstat(src_fd, &meta_data) == -1) {
+        pfs_close(src_fd);
+        return call.done(-1);
+    }
+
+    struct pfs_create_options options;
+    options.compression = meta_data.recipe.compression;
+    options.replication = meta_data.recipe.replication;
+    options.ec_parity = meta_data.recipe.ec_parity;
+    options.stripe_unit = meta_data.recipe.stripe_unit;
+    if (pfs_create(dst_filename, meta_data.recipe.stripe_width, options) == -1) {
+        pfs_close(src_fd);
+        return call.done(-1);
+    }
+    int dst_fd = pfs_open(dst_filename, 2);
+    if (dst_fd == -1) {
+        pfs_close(src_fd);
+        return call.done(-1);
+    }
+
+    ssize_t copied = meta_data.file_size > 0 ? pfs_copy(src_fd, 0, dst_fd, 0, meta_data.file_size) : 0;
+    pfs_close(dst_fd);
+    pfs_close(src_fd);
+    return call.done(copied == (ssize_t) meta_data.file_size ? 0 : -1);
+}
+
+/*
+    Copy-on-write snapshot: the metaserver copies the recipe and counts a reference to every chunk.
+    A chunk shared this way is forked onto a new version by the first write to it, from either file.
+ */
+int pfs_snapshot(const char *filename, const char *snapshot_name) {
+    ClientStatTimer timer(PFS_STAT_SNAPSHOT);
+    WorkloadCall call(PFS_OP_SNAPSHOT, {}, filename, snapshot_name);
+    return call.done(metaserver_api_snapshot(filename, snapshot_name, my_client_id));
+}
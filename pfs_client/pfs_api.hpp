@@ -19,10 +19,13 @@
 
 #include "pfs_common/pfs_config.hpp"
 #include "pfs_common/pfs_common.hpp"
+#include "pfs_common/pfs_compress.hpp"
+#include "pfs_common/pfs_client_stats.hpp"
 
+/* Byte ranges are 64-bit: files are addressed like off_t, well past 2 GB */
 struct FileToken {
-    int start_byte;
-    int end_byte;
+    int64_t start_byte;
+    int64_t end_byte;
     int type; // 1 = READ, 2 = WRITE
     int client_id;
 
@@ -65,26 +68,82 @@ struct FileToken {
 struct Chunk {
     int chunk_number;
     int server_number;
-    int start_byte;
-    int end_byte;
+    int64_t start_byte; // file offsets, not offsets in the chunk
+    int64_t end_byte;
+    int version = 0; // generation of the file that wrote this copy of the chunk, see pfs_snapshot()
+    std::vector<int> servers; // in instructions: every server holding a copy, server_number first
 
     std::string to_string() const {
         std::ostringstream oss;
         oss << "chunk_number: " << chunk_number << "; ";
         oss << "server_number: " << server_number << "; ";
+        oss << "version: " << version << "; ";
         oss << "byte_range: (" << start_byte << ", " << end_byte << ")\n";
         return oss.str();
     }
 };
 
+/* Fileserver name of a chunk: "<server>_<storage_name>_<chunk_number>", with ".v<version>" after the name for versions past 0 */
+inline std::string pfs_chunk_filename(int server, const std::string &storage_name, int chunk_number, int version) {
+    std::string name = std::to_string(server) + "_" + storage_name;
+    if (version > 0) name += ".v" + std::to_string(version);
+    return name + "_" + std::to_string(chunk_number);
+}
+
+/* One piece of a server-side copy: the src chunk's [start_byte, end_byte] become the dst chunk's */
+struct ChunkCopy {
+    struct Chunk src;
+    struct Chunk dst;
+};
+
 struct pfs_filerecipe {
     int stripe_width;
+    int stripe_unit = PFS_DEFAULT_STRIPE_UNIT; // bytes of the file per chunk, a power of two
+    int compression; // PFS_COMPRESSION_*
+    int replication; // copies of every chunk
+    int ec_parity;   // parity chunks per stripe of stripe_width data chunks, 0 = no erasure coding
+    std::string storage_name; // name the chunks are stored under, shared by a file and its snapshots
+    int generation;  // version of the chunks written through this file from now on
+    bool inlined = false; // the data lives in the metaserver record, there are no chunks (see INLINE_FILE_THRESHOLD)
+    std::vector<int> servers; // placement, replication entries per slot: copy r of data chunk n on servers[(n % stripe_width) * replication + r]
     std::vector<struct Chunk> chunks; // metadata.recipe.chunks
 
+    /* Server holding copy `replica` of slot `slot`: data slots first, then a slot per parity chunk */
+    int slot_server(int slot, int replica) const {
+        int i = slot * replication + replica;
+        // Recipes from before placement: consecutive servers from the slot on
+        return i < (int) servers.size() ? servers[i] : (slot + replica) % NUM_FILE_SERVERS;
+    }
+
+    /* Server holding the first copy of data chunk chunk_number */
+    int data_server(int chunk_number) const {
+        return slot_server(chunk_number % stripe_width, 0);
+    }
+
+    /* Server holding copy `replica` of data chunk chunk_number */
+    int replica_server(int chunk_number, int replica) const {
+        return slot_server(chunk_number % stripe_width, replica);
+    }
+
+    /* Server holding parity chunk `parity` of every stripe, placed after the stripe_width data servers */
+    int parity_server(int parity) const {
+        return slot_server(stripe_width + parity, 0);
+    }
+
     std::string to_string() const {
         std::ostringstream oss;
         oss << "pfs_filerecipe { \n";
-        oss << "stripe_width: " << stripe_width << ", \n";
+        oss << "stripe_width: " << stripe_width << ", stripe_unit: " << stripe_unit << ", \n";
+        oss << "compression: " << (compression == PFS_COMPRESSION_ZLIB ? "zlib" : "none") << ", \n";
+        oss << "replication: " << replication << ", \n";
+        oss << "ec_parity: " << ec_parity << ", \n";
+        oss << "storage_name: " << storage_name << ", generation: " << generation << ", \n";
+        oss << "inlined: " << (inlined ? "true" : "false") << ", \n";
+        oss << "servers: [";
+        for (size_t i = 0; i < servers.size(); ++i) {
+            oss << (i > 0 ? ", " : "") << servers[i];
+        }
+        oss << "], \n";
         oss << "chunks: [\n";
         for (size_t i = 0; i < chunks.size(); ++i) {
             oss << chunks[i].to_string();
@@ -126,6 +185,20 @@ struct pfs_metadata {
     }
 };
 
+#define PFS_PLACEMENT_DEFAULT 0  // the metaserver's PFS_DEFAULT_PLACEMENT
+#define PFS_PLACEMENT_ROTATE 1   // consecutive servers, each new file starting one server further
+#define PFS_PLACEMENT_HASH 2     // consecutive servers, starting where the file name hashes to
+#define PFS_PLACEMENT_LOAD 3     // the servers with the most free space and the fewest requests
+
+/* Optional per-file settings for pfs_create() */
+struct pfs_create_options {
+    int compression = PFS_COMPRESSION_NONE;
+    int replication = 1; // every chunk is written to this many distinct fileservers
+    int ec_parity = 0;   // Reed-Solomon parity chunks per stripe_width data chunks, exclusive with replication
+    int stripe_unit = PFS_DEFAULT_STRIPE_UNIT; // bytes per chunk, a power of two from PFS_BLOCK_SIZE to PFS_MAX_STRIPE_UNIT
+    int placement = PFS_PLACEMENT_DEFAULT;     // how the metaserver picks the file's servers, PFS_PLACEMENT_*
+};
+
 struct pfs_execstat {
     long num_read_hits;
     long num_write_hits;
@@ -150,13 +223,35 @@ struct pfs_execstat {
     }
 };
 
+/*
+    pfs_execstat() and what the client library timed since it started, over all threads:
+    latency histograms of every pfs_* call and of every metaserver and fileserver RPC, the time
+    spent waiting for tokens, and the bytes written to and read from each fileserver.
+ */
+struct pfs_execstat_ext {
+    struct pfs_execstat cache;
+    struct pfs_client_stats client;
+};
+
+/* Write durability modes, see pfs_set_durability() */
+#define PFS_DURABILITY_NONE 0           // acknowledged once in the fileserver's page cache
+#define PFS_DURABILITY_PER_WRITE 1      // acknowledged after an fdatasync of every write
+#define PFS_DURABILITY_GROUP_COMMIT 2   // acknowledged after an fdatasync shared by concurrent writers
+
 int pfs_initialize();
 int pfs_finish(int client_id);
 int pfs_create(const char *filename, int stripe_width);
+int pfs_create(const char *filename, int stripe_width, const struct pfs_create_options &options);
 int pfs_open(const char *filename, int mode);
-int pfs_read(int fd, void *buf, size_t num_bytes, off_t offset);
-int pfs_write(int fd, const void *buf, size_t num_bytes, off_t offset);
+ssize_t pfs_read(int fd, void *buf, size_t num_bytes, off_t offset);
+ssize_t pfs_write(int fd, const void *buf, size_t num_bytes, off_t offset);
 int pfs_close(int fd);
 int pfs_delete(const char *filename);
 int pfs_fstat(int fd, struct pfs_metadata *meta_data);
 int pfs_execstat(struct pfs_execstat *execstat_data);
+int pfs_execstat_ext(struct pfs_execstat_ext *execstat_data);
+int pfs_fsync(int fd);
+int pfs_set_durability(int mode);
+ssize_t pfs_copy(int src_fd, off_t src_offset, int dst_fd, off_t dst_offset, size_t num_bytes);
+int pfs_clone(const char *src_filename, const char *dst_filename);
+int pfs_snapshot(const char *filename, const char *snapshot_name);
@@ -1,7 +1,7 @@
 #include "pfs_cache.hpp"
 
 void cache_func_temp() {
-    printf("%s: called.\n", __func__);
+    PFS_LOG_DEBUG("%s: called.", __func__);
 }
 
 LRUCache cache = NULL;
@@ -9,11 +9,11 @@ int cache_api_initialize(int lru_size) {
     cache = LRUCache(lru_size);
 }
 
-int cache_api_read(std::string filename, int start_byte, int end_byte, std::string &result) {
+int cache_api_read(std::string filename, int64_t start_byte, int64_t end_byte, std::string &result) {
     return cache.read(filename, start_byte, end_byte, result);
 }
 
-void cache_api_update(std::string filename, int start_byte, int end_byte, std::string data) {
+void cache_api_update(std::string filename, int64_t start_byte, int64_t end_byte, std::string data) {
     return cache.update_cache(filename, start_byte, end_byte, data);
 }
 
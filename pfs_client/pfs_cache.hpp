@@ -9,6 +9,7 @@
 #include <vector>
 
 #include "pfs_common/pfs_config.hpp"
+#include "pfs_common/pfs_log.hpp"
 #include "pfs_api.hpp"
 
 void cache_func_temp();
@@ -26,7 +27,7 @@ struct CachedBlock {
 
 class LRUCache {
     size_t max_size; 
-    using RangeKey = std::pair<int, int>;
+    using RangeKey = std::pair<int64_t, int64_t>;
     struct pfs_execstat client_cache_stats;
 
     std::map<std::string, std::map<RangeKey, CachedBlock>> cache;
@@ -39,24 +40,24 @@ public:
         client_cache_stats = {0LL, 0LL, 0LL, 0LL, 0LL, 0LL, 0LL};
     }
 
-    int read(const std::string& filename, int start_byte, int end_byte, std::string &result) {
-        std::cout << "Querying Cache for " << filename << " from " << start_byte << "-" << end_byte << std::endl;
+    int read(const std::string& filename, int64_t start_byte, int64_t end_byte, std::string &result) {
+        PFS_LOG_DEBUG("Querying Cache for %s from %ld-%ld", filename.c_str(), (long) start_byte, (long) end_byte);
         if (cache.find(filename) == cache.end()) {
             return -1; 
         }
 
         auto& cached_blocks = cache[filename];
-        int current_start = start_byte;
+        int64_t current_start = start_byte;
 
         for (const auto& [range, block] : cached_blocks) {
             if (!block.valid) continue;
 
-            int block_start = range.first;
-            int block_end = range.second;
+            int64_t block_start = range.first;
+            int64_t block_end = range.second;
 
             if (block_start <= current_start && current_start <= block_end) {
-                int copy_start = std::max(current_start, block_start);
-                int copy_end = std::min(end_byte, block_end);
+                int64_t copy_start = std::max(current_start, block_start);
+                int64_t copy_end = std::min(end_byte, block_end);
 
                 result += block.data.substr(copy_start - block_start, copy_end - copy_start + 1);
 
@@ -70,7 +71,7 @@ public:
         }
 
         if (current_start <= end_byte) {
-            std::cout << "Cache Miss" << std::endl;
+            PFS_LOG_DEBUG("Cache Miss");
             return -1; // Cache miss
         }
         client_cache_stats.num_read_hits++;
@@ -78,9 +79,8 @@ public:
     }
 
     // Update cache with new data
-    void update_cache(const std::string& filename, int start_byte, int end_byte, const std::string& data) {
-        std::cout << "Updating Cache for " << filename << " from " << start_byte << "-" << end_byte << std::endl;
-        std::cout << "Updating with content: " << data << std::endl;
+    void update_cache(const std::string& filename, int64_t start_byte, int64_t end_byte, const std::string& data) {
+        PFS_LOG_DEBUG("Updating Cache for %s from %ld-%ld", filename.c_str(), (long) start_byte, (long) end_byte);
         RangeKey range = {start_byte, end_byte};
         if (check_size()) {
             evict();
@@ -96,33 +96,33 @@ public:
     void invalidate(std::string filename, struct FileToken revoked_token) {
         /* Invalidate caches in the same range */
         auto& cached_blocks = cache[filename];
-        std::vector<std::pair<int, int>> to_invalidate; // we will delete these cache blocks
-        std::vector<std::pair<std::pair<int, int>, CachedBlock>> to_split; // we will add these new "split" blocks
+        std::vector<RangeKey> to_invalidate; // we will delete these cache blocks
+        std::vector<std::pair<RangeKey, CachedBlock>> to_split; // we will add these new "split" blocks
 
         for (auto it = cached_blocks.begin(); it != cached_blocks.end(); ) {
             const auto& [block_range, block] = *it;
-            int block_start = block_range.first, block_end = block_range.second;
+            int64_t block_start = block_range.first, block_end = block_range.second;
 
             // Check if the block overlaps with the REVOKED TOKEN
             if (block_start <= revoked_token.end_byte && block_end >= revoked_token.start_byte) {
-                std::cout << "Invalidating cache block of [" << block_start << "-" << block_end << "]\n";
+                PFS_LOG_DEBUG("Invalidating cache block of [%ld-%ld]", (long) block_start, (long) block_end);
 
                 // Remove the invalidated block
                 to_invalidate.push_back(block_range);
 
-                int new_start, new_end;
+                int64_t new_start, new_end;
                 if (block_start < revoked_token.start_byte) {
                     new_start = block_start;
                     new_end = revoked_token.start_byte - 1;
                     CachedBlock split_block = block;
 
                     // Adjust the block's data for the new range
-                    int offset = new_start - block_range.first;  // Calculate offset within the original data
+                    int64_t offset = new_start - block_range.first;  // Calculate offset within the original data
                     if (new_end - new_start + 1 > 0) {
                         split_block.data = block.data.substr(offset, new_end - new_start + 1);  // Extract relevant portion of data
 
                         // Emplace the modified block
-                        std::cout << "Adding split cache block: " << split_block.to_string() << std::endl;
+                        PFS_LOG_DEBUG("Adding split cache block [%ld-%ld]", (long) new_start, (long) new_end);
                         to_split.emplace_back(std::make_pair(new_start, new_end), split_block);
                     }
                 }
@@ -132,12 +132,12 @@ public:
                     CachedBlock split_block = block;
 
                     // Adjust the block's data for the new range
-                    int offset = new_start - block_range.first;  // Calculate offset within the original data
+                    int64_t offset = new_start - block_range.first;  // Calculate offset within the original data
                     if (new_end - new_start + 1 > 0) {
                         split_block.data = block.data.substr(offset, new_end - new_start + 1);  // Extract relevant portion of data
 
                         // Emplace the modified block
-                        std::cout << "Adding split cache block: " << split_block.to_string() << std::endl;
+                        PFS_LOG_DEBUG("Adding split cache block [%ld-%ld]", (long) new_start, (long) new_end);
                         to_split.emplace_back(std::make_pair(new_start, new_end), split_block);
                     }
                 }
@@ -154,7 +154,7 @@ public:
         // Add the split blocks
         for (const auto& [new_range, block] : to_split) {
             cached_blocks[new_range] = block;
-            std::cout << "Added new cache block [" << new_range.first << "-" << new_range.second << "]\n";
+            PFS_LOG_DEBUG("Added new cache block [%ld-%ld]", (long) new_range.first, (long) new_range.second);
         }
     }
 
@@ -226,11 +226,11 @@ private:
 
     bool check_size() {
         std::map<std::string, std::map<RangeKey, CachedBlock>> cache;
-        int cur_size = 0;
+        int64_t cur_size = 0;
         for (auto it: cache) {
             for (auto jt: it.second) {
                 cur_size += (jt.first.second - jt.first.first + 1);
-                if (cur_size > max_size) return true;
+                if (cur_size > (int64_t) max_size) return true;
             }
         }
         return false;
@@ -239,9 +239,9 @@ private:
 
 int cache_api_initialize(int lru_size);
 
-int cache_api_read(std::string filename, int start_byte, int end_byte, std::string &result);
+int cache_api_read(std::string filename, int64_t start_byte, int64_t end_byte, std::string &result);
 
-void cache_api_update(std::string filename, int start_byte, int end_byte, std::string data);
+void cache_api_update(std::string filename, int64_t start_byte, int64_t end_byte, std::string data);
 
 void cache_api_invalidate(std::string filename, struct FileToken revoked_token);
 
@@ -0,0 +1,113 @@
+#include "pfs_replica.hpp"
+#include "pfs_common/pfs_trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <thread>
+
+std::vector<int> ReplicaSelector::rank(const std::vector<int>& servers) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::pair<double, int>> scored;
+    for (size_t i = 0; i < servers.size(); i++) {
+        const ServerLoad& server_load = load(servers[i]);
+        // Unmeasured servers look fast so every replica gets sampled; ties keep the recipe order
+        double cost = server_load.ewma_us * (server_load.in_flight + 1);
+        scored.emplace_back(cost, (int) i);
+    }
+    std::stable_sort(scored.begin(), scored.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    std::vector<int> ranked;
+    for (const auto& [cost, i] : scored) ranked.push_back(servers[i]);
+    return ranked;
+}
+
+void ReplicaSelector::begin(int server) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    load(server).in_flight++;
+}
+
+void ReplicaSelector::end(int server, double latency_us, bool ok) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ServerLoad& server_load = load(server);
+    server_load.in_flight--;
+    // A failure counts as a very slow read, so the server drops to the back until it recovers
+    double sample = ok ? latency_us : std::max<double>(latency_us, REPLICA_FAILURE_PENALTY_US);
+    server_load.ewma_us = server_load.ewma_us == 0 ? sample : (1 - REPLICA_EWMA_ALPHA) * server_load.ewma_us + REPLICA_EWMA_ALPHA * sample;
+}
+
+double ReplicaSelector::hedge_delay_us(int server) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::max<double>(REPLICA_HEDGE_MIN_US, REPLICA_HEDGE_FACTOR * load(server).ewma_us);
+}
+
+int replica_read(ReplicaSelector& selector, const std::vector<int>& servers,
+                 std::function<int(int server, std::string& out)> read_one, std::string& out) {
+    using Clock = std::chrono::steady_clock;
+    if (servers.empty()) return -1;
+
+    // Shared with the reader threads, stragglers finish after we've returned
+    struct Race {
+        std::mutex mtx;
+        std::condition_variable cv;
+        int pending = 0;
+        bool done = false;
+        std::string result;
+    };
+    auto race = std::make_shared<Race>();
+    std::vector<int> ranked = selector.rank(servers);
+
+    auto launch = [&](int server) {
+        race->pending++;
+        selector.begin(server);
+        trace_thread([race, server, read_one, &selector]() {
+            auto start = Clock::now();
+            std::string content;
+            int ret = read_one(server, content);
+            double latency_us = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+            selector.end(server, latency_us, ret == 0);
+
+            std::lock_guard<std::mutex> lock(race->mtx);
+            race->pending--;
+            if (ret == 0 && !race->done) {
+                race->done = true;
+                race->result = std::move(content);
+            }
+            race->cv.notify_all();
+        }).detach();
+    };
+
+    std::unique_lock<std::mutex> lock(race->mtx);
+    size_t next = 0;
+    launch(ranked[next++]);
+    while (!race->done) {
+        if (race->pending == 0) {
+            // Everything sent so far failed
+            if (next >= ranked.size()) break;
+            {
+                std::lock_guard<std::mutex> stats_lock(selector.mutex_);
+                selector.failovers_++;
+            }
+            launch(ranked[next++]);
+            continue;
+        }
+        if (next < ranked.size()) {
+            auto delay = std::chrono::duration<double, std::micro>(selector.hedge_delay_us(ranked[next - 1]));
+            bool answered = race->cv.wait_for(lock, delay, [&] { return race->done || race->pending == 0; });
+            if (!answered) {
+                {
+                    std::lock_guard<std::mutex> stats_lock(selector.mutex_);
+                    selector.hedged_++;
+                }
+                launch(ranked[next++]);
+            }
+        } else {
+            race->cv.wait(lock, [&] { return race->done || race->pending == 0; });
+        }
+    }
+
+    if (!race->done) return -1;
+    out = std::move(race->result);
+    return 0;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <functional>
+
+#include "pfs_common/pfs_config.hpp"
+
+/*
+    Chooses which copy of a replicated chunk to read. Every fileserver has an EWMA of its
+    read latency and a count of this client's reads in flight to it. Replicas are tried
+    in order of expected wait, ewma * (in_flight + 1). A read that takes longer than its
+    hedge delay is sent to the next replica as well, and the first good answer wins.
+ */
+class ReplicaSelector {
+public:
+    ReplicaSelector() : servers_(NUM_FILE_SERVERS) {}
+
+    /* servers, best candidate first */
+    std::vector<int> rank(const std::vector<int>& servers);
+
+    void begin(int server);
+    void end(int server, double latency_us, bool ok);
+
+    /* How long to wait on a server before hedging: REPLICA_HEDGE_FACTOR x its EWMA, at least REPLICA_HEDGE_MIN_US */
+    double hedge_delay_us(int server);
+
+    uint64_t num_hedged() { std::lock_guard<std::mutex> lock(mutex_); return hedged_; }
+    uint64_t num_failovers() { std::lock_guard<std::mutex> lock(mutex_); return failovers_; }
+
+private:
+    friend int replica_read(ReplicaSelector&, const std::vector<int>&, std::function<int(int, std::string&)>, std::string&);
+
+    struct ServerLoad {
+        double ewma_us = 0;     // 0 until the first sample
+        int in_flight = 0;
+    };
+
+    /* Load of a server, growing the table for fileservers that joined since; mutex_ held */
+    ServerLoad& load(int server) {
+        if (server >= (int) servers_.size()) servers_.resize(server + 1);
+        return servers_[server];
+    }
+
+    std::mutex mutex_;
+    std::vector<ServerLoad> servers_;
+    uint64_t hedged_ = 0;
+    uint64_t failovers_ = 0;
+};
+
+/*
+    Reads one chunk from whichever of `servers` holds a copy, through read_one(server, out),
+    which returns 0 or -1. Hedges slow replicas and fails over on errors. Returns 0 with the
+    content in out, or -1 if every replica failed.
+ */
+int replica_read(ReplicaSelector& selector, const std::vector<int>& servers,
+                 std::function<int(int server, std::string& out)> read_one, std::string& out);
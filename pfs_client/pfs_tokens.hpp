@@ -0,0 +1,48 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "pfs_api.hpp"
+
+/*
+    Token range logic of the client and the metaserver, kept apart from the token stream and
+    RPC state so it can be exercised on synthetic token sets (bench/bench_micro.cpp).
+ */
+
+/*
+    Whether tokens, in FileToken order, cover an access of type (1 read, 2 write) to
+    [start_byte, end_byte]: a read is covered by any token, a write by write tokens only.
+ */
+inline bool pfs_tokens_cover(const std::set<FileToken>& tokens, int64_t start_byte, int64_t end_byte, int type) {
+    int64_t current_start = start_byte;
+    for (const FileToken& token : tokens) {
+        // Check if the token overlaps with the current uncovered range
+        if (token.start_byte <= current_start && token.end_byte >= current_start) {
+            if ((type == 1 && (token.type == 1 || token.type == 2)) || (type == 2 && token.type == 2)) {
+                current_start = token.end_byte + 1;
+            }
+        }
+        // If the entire range is covered, return true
+        if (current_start >= end_byte) return true;
+    }
+    return false;
+}
+
+/*
+    Removes the tokens of other clients overlapping requested from ranges (token -> holder),
+    calling revoke(token, holder, remainders) for each of them first. remainders are the
+    parts of the token outside requested, which its holder keeps.
+ */
+template <typename Holder, typename Revoke>
+inline void pfs_revoke_overlapping(std::map<FileToken, Holder>& ranges, const FileToken& requested, Revoke&& revoke) {
+    for (auto it = ranges.begin(); it != ranges.end(); ) {
+        if (it->first.client_id != requested.client_id && it->first.overlaps(requested)) {
+            revoke(it->first, it->second, it->first.subtract(requested));
+            it = ranges.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
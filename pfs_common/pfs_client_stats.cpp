@@ -0,0 +1,143 @@
+#include "pfs_client_stats.hpp"
+
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+const char* const PFS_STAT_NAMES[PFS_STAT_COUNT] = {
+    "pfs_create", "pfs_open", "pfs_read", "pfs_write", "pfs_close", "pfs_delete",
+    "pfs_fstat", "pfs_fsync", "pfs_copy", "pfs_clone", "pfs_snapshot",
+    "meta.Initialize", "meta.CreateFile", "meta.OpenFile", "meta.CloseFile",
+    "meta.WriteToFile", "meta.ReadFile", "meta.CopyFile", "meta.FileMetadata",
+    "meta.DeleteFile", "meta.SnapshotFile", "meta.GetClusterMap", "meta.GetStats",
+    "file.Initialize", "file.WriteFile", "file.ReadFile", "file.DeleteFile",
+    "file.FlushFile", "file.CopyChunks", "file.DiscardChunks", "file.GetStats",
+    "token_wait",
+};
+
+namespace {
+
+/* The counters of one thread. Only that thread writes them, snapshots read them at any time */
+struct ThreadStats {
+    AtomicLatencyHistogram latency[PFS_STAT_COUNT];
+    std::atomic<uint64_t> bytes_written[CLIENT_STATS_MAX_FILESERVERS] = {};
+    std::atomic<uint64_t> bytes_read[CLIENT_STATS_MAX_FILESERVERS] = {};
+};
+
+/*
+    Counters outlive their threads: a thread that exits hands its counters to the next one to
+    start, which keeps adding to them, so short-lived threads (one per replica write) don't
+    pile up counters and nothing recorded is lost.
+ */
+std::mutex registry_mutex;
+std::vector<std::unique_ptr<ThreadStats>> all_stats;
+std::vector<ThreadStats*> free_stats;
+std::vector<std::string> fileserver_addresses; // fileserver of each bytes slot
+
+struct ThreadHandle {
+    ThreadStats* stats = nullptr;
+    std::unordered_map<std::string, int> slots; // this thread's copy of fileserver_addresses
+
+    ThreadStats& get() {
+        if (stats == nullptr) {
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            if (!free_stats.empty()) {
+                stats = free_stats.back();
+                free_stats.pop_back();
+            } else {
+                all_stats.push_back(std::make_unique<ThreadStats>());
+                stats = all_stats.back().get();
+            }
+        }
+        return *stats;
+    }
+
+    /* Bytes slot of a fileserver, -1 once CLIENT_STATS_MAX_FILESERVERS have one */
+    int slot(const std::string& address) {
+        auto it = slots.find(address);
+        if (it != slots.end()) return it->second;
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        int slot = std::find(fileserver_addresses.begin(), fileserver_addresses.end(), address) - fileserver_addresses.begin();
+        if (slot == (int) fileserver_addresses.size()) {
+            if (slot == CLIENT_STATS_MAX_FILESERVERS) return -1;
+            fileserver_addresses.push_back(address);
+        }
+        slots[address] = slot;
+        return slot;
+    }
+
+    ~ThreadHandle() {
+        if (stats == nullptr) return;
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        free_stats.push_back(stats);
+    }
+};
+
+thread_local ThreadHandle this_thread;
+
+}
+
+void client_stats_record(int stat, uint64_t ns) {
+    if (stat < 0 || stat >= PFS_STAT_COUNT) return;
+    this_thread.get().latency[stat].record(ns);
+}
+
+void client_stats_bytes(const std::string& fileserver_address, uint64_t bytes_written, uint64_t bytes_read) {
+    int slot = this_thread.slot(fileserver_address);
+    if (slot == -1) return;
+    ThreadStats& stats = this_thread.get();
+    stats.bytes_written[slot].fetch_add(bytes_written, std::memory_order_relaxed);
+    stats.bytes_read[slot].fetch_add(bytes_read, std::memory_order_relaxed);
+}
+
+void client_stats_snapshot(struct pfs_client_stats& stats) {
+    std::vector<LatencyHistogram> latency(PFS_STAT_COUNT);
+    std::vector<struct pfs_fileserver_bytes> fileservers;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        fileservers.resize(fileserver_addresses.size());
+        for (size_t slot = 0; slot < fileserver_addresses.size(); slot++) fileservers[slot].address = fileserver_addresses[slot];
+        for (const auto& thread : all_stats) {
+            for (int stat = 0; stat < PFS_STAT_COUNT; stat++) thread->latency[stat].add_to(latency[stat]);
+            for (size_t slot = 0; slot < fileservers.size(); slot++) {
+                fileservers[slot].bytes_written += thread->bytes_written[slot].load(std::memory_order_relaxed);
+                fileservers[slot].bytes_read += thread->bytes_read[slot].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    stats = pfs_client_stats();
+    for (int stat = 0; stat < PFS_STAT_COUNT; stat++) {
+        if (stat == PFS_STAT_TOKEN_WAIT) {
+            stats.token_wait = latency[stat];
+        } else if (latency[stat].count > 0) {
+            (stat < PFS_STAT_FIRST_RPC ? stats.calls : stats.rpcs).push_back({PFS_STAT_NAMES[stat], latency[stat]});
+        }
+    }
+    stats.fileservers = fileservers;
+}
+
+static void append_latency(std::string& out, const char* name, const LatencyHistogram& h) {
+    char line[256];
+    snprintf(line, sizeof(line), "%-22s count %8lu  mean %10.1f  p50 %10.1f  p99 %10.1f  p999 %10.1f  max %10.1f us\n", name,
+             (unsigned long) h.count, h.mean_ns() / 1e3, h.percentile_ns(0.50) / 1e3, h.percentile_ns(0.99) / 1e3,
+             h.percentile_ns(0.999) / 1e3, h.max_ns / 1e3);
+    out += line;
+}
+
+std::string pfs_client_stats::to_string() const {
+    std::string out;
+    for (const struct pfs_stat_latency& call : calls) append_latency(out, call.name.c_str(), call.latency);
+    for (const struct pfs_stat_latency& rpc : rpcs) append_latency(out, rpc.name.c_str(), rpc.latency);
+    append_latency(out, "token_wait", token_wait);
+    for (const struct pfs_fileserver_bytes& server : fileservers) {
+        char line[256];
+        snprintf(line, sizeof(line), "fileserver %-21s written %12lu  read %12lu bytes\n", server.address.c_str(),
+                 (unsigned long) server.bytes_written, (unsigned long) server.bytes_read);
+        out += line;
+    }
+    return out;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "pfs_config.hpp"
+#include "pfs_histogram.hpp"
+#include "pfs_trace.hpp"
+
+/*
+    Instrumentation of the client library: a latency histogram for every pfs_* call, for every
+    metaserver and fileserver RPC it makes and for the time spent blocked on tokens, plus the
+    bytes of file data sent to and received from each fileserver. Every thread records into
+    counters of its own, so recording takes no lock. pfs_execstat_ext() adds them all up.
+ */
+
+/* What is timed, PFS_STAT_NAMES has their names */
+enum pfs_client_stat {
+    // pfs_* calls
+    PFS_STAT_CREATE, PFS_STAT_OPEN, PFS_STAT_READ, PFS_STAT_WRITE, PFS_STAT_CLOSE, PFS_STAT_DELETE,
+    PFS_STAT_FSTAT, PFS_STAT_FSYNC, PFS_STAT_COPY, PFS_STAT_CLONE, PFS_STAT_SNAPSHOT,
+    // Metaserver RPCs, from before connecting to the reply
+    PFS_STAT_META_INITIALIZE, PFS_STAT_META_CREATE_FILE, PFS_STAT_META_OPEN_FILE, PFS_STAT_META_CLOSE_FILE,
+    PFS_STAT_META_WRITE_TO_FILE, PFS_STAT_META_READ_FILE, PFS_STAT_META_COPY_FILE, PFS_STAT_META_FILE_METADATA,
+    PFS_STAT_META_DELETE_FILE, PFS_STAT_META_SNAPSHOT_FILE, PFS_STAT_META_GET_CLUSTER_MAP, PFS_STAT_META_GET_STATS,
+    // Fileserver RPCs
+    PFS_STAT_FILE_INITIALIZE, PFS_STAT_FILE_WRITE_FILE, PFS_STAT_FILE_READ_FILE, PFS_STAT_FILE_DELETE_FILE,
+    PFS_STAT_FILE_FLUSH_FILE, PFS_STAT_FILE_COPY_CHUNKS, PFS_STAT_FILE_DISCARD_CHUNKS, PFS_STAT_FILE_GET_STATS,
+    // Blocked in metaserver_api_request_token() until the token was granted
+    PFS_STAT_TOKEN_WAIT,
+    PFS_STAT_COUNT
+};
+
+#define PFS_STAT_FIRST_RPC PFS_STAT_META_INITIALIZE
+
+extern const char* const PFS_STAT_NAMES[PFS_STAT_COUNT];
+
+/* Records one timed event of stat on the calling thread */
+void client_stats_record(int stat, uint64_t ns);
+
+/* Records bytes of file data written to and read from the fileserver at address */
+void client_stats_bytes(const std::string& fileserver_address, uint64_t bytes_written, uint64_t bytes_read);
+
+/*
+    Records the time until it goes out of scope as one event of stat, and as a trace span: a
+    pfs_* call may start a trace, RPCs and token waits are spans of the one they are made in
+ */
+class ClientStatTimer {
+public:
+    explicit ClientStatTimer(int stat)
+        : span_(PFS_STAT_NAMES[stat], stat < PFS_STAT_FIRST_RPC), stat_(stat), start_(std::chrono::steady_clock::now()) {}
+    ~ClientStatTimer() {
+        auto elapsed = std::chrono::steady_clock::now() - start_;
+        client_stats_record(stat_, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+
+private:
+    TraceScope span_;
+    int stat_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+struct pfs_stat_latency {
+    std::string name;
+    LatencyHistogram latency;
+};
+
+struct pfs_fileserver_bytes {
+    std::string address;
+    uint64_t bytes_written = 0;
+    uint64_t bytes_read = 0;
+};
+
+/* Everything recorded since the process started, over all threads. Only stats seen at least once are listed */
+struct pfs_client_stats {
+    std::vector<struct pfs_stat_latency> calls; // pfs_* calls
+    std::vector<struct pfs_stat_latency> rpcs;  // "meta.<RPC>" and "file.<RPC>"
+    LatencyHistogram token_wait;
+    std::vector<struct pfs_fileserver_bytes> fileservers; // at most CLIENT_STATS_MAX_FILESERVERS
+
+    /* One line per stat: count, mean and percentiles in microseconds */
+    std::string to_string() const;
+};
+
+void client_stats_snapshot(struct pfs_client_stats& stats);
@@ -17,3 +17,9 @@ std::string getMyIP() {
     std::string ret(temp);
     return ret;
 }
+
+// Get the path of pfs_list.txt
+std::string pfs_list_path(const char *default_path) {
+    const char *path = getenv("PFS_LIST");
+    return (path && *path) ? std::string(path) : std::string(default_path);
+}
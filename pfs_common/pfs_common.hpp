@@ -18,3 +18,6 @@
 
 std::string getMyHostname();
 std::string getMyIP();
+
+/* Path of the cluster list, $PFS_LIST if it's set (e.g. by the local cluster launcher), otherwise default_path */
+std::string pfs_list_path(const char *default_path);
@@ -0,0 +1,29 @@
+#include "pfs_compress.hpp"
+
+#include <zlib.h>
+
+bool pfs_compress(const char* data, size_t len, std::string& out) {
+    out.clear();
+    if (len == 0) return false;
+
+    uLongf out_len = compressBound(len);
+    out.resize(out_len);
+    int ret = compress2(reinterpret_cast<Bytef*>(&out[0]), &out_len, reinterpret_cast<const Bytef*>(data), len, COMPRESSION_LEVEL);
+    if (ret != Z_OK || out_len >= len * COMPRESSION_MAX_RATIO) {
+        out.clear();
+        return false;
+    }
+    out.resize(out_len);
+    return true;
+}
+
+bool pfs_decompress(const char* data, size_t len, size_t raw_len, std::string& out) {
+    out.resize(raw_len);
+    uLongf out_len = raw_len;
+    int ret = uncompress(reinterpret_cast<Bytef*>(&out[0]), &out_len, reinterpret_cast<const Bytef*>(data), len);
+    if (ret != Z_OK || out_len != raw_len) {
+        out.clear();
+        return false;
+    }
+    return true;
+}
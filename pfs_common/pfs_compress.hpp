@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+
+#include "pfs_config.hpp"
+
+/* Per-file compression modes, chosen at pfs_create() */
+#define PFS_COMPRESSION_NONE 0
+#define PFS_COMPRESSION_ZLIB 1
+
+/*
+    Compresses data with zlib at COMPRESSION_LEVEL into out. Returns false, leaving out
+    empty, when the result would not be below COMPRESSION_MAX_RATIO of the input: such
+    data is cheaper to store and send as is.
+ */
+bool pfs_compress(const char* data, size_t len, std::string& out);
+
+/* Inflates data that pfs_compress() produced from raw_len bytes. false on corrupt input */
+bool pfs_decompress(const char* data, size_t len, size_t raw_len, std::string& out);
+
+/*
+    Adaptive skip for incompressible streams: after COMPRESSION_SKIP_AFTER attempts in a
+    row that didn't pay off, only every COMPRESSION_PROBE_EVERY-th chunk is tried, until
+    one compresses again. Not synchronized, a lost update only costs one extra attempt.
+ */
+class CompressionProbe {
+public:
+    bool should_try() {
+        if (failures_ < COMPRESSION_SKIP_AFTER) return true;
+        return ++skipped_ % COMPRESSION_PROBE_EVERY == 0;
+    }
+
+    void record(bool compressed) {
+        if (compressed) {
+            failures_ = 0;
+            skipped_ = 0;
+        } else if (failures_ < COMPRESSION_SKIP_AFTER) {
+            failures_++;
+        }
+    }
+
+private:
+    uint32_t failures_ = 0;
+    uint32_t skipped_ = 0;
+};
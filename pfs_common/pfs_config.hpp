@@ -1,6 +1,67 @@
 #pragma once
 
 #define PFS_BLOCK_SIZE 512 // 512 Bytes
-#define NUM_FILE_SERVERS 4 // 4 File Servers
+#define NUM_FILE_SERVERS 4 // 4 File Servers in pfs_list.txt, more can join at run time
 #define STRIPE_BLOCKS 2 // 2 Blocks
+#define PFS_DEFAULT_STRIPE_UNIT (PFS_BLOCK_SIZE * STRIPE_BLOCKS) // Bytes of a file per chunk unless chosen at pfs_create
+#define PFS_MAX_STRIPE_UNIT (16 * 1024 * 1024) // Per-file stripe units are powers of two up to 16 MB
+#define PFS_MAX_MESSAGE_BYTES (PFS_MAX_STRIPE_UNIT + 1024 * 1024) // gRPC message cap, a whole chunk plus headers
 #define CLIENT_CACHE_BLOCKS 16 // 16 Blocks
+#define CLIENT_STATS_MAX_FILESERVERS 64 // Fileservers the client counts bytes for, see pfs_execstat_ext()
+
+#define FILESERVER_USE_IO_URING 1 // Use the io_uring storage backend when the kernel supports it
+#define FILESERVER_O_DIRECT 0 // Bypass the page cache on the fileserver (io_uring backend only)
+#define IO_URING_QUEUE_DEPTH 128 // Submission queue entries
+#define IO_URING_FIXED_BUFFERS 64 // Registered buffers in the aligned pool
+#define IO_URING_FIXED_BUFFER_SIZE 65536 // 64 KB per registered buffer
+#define DIRECT_IO_ALIGNMENT 4096 // O_DIRECT offset/length alignment
+
+#define FILESERVER_CACHE_BYTES (64 * 1024 * 1024) // 64 MB server-side block cache, 0 disables it
+#define FILESERVER_CACHE_SHARDS 16 // Independently locked cache shards
+#define FILESERVER_CACHE_MAX_CHUNK (64 * 1024) // Chunks of larger stripe units bypass the block cache
+
+#define RECLAIM_TRUNCATE_STEP (64 * 1024 * 1024) // Deleted objects are truncated 64 MB at a time
+
+#define PFS_DEFAULT_DURABILITY 2 // Write acknowledgement: 0 = page cache, 1 = fdatasync per write, 2 = group commit
+#define GROUP_COMMIT_INTERVAL_US 1000 // A group commit batch stays open for at most 1 ms
+#define GROUP_COMMIT_BATCH 32 // ... or until this many writers are waiting on it
+
+#define CHECKSUM_LOCK_STRIPES 16 // Chunk and block lock stripes of every stored object, keep data and checksum updates atomic
+#define SCRUB_INTERVAL_SEC 3600 // The fileserver re-verifies all stored data every hour, 0 disables it
+#define SCRUB_BYTES_PER_SEC (32 * 1024 * 1024) // Scrubber read bandwidth cap
+
+#define COMPRESSION_LEVEL 1 // zlib level for compressed files, 1 = fastest
+#define COMPRESSION_MAX_RATIO 0.875 // Chunks that don't shrink below 7/8 are stored and sent as is
+#define COMPRESSION_SKIP_AFTER 8 // Incompressible chunks in a row before compression is mostly skipped
+#define COMPRESSION_PROBE_EVERY 16 // ... then only every 16th chunk is tried
+#define PFS_WIRE_COMPRESSION 1 // Compress chunk data on the wire too for compressed files
+
+#define REPLICA_EWMA_ALPHA 0.2 // Weight of the newest sample in a fileserver's read latency average
+#define REPLICA_HEDGE_FACTOR 3 // A replica read slower than 3x the server's average is hedged ...
+#define REPLICA_HEDGE_MIN_US 2000 // ... but never before 2 ms
+#define REPLICA_FAILURE_PENALTY_US 1000000 // A failed read counts as a 1 s sample
+
+#define COPY_BATCH_RANGES 256 // Chunk ranges per CopyChunks RPC of a server-side copy
+
+#define PFS_DEFAULT_PLACEMENT 3 // Servers of new files: 1 = rotation, 2 = name hash, 3 = load and capacity aware
+#define PLACEMENT_LOAD_WEIGHT 0.5 // Weight of request rate and recent placements against used capacity
+
+#define HEARTBEAT_INTERVAL_SEC 2 // Fileservers report their load to the metaserver this often
+#define HEARTBEAT_TIMEOUT_SEC 10 // A fileserver silent this long is marked down in the cluster map
+#define REBALANCE_INTERVAL_SEC 30 // The rebalancer looks for uneven fileservers this often, and whenever one joins
+#define REBALANCE_IMBALANCE 0.1 // ... and moves chunks while the fullest server holds 10% more than the mean
+#define REBALANCE_BYTES_PER_SEC (16 * 1024 * 1024) // Migration bandwidth cap
+#define MIGRATION_GRACE_MS 200 // Writes planned before a migration step are given this long to land
+
+#define STATS_MAX_CALLERS 256 // Callers a server counts separately in GetStats, the rest are added up as "other"
+#define STATS_TOP_FILES 10 // Files with the most token revocations the metaserver's GetStats lists
+#ifndef PFS_LOG_LEVEL
+#define PFS_LOG_LEVEL 1 // Lowest log level compiled in: 0 = debug, 1 = info, 2 = warn, 3 = error; make LOG_LEVEL=0 for all
+#endif
+#define LOG_RING_MESSAGES 4096 // Log messages waiting for the writer thread, more are dropped
+#define LOG_LINE_BYTES 240 // Longer log messages are cut
+#define LOG_WRITER_IDLE_MS 5 // How often an idle log writer looks for new messages
+#define TRACE_RING_SPANS 65536 // Finished trace spans each process keeps, about 5 MB once the first one is recorded
+#define WORKLOAD_FLUSH_BYTES 65536 // Recorded pfs_* calls a client buffers before writing them to its workload file
+
+#define INLINE_FILE_THRESHOLD 512 // Files up to 512 bytes live in their metaserver record, 0 disables inlining
@@ -0,0 +1,169 @@
+#include "pfs_crc32c.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define PFS_CRC32C_X86 1
+#endif
+
+static const uint32_t CRC32C_POLY = 0x82f63b78; // reflected Castagnoli polynomial
+static const size_t CRC32C_LANE = 128;          // bytes per lane of the 3-way hardware loop
+
+namespace {
+
+struct SlicingTables {
+    uint32_t t[8][256];
+
+    SlicingTables() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+            t[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int s = 1; s < 8; s++) t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xff];
+        }
+    }
+};
+
+const SlicingTables& tables() {
+    static const SlicingTables instance;
+    return instance;
+}
+
+/*
+    CRC is linear in the register, so lanes computed independently combine as
+        crc(A || B) = shift(crc(A), |B|) ^ crc_from_zero(B)
+    where shift(x, n) runs n zero bytes through the register. For n = CRC32C_LANE that
+    operator is tabulated one register byte at a time.
+ */
+struct ShiftTable {
+    uint32_t t[4][256];
+
+    ShiftTable() {
+        const SlicingTables& tab = tables();
+        for (int k = 0; k < 4; k++) {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t crc = i << (8 * k);
+                for (size_t n = 0; n < CRC32C_LANE; n++) crc = (crc >> 8) ^ tab.t[0][crc & 0xff];
+                t[k][i] = crc;
+            }
+        }
+    }
+
+    uint32_t shift(uint32_t crc) const {
+        return t[0][crc & 0xff] ^ t[1][(crc >> 8) & 0xff] ^ t[2][(crc >> 16) & 0xff] ^ t[3][crc >> 24];
+    }
+};
+
+const ShiftTable& lane_shift() {
+    static const ShiftTable instance;
+    return instance;
+}
+
+} // namespace
+
+uint32_t crc32c_portable(const void* data, size_t len, uint32_t crc) {
+    const SlicingTables& tab = tables();
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+
+    // Eight bytes per step, one lookup per byte into its own table
+    while (len >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        word ^= crc;
+        crc = tab.t[7][word & 0xff] ^ tab.t[6][(word >> 8) & 0xff] ^
+              tab.t[5][(word >> 16) & 0xff] ^ tab.t[4][(word >> 24) & 0xff] ^
+              tab.t[3][(word >> 32) & 0xff] ^ tab.t[2][(word >> 40) & 0xff] ^
+              tab.t[1][(word >> 48) & 0xff] ^ tab.t[0][word >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) crc = (crc >> 8) ^ tab.t[0][(crc ^ *p++) & 0xff];
+    return ~crc;
+}
+
+#if PFS_CRC32C_X86
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hw(const void* data, size_t len, uint32_t crc) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint64_t crc64 = ~crc;
+
+    // Unaligned head byte by byte, then 8 bytes per crc32 instruction
+    while (len && (reinterpret_cast<uintptr_t>(p) & 7)) {
+        crc64 = _mm_crc32_u8((uint32_t) crc64, *p++);
+        len--;
+    }
+#if defined(__x86_64__)
+    // crc32 has a 3 cycle latency but a throughput of one per cycle: keep three independent
+    // lanes in flight and stitch them together with the precomputed lane shift
+    if (len >= 3 * CRC32C_LANE) {
+        const ShiftTable& shift = lane_shift();
+        while (len >= 3 * CRC32C_LANE) {
+            uint64_t a = crc64, b = 0, c = 0;
+            for (size_t i = 0; i < CRC32C_LANE; i += 8) {
+                uint64_t wa, wb, wc;
+                std::memcpy(&wa, p + i, 8);
+                std::memcpy(&wb, p + CRC32C_LANE + i, 8);
+                std::memcpy(&wc, p + 2 * CRC32C_LANE + i, 8);
+                a = _mm_crc32_u64(a, wa);
+                b = _mm_crc32_u64(b, wb);
+                c = _mm_crc32_u64(c, wc);
+            }
+            crc64 = shift.shift(shift.shift((uint32_t) a) ^ (uint32_t) b) ^ (uint32_t) c;
+            p += 3 * CRC32C_LANE;
+            len -= 3 * CRC32C_LANE;
+        }
+    }
+    while (len >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        len -= 8;
+    }
+#endif
+    while (len >= 4) {
+        uint32_t word;
+        std::memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u32((uint32_t) crc64, word);
+        p += 4;
+        len -= 4;
+    }
+    while (len--) crc64 = _mm_crc32_u8((uint32_t) crc64, *p++);
+    return ~(uint32_t) crc64;
+}
+
+bool crc32c_hw_available() {
+    static const bool available = __builtin_cpu_supports("sse4.2");
+    return available;
+}
+#else
+uint32_t crc32c_hw(const void* data, size_t len, uint32_t crc) {
+    return crc32c_portable(data, len, crc);
+}
+
+bool crc32c_hw_available() {
+    return false;
+}
+#endif
+
+uint32_t crc32c(const void* data, size_t len, uint32_t crc) {
+    if (crc32c_hw_available()) return crc32c_hw(data, len, crc);
+    return crc32c_portable(data, len, crc);
+}
+
+std::vector<uint32_t> crc32c_blocks(const char* data, size_t len, uint64_t offset, size_t block_size) {
+    std::vector<uint32_t> crcs;
+    while (len > 0) {
+        size_t piece = std::min<size_t>(len, block_size - offset % block_size);
+        crcs.push_back(crc32c(data, piece));
+        data += piece;
+        offset += piece;
+        len -= piece;
+    }
+    return crcs;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+
+#include "pfs_config.hpp"
+
+/*
+    CRC32C (Castagnoli), the checksum PFS keeps for every PFS_BLOCK_SIZE block of file data.
+    Uses the SSE4.2 crc32 instruction when the CPU has it, a slicing-by-8 table otherwise.
+    crc is the checksum of the preceding data, so a checksum can be extended piece by piece.
+ */
+uint32_t crc32c(const void* data, size_t len, uint32_t crc = 0);
+
+/* The two implementations behind crc32c(), exposed for the microbenchmark */
+uint32_t crc32c_portable(const void* data, size_t len, uint32_t crc = 0);
+uint32_t crc32c_hw(const void* data, size_t len, uint32_t crc = 0);
+bool crc32c_hw_available();
+
+/*
+    Checksums of data that starts at file offset `offset`, one per piece between block
+    boundaries: a block-aligned range yields exactly the per-block checksums, a partial
+    first or last block gets the checksum of the bytes actually covered.
+ */
+std::vector<uint32_t> crc32c_blocks(const char* data, size_t len, uint64_t offset, size_t block_size = PFS_BLOCK_SIZE);
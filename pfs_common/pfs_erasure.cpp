@@ -0,0 +1,236 @@
+#include "pfs_erasure.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PFS_GF_X86 1
+#endif
+
+static const uint32_t GF_POLY = 0x11d;
+
+namespace {
+
+struct GaloisTables {
+    uint8_t exp[512];
+    uint8_t log[256];
+    uint8_t mul[256][256];
+
+    GaloisTables() {
+        uint32_t x = 1;
+        for (int i = 0; i < 255; i++) {
+            exp[i] = (uint8_t) x;
+            log[x] = (uint8_t) i;
+            x <<= 1;
+            if (x & 0x100) x ^= GF_POLY;
+        }
+        for (int i = 255; i < 512; i++) exp[i] = exp[i - 255];
+        log[0] = 0;
+        for (int a = 0; a < 256; a++) {
+            for (int b = 0; b < 256; b++) {
+                mul[a][b] = (a == 0 || b == 0) ? 0 : exp[log[a] + log[b]];
+            }
+        }
+    }
+};
+
+const GaloisTables& gf() {
+    static const GaloisTables instance;
+    return instance;
+}
+
+}
+
+uint8_t gf_mul(uint8_t a, uint8_t b) {
+    return gf().mul[a][b];
+}
+
+uint8_t gf_inv(uint8_t a) {
+    if (a == 0) return 0;
+    return gf().exp[255 - gf().log[a]];
+}
+
+void gf_mul_add_portable(uint8_t c, const uint8_t* src, uint8_t* dst, size_t len) {
+    const uint8_t* row = gf().mul[c];
+    for (size_t i = 0; i < len; i++) dst[i] ^= row[src[i]];
+}
+
+#if PFS_GF_X86
+/*
+    c * x = c * (x & 0x0f) ^ c * (x & 0xf0), and each half is a 16-entry table: one pshufb
+    per nibble looks up 16 (or 32) products at once.
+ */
+static void nibble_tables(uint8_t c, uint8_t low[16], uint8_t high[16]) {
+    const uint8_t* row = gf().mul[c];
+    for (int i = 0; i < 16; i++) {
+        low[i] = row[i];
+        high[i] = row[i << 4];
+    }
+}
+
+__attribute__((target("ssse3")))
+void gf_mul_add_ssse3(uint8_t c, const uint8_t* src, uint8_t* dst, size_t len) {
+    alignas(16) uint8_t low[16], high[16];
+    nibble_tables(c, low, high);
+    const __m128i tlow = _mm_load_si128((const __m128i*) low);
+    const __m128i thigh = _mm_load_si128((const __m128i*) high);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (src + i));
+        __m128i lo = _mm_shuffle_epi8(tlow, _mm_and_si128(x, mask));
+        __m128i hi = _mm_shuffle_epi8(thigh, _mm_and_si128(_mm_srli_epi64(x, 4), mask));
+        __m128i d = _mm_loadu_si128((const __m128i*) (dst + i));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_xor_si128(d, _mm_xor_si128(lo, hi)));
+    }
+    if (i < len) gf_mul_add_portable(c, src + i, dst + i, len - i);
+}
+
+__attribute__((target("avx2")))
+void gf_mul_add_avx2(uint8_t c, const uint8_t* src, uint8_t* dst, size_t len) {
+    alignas(16) uint8_t low[16], high[16];
+    nibble_tables(c, low, high);
+    // vpshufb looks up within each 128-bit lane, so both lanes get the same table
+    const __m256i tlow = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*) low));
+    const __m256i thigh = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*) high));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*) (src + i));
+        __m256i lo = _mm256_shuffle_epi8(tlow, _mm256_and_si256(x, mask));
+        __m256i hi = _mm256_shuffle_epi8(thigh, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask));
+        __m256i d = _mm256_loadu_si256((const __m256i*) (dst + i));
+        _mm256_storeu_si256((__m256i*) (dst + i), _mm256_xor_si256(d, _mm256_xor_si256(lo, hi)));
+    }
+    if (i < len) gf_mul_add_ssse3(c, src + i, dst + i, len - i);
+}
+
+bool gf_ssse3_available() {
+    static const bool available = __builtin_cpu_supports("ssse3");
+    return available;
+}
+
+bool gf_avx2_available() {
+    static const bool available = __builtin_cpu_supports("avx2");
+    return available;
+}
+#else
+void gf_mul_add_ssse3(uint8_t c, const uint8_t* src, uint8_t* dst, size_t len) {
+    gf_mul_add_portable(c, src, dst, len);
+}
+
+void gf_mul_add_avx2(uint8_t c, const uint8_t* src, uint8_t* dst, size_t len) {
+    gf_mul_add_portable(c, src, dst, len);
+}
+
+bool gf_ssse3_available() {
+    return false;
+}
+
+bool gf_avx2_available() {
+    return false;
+}
+#endif
+
+void gf_mul_add(uint8_t c, const uint8_t* src, uint8_t* dst, size_t len) {
+    if (c == 0) return;
+    if (c == 1) {
+        for (size_t i = 0; i < len; i++) dst[i] ^= src[i];
+        return;
+    }
+    if (gf_avx2_available()) return gf_mul_add_avx2(c, src, dst, len);
+    if (gf_ssse3_available()) return gf_mul_add_ssse3(c, src, dst, len);
+    gf_mul_add_portable(c, src, dst, len);
+}
+
+const char* gf_kernel_name() {
+    if (gf_avx2_available()) return "avx2";
+    if (gf_ssse3_available()) return "ssse3";
+    return "portable";
+}
+
+/* Inverts the n x n matrix a in place by Gauss-Jordan elimination. false if it is singular */
+static bool invert(std::vector<uint8_t>& a, int n) {
+    std::vector<uint8_t> inv(n * n, 0);
+    for (int i = 0; i < n; i++) inv[i * n + i] = 1;
+
+    for (int col = 0; col < n; col++) {
+        int pivot = col;
+        while (pivot < n && a[pivot * n + col] == 0) pivot++;
+        if (pivot == n) return false;
+        if (pivot != col) {
+            for (int j = 0; j < n; j++) {
+                std::swap(a[pivot * n + j], a[col * n + j]);
+                std::swap(inv[pivot * n + j], inv[col * n + j]);
+            }
+        }
+        uint8_t scale = gf_inv(a[col * n + col]);
+        for (int j = 0; j < n; j++) {
+            a[col * n + j] = gf_mul(a[col * n + j], scale);
+            inv[col * n + j] = gf_mul(inv[col * n + j], scale);
+        }
+        for (int row = 0; row < n; row++) {
+            uint8_t factor = a[row * n + col];
+            if (row == col || factor == 0) continue;
+            for (int j = 0; j < n; j++) {
+                a[row * n + j] ^= gf_mul(factor, a[col * n + j]);
+                inv[row * n + j] ^= gf_mul(factor, inv[col * n + j]);
+            }
+        }
+    }
+    a = std::move(inv);
+    return true;
+}
+
+ReedSolomon::ReedSolomon(int data_shards, int parity_shards)
+    : k_(data_shards), m_(parity_shards), matrix_((data_shards + parity_shards) * data_shards, 0) {
+    for (int i = 0; i < k_; i++) matrix_[i * k_ + i] = 1;
+    // Cauchy rows 1 / (x_i + y_j) with x_i = k + i, y_j = j: all distinct, every square submatrix is invertible
+    for (int i = 0; i < m_; i++) {
+        for (int j = 0; j < k_; j++) {
+            matrix_[(k_ + i) * k_ + j] = gf_inv((uint8_t) ((k_ + i) ^ j));
+        }
+    }
+}
+
+void ReedSolomon::encode(const std::vector<const uint8_t*>& data, const std::vector<uint8_t*>& parity, size_t len) const {
+    for (int i = 0; i < m_; i++) {
+        std::memset(parity[i], 0, len);
+        for (int j = 0; j < k_; j++) gf_mul_add(at(k_ + i, j), data[j], parity[i], len);
+    }
+}
+
+bool ReedSolomon::reconstruct(const std::vector<uint8_t*>& shards, const std::vector<bool>& present, size_t len) const {
+    std::vector<int> rows;
+    for (int i = 0; i < k_ + m_ && (int) rows.size() < k_; i++) {
+        if (present[i]) rows.push_back(i);
+    }
+    if ((int) rows.size() < k_) return false;
+
+    // The k surviving rows map the data to what survived, their inverse maps it back
+    bool data_missing = false;
+    for (int j = 0; j < k_; j++) data_missing |= !present[j];
+    if (data_missing) {
+        std::vector<uint8_t> decode(k_ * k_);
+        for (int r = 0; r < k_; r++) {
+            for (int j = 0; j < k_; j++) decode[r * k_ + j] = at(rows[r], j);
+        }
+        if (!invert(decode, k_)) return false;
+        for (int j = 0; j < k_; j++) {
+            if (present[j]) continue;
+            std::memset(shards[j], 0, len);
+            for (int r = 0; r < k_; r++) gf_mul_add(decode[j * k_ + r], shards[rows[r]], shards[j], len);
+        }
+    }
+
+    // Lost parity is just encoded again from the (now complete) data
+    for (int i = 0; i < m_; i++) {
+        if (present[k_ + i]) continue;
+        std::memset(shards[k_ + i], 0, len);
+        for (int j = 0; j < k_; j++) gf_mul_add(at(k_ + i, j), shards[j], shards[k_ + i], len);
+    }
+    return true;
+}
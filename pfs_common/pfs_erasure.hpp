@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+
+#include "pfs_config.hpp"
+
+/*
+    GF(2^8) arithmetic over the 0x11d polynomial, the field the Reed-Solomon code works in.
+    gf_mul_add() is the only hot loop: split-nibble table lookups with pshufb, 32 bytes at a
+    time with AVX2 or 16 with SSSE3, whichever the CPU has, and a full product table otherwise.
+ */
+uint8_t gf_mul(uint8_t a, uint8_t b);
+uint8_t gf_inv(uint8_t a);
+
+/* dst[i] ^= c * src[i] */
+void gf_mul_add(uint8_t c, const uint8_t* src, uint8_t* dst, size_t len);
+
+/* The implementations behind gf_mul_add(), exposed for the microbenchmark */
+void gf_mul_add_portable(uint8_t c, const uint8_t* src, uint8_t* dst, size_t len);
+void gf_mul_add_ssse3(uint8_t c, const uint8_t* src, uint8_t* dst, size_t len);
+void gf_mul_add_avx2(uint8_t c, const uint8_t* src, uint8_t* dst, size_t len);
+bool gf_ssse3_available();
+bool gf_avx2_available();
+const char* gf_kernel_name();
+
+/*
+    Systematic Reed-Solomon code with k data and m parity shards of equal length. The
+    generator is the k x k identity on top of an m x k Cauchy matrix, so any k of the
+    k + m shards are enough to rebuild the rest.
+ */
+class ReedSolomon {
+public:
+    ReedSolomon(int data_shards, int parity_shards);
+
+    int data_shards() const { return k_; }
+    int parity_shards() const { return m_; }
+
+    /* Fills the m parity buffers from the k data buffers, all len bytes */
+    void encode(const std::vector<const uint8_t*>& data, const std::vector<uint8_t*>& parity, size_t len) const;
+
+    /*
+        shards holds k + m buffers of len bytes, data shards first. Rebuilds every shard whose
+        present flag is false in place. Returns false if fewer than k shards are present.
+     */
+    bool reconstruct(const std::vector<uint8_t*>& shards, const std::vector<bool>& present, size_t len) const;
+
+private:
+    int k_;
+    int m_;
+    std::vector<uint8_t> matrix_;   // (k + m) x k generator, row major
+
+    uint8_t at(int row, int col) const { return matrix_[row * k_ + col]; }
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+
+/*
+    HDR-style latency histogram in nanoseconds. Buckets are log-linear: every power of two is
+    split into SUB_BUCKETS equal buckets, so a bucket is never wider than 1/16 of the values in
+    it, from 1 ns to 2^41 ns (about 36 minutes) in a fixed BUCKETS buckets, larger values land
+    in the last one. Histograms of different threads, phases or servers add up bucket by bucket.
+ */
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BITS = 4;
+    static constexpr int SUB_BUCKETS = 1 << SUB_BITS;
+    static constexpr int MAX_SHIFT = 36;
+    static constexpr int BUCKETS = (MAX_SHIFT + 2) * SUB_BUCKETS;
+
+    uint64_t counts[BUCKETS] = {};
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+
+    /* Values up to 2 * SUB_BUCKETS get a bucket each, then SUB_BUCKETS per power of two */
+    static int bucket_of(uint64_t ns) {
+        int shift = ns < 2 * SUB_BUCKETS ? 0 : 63 - __builtin_clzll(ns) - SUB_BITS;
+        if (shift > MAX_SHIFT) return BUCKETS - 1;
+        return shift * SUB_BUCKETS + (int) (ns >> shift);
+    }
+
+    /* Smallest and largest value of bucket */
+    static uint64_t bucket_low(int bucket) {
+        if (bucket < 2 * SUB_BUCKETS) return bucket;
+        int shift = bucket / SUB_BUCKETS - 1;
+        return (uint64_t) (bucket % SUB_BUCKETS + SUB_BUCKETS) << shift;
+    }
+    static uint64_t bucket_high(int bucket) {
+        if (bucket < 2 * SUB_BUCKETS) return bucket;
+        int shift = bucket / SUB_BUCKETS - 1;
+        return ((uint64_t) (bucket % SUB_BUCKETS + SUB_BUCKETS + 1) << shift) - 1;
+    }
+
+    void record(uint64_t ns) {
+        counts[bucket_of(ns)]++;
+        count++;
+        total_ns += ns;
+        max_ns = std::max(max_ns, ns);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (int b = 0; b < BUCKETS; b++) counts[b] += other.counts[b];
+        count += other.count;
+        total_ns += other.total_ns;
+        max_ns = std::max(max_ns, other.max_ns);
+    }
+
+    double mean_ns() const { return count == 0 ? 0 : (double) total_ns / count; }
+
+    /* Nearest-rank percentile (p in [0, 1]), the middle of its bucket, 0 if empty */
+    uint64_t percentile_ns(double p) const {
+        if (count == 0) return 0;
+        uint64_t rank = std::max<uint64_t>(1, (uint64_t) std::ceil(p * count));
+        uint64_t seen = 0;
+        for (int b = 0; b < BUCKETS; b++) {
+            seen += counts[b];
+            if (seen >= rank) return std::min(max_ns, bucket_low(b) + (bucket_high(b) - bucket_low(b)) / 2);
+        }
+        return max_ns;
+    }
+};
+
+/*
+    A LatencyHistogram that threads record into while others read it: relaxed atomics, no lock.
+    A snapshot taken during recording may be off by the calls in flight, never torn per counter.
+ */
+class AtomicLatencyHistogram {
+public:
+    void record(uint64_t ns) {
+        counts_[LatencyHistogram::bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        total_ns_.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t max = max_ns_.load(std::memory_order_relaxed);
+        while (ns > max && !max_ns_.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+    }
+
+    /* Adds what was recorded so far to out */
+    void add_to(LatencyHistogram& out) const {
+        for (int b = 0; b < LatencyHistogram::BUCKETS; b++) out.counts[b] += counts_[b].load(std::memory_order_relaxed);
+        out.count += count_.load(std::memory_order_relaxed);
+        out.total_ns += total_ns_.load(std::memory_order_relaxed);
+        out.max_ns = std::max(out.max_ns, max_ns_.load(std::memory_order_relaxed));
+    }
+
+private:
+    std::atomic<uint64_t> counts_[LatencyHistogram::BUCKETS] = {};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> total_ns_{0};
+    std::atomic<uint64_t> max_ns_{0};
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+
+#include "pfs_config.hpp"
+
+/*
+    Chunk arithmetic for a file's stripe unit, the bytes of the file in one chunk. Units are
+    powers of two, so it's all shifts and masks. The common sizes are instantiated with the
+    shift as a compile-time constant, pfs_with_stripe_unit() picks the instantiation once per
+    call and the layout loops inside run specialized for it.
+ */
+template <int SHIFT>
+struct FixedStripeUnit {
+    static constexpr int64_t size() { return int64_t(1) << SHIFT; }
+    static constexpr int64_t chunk_of(int64_t offset) { return offset >> SHIFT; }
+    static constexpr int64_t chunk_start(int64_t chunk_number) { return chunk_number << SHIFT; }
+    static constexpr int64_t offset_in_chunk(int64_t offset) { return offset & (size() - 1); }
+};
+
+/* Any other power-of-two unit, the shift is only known at run time */
+struct StripeUnit {
+    int shift;
+
+    int64_t size() const { return int64_t(1) << shift; }
+    int64_t chunk_of(int64_t offset) const { return offset >> shift; }
+    int64_t chunk_start(int64_t chunk_number) const { return chunk_number << shift; }
+    int64_t offset_in_chunk(int64_t offset) const { return offset & (size() - 1); }
+};
+
+/* A unit every fileserver can store: a power of two, whole checksum blocks, at most PFS_MAX_STRIPE_UNIT */
+inline bool pfs_valid_stripe_unit(int64_t stripe_unit) {
+    return stripe_unit >= PFS_BLOCK_SIZE && stripe_unit <= PFS_MAX_STRIPE_UNIT && (stripe_unit & (stripe_unit - 1)) == 0;
+}
+
+/* 0 (unset, e.g. a request from an older client) means the default unit */
+inline int pfs_stripe_unit_or_default(int stripe_unit) {
+    return stripe_unit > 0 ? stripe_unit : PFS_DEFAULT_STRIPE_UNIT;
+}
+
+/* Calls fn with the arithmetic of stripe_unit, a FixedStripeUnit for the sizes files commonly use */
+template <typename Fn>
+inline auto pfs_with_stripe_unit(int stripe_unit, Fn&& fn) -> decltype(fn(StripeUnit{0})) {
+    switch (pfs_stripe_unit_or_default(stripe_unit)) {
+        case 1 << 10: return fn(FixedStripeUnit<10>());    // 1 KB, the default
+        case 1 << 16: return fn(FixedStripeUnit<16>());    // 64 KB
+        case 1 << 20: return fn(FixedStripeUnit<20>());    // 1 MB
+        case 1 << 22: return fn(FixedStripeUnit<22>());    // 4 MB
+        default: {
+            int shift = 0;
+            while ((int64_t(1) << shift) < pfs_stripe_unit_or_default(stripe_unit)) shift++;
+            return fn(StripeUnit{shift});
+        }
+    }
+}
+
+/* Calls piece(chunk_number, start_byte, end_byte) for the part of [offset, offset + num_bytes) in each chunk, in order */
+template <typename Unit, typename Piece>
+inline void pfs_for_each_chunk(const Unit& unit, int64_t offset, int64_t num_bytes, Piece&& piece) {
+    if (num_bytes <= 0) return;
+    int64_t last_byte = offset + num_bytes - 1;
+    for (int64_t chunk_number = unit.chunk_of(offset); chunk_number <= unit.chunk_of(last_byte); chunk_number++) {
+        int64_t start_byte = std::max(unit.chunk_start(chunk_number), offset);
+        int64_t end_byte = std::min(unit.chunk_start(chunk_number + 1) - 1, last_byte);
+        piece(chunk_number, start_byte, end_byte);
+    }
+}
+
+/*
+    Offsets and lengths are 64-bit everywhere, chunk numbers stay 32-bit (the fileservers'
+    manifests store them as uint32): a file is at most 2^31 chunks, 2 TB at the default stripe
+    unit and 32 PB at PFS_MAX_STRIPE_UNIT. Whether file byte last_byte is within that.
+ */
+inline bool pfs_byte_addressable(int stripe_unit, int64_t last_byte) {
+    return last_byte >= -1 && pfs_with_stripe_unit(stripe_unit, [&](auto unit) { return unit.chunk_of(last_byte); }) <= INT32_MAX;
+}
+
+/* Offset of a file byte within its chunk */
+inline int64_t pfs_offset_in_chunk(int stripe_unit, int64_t offset) {
+    return pfs_with_stripe_unit(stripe_unit, [&](auto unit) { return unit.offset_in_chunk(offset); });
+}
@@ -0,0 +1,141 @@
+#include "pfs_log.hpp"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <pthread.h>
+#include <time.h>
+
+namespace {
+
+/*
+    One ring entry. Position p of the ring uses slot p % LOG_RING_MESSAGES in round
+    p / LOG_RING_MESSAGES; the slot is free for round r while seq is 2 * r and holds its
+    message once seq is 2 * r + 1, so the zeroed ring starts out free.
+ */
+struct Slot {
+    std::atomic<uint64_t> seq{0};
+    int level;
+    struct timespec time;
+    char text[LOG_LINE_BYTES];
+};
+
+Slot ring[LOG_RING_MESSAGES];
+std::atomic<uint64_t> head{0};          // next position to log into
+std::atomic<uint64_t> tail{0};          // next position to write out, moved under drain_mutex
+std::atomic<uint64_t> dropped{0};
+
+std::mutex drain_mutex;                 // one drainer at a time: the writer thread or pfs_log_flush()
+std::mutex start_mutex;
+std::atomic<bool> writer_running{false};
+
+const char LEVEL_LETTERS[] = "DIWE";
+
+int threshold_from_env() {
+    const char* value = getenv("PFS_LOG");
+    if (!value) return PFS_LOG_LEVEL;
+    if (strcmp(value, "debug") == 0) return PFS_LOG_LEVEL_DEBUG;
+    if (strcmp(value, "info") == 0) return PFS_LOG_LEVEL_INFO;
+    if (strcmp(value, "warn") == 0) return PFS_LOG_LEVEL_WARN;
+    if (strcmp(value, "error") == 0) return PFS_LOG_LEVEL_ERROR;
+    return PFS_LOG_LEVEL;
+}
+
+/* Writes out the messages logged so far, stopping at one still being written. Returns how many */
+size_t drain() {
+    std::lock_guard<std::mutex> lock(drain_mutex);
+    size_t written = 0;
+    bool to_stdout = false, to_stderr = false;
+    for (uint64_t p = tail.load(std::memory_order_relaxed);; p++) {
+        Slot& slot = ring[p % LOG_RING_MESSAGES];
+        uint64_t round = p / LOG_RING_MESSAGES;
+        if (slot.seq.load(std::memory_order_acquire) != 2 * round + 1) break;
+        struct tm local;
+        localtime_r(&slot.time.tv_sec, &local);
+        FILE* out = slot.level >= PFS_LOG_LEVEL_WARN ? stderr : stdout;
+        fprintf(out, "%02d:%02d:%02d.%06ld %c %s\n", local.tm_hour, local.tm_min, local.tm_sec, slot.time.tv_nsec / 1000,
+                LEVEL_LETTERS[slot.level], slot.text);
+        (out == stderr ? to_stderr : to_stdout) = true;
+        slot.seq.store(2 * round + 2, std::memory_order_release);
+        tail.store(p + 1, std::memory_order_release);
+        written++;
+    }
+    uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+    if (lost > 0) {
+        fprintf(stderr, "%lu log messages dropped, the log ring was full\n", (unsigned long) lost);
+        to_stderr = true;
+    }
+    if (to_stdout) fflush(stdout);
+    if (to_stderr) fflush(stderr);
+    return written;
+}
+
+/* Forked children have no writer thread, and must not inherit a drain in progress */
+void before_fork() { drain_mutex.lock(); }
+void after_fork_parent() { drain_mutex.unlock(); }
+void after_fork_child() {
+    drain_mutex.unlock();
+    writer_running.store(false, std::memory_order_relaxed);
+}
+
+void start_writer() {
+    std::lock_guard<std::mutex> lock(start_mutex);
+    if (writer_running.load(std::memory_order_relaxed)) return;
+    static std::once_flag once;
+    std::call_once(once, [] {
+        pthread_atfork(before_fork, after_fork_parent, after_fork_child);
+        atexit(pfs_log_flush);
+    });
+    writer_running.store(true, std::memory_order_relaxed);
+    std::thread([] {
+        // Idle, it polls every LOG_WRITER_IDLE_MS; busy, it writes batch after batch
+        while (true) {
+            if (drain() == 0) std::this_thread::sleep_for(std::chrono::milliseconds(LOG_WRITER_IDLE_MS));
+        }
+    }).detach();
+}
+
+}
+
+int pfs_log_threshold = threshold_from_env();
+
+void pfs_log_write(int level, const char* format, ...) {
+    if (!writer_running.load(std::memory_order_relaxed)) start_writer();
+    uint64_t p = head.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+        slot = &ring[p % LOG_RING_MESSAGES];
+        uint64_t seq = slot->seq.load(std::memory_order_acquire);
+        uint64_t free = 2 * (p / LOG_RING_MESSAGES);
+        if (seq == free) {
+            if (head.compare_exchange_weak(p, p + 1, std::memory_order_relaxed)) break;
+        } else if (seq < free) {
+            // Still holds the message of the previous round, the writer is a whole ring behind
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            p = head.load(std::memory_order_relaxed);
+        }
+    }
+    slot->level = level;
+    clock_gettime(CLOCK_REALTIME, &slot->time);
+    va_list args;
+    va_start(args, format);
+    vsnprintf(slot->text, sizeof(slot->text), format, args);
+    va_end(args);
+    slot->seq.store(2 * (p / LOG_RING_MESSAGES) + 1, std::memory_order_release);
+}
+
+void pfs_log_flush() {
+    uint64_t end = head.load(std::memory_order_acquire);
+    // Messages claimed before the call may still be being formatted, wait a little for those
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (tail.load(std::memory_order_acquire) < end && std::chrono::steady_clock::now() < deadline) {
+        if (drain() == 0) std::this_thread::yield();
+    }
+}
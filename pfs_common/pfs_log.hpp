@@ -0,0 +1,38 @@
+#pragma once
+
+#include "pfs_config.hpp"
+
+/*
+    Logging for the servers and the client library. PFS_LOG_DEBUG(...) and the others take
+    printf arguments. Levels below PFS_LOG_LEVEL are compiled out: the call is a constant false
+    branch, its arguments are never evaluated. The rest are checked at run time against
+    $PFS_LOG (debug, info, warn or error, the compiled level by default) before anything is
+    formatted. A message that passes is formatted by the calling thread straight into a slot
+    of a ring of LOG_RING_MESSAGES, without locks, and a background thread writes the ring out
+    in batches: debug and info to stdout, warnings and errors to stderr, each line stamped with
+    the time it was logged. When the ring is full messages are dropped, and counted, rather
+    than making the caller wait.
+ */
+
+#define PFS_LOG_LEVEL_DEBUG 0
+#define PFS_LOG_LEVEL_INFO 1
+#define PFS_LOG_LEVEL_WARN 2
+#define PFS_LOG_LEVEL_ERROR 3
+
+/* The lowest level logged at run time, from $PFS_LOG */
+extern int pfs_log_threshold;
+
+void pfs_log_write(int level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+/* Writes out everything logged so far; runs at exit, and before _exit() or handing stdout to someone else */
+void pfs_log_flush();
+
+#define PFS_LOG(level, ...)                                                                                   \
+    do {                                                                                                      \
+        if ((level) >= PFS_LOG_LEVEL && (level) >= pfs_log_threshold) pfs_log_write((level), __VA_ARGS__);    \
+    } while (0)
+
+#define PFS_LOG_DEBUG(...) PFS_LOG(PFS_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define PFS_LOG_INFO(...) PFS_LOG(PFS_LOG_LEVEL_INFO, __VA_ARGS__)
+#define PFS_LOG_WARN(...) PFS_LOG(PFS_LOG_LEVEL_WARN, __VA_ARGS__)
+#define PFS_LOG_ERROR(...) PFS_LOG(PFS_LOG_LEVEL_ERROR, __VA_ARGS__)
@@ -0,0 +1,286 @@
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "pfs_config.hpp"
+#include "pfs_histogram.hpp"
+#include "pfs_trace.hpp"
+
+/*
+    Calls, handler time, latency histogram, calls in flight and message bytes of each RPC a
+    server serves, and calls and bytes per caller. The set of RPCs is fixed when the server
+    starts, after that recording an RPC is a map lookup and a few relaxed atomics, plus one
+    short lock for the caller's counters. GetStats reports it all, see report().
+ */
+class RpcStats {
+public:
+    struct Counter {
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> total_us{0};
+        std::atomic<uint64_t> max_us{0};
+        std::atomic<int64_t> in_flight{0};      // calls being served right now
+        std::atomic<uint64_t> bytes_in{0};      // request messages
+        std::atomic<uint64_t> bytes_out{0};     // reply messages
+        AtomicLatencyHistogram latency;         // handler time in ns
+    };
+
+    /* Calls and bytes of one caller, over all RPCs */
+    struct Caller {
+        uint64_t calls = 0;
+        uint64_t total_us = 0;
+        uint64_t bytes_in = 0;
+        uint64_t bytes_out = 0;
+    };
+
+    RpcStats(std::initializer_list<const char*> rpcs) : start_(std::chrono::steady_clock::now()) {
+        for (const char* rpc : rpcs) counters_.emplace(rpc, std::make_unique<Counter>());
+    }
+
+    /* nullptr for an RPC not given to the constructor */
+    Counter* find(std::string_view rpc) {
+        auto it = counters_.find(rpc);
+        return it == counters_.end() ? nullptr : it->second.get();
+    }
+
+    /* One finished call. caller may be empty; past STATS_MAX_CALLERS callers the rest count as "other" */
+    void record(Counter& counter, uint64_t ns, const std::string& caller, uint64_t bytes_in, uint64_t bytes_out) {
+        uint64_t micros = ns / 1000;
+        counter.calls.fetch_add(1, std::memory_order_relaxed);
+        counter.total_us.fetch_add(micros, std::memory_order_relaxed);
+        uint64_t max = counter.max_us.load(std::memory_order_relaxed);
+        while (micros > max && !counter.max_us.compare_exchange_weak(max, micros, std::memory_order_relaxed)) {}
+        counter.bytes_in.fetch_add(bytes_in, std::memory_order_relaxed);
+        counter.bytes_out.fetch_add(bytes_out, std::memory_order_relaxed);
+        counter.latency.record(ns);
+        if (caller.empty()) return;
+
+        std::lock_guard<std::mutex> lock(callers_mutex_);
+        auto it = callers_.find(caller);
+        if (it == callers_.end()) {
+            it = callers_.size() < STATS_MAX_CALLERS ? callers_.emplace(caller, Caller()).first : callers_.emplace("other", Caller()).first;
+        }
+        it->second.calls++;
+        it->second.total_us += micros;
+        it->second.bytes_in += bytes_in;
+        it->second.bytes_out += bytes_out;
+    }
+
+    /* fn(name, counter) for every RPC, in name order */
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for (const auto& [name, counter] : counters_) fn(name, *counter);
+    }
+
+    std::vector<std::pair<std::string, Caller>> callers() const {
+        std::lock_guard<std::mutex> lock(callers_mutex_);
+        return std::vector<std::pair<std::string, Caller>>(callers_.begin(), callers_.end());
+    }
+
+    uint64_t uptime_sec() const {
+        return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+    /*
+        Fills the uptime_sec, rpcs and clients of a GetStats reply, the same for every service's
+        StatsResponse. Histograms go out sparse: the non-empty buckets and their counts.
+     */
+    template <typename Reply>
+    void report(Reply* reply) const {
+        reply->set_uptime_sec(uptime_sec());
+        for_each([&](const std::string& name, const Counter& counter) {
+            auto* timing = reply->add_rpcs();
+            timing->set_rpc(name);
+            timing->set_calls(counter.calls.load(std::memory_order_relaxed));
+            timing->set_total_us(counter.total_us.load(std::memory_order_relaxed));
+            timing->set_max_us(counter.max_us.load(std::memory_order_relaxed));
+            timing->set_in_flight(counter.in_flight.load(std::memory_order_relaxed));
+            timing->set_bytes_in(counter.bytes_in.load(std::memory_order_relaxed));
+            timing->set_bytes_out(counter.bytes_out.load(std::memory_order_relaxed));
+            LatencyHistogram latency;
+            counter.latency.add_to(latency);
+            for (int b = 0; b < LatencyHistogram::BUCKETS; b++) {
+                if (latency.counts[b] == 0) continue;
+                timing->add_latency_buckets(b);
+                timing->add_latency_counts(latency.counts[b]);
+            }
+            timing->set_latency_total_ns(latency.total_ns);
+            timing->set_latency_max_ns(latency.max_ns);
+        });
+        for (const auto& [name, caller] : callers()) {
+            auto* client = reply->add_clients();
+            client->set_client(name);
+            client->set_calls(caller.calls);
+            client->set_total_us(caller.total_us);
+            client->set_bytes_in(caller.bytes_in);
+            client->set_bytes_out(caller.bytes_out);
+        }
+    }
+
+private:
+    const std::chrono::steady_clock::time_point start_;
+    std::map<std::string, std::unique_ptr<Counter>, std::less<>> counters_;
+    mutable std::mutex callers_mutex_;
+    std::unordered_map<std::string, Caller> callers_;
+};
+
+template <typename Request, typename = void>
+struct RpcHasClientId : std::false_type {};
+template <typename Request>
+struct RpcHasClientId<Request, std::void_t<decltype(std::declval<const Request&>().client_id())>> : std::true_type {};
+
+/*
+    "client-<id>" for requests that carry a client id, else the caller's host without the port,
+    which changes with every channel: "ipv4:10.0.0.7:51234" is "10.0.0.7", "ipv6:%5B::1%5D:51234" is "[::1]"
+ */
+template <typename Context, typename Request>
+std::string rpc_caller(const Context* context, const Request* request) {
+    if constexpr (RpcHasClientId<Request>::value) {
+        return "client-" + std::to_string(request->client_id());
+    } else {
+        std::string peer = context->peer();
+        std::string host = peer.substr(peer.find(':') + 1); // the whole peer without a scheme
+        if (host.compare(0, 3, "%5B") == 0) {
+            size_t end = host.find("%5D");
+            return end == std::string::npos ? host : "[" + host.substr(3, end - 3) + "]";
+        }
+        return host.substr(0, host.rfind(':'));
+    }
+}
+
+template <typename Request, typename = void>
+struct RpcCarriesTrace : std::false_type {};
+template <typename Request>
+struct RpcCarriesTrace<Request, std::void_t<decltype(std::declval<const Request&>().span_id())>> : std::true_type {};
+
+/* The caller's span: in the request for messages on a stream, which carry their own, else in the call's metadata */
+template <typename Context, typename Request>
+TraceContext rpc_trace_parent(const Context* context, const Request* request) {
+    if constexpr (RpcCarriesTrace<Request>::value) {
+        return TraceContext{request->trace_id(), request->span_id()};
+    } else {
+        return trace_extract(context);
+    }
+}
+
+/*
+    Records the time until it goes out of scope as one call of rpc. Given the call's context,
+    request and reply it also records who called and the size of both messages, the reply
+    being measured when the timer goes out of scope, so it must outlive the handler's last write,
+    and the call is a span of the caller's trace, if it has one.
+ */
+class RpcTimer {
+public:
+    RpcTimer(RpcStats& stats, const char* rpc) : stats_(stats), counter_(stats.find(rpc)), start_(std::chrono::steady_clock::now()) {
+        if (counter_) counter_->in_flight.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    template <typename Context, typename Request, typename Reply>
+    RpcTimer(RpcStats& stats, const char* rpc, const Context* context, const Request* request, const Reply* reply)
+        : RpcTimer(stats, rpc) {
+        caller_ = rpc_caller(context, request);
+        bytes_in_ = request->ByteSizeLong();
+        reply_ = reply;
+        reply_size_ = [](const void* reply) -> uint64_t { return static_cast<const Reply*>(reply)->ByteSizeLong(); };
+        span_.start(rpc, rpc_trace_parent(context, request));
+    }
+
+    ~RpcTimer() {
+        if (!counter_) return;
+        auto elapsed = std::chrono::steady_clock::now() - start_;
+        uint64_t bytes_out = reply_ ? reply_size_(reply_) : 0;
+        stats_.record(*counter_, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), caller_, bytes_in_, bytes_out);
+        counter_->in_flight.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+private:
+    RpcStats& stats_;
+    RpcStats::Counter* counter_;
+    std::chrono::steady_clock::time_point start_;
+    std::string caller_;
+    uint64_t bytes_in_ = 0;
+    const void* reply_ = nullptr;
+    uint64_t (*reply_size_)(const void*) = nullptr;
+    TraceScope span_;
+};
+
+/* One RPC as a server reported it, everything since the server started */
+struct pfs_rpc_timing {
+    std::string rpc;
+    uint64_t calls = 0;
+    uint64_t total_us = 0;
+    uint64_t max_us = 0;
+    int64_t in_flight = 0;
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    LatencyHistogram latency; // handler time
+};
+
+/* Calls and message bytes of one caller of a server */
+struct pfs_caller_stats {
+    std::string client; // "client-<id>" or a host
+    uint64_t calls = 0;
+    uint64_t total_us = 0;
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+};
+
+/* The contention on one file's tokens, as the metaserver counts it */
+struct pfs_file_contention {
+    std::string filename;
+    uint64_t tokens = 0;
+    uint64_t token_requests = 0;
+    uint64_t revocations = 0;
+};
+
+/* A server's GetStats reply */
+struct pfs_server_stats {
+    std::string address;
+    uint64_t uptime_sec = 0;
+    std::vector<struct pfs_rpc_timing> rpcs;
+    std::vector<struct pfs_caller_stats> clients;
+    // Service-specific numbers, e.g. "open_files" or "cache_hits_total". Names ending in _total only grow
+    std::vector<std::pair<std::string, double>> values;
+    std::vector<struct pfs_file_contention> files; // metaserver only, the most contended first
+};
+
+/* Reads what RpcStats::report() filled into a GetStats response */
+template <typename Response>
+void rpc_stats_read(const Response& response, struct pfs_server_stats& stats) {
+    stats.uptime_sec = response.uptime_sec();
+    stats.rpcs.clear();
+    for (const auto& timing : response.rpcs()) {
+        struct pfs_rpc_timing t;
+        t.rpc = timing.rpc();
+        t.calls = timing.calls();
+        t.total_us = timing.total_us();
+        t.max_us = timing.max_us();
+        t.in_flight = timing.in_flight();
+        t.bytes_in = timing.bytes_in();
+        t.bytes_out = timing.bytes_out();
+        for (int i = 0; i < std::min(timing.latency_buckets_size(), timing.latency_counts_size()); i++) {
+            int bucket = timing.latency_buckets(i);
+            if (bucket < 0 || bucket >= LatencyHistogram::BUCKETS) continue;
+            t.latency.counts[bucket] += timing.latency_counts(i);
+            t.latency.count += timing.latency_counts(i);
+        }
+        t.latency.total_ns = timing.latency_total_ns();
+        t.latency.max_ns = timing.latency_max_ns();
+        stats.rpcs.push_back(t);
+    }
+    stats.clients.clear();
+    for (const auto& client : response.clients()) {
+        stats.clients.push_back({client.client(), client.calls(), client.total_us(), client.bytes_in(), client.bytes_out()});
+    }
+}
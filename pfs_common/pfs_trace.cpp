@@ -0,0 +1,195 @@
+#include "pfs_trace.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+/* One ring entry. seq is odd while the span is written and 2 * n + 2 once span n is complete */
+struct Slot {
+    std::atomic<uint64_t> seq{0};
+    TraceSpan span;
+};
+
+std::once_flag ring_once;
+std::atomic<Slot*> ring{nullptr};       // TRACE_RING_SPANS slots, allocated by the first span
+std::atomic<uint64_t> next_span{0};
+
+thread_local TraceContext current;
+
+/* Every how many pfs_* calls one is traced, 0 for none, from PFS_TRACE */
+uint64_t sample_every() {
+    static const uint64_t every = [] {
+        const char* value = getenv("PFS_TRACE");
+        long n = value ? atol(value) : 0;
+        return n > 0 ? (uint64_t) n : 0;
+    }();
+    return every;
+}
+
+uint64_t random_id() {
+    thread_local std::mt19937_64 generator(std::random_device{}() ^ ((uint64_t) getpid() << 32) ^ (uint64_t) syscall(SYS_gettid));
+    uint64_t id;
+    do id = generator(); while (id == 0);
+    return id;
+}
+
+int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+uint32_t thread_id() {
+    thread_local uint32_t tid = (uint32_t) syscall(SYS_gettid);
+    return tid;
+}
+
+std::atomic<bool> traced{false};     // this process started a trace, so writes its spans out at exit
+
+void record(const TraceSpan& span) {
+    std::call_once(ring_once, [] { ring.store(new Slot[TRACE_RING_SPANS], std::memory_order_release); });
+    uint64_t n = next_span.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = ring.load(std::memory_order_relaxed)[n % TRACE_RING_SPANS];
+    slot.seq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.span = span;
+    slot.seq.store(2 * n + 2, std::memory_order_release);
+}
+
+struct TraceFileHeader {
+    char magic[8];
+    uint32_t pid;
+    uint32_t count;
+};
+const char TRACE_FILE_MAGIC[8] = "PFSTRC1";
+
+}
+
+TraceContext trace_current() {
+    return current;
+}
+
+void trace_finish() {
+    if (!traced.exchange(false)) return;
+    const char* dir = getenv("PFS_TRACE_DIR");
+    std::string path = std::string(dir && *dir ? dir : ".") + "/pfs_trace_" + std::to_string(getpid()) + ".bin";
+    if (trace_write_file(path) == 0) fprintf(stderr, "Trace written to %s\n", path.c_str());
+}
+
+TraceScope::TraceScope(const char* name, bool root) {
+    if (current.trace_id != 0) {
+        start(name, current);
+        return;
+    }
+    uint64_t every = sample_every();
+    if (!root || every == 0) return;
+    static std::atomic<uint64_t> calls{0};
+    if (calls.fetch_add(1, std::memory_order_relaxed) % every != 0) return;
+    static std::once_flag at_exit_once;
+    std::call_once(at_exit_once, [] {
+        traced = true;
+        atexit(trace_finish);
+    });
+    start(name, TraceContext{random_id(), 0});
+}
+
+void TraceScope::start(const char* name, TraceContext parent) {
+    if (active_ || parent.trace_id == 0) return;
+    active_ = true;
+    saved_ = current;
+    span_.trace_id = parent.trace_id;
+    span_.span_id = random_id();
+    span_.parent_id = parent.span_id;
+    span_.tid = thread_id();
+    strncpy(span_.name, name, sizeof(span_.name) - 1);
+    current = TraceContext{span_.trace_id, span_.span_id};
+    span_.start_ns = now_ns();
+}
+
+TraceScope::~TraceScope() {
+    if (!active_) return;
+    span_.end_ns = now_ns();
+    record(span_);
+    current = saved_;
+}
+
+TraceAdopt::TraceAdopt(TraceContext context) : saved_(current) {
+    current = context;
+}
+
+TraceAdopt::~TraceAdopt() {
+    current = saved_;
+}
+
+std::string trace_format(TraceContext context) {
+    char value[40];
+    snprintf(value, sizeof(value), "%016llx-%016llx", (unsigned long long) context.trace_id, (unsigned long long) context.span_id);
+    return value;
+}
+
+TraceContext trace_parse(const std::string& value) {
+    unsigned long long trace_id, span_id;
+    if (sscanf(value.c_str(), "%16llx-%16llx", &trace_id, &span_id) != 2) return TraceContext();
+    return TraceContext{trace_id, span_id};
+}
+
+std::vector<TraceSpan> trace_snapshot(uint64_t trace_id) {
+    std::vector<TraceSpan> spans;
+    const Slot* slots = ring.load(std::memory_order_acquire);
+    if (slots == nullptr) return spans;
+    uint64_t end = next_span.load(std::memory_order_acquire);
+    for (uint64_t n = end > TRACE_RING_SPANS ? end - TRACE_RING_SPANS : 0; n < end; n++) {
+        const Slot& slot = slots[n % TRACE_RING_SPANS];
+        // Skips spans being written or overwritten while copied
+        uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq != 2 * n + 2) continue;
+        TraceSpan span = slot.span;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != seq) continue;
+        if (trace_id == 0 || span.trace_id == trace_id) spans.push_back(span);
+    }
+    return spans;
+}
+
+int trace_write_file(const std::string& path) {
+    std::vector<TraceSpan> spans = trace_snapshot();
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        perror(path.c_str());
+        return -1;
+    }
+    TraceFileHeader header;
+    memcpy(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic));
+    header.pid = (uint32_t) getpid();
+    header.count = (uint32_t) spans.size();
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(spans.data(), sizeof(TraceSpan), spans.size(), file) == spans.size();
+    if (fclose(file) != 0 || !ok) {
+        perror(path.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+int trace_read_file(const std::string& path, std::vector<TraceSpan>& spans, uint32_t& pid) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        perror(path.c_str());
+        return -1;
+    }
+    TraceFileHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic)) == 0;
+    if (ok) {
+        spans.resize(header.count);
+        ok = fread(spans.data(), sizeof(TraceSpan), spans.size(), file) == spans.size();
+        pid = header.pid;
+    }
+    fclose(file);
+    if (!ok) fprintf(stderr, "%s: not a trace file\n", path.c_str());
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "pfs_config.hpp"
+
+/*
+    Distributed request tracing. A traced pfs_* call starts a trace; every RPC it makes, the
+    handler serving it, the RPCs that handler makes in turn and the time waiting for tokens
+    become spans of it, each with the id of the span it was made from. The current span is
+    per thread: it crosses threads through trace_thread(), unary RPCs in the "pfs-trace"
+    metadata entry and token requests in their trace fields.
+    Every process records its finished spans into a ring of TRACE_RING_SPANS, overwriting
+    the oldest, without locks. Servers hand theirs out through GetTrace, clients write theirs
+    to $PFS_TRACE_DIR/pfs_trace_<pid>.bin when they exit, and tools/pfs_trace merges them.
+    Clients choose what is traced: PFS_TRACE=N in the environment traces every N-th pfs_*
+    call, nothing is traced without it. Servers trace whatever arrives with a trace.
+ */
+
+#define TRACE_METADATA_KEY "pfs-trace"
+
+struct TraceSpan {
+    uint64_t trace_id = 0;
+    uint64_t span_id = 0;
+    uint64_t parent_id = 0;     // 0 for the root of a trace
+    int64_t start_ns = 0;       // wall clock, spans of different hosts line up as well as their clocks do
+    int64_t end_ns = 0;
+    uint32_t tid = 0;
+    char name[32] = {};
+};
+
+/* A span to continue from, zero ids for none */
+struct TraceContext {
+    uint64_t trace_id = 0;
+    uint64_t span_id = 0;
+};
+
+/* The span the calling thread is in */
+TraceContext trace_current();
+
+/* A span of the calling thread from start() or construction to destruction, nothing outside a trace */
+class TraceScope {
+public:
+    TraceScope() {}
+    /* A child of the thread's current span. root: start a new trace if there is none and PFS_TRACE picks this call */
+    explicit TraceScope(const char* name, bool root = false);
+    ~TraceScope();
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+    /* A child of parent, usually a span of another process; does nothing if parent has no trace */
+    void start(const char* name, TraceContext parent);
+
+private:
+    TraceContext saved_;
+    TraceSpan span_;
+    bool active_ = false;
+};
+
+/* Makes the calling thread continue context while in scope */
+class TraceAdopt {
+public:
+    explicit TraceAdopt(TraceContext context);
+    ~TraceAdopt();
+
+private:
+    TraceContext saved_;
+};
+
+/* A std::thread running f(args...) in the caller's current span */
+template <typename F, typename... Args>
+std::thread trace_thread(F&& f, Args&&... args) {
+    return std::thread([context = trace_current(), f = std::forward<F>(f), args...]() mutable {
+        TraceAdopt adopt(context);
+        f(args...);
+    });
+}
+
+/* "<trace id>-<span id>" in hex, and back; a malformed string is no trace */
+std::string trace_format(TraceContext context);
+TraceContext trace_parse(const std::string& value);
+
+/* Adds the current span to an outgoing RPC */
+template <typename ClientContext>
+void trace_inject(ClientContext& context) {
+    TraceContext current = trace_current();
+    if (current.trace_id != 0) context.AddMetadata(TRACE_METADATA_KEY, trace_format(current));
+}
+
+/* The caller's span of an incoming RPC */
+template <typename ServerContext>
+TraceContext trace_extract(const ServerContext* context) {
+    const auto& metadata = context->client_metadata();
+    auto it = metadata.find(TRACE_METADATA_KEY);
+    if (it == metadata.end()) return TraceContext();
+    return trace_parse(std::string(it->second.data(), it->second.length()));
+}
+
+/* The spans in this process's ring, oldest first, only those of trace_id unless it is 0 */
+std::vector<TraceSpan> trace_snapshot(uint64_t trace_id = 0);
+
+/* The ring as a file, for processes that exit before anyone asks. Return 0 or -1 */
+int trace_write_file(const std::string& path);
+int trace_read_file(const std::string& path, std::vector<TraceSpan>& spans, uint32_t& pid);
+
+/* Writes the client's file now if it traced anything, for processes that leave through _exit() */
+void trace_finish();
+
+/* Fills a GetTrace reply, the same for every service's TraceResponse */
+template <typename Reply>
+void trace_report(Reply* reply, uint64_t trace_id, uint32_t pid) {
+    reply->set_pid(pid);
+    for (const TraceSpan& span : trace_snapshot(trace_id)) {
+        auto* out = reply->add_spans();
+        out->set_trace_id(span.trace_id);
+        out->set_span_id(span.span_id);
+        out->set_parent_id(span.parent_id);
+        out->set_start_ns(span.start_ns);
+        out->set_end_ns(span.end_ns);
+        out->set_tid(span.tid);
+        out->set_name(span.name);
+    }
+}
+
+/* Reads what trace_report() filled into a GetTrace response */
+template <typename Response>
+void trace_read(const Response& response, std::vector<TraceSpan>& spans) {
+    spans.clear();
+    for (const auto& in : response.spans()) {
+        TraceSpan span;
+        span.trace_id = in.trace_id();
+        span.span_id = in.span_id();
+        span.parent_id = in.parent_id();
+        span.start_ns = in.start_ns();
+        span.end_ns = in.end_ns();
+        span.tid = in.tid();
+        in.name().copy(span.name, sizeof(span.name) - 1);
+        spans.push_back(span);
+    }
+}
@@ -0,0 +1,236 @@
+#include "pfs_workload.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+const char* const PFS_OP_NAMES[PFS_OP_COUNT] = {
+    "", "create", "open", "read", "write", "close", "delete", "fstat", "fsync", "set_durability", "copy", "clone", "snapshot",
+};
+
+namespace {
+
+const char WORKLOAD_FILE_MAGIC[8] = "PFSWKL1";
+
+struct WorkloadFileHeader {
+    char magic[8];
+    uint32_t pid;
+    uint32_t reserved;
+    int64_t start_ns;
+};
+
+/* $PFS_RECORD, the directory to record into, empty when not recording */
+const std::string& record_dir() {
+    static const std::string dir = [] {
+        const char* value = getenv("PFS_RECORD");
+        return std::string(value ? value : "");
+    }();
+    return dir;
+}
+
+thread_local int depth = 0;             // pfs_* calls the thread is in
+thread_local uint32_t thread_number = 0;
+
+std::mutex mutex;                       // guards everything below
+bool started = false;
+std::chrono::steady_clock::time_point start;
+int fd = -1;
+std::string path;
+std::string buffer;                     // encoded records not written yet
+uint32_t threads = 0;
+
+void put_varint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += (char) (value | 0x80);
+        value >>= 7;
+    }
+    out += (char) value;
+}
+
+void put_signed(std::string& out, int64_t value) {
+    put_varint(out, ((uint64_t) value << 1) ^ (uint64_t) (value >> 63));
+}
+
+bool get_varint(const std::string& in, size_t& pos, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < in.size(); shift += 7) {
+        uint8_t byte = in[pos++];
+        value |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+bool get_signed(const std::string& in, size_t& pos, int64_t& value) {
+    uint64_t raw;
+    if (!get_varint(in, pos, raw)) return false;
+    value = (int64_t) (raw >> 1) ^ -(int64_t) (raw & 1);
+    return true;
+}
+
+uint64_t elapsed_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* Writes the buffer out, with mutex held */
+void write_buffer() {
+    size_t written = 0;
+    while (fd != -1 && written < buffer.size()) {
+        ssize_t n = write(fd, buffer.data() + written, buffer.size() - written);
+        if (n <= 0) {
+            perror(path.c_str());
+            close(fd);
+            fd = -1;
+        } else {
+            written += n;
+        }
+    }
+    buffer.clear();
+}
+
+/* A child forked while recording records into a file of its own, not its parent's */
+void after_fork_child() {
+    mutex.unlock();
+    if (fd != -1) close(fd);
+    fd = -1;
+    started = false;
+    buffer.clear();
+    threads = 0;
+    thread_number = 0;
+}
+
+/* Opens this process's file at its first recorded call, with mutex held; false if it can't */
+bool start_recording() {
+    if (started) return fd != -1;
+    started = true;
+    static std::once_flag once;
+    std::call_once(once, [] {
+        pthread_atfork([] { mutex.lock(); }, [] { mutex.unlock(); }, after_fork_child);
+        atexit(workload_finish);
+    });
+    start = std::chrono::steady_clock::now();
+    path = record_dir() + "/pfs_workload_" + std::to_string(getpid()) + ".bin";
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror(path.c_str());
+        return false;
+    }
+    WorkloadFileHeader header;
+    memcpy(header.magic, WORKLOAD_FILE_MAGIC, sizeof(header.magic));
+    header.pid = (uint32_t) getpid();
+    header.reserved = 0;
+    header.start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    buffer.append((const char*) &header, sizeof(header));
+    return true;
+}
+
+}
+
+WorkloadCall::WorkloadCall(int op, std::initializer_list<int64_t> args, const char* name, const char* name2) : op_(op) {
+    if (depth++ > 0 || record_dir().empty()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!start_recording()) return;
+        start_us_ = elapsed_us();
+        if (thread_number == 0) thread_number = ++threads;
+    }
+    active_ = true;
+    for (int64_t arg : args) {
+        if (argc_ < WORKLOAD_MAX_ARGS) args_[argc_++] = arg;
+    }
+    names_[0] = name;
+    names_[1] = name2;
+}
+
+WorkloadCall::~WorkloadCall() {
+    depth--;
+}
+
+void WorkloadCall::record(int64_t result) {
+    active_ = false;
+    uint64_t duration_us = elapsed_us() - start_us_;
+    thread_local std::string record;
+    record.clear();
+    put_varint(record, op_);
+    put_varint(record, start_us_);
+    put_varint(record, duration_us);
+    put_varint(record, thread_number);
+    put_signed(record, result);
+    put_varint(record, argc_);
+    for (int i = 0; i < argc_; i++) put_signed(record, args_[i]);
+    int names = names_[1] ? 2 : names_[0] ? 1 : 0;
+    put_varint(record, names);
+    for (int i = 0; i < names; i++) {
+        size_t length = strlen(names_[i]);
+        put_varint(record, length);
+        record.append(names_[i], length);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    buffer += record;
+    if (buffer.size() >= WORKLOAD_FLUSH_BYTES) write_buffer();
+}
+
+void workload_finish() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fd == -1) return;
+    write_buffer();
+    if (fd != -1 && close(fd) == 0) fprintf(stderr, "Workload recorded to %s\n", path.c_str());
+    fd = -1;
+}
+
+int workload_read_file(const std::string& path, WorkloadFile& file) {
+    FILE* in = fopen(path.c_str(), "rb");
+    if (!in) {
+        perror(path.c_str());
+        return -1;
+    }
+    WorkloadFileHeader header;
+    bool ok = fread(&header, sizeof(header), 1, in) == 1 && memcmp(header.magic, WORKLOAD_FILE_MAGIC, sizeof(header.magic)) == 0;
+    std::string data;
+    char chunk[65536];
+    size_t n;
+    while (ok && (n = fread(chunk, 1, sizeof(chunk), in)) > 0) data.append(chunk, n);
+    fclose(in);
+    if (!ok) {
+        fprintf(stderr, "%s: not a workload file\n", path.c_str());
+        return -1;
+    }
+    file.pid = header.pid;
+    file.start_ns = header.start_ns;
+    file.records.clear();
+
+    size_t pos = 0;
+    while (pos < data.size()) {
+        WorkloadRecord record;
+        uint64_t op, thread, count, length;
+        bool complete = get_varint(data, pos, op) && get_varint(data, pos, record.start_us) &&
+                        get_varint(data, pos, record.duration_us) && get_varint(data, pos, thread) &&
+                        get_signed(data, pos, record.result) && get_varint(data, pos, count) && count <= WORKLOAD_MAX_ARGS;
+        for (uint64_t i = 0; complete && i < count; i++) {
+            int64_t arg;
+            complete = get_signed(data, pos, arg);
+            record.args.push_back(arg);
+        }
+        complete = complete && get_varint(data, pos, count) && count <= WORKLOAD_MAX_NAMES;
+        for (uint64_t i = 0; complete && i < count; i++) {
+            complete = get_varint(data, pos, length) && length <= data.size() - pos;
+            if (complete) record.names.push_back(data.substr(pos, length));
+            pos += complete ? length : 0;
+        }
+        if (!complete || op == 0 || op >= PFS_OP_COUNT) {
+            fprintf(stderr, "%s: damaged after %zu records, the rest is dropped\n", path.c_str(), file.records.size());
+            break;
+        }
+        record.op = (int) op;
+        record.thread = (uint32_t) thread;
+        file.records.push_back(std::move(record));
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "pfs_config.hpp"
+
+/*
+    Workload recording. With PFS_RECORD=<dir> in the environment the client library records
+    every pfs_* call the application makes into <dir>/pfs_workload_<pid>.bin: when it started,
+    how long it took, the thread that made it, its arguments and its result. Calls the library
+    makes itself, like the opens and copies of pfs_clone(), are part of the call that made them.
+    Records are varint encoded, a read or write takes about 16 bytes; they are buffered and
+    written out WORKLOAD_FLUSH_BYTES at a time and at exit. bench/pfs_replay issues the calls
+    of such files again against a cluster.
+
+    The integer arguments of each op, in order (names are the file names it takes):
+        create          stripe_width, compression, replication, ec_parity, stripe_unit, placement
+        open            mode
+        read, write     fd, offset, size
+        close, fstat, fsync   fd
+        set_durability  mode
+        copy            src_fd, src_offset, dst_fd, dst_offset, size
+        delete, clone, snapshot   none
+ */
+
+enum pfs_workload_op {
+    PFS_OP_CREATE = 1, PFS_OP_OPEN, PFS_OP_READ, PFS_OP_WRITE, PFS_OP_CLOSE, PFS_OP_DELETE, PFS_OP_FSTAT,
+    PFS_OP_FSYNC, PFS_OP_SET_DURABILITY, PFS_OP_COPY, PFS_OP_CLONE, PFS_OP_SNAPSHOT,
+    PFS_OP_COUNT
+};
+
+extern const char* const PFS_OP_NAMES[PFS_OP_COUNT];
+
+#define WORKLOAD_MAX_ARGS 6
+#define WORKLOAD_MAX_NAMES 2
+
+/* One recorded call */
+struct WorkloadRecord {
+    int op = 0;
+    uint64_t start_us = 0;          // since the file's start_ns
+    uint64_t duration_us = 0;
+    uint32_t thread = 0;            // threads of a process are numbered from 1 in the order of their first call
+    int64_t result = 0;
+    std::vector<int64_t> args;
+    std::vector<std::string> names;
+};
+
+/* The calls of one recorded process, in the order they finished */
+struct WorkloadFile {
+    uint32_t pid = 0;
+    int64_t start_ns = 0;           // wall clock, files of different processes line up
+    std::vector<WorkloadRecord> records;
+};
+
+/* Records the pfs_* call it is made at the top of, if PFS_RECORD is set and no other call is recording */
+class WorkloadCall {
+public:
+    WorkloadCall(int op, std::initializer_list<int64_t> args, const char* name = nullptr, const char* name2 = nullptr);
+    ~WorkloadCall();
+    WorkloadCall(const WorkloadCall&) = delete;
+    WorkloadCall& operator=(const WorkloadCall&) = delete;
+
+    /* Records the call with its result, returns result: an int, or the ssize_t of a read, write or copy */
+    template <typename T>
+    T done(T result) {
+        if (active_) record((int64_t) result);
+        return result;
+    }
+
+private:
+    void record(int64_t result);
+
+    bool active_ = false;
+    int op_;
+    int argc_ = 0;
+    int64_t args_[WORKLOAD_MAX_ARGS];
+    const char* names_[WORKLOAD_MAX_NAMES];
+    uint64_t start_us_ = 0;
+};
+
+/* Writes out the calls recorded so far, for processes that leave through _exit() */
+void workload_finish();
+
+/* Reads a file PFS_RECORD wrote; a record cut short at the end is dropped. Returns 0 or -1 */
+int workload_read_file(const std::string& path, WorkloadFile& file);
@@ -0,0 +1,196 @@
+#include "pfs_block_cache.hpp"
+
+#include <cstring>
+#include <algorithm>
+#include <functional>
+
+BlockCache::BlockCache(size_t capacity_bytes, int num_shards) : capacity_bytes_(capacity_bytes) {
+    num_shards = std::max(num_shards, 1);
+    for (int i = 0; i < num_shards; i++) {
+        shards_.emplace_back(new Shard());
+        shards_.back()->capacity = capacity_bytes / num_shards;
+        shards_.back()->stats.capacity_bytes = shards_.back()->capacity;
+    }
+}
+
+BlockCache::Shard& BlockCache::shard_for(const std::string& key) {
+    return *shards_[std::hash<std::string>{}(key) % shards_.size()];
+}
+
+bool BlockCache::read(const std::string& object, int chunk_number, int offset_in_chunk, size_t len, char* out) {
+    if (!enabled()) return false;
+    std::string k = key(object, chunk_number);
+    Shard& shard = shard_for(k);
+    std::lock_guard<std::mutex> lock(shard.mtx);
+
+    auto it = shard.entries.find(k);
+    if (it == shard.entries.end() || offset_in_chunk + len > it->second.data.size()) {
+        shard.stats.misses++;
+        return false;
+    }
+    Entry& entry = it->second;
+    std::memcpy(out, entry.data.data() + offset_in_chunk, len);
+    shard.stats.hits++;
+
+    // 2Q: only hits in Am refresh recency, a second touch while still in A1in doesn't promote
+    if (entry.in_am) {
+        shard.am.splice(shard.am.begin(), shard.am, entry.position);
+    }
+    return true;
+}
+
+uint64_t BlockCache::begin_fill(const std::string& object, int chunk_number) {
+    if (!enabled()) return 0;
+    Shard& shard = shard_for(key(object, chunk_number));
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    return shard.write_epoch;
+}
+
+void BlockCache::fill(const std::string& object, int chunk_number, uint64_t epoch, std::string data) {
+    if (!enabled() || data.empty()) return;
+    std::string k = key(object, chunk_number);
+    Shard& shard = shard_for(k);
+    std::lock_guard<std::mutex> lock(shard.mtx);
+
+    // A write landed after the disk read started, what we read may already be stale
+    if (epoch != shard.write_epoch) return;
+    if (data.size() > shard.capacity) return;
+    if (shard.entries.count(k)) erase(shard, k);
+
+    Entry entry;
+    entry.object = object;
+    entry.chunk_number = chunk_number;
+    entry.data = std::move(data);
+
+    auto ghost = shard.a1out_index.find(k);
+    if (ghost != shard.a1out_index.end()) {
+        // Seen recently enough to still have a ghost: it's hot, goes straight to Am
+        shard.a1out.erase(ghost->second);
+        shard.a1out_index.erase(ghost);
+        entry.in_am = true;
+        shard.am.push_front(k);
+        entry.position = shard.am.begin();
+    } else {
+        entry.in_am = false;
+        shard.a1in.push_front(k);
+        entry.position = shard.a1in.begin();
+        shard.a1in_bytes += entry.data.size();
+    }
+    shard.bytes += entry.data.size();
+    shard.chunks_by_object[object].insert(chunk_number);
+    shard.entries.emplace(k, std::move(entry));
+    shard.stats.insertions++;
+
+    while (shard.bytes > shard.capacity) evict(shard);
+}
+
+void BlockCache::write(const std::string& object, int chunk_number, int offset_in_chunk, const char* data, size_t len) {
+    if (!enabled()) return;
+    std::string k = key(object, chunk_number);
+    Shard& shard = shard_for(k);
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    shard.write_epoch++;
+
+    auto it = shard.entries.find(k);
+    if (it == shard.entries.end()) return;
+    Entry& entry = it->second;
+    if (offset_in_chunk > (int) entry.data.size()) {
+        // Would leave a gap we don't have, let the next read refill it
+        erase(shard, k);
+        return;
+    }
+    if (offset_in_chunk + len > entry.data.size()) {
+        size_t grown = offset_in_chunk + len - entry.data.size();
+        entry.data.resize(offset_in_chunk + len);
+        shard.bytes += grown;
+        if (!entry.in_am) shard.a1in_bytes += grown;
+    }
+    std::memcpy(&entry.data[offset_in_chunk], data, len);
+    while (shard.bytes > shard.capacity) evict(shard);
+}
+
+void BlockCache::invalidate(const std::string& object, int chunk_number) {
+    if (!enabled()) return;
+    std::string k = key(object, chunk_number);
+    Shard& shard = shard_for(k);
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    shard.write_epoch++;
+    erase(shard, k);
+}
+
+void BlockCache::invalidate_object(const std::string& object) {
+    if (!enabled()) return;
+    for (auto& shard_ptr : shards_) {
+        Shard& shard = *shard_ptr;
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        shard.write_epoch++;
+        auto it = shard.chunks_by_object.find(object);
+        if (it == shard.chunks_by_object.end()) continue;
+        std::vector<int> chunks(it->second.begin(), it->second.end());
+        for (int chunk_number : chunks) erase(shard, key(object, chunk_number));
+    }
+}
+
+void BlockCache::evict(Shard& shard) {
+    size_t a1in_limit = shard.capacity / 4;
+    std::string victim;
+    bool ghost = false;
+    if (!shard.a1in.empty() && (shard.a1in_bytes > a1in_limit || shard.am.empty())) {
+        victim = shard.a1in.back();
+        ghost = true;
+    } else if (!shard.am.empty()) {
+        victim = shard.am.back();
+    } else {
+        return;
+    }
+    erase(shard, victim);
+    shard.stats.evictions++;
+
+    if (ghost) {
+        // Remember the key only, bounded to roughly as many ghosts as resident chunks
+        if (!shard.a1out_index.count(victim)) {
+            shard.a1out.push_front(victim);
+            shard.a1out_index[victim] = shard.a1out.begin();
+        }
+        size_t max_ghosts = std::max<size_t>(shard.entries.size(), 64);
+        while (shard.a1out.size() > max_ghosts) {
+            shard.a1out_index.erase(shard.a1out.back());
+            shard.a1out.pop_back();
+        }
+    }
+}
+
+void BlockCache::erase(Shard& shard, const std::string& k) {
+    auto it = shard.entries.find(k);
+    if (it == shard.entries.end()) return;
+    Entry& entry = it->second;
+    shard.bytes -= entry.data.size();
+    if (entry.in_am) {
+        shard.am.erase(entry.position);
+    } else {
+        shard.a1in.erase(entry.position);
+        shard.a1in_bytes -= entry.data.size();
+    }
+    auto by_object = shard.chunks_by_object.find(entry.object);
+    if (by_object != shard.chunks_by_object.end()) {
+        by_object->second.erase(entry.chunk_number);
+        if (by_object->second.empty()) shard.chunks_by_object.erase(by_object);
+    }
+    shard.entries.erase(it);
+}
+
+BlockCacheStats BlockCache::stats() {
+    BlockCacheStats total;
+    for (auto& shard_ptr : shards_) {
+        Shard& shard = *shard_ptr;
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        total.hits += shard.stats.hits;
+        total.misses += shard.stats.misses;
+        total.insertions += shard.stats.insertions;
+        total.evictions += shard.stats.evictions;
+        total.bytes_cached += shard.bytes;
+        total.entries += shard.entries.size();
+        total.capacity_bytes += shard.capacity;
+    }
+    return total;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <list>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "pfs_common/pfs_config.hpp"
+
+struct BlockCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t insertions = 0;
+    uint64_t evictions = 0;
+    uint64_t bytes_cached = 0;
+    uint64_t entries = 0;
+    uint64_t capacity_bytes = 0;
+};
+
+/*
+    Fileserver block cache: whole chunks keyed by <object, chunk_number>, split into
+    independently locked shards. Each shard runs 2Q so a one-off scan of a large file
+    only churns the small A1in FIFO and never flushes the hot chunks held in Am:
+        A1in : FIFO of chunks seen once (up to 1/4 of the shard's bytes)
+        A1out: ghost keys recently evicted from A1in (no data)
+        Am   : LRU of chunks referenced again after leaving A1in
+    The cache is write-through: writes go to disk first, then patch any cached copy.
+ */
+class BlockCache {
+public:
+    BlockCache(size_t capacity_bytes, int num_shards);
+
+    bool enabled() const { return capacity_bytes_ > 0; }
+
+    /* Copies [offset_in_chunk, offset_in_chunk + len) of a cached chunk into out. false on miss */
+    bool read(const std::string& object, int chunk_number, int offset_in_chunk, size_t len, char* out);
+
+    /* Epoch to pass to fill(): taken before reading the chunk from disk */
+    uint64_t begin_fill(const std::string& object, int chunk_number);
+
+    /* Inserts a chunk read from disk, unless a write to its shard raced with the disk read */
+    void fill(const std::string& object, int chunk_number, uint64_t epoch, std::string data);
+
+    /* Write-through: patches the cached copy of the chunk, if any */
+    void write(const std::string& object, int chunk_number, int offset_in_chunk, const char* data, size_t len);
+
+    /* Drops one cached chunk */
+    void invalidate(const std::string& object, int chunk_number);
+
+    /* Drops every cached chunk of an object */
+    void invalidate_object(const std::string& object);
+
+    BlockCacheStats stats();
+
+private:
+    struct Entry {
+        std::string object;
+        int chunk_number;
+        std::string data;
+        bool in_am = false;                             // false: A1in
+        std::list<std::string>::iterator position;      // in a1in or am
+    };
+
+    struct Shard {
+        std::mutex mtx;
+        size_t capacity = 0;
+        size_t bytes = 0;
+        size_t a1in_bytes = 0;
+        uint64_t write_epoch = 0;                       // bumped by every write to the shard
+        std::unordered_map<std::string, Entry> entries; // key : Entry
+        std::list<std::string> a1in;                    // front = newest
+        std::list<std::string> am;                      // front = most recently used
+        std::list<std::string> a1out;                   // ghost keys, front = newest
+        std::unordered_map<std::string, std::list<std::string>::iterator> a1out_index;
+        std::unordered_map<std::string, std::unordered_set<int>> chunks_by_object;
+        BlockCacheStats stats;
+    };
+
+    static std::string key(const std::string& object, int chunk_number) {
+        return object + "#" + std::to_string(chunk_number);
+    }
+    Shard& shard_for(const std::string& key);
+    void evict(Shard& shard);
+    void erase(Shard& shard, const std::string& key);
+
+    size_t capacity_bytes_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
@@ -0,0 +1,663 @@
+#include "pfs_chunk_store.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <filesystem>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <linux/falloc.h>
+
+#include "pfs_common/pfs_crc32c.hpp"
+#include "pfs_common/pfs_log.hpp"
+
+struct ManifestHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t chunk_size;
+    uint32_t compression;   // version 2 onwards
+};
+static const size_t MANIFEST_V1_HEADER_SIZE = 3 * sizeof(uint32_t);
+
+struct ManifestRecord {
+    uint32_t chunk_number;
+    uint32_t slot;
+};
+
+ChunkStore::ChunkStore(StorageBackend* storage, const std::string& root) : storage_(storage), root_(root) {
+    std::filesystem::create_directories(root_);
+    std::filesystem::create_directories(reclaim_dir());
+
+    // Rebuild the in-memory indexes from the manifests
+    for (const auto& entry : std::filesystem::directory_iterator(root_)) {
+        if (entry.path().extension() != ".idx") continue;
+        load_manifest(entry.path().stem().string());
+    }
+    PFS_LOG_INFO("%s: Loaded %zu objects from %s.", __func__, objects_.size(), root_.c_str());
+
+    // Anything left in the reclaim directory was deleted before a restart
+    for (const auto& entry : std::filesystem::directory_iterator(reclaim_dir())) {
+        reclaim_queue_.push_back(entry.path().string());
+    }
+    reclaimer_ = std::thread(&ChunkStore::reclaimer_loop, this);
+
+    dir_fd_ = ::open(root_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    committer_ = std::thread(&ChunkStore::committer_loop, this);
+
+    if (SCRUB_INTERVAL_SEC > 0) scrubber_ = std::thread(&ChunkStore::scrubber_loop, this);
+}
+
+ChunkStore::~ChunkStore() {
+    {
+        std::lock_guard<std::mutex> lock(scrub_mutex_);
+        scrub_stop_ = true;
+    }
+    scrub_cv_.notify_all();
+    if (scrubber_.joinable()) scrubber_.join();
+
+    {
+        std::lock_guard<std::mutex> lock(commit_mutex_);
+        commit_stop_ = true;
+    }
+    commit_cv_.notify_all();
+    if (committer_.joinable()) committer_.join();
+    if (dir_fd_ >= 0) ::close(dir_fd_);
+
+    {
+        std::lock_guard<std::mutex> lock(reclaim_mutex_);
+        stop_ = true;
+    }
+    reclaim_cv_.notify_all();
+    if (reclaimer_.joinable()) reclaimer_.join();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    objects_.clear();
+}
+
+std::string ChunkStore::file_of(const std::string& object) {
+    size_t underscore = object.find('_');
+    std::string file = underscore == std::string::npos ? object : object.substr(underscore + 1);
+    // PFS names are stored without extension, so a dot can only start a version suffix
+    return file.substr(0, file.find('.'));
+}
+
+void ChunkStore::index_object(const std::string& object) {
+    objects_by_file_[file_of(object)].insert(object);
+}
+
+bool ChunkStore::load_manifest(const std::string& object) {
+    int manifest_fd = ::open(manifest_path(object).c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+    if (manifest_fd < 0) return false;
+
+    std::vector<char> contents;
+    char buf[65536];
+    ssize_t n;
+    while ((n = ::read(manifest_fd, buf, sizeof(buf))) > 0) {
+        contents.insert(contents.end(), buf, buf + n);
+    }
+
+    ManifestHeader header = {};
+    if (contents.size() < MANIFEST_V1_HEADER_SIZE) {
+        PFS_LOG_WARN("Ignoring truncated manifest %s", manifest_path(object).c_str());
+        ::close(manifest_fd);
+        return false;
+    }
+    std::memcpy(&header, contents.data(), MANIFEST_V1_HEADER_SIZE);
+    size_t header_size = header.version == 1 ? MANIFEST_V1_HEADER_SIZE : sizeof(header);
+    if (header.magic != MANIFEST_MAGIC || header.version == 0 || header.version > MANIFEST_VERSION ||
+        header.chunk_size == 0 || contents.size() < header_size) {
+        PFS_LOG_WARN("Ignoring bad manifest %s", manifest_path(object).c_str());
+        ::close(manifest_fd);
+        return false;
+    }
+    std::memcpy(&header, contents.data(), header_size);
+
+    auto obj = std::make_shared<Object>();
+    obj->manifest_fd = manifest_fd;
+    obj->chunk_size = header.chunk_size;
+    obj->compression = header.compression;
+    obj->slot_size = obj->chunk_size + (obj->compression != PFS_COMPRESSION_NONE ? sizeof(SlotHeader) : 0);
+    // A torn trailing record (crash mid-append) is ignored
+    size_t num_records = (contents.size() - header_size) / sizeof(ManifestRecord);
+    for (size_t i = 0; i < num_records; i++) {
+        ManifestRecord record;
+        std::memcpy(&record, contents.data() + header_size + i * sizeof(record), sizeof(record));
+        obj->index[record.chunk_number] = record.slot;
+        obj->next_slot = std::max(obj->next_slot, record.slot + 1);
+    }
+    obj->data_fd = storage_->open_file(data_path(object), true);
+    if (obj->data_fd < 0) {
+        PFS_LOG_ERROR("Error opening file: %s", data_path(object).c_str());
+        return false;
+    }
+    obj->checksum_fd = ::open(checksum_path(object).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (obj->checksum_fd < 0) {
+        PFS_LOG_ERROR("Error opening file: %s", checksum_path(object).c_str());
+        return false;
+    }
+    objects_[object] = obj;
+    index_object(object);
+    return true;
+}
+
+std::shared_ptr<ChunkStore::Object> ChunkStore::lookup(const std::string& object, int chunk_size, int compression) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = objects_.find(object);
+    if (it != objects_.end()) return it->second;
+    if (chunk_size <= 0) return nullptr; // reads never create objects
+
+    // First write to this object: start its manifest and data file
+    auto obj = std::make_shared<Object>();
+    obj->chunk_size = chunk_size;
+    obj->compression = compression;
+    obj->slot_size = obj->chunk_size + (compression != PFS_COMPRESSION_NONE ? sizeof(SlotHeader) : 0);
+    obj->manifest_fd = ::open(manifest_path(object).c_str(), O_RDWR | O_APPEND | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (obj->manifest_fd < 0) {
+        PFS_LOG_ERROR("Error opening file: %s", manifest_path(object).c_str());
+        return nullptr;
+    }
+    ManifestHeader header = {MANIFEST_MAGIC, MANIFEST_VERSION, (uint32_t) chunk_size, (uint32_t) compression};
+    if (::write(obj->manifest_fd, &header, sizeof(header)) != sizeof(header)) {
+        PFS_LOG_ERROR("Error writing file: %s", manifest_path(object).c_str());
+        return nullptr;
+    }
+    obj->data_fd = storage_->open_file(data_path(object), true);
+    if (obj->data_fd < 0) {
+        PFS_LOG_ERROR("Error opening file: %s", data_path(object).c_str());
+        return nullptr;
+    }
+    obj->checksum_fd = ::open(checksum_path(object).c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (obj->checksum_fd < 0) {
+        PFS_LOG_ERROR("Error opening file: %s", checksum_path(object).c_str());
+        return nullptr;
+    }
+    objects_[object] = obj;
+    index_object(object);
+    dir_dirty_ = true; // the new directory entries need a sync before anything in them is durable
+    return obj;
+}
+
+ssize_t ChunkStore::write(const std::string& object, int chunk_number, int chunk_size, int offset_in_chunk, const char* data, size_t len,
+                          Durability durability, int compression) {
+    std::shared_ptr<Object> obj = lookup(object, chunk_size, compression);
+    if (!obj) return -EIO;
+    if (offset_in_chunk < 0 || offset_in_chunk + len > obj->chunk_size) return -EINVAL;
+
+    uint32_t slot;
+    {
+        std::lock_guard<std::mutex> lock(obj->mtx);
+        auto it = obj->index.find(chunk_number);
+        if (it != obj->index.end()) {
+            slot = it->second;
+        } else {
+            // New chunk: take the next slot and record it before any data lands there
+            slot = obj->next_slot++;
+            ManifestRecord record = {(uint32_t) chunk_number, slot};
+            if (::write(obj->manifest_fd, &record, sizeof(record)) != sizeof(record)) {
+                obj->next_slot--;
+                return -EIO;
+            }
+            obj->index[chunk_number] = slot;
+            obj->manifest_dirty = true;
+        }
+    }
+
+    if (len == 0) return 0;
+
+    off_t position = (off_t) slot * obj->slot_size + offset_in_chunk;
+    ssize_t written;
+    if (obj->compression != PFS_COMPRESSION_NONE) {
+        written = write_compressed(*obj, slot, offset_in_chunk, data, len);
+        if (written < 0) return written;
+    } else {
+        uint32_t first = offset_in_chunk / PFS_BLOCK_SIZE, last = (offset_in_chunk + len - 1) / PFS_BLOCK_SIZE;
+        auto locks = lock_blocks(*obj, slot, first, last);
+        written = storage_->write_at(obj->data_fd, data, len, position);
+        if (written < 0) return written;
+        int ret = update_checksums(*obj, slot, offset_in_chunk, data, len);
+        if (ret < 0) return ret;
+    }
+    if (durability == Durability::NONE) return written;
+
+    if (durability == Durability::PER_WRITE) {
+        int ret = sync_object(*obj);
+        return ret < 0 ? ret : written;
+    }
+
+    // GROUP_COMMIT: join the next batch and wait for its fdatasync
+    std::unique_lock<std::mutex> lock(commit_mutex_);
+    uint64_t seq = ++obj->write_seq;
+    bool was_idle = dirty_.empty();
+    dirty_.insert(obj);
+    waiting_writers_++;
+    if (was_idle || waiting_writers_ >= GROUP_COMMIT_BATCH) commit_cv_.notify_one();
+    durable_cv_.wait(lock, [&] { return obj->synced_seq >= seq; });
+    waiting_writers_--;
+    if (obj->error_seq >= seq) return obj->sync_error;
+    return written;
+}
+
+int ChunkStore::sync_object(Object& obj) {
+    if (dir_dirty_.exchange(false) && dir_fd_ >= 0 && ::fsync(dir_fd_) != 0) {
+        dir_dirty_ = true;
+        return -errno;
+    }
+    if (obj.manifest_dirty.exchange(false) && ::fdatasync(obj.manifest_fd) != 0) {
+        obj.manifest_dirty = true;
+        return -errno;
+    }
+    if (obj.checksums_dirty.exchange(false) && ::fdatasync(obj.checksum_fd) != 0) {
+        obj.checksums_dirty = true;
+        return -errno;
+    }
+    return storage_->sync(obj.data_fd);
+}
+
+void ChunkStore::committer_loop() {
+    std::unique_lock<std::mutex> lock(commit_mutex_);
+    while (true) {
+        commit_cv_.wait(lock, [this] { return commit_stop_ || !dirty_.empty(); });
+        if (!commit_stop_) {
+            // Hold the batch open briefly so concurrent writers can share this sync
+            commit_cv_.wait_for(lock, std::chrono::microseconds(GROUP_COMMIT_INTERVAL_US),
+                                [this] { return commit_stop_ || waiting_writers_ >= GROUP_COMMIT_BATCH; });
+        }
+        if (dirty_.empty()) {
+            if (commit_stop_) break;
+            continue;
+        }
+
+        std::vector<std::pair<std::shared_ptr<Object>, uint64_t>> batch;
+        for (const auto& obj : dirty_) batch.emplace_back(obj, obj->write_seq);
+        dirty_.clear();
+        lock.unlock();
+
+        std::vector<int> results;
+        for (auto& [obj, target] : batch) results.push_back(sync_object(*obj));
+
+        lock.lock();
+        for (size_t i = 0; i < batch.size(); i++) {
+            auto& [obj, target] = batch[i];
+            if (results[i] < 0) {
+                obj->sync_error = results[i];
+                obj->error_seq = std::max(obj->error_seq, target);
+            }
+            obj->synced_seq = std::max(obj->synced_seq, target);
+        }
+        durable_cv_.notify_all();
+    }
+}
+
+int ChunkStore::flush_file(const std::string& filename) {
+    std::vector<std::shared_ptr<Object>> objects;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto by_file = objects_by_file_.find(filename);
+        if (by_file == objects_by_file_.end()) return 0;
+        for (const std::string& object : by_file->second) objects.push_back(objects_[object]);
+    }
+
+    int ret = 0;
+    for (auto& obj : objects) {
+        int err = sync_object(*obj);
+        if (err < 0 && ret == 0) ret = err;
+    }
+    return ret;
+}
+
+ssize_t ChunkStore::read(const std::string& object, int chunk_number, int offset_in_chunk, char* data, size_t len) {
+    std::shared_ptr<Object> obj = lookup(object, 0);
+    if (!obj) return 0;
+    if (offset_in_chunk < 0 || offset_in_chunk + len > obj->chunk_size) return -EINVAL;
+
+    uint32_t slot;
+    {
+        std::lock_guard<std::mutex> lock(obj->mtx);
+        auto it = obj->index.find(chunk_number);
+        if (it == obj->index.end()) return 0;
+        slot = it->second;
+    }
+
+    if (obj->compression != PFS_COMPRESSION_NONE) {
+        auto locks = lock_blocks_shared(*obj, slot, 0, obj->blocks_per_chunk() - 1);
+        std::string chunk;
+        int ret = load_chunk(*obj, slot, chunk);
+        if (ret < 0) return ret;
+        size_t n = chunk.size() > (size_t) offset_in_chunk ? std::min(len, chunk.size() - offset_in_chunk) : 0;
+        std::memcpy(data, chunk.data() + offset_in_chunk, n);
+        ret = verify_checksums(object, *obj, slot, chunk_number, offset_in_chunk, data, len, n);
+        return ret < 0 ? ret : n;
+    }
+
+    off_t position = (off_t) slot * obj->slot_size + offset_in_chunk;
+
+    // Only blocks the read covers whole can be verified
+    uint32_t first = (offset_in_chunk + PFS_BLOCK_SIZE - 1) / PFS_BLOCK_SIZE;
+    uint32_t end = offset_in_chunk + len == obj->chunk_size ? obj->blocks_per_chunk() : (offset_in_chunk + len) / PFS_BLOCK_SIZE;
+    if (first >= end) return storage_->read_at(obj->data_fd, data, len, position);
+
+    auto locks = lock_blocks_shared(*obj, slot, first, end - 1);
+    ssize_t n = storage_->read_at(obj->data_fd, data, len, position);
+    if (n < 0) return n;
+    int ret = verify_checksums(object, *obj, slot, chunk_number, offset_in_chunk, data, len, n);
+    return ret < 0 ? ret : n;
+}
+
+/* Block stripes of the object covering blocks [first, last] of a slot, in ascending order so lockers never deadlock */
+static std::vector<size_t> block_stripes(uint32_t blocks_per_chunk, uint32_t slot, uint32_t first, uint32_t last) {
+    std::vector<bool> used(CHECKSUM_LOCK_STRIPES, false);
+    size_t base = (size_t) slot * blocks_per_chunk;
+    for (uint32_t b = first; b <= last && b - first < CHECKSUM_LOCK_STRIPES; b++) {
+        used[(base + b) % CHECKSUM_LOCK_STRIPES] = true;
+    }
+    std::vector<size_t> stripes;
+    for (size_t i = 0; i < used.size(); i++) {
+        if (used[i]) stripes.push_back(i);
+    }
+    return stripes;
+}
+
+ChunkStore::BlockLocks ChunkStore::lock_blocks(Object& obj, uint32_t slot, uint32_t first, uint32_t last) {
+    BlockLocks locks;
+    std::shared_mutex& chunk = obj.chunk_locks[slot % CHECKSUM_LOCK_STRIPES];
+    if (first == 0 && last + 1 >= obj.blocks_per_chunk()) {
+        locks.chunk = std::unique_lock<std::shared_mutex>(chunk);
+        return locks;
+    }
+    locks.chunk_shared = std::shared_lock<std::shared_mutex>(chunk);
+    for (size_t stripe : block_stripes(obj.blocks_per_chunk(), slot, first, last)) {
+        locks.blocks.emplace_back(obj.block_locks[stripe]);
+    }
+    return locks;
+}
+
+ChunkStore::BlockLocks ChunkStore::lock_blocks_shared(Object& obj, uint32_t slot, uint32_t first, uint32_t last) {
+    BlockLocks locks;
+    locks.chunk_shared = std::shared_lock<std::shared_mutex>(obj.chunk_locks[slot % CHECKSUM_LOCK_STRIPES]);
+    for (size_t stripe : block_stripes(obj.blocks_per_chunk(), slot, first, last)) {
+        locks.blocks_shared.emplace_back(obj.block_locks[stripe]);
+    }
+    return locks;
+}
+
+int ChunkStore::update_checksums(Object& obj, uint32_t slot, int offset_in_chunk, const char* data, size_t len, const std::string* chunk) {
+    uint32_t first = offset_in_chunk / PFS_BLOCK_SIZE, last = (offset_in_chunk + len - 1) / PFS_BLOCK_SIZE;
+    std::vector<BlockChecksum> sums;
+    std::string block;
+    for (uint32_t b = first; b <= last; b++) {
+        size_t block_start = (size_t) b * PFS_BLOCK_SIZE;
+        size_t block_end = std::min<size_t>(block_start + PFS_BLOCK_SIZE, obj.chunk_size);
+        uint32_t crc;
+        if ((size_t) offset_in_chunk <= block_start && offset_in_chunk + len >= block_end) {
+            crc = crc32c(data + (block_start - offset_in_chunk), block_end - block_start);
+        } else if (chunk) {
+            // Partly written block of a whole chunk in memory, past its end is zeros
+            block.assign(block_end - block_start, '\0');
+            if (chunk->size() > block_start) {
+                std::memcpy(&block[0], chunk->data() + block_start, std::min(block.size(), chunk->size() - block_start));
+            }
+            crc = crc32c(block.data(), block.size());
+        } else {
+            // Partly written block: checksum what is on disk now, the rest of it included
+            block.assign(block_end - block_start, '\0');
+            ssize_t n = storage_->read_at(obj.data_fd, &block[0], block.size(), (off_t) slot * obj.slot_size + block_start);
+            if (n < 0) return n;
+            crc = crc32c(block.data(), block.size());
+        }
+        sums.push_back({crc, CHECKSUM_VALID});
+    }
+
+    size_t bytes = sums.size() * sizeof(BlockChecksum);
+    off_t position = ((off_t) slot * obj.blocks_per_chunk() + first) * sizeof(BlockChecksum);
+    if (::pwrite(obj.checksum_fd, sums.data(), bytes, position) != (ssize_t) bytes) return -EIO;
+    obj.checksums_dirty = true;
+    return 0;
+}
+
+int ChunkStore::verify_checksums(const std::string& object, Object& obj, uint32_t slot, int chunk_number, int offset_in_chunk,
+                                 const char* data, size_t len, size_t valid) {
+    static const char zeros[PFS_BLOCK_SIZE] = {0};
+    uint32_t first = (offset_in_chunk + PFS_BLOCK_SIZE - 1) / PFS_BLOCK_SIZE;
+    uint32_t end = offset_in_chunk + len == obj.chunk_size ? obj.blocks_per_chunk() : (offset_in_chunk + len) / PFS_BLOCK_SIZE;
+    if (first >= end) return 0;
+
+    // A sidecar shorter than the data just means those blocks were never checksummed
+    std::vector<BlockChecksum> sums(end - first, BlockChecksum{0, 0});
+    off_t position = ((off_t) slot * obj.blocks_per_chunk() + first) * sizeof(BlockChecksum);
+    if (::pread(obj.checksum_fd, sums.data(), sums.size() * sizeof(BlockChecksum), position) < 0) return -errno;
+
+    int ret = 0;
+    for (uint32_t b = first; b < end; b++) {
+        const BlockChecksum& sum = sums[b - first];
+        if (!(sum.flags & CHECKSUM_VALID)) continue;
+
+        // Bytes past the end of the data file read back as zeros
+        size_t block_start = (size_t) b * PFS_BLOCK_SIZE - offset_in_chunk;
+        size_t block_len = std::min<size_t>(PFS_BLOCK_SIZE, obj.chunk_size - (size_t) b * PFS_BLOCK_SIZE);
+        size_t present = block_start >= valid ? 0 : std::min(block_len, valid - block_start);
+        uint32_t crc = crc32c(data + block_start, present);
+        crc = crc32c(zeros, block_len - present, crc);
+        if (crc != sum.crc) {
+            PFS_LOG_ERROR("Checksum mismatch in block %u of chunk %ld of %s", b, (long) chunk_number, object.c_str());
+            checksum_failures_++;
+            ret = -EBADMSG;
+        }
+    }
+    return ret;
+}
+
+int ChunkStore::load_chunk(Object& obj, uint32_t slot, std::string& chunk) {
+    std::string slot_data(obj.slot_size, '\0');
+    ssize_t n = storage_->read_at(obj.data_fd, &slot_data[0], slot_data.size(), (off_t) slot * obj.slot_size);
+    if (n < 0) return n;
+
+    SlotHeader header = {};
+    std::memcpy(&header, slot_data.data(), sizeof(header));
+    chunk.clear();
+    if (header.magic == 0) return 0; // allocated, never written
+    if (header.magic != SLOT_MAGIC || header.stored_len > obj.slot_size - sizeof(header) || header.raw_len > obj.chunk_size) {
+        PFS_LOG_ERROR("Bad slot header in slot %u", slot);
+        return -EBADMSG;
+    }
+
+    const char* payload = slot_data.data() + sizeof(header);
+    if (!(header.flags & SLOT_COMPRESSED)) {
+        chunk.assign(payload, header.raw_len);
+    } else if (!pfs_decompress(payload, header.stored_len, header.raw_len, chunk)) {
+        PFS_LOG_ERROR("Corrupt compressed chunk in slot %u", slot);
+        checksum_failures_++;
+        return -EBADMSG;
+    }
+    return 0;
+}
+
+ssize_t ChunkStore::write_compressed(Object& obj, uint32_t slot, int offset_in_chunk, const char* data, size_t len) {
+    // The whole chunk is re-encoded, nobody else may touch any of it meanwhile
+    auto locks = lock_blocks(obj, slot, 0, obj.blocks_per_chunk() - 1);
+    std::string chunk;
+    int ret = load_chunk(obj, slot, chunk);
+    if (ret < 0) return ret;
+    if (chunk.size() < offset_in_chunk + len) chunk.resize(offset_in_chunk + len, '\0');
+    std::memcpy(&chunk[offset_in_chunk], data, len);
+
+    bool attempt;
+    {
+        std::lock_guard<std::mutex> lock(obj.mtx);
+        attempt = obj.probe.should_try();
+    }
+    std::string compressed;
+    bool packed = attempt && pfs_compress(chunk.data(), chunk.size(), compressed);
+    if (attempt) {
+        std::lock_guard<std::mutex> lock(obj.mtx);
+        obj.probe.record(packed);
+    }
+
+    const std::string& payload = packed ? compressed : chunk;
+    SlotHeader header = {SLOT_MAGIC, packed ? SLOT_COMPRESSED : 0, (uint32_t) payload.size(), (uint32_t) chunk.size()};
+    std::string slot_data(sizeof(header) + payload.size(), '\0');
+    std::memcpy(&slot_data[0], &header, sizeof(header));
+    std::memcpy(&slot_data[sizeof(header)], payload.data(), payload.size());
+
+    off_t position = (off_t) slot * obj.slot_size;
+    ssize_t n = storage_->write_at(obj.data_fd, slot_data.data(), slot_data.size(), position);
+    if (n < 0) return n;
+
+    // Give the rest of the slot back to the filesystem, best effort
+    off_t used = (slot_data.size() + 4095) & ~(off_t) 4095;
+    if (used < (off_t) obj.slot_size) {
+        ::fallocate(obj.data_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, position + used, obj.slot_size - used);
+    }
+
+    (packed ? chunks_compressed_ : chunks_stored_raw_)++;
+    compression_raw_bytes_ += chunk.size();
+    compression_stored_bytes_ += payload.size();
+
+    ret = update_checksums(obj, slot, offset_in_chunk, data, len, &chunk);
+    return ret < 0 ? ret : len;
+}
+
+void ChunkStore::scrubber_loop() {
+    std::unique_lock<std::mutex> lock(scrub_mutex_);
+    while (true) {
+        scrub_cv_.wait_for(lock, std::chrono::seconds(SCRUB_INTERVAL_SEC), [this] { return scrub_stop_; });
+        if (scrub_stop_) break;
+        lock.unlock();
+
+        std::vector<std::pair<std::string, std::shared_ptr<Object>>> objects;
+        {
+            std::lock_guard<std::mutex> objects_lock(mutex_);
+            objects.assign(objects_.begin(), objects_.end());
+        }
+
+        // Re-read every chunk through read(), which verifies it, at no more than SCRUB_BYTES_PER_SEC
+        auto start = std::chrono::steady_clock::now();
+        uint64_t pass_bytes = 0;
+        bool stopped = false;
+        for (auto& [object, obj] : objects) {
+            std::vector<uint32_t> chunks;
+            {
+                std::lock_guard<std::mutex> obj_lock(obj->mtx);
+                for (const auto& [chunk_number, slot] : obj->index) chunks.push_back(chunk_number);
+            }
+            std::string buf(obj->chunk_size, '\0');
+            for (uint32_t chunk_number : chunks) {
+                read(object, chunk_number, 0, &buf[0], buf.size());
+                pass_bytes += buf.size();
+                scrubbed_bytes_ += buf.size();
+
+                auto due = start + std::chrono::microseconds(pass_bytes * 1000000 / SCRUB_BYTES_PER_SEC);
+                lock.lock();
+                stopped = scrub_cv_.wait_until(lock, due, [this] { return scrub_stop_; });
+                lock.unlock();
+                if (stopped) break;
+            }
+            if (stopped) break;
+        }
+        if (!stopped) scrub_passes_++;
+        lock.lock();
+    }
+}
+
+ChunkStoreStats ChunkStore::stats() {
+    ChunkStoreStats stats;
+    stats.checksum_failures = checksum_failures_;
+    stats.scrub_passes = scrub_passes_;
+    stats.scrubbed_bytes = scrubbed_bytes_;
+    stats.chunks_compressed = chunks_compressed_;
+    stats.chunks_stored_raw = chunks_stored_raw_;
+    stats.compression_raw_bytes = compression_raw_bytes_;
+    stats.compression_stored_bytes = compression_stored_bytes_;
+    return stats;
+}
+
+int ChunkStore::discard_chunk(const std::string& object, int chunk_number) {
+    std::shared_ptr<Object> obj = lookup(object, 0);
+    if (!obj) return 0;
+
+    uint32_t slot;
+    {
+        std::lock_guard<std::mutex> lock(obj->mtx);
+        auto it = obj->index.find(chunk_number);
+        if (it == obj->index.end()) return 0;
+        slot = it->second;
+        obj->index.erase(it);
+    }
+
+    // The slot is never handed out again, and after a restart the manifest maps the chunk to a hole no recipe refers to
+    auto locks = lock_blocks(*obj, slot, 0, obj->blocks_per_chunk() - 1);
+    if (::fallocate(obj->data_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t) slot * obj->slot_size, obj->slot_size) != 0) {
+        return -errno;
+    }
+    std::vector<BlockChecksum> cleared(obj->blocks_per_chunk(), BlockChecksum{0, 0});
+    size_t bytes = cleared.size() * sizeof(BlockChecksum);
+    off_t position = (off_t) slot * obj->blocks_per_chunk() * sizeof(BlockChecksum);
+    if (::pwrite(obj->checksum_fd, cleared.data(), bytes, position) != (ssize_t) bytes) return -EIO;
+    obj->checksums_dirty = true;
+    return 1;
+}
+
+std::vector<std::string> ChunkStore::remove_file(const std::string& filename) {
+    std::vector<std::string> removed;
+    std::vector<std::string> to_reclaim;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto by_file = objects_by_file_.find(filename);
+        if (by_file == objects_by_file_.end()) return removed;
+
+        for (const std::string& object : by_file->second) {
+            objects_.erase(object); // in-flight I/O keeps its Object (and fds) alive until done
+            removed.push_back(object);
+
+            // Move the files out of the namespace so a re-created object starts clean, the
+            // reclaimer frees the blocks later. rename() is O(1) whatever the file size.
+            std::string tag = "/" + object + "." + std::to_string(reclaim_seq_++);
+            std::string trash_data = reclaim_dir() + tag + ".dat";
+            std::string trash_manifest = reclaim_dir() + tag + ".idx";
+            std::string trash_checksums = reclaim_dir() + tag + ".crc";
+            if (::rename(data_path(object).c_str(), trash_data.c_str()) == 0) to_reclaim.push_back(trash_data);
+            if (::rename(manifest_path(object).c_str(), trash_manifest.c_str()) == 0) to_reclaim.push_back(trash_manifest);
+            if (::rename(checksum_path(object).c_str(), trash_checksums.c_str()) == 0) to_reclaim.push_back(trash_checksums);
+        }
+        objects_by_file_.erase(by_file);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(reclaim_mutex_);
+        reclaim_queue_.insert(reclaim_queue_.end(), to_reclaim.begin(), to_reclaim.end());
+    }
+    reclaim_cv_.notify_one();
+    return removed;
+}
+
+void ChunkStore::reclaimer_loop() {
+    std::unique_lock<std::mutex> lock(reclaim_mutex_);
+    while (true) {
+        reclaim_cv_.wait(lock, [this] { return stop_ || !reclaim_queue_.empty(); });
+        if (stop_) break; // leftovers are picked up again at the next startup
+
+        std::string path = reclaim_queue_.front();
+        reclaim_queue_.pop_front();
+        lock.unlock();
+
+        // Give the blocks back in steps, one huge unlink can stall the filesystem for everyone else
+        struct stat st;
+        if (::stat(path.c_str(), &st) == 0) {
+            for (off_t size = st.st_size; size > RECLAIM_TRUNCATE_STEP; ) {
+                size -= RECLAIM_TRUNCATE_STEP;
+                if (::truncate(path.c_str(), size) != 0) break;
+                std::this_thread::yield();
+            }
+        }
+        ::unlink(path.c_str());
+
+        lock.lock();
+    }
+}
+
+size_t ChunkStore::num_objects() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return objects_.size();
+}
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <condition_variable>
+#include <shared_mutex>
+#include <unistd.h>
+
+#include "pfs_common/pfs_config.hpp"
+#include "pfs_common/pfs_compress.hpp"
+#include "pfs_storage.hpp"
+
+/* How far a write must get before it is acknowledged, mirrors pfsfile::Durability */
+enum class Durability {
+    NONE = 0,           // page cache only
+    PER_WRITE = 1,      // fdatasync before every acknowledgement
+    GROUP_COMMIT = 2,   // concurrent writers to an object share one fdatasync
+};
+
+struct ChunkStoreStats {
+    uint64_t checksum_failures = 0;     // blocks that failed verification on read or scrub
+    uint64_t scrub_passes = 0;
+    uint64_t scrubbed_bytes = 0;
+    uint64_t chunks_compressed = 0;     // chunk writes of compressed objects that were stored compressed
+    uint64_t chunks_stored_raw = 0;     // ... and that were skipped as incompressible
+    uint64_t compression_raw_bytes = 0;
+    uint64_t compression_stored_bytes = 0;
+};
+
+/*
+    Packed chunk store. Every object, i.e. the part of a PFS file held by one fileserver
+    ("<server>_<name>"), lives in a single backing file <root>/<object>.dat. Chunks are
+    packed into fixed-size slots of chunk_size bytes, allocated in write order.
+
+    The chunk_number -> slot index is kept in memory and persisted in <root>/<object>.idx:
+        header  : magic "PFSM", version, chunk_size, compression   (4 x uint32, version 1 has no compression)
+        records : chunk_number, slot                               (2 x uint32, appended on allocation)
+    Startup replays the manifests only, the data files are never scanned.
+
+    Objects of compressed files (PFS_COMPRESSION_ZLIB) store every chunk whole, prefixed with
+    a SlotHeader, zlib-compressed unless it doesn't pay off. Their slots are a header larger
+    and the unused tail of a slot is punched out, so the saving shows up on disk. A write
+    to such a chunk re-encodes the whole chunk.
+
+    Every PFS_BLOCK_SIZE block has a CRC32C in the sidecar <root>/<object>.crc, one
+    {crc, flags} pair per block at slot * blocks_per_chunk + block. Reads verify every
+    block they cover whole, and a background scrubber re-reads all chunks periodically.
+    Blocks without a checksum (flags 0, e.g. never written) are not verified.
+
+    Objects are also indexed by PFS file name, so deleting a file touches only its own
+    objects. Chunk versions written after a snapshot ("<server>_<name>.v<version>") count
+    as objects of <name>, so a file and all of its snapshots go together. A delete just
+    unhooks them and renames their files into <root>/.reclaim, a background reclaimer
+    then frees the space (truncating large files in steps).
+ */
+class ChunkStore {
+public:
+    ChunkStore(StorageBackend* storage, const std::string& root);
+    ~ChunkStore();
+
+    /*
+        Writes len bytes at offset_in_chunk of the chunk, allocating its slot if needed. Returns bytes written or -errno.
+        compression (PFS_COMPRESSION_*) only matters for the write that creates the object.
+     */
+    ssize_t write(const std::string& object, int chunk_number, int chunk_size, int offset_in_chunk, const char* data, size_t len,
+                  Durability durability = Durability::NONE, int compression = PFS_COMPRESSION_NONE);
+
+    /* Reads len bytes at offset_in_chunk of the chunk. Returns bytes read, 0 if the chunk doesn't exist, or -errno (-EBADMSG on a checksum mismatch) */
+    ssize_t read(const std::string& object, int chunk_number, int offset_in_chunk, char* data, size_t len);
+
+    /* Unhooks every object of a PFS file and queues its space for reclamation. Returns the removed objects */
+    std::vector<std::string> remove_file(const std::string& filename);
+
+    /* Frees one chunk that no file references any more: its slot is punched out and unindexed. Returns 1, 0 if absent, or -errno */
+    int discard_chunk(const std::string& object, int chunk_number);
+
+    /* Flush barrier: every write acknowledged so far for the file is on stable storage once this returns 0 */
+    int flush_file(const std::string& filename);
+
+    /* "<server>_<name>" or "<server>_<name>.v<version>" -> "<name>" */
+    static std::string file_of(const std::string& object);
+
+    size_t num_objects();
+
+    ChunkStoreStats stats();
+
+private:
+    static const uint32_t MANIFEST_MAGIC = 0x4d534650; // "PFSM"
+    static const uint32_t MANIFEST_VERSION = 2;
+    static const uint32_t SLOT_MAGIC = 0x43534650; // "PFSC"
+    static const uint32_t SLOT_COMPRESSED = 1;
+    static const uint32_t CHECKSUM_VALID = 1;
+
+    struct BlockChecksum {
+        uint32_t crc;
+        uint32_t flags;
+    };
+
+    // Start of every slot of a compressed object, an all-zero header is a chunk never written
+    struct SlotHeader {
+        uint32_t magic;
+        uint32_t flags;
+        uint32_t stored_len;
+        uint32_t raw_len;
+    };
+
+    struct Object {
+        std::mutex mtx;                                 // guards index and manifest appends
+        int data_fd = -1;
+        int manifest_fd = -1;
+        int checksum_fd = -1;
+        uint32_t chunk_size = 0;
+        uint32_t compression = PFS_COMPRESSION_NONE;
+        uint64_t slot_size = 0;                         // chunk_size, plus a SlotHeader if compressed
+        uint32_t next_slot = 0;
+        std::unordered_map<uint32_t, uint32_t> index;   // chunk_number : slot
+        CompressionProbe probe;                         // guarded by mtx
+
+        std::atomic<bool> manifest_dirty{false};        // slots allocated since the last manifest sync
+        std::atomic<bool> checksums_dirty{false};
+
+        // A write and the checksum update of its blocks happen under their locks exclusively, verification
+        // holds them shared so it never sees new data with an old checksum. A write of a whole chunk locks
+        // just its slot's chunk stripe, everything else holds that shared and the stripes of its blocks.
+        std::shared_mutex chunk_locks[CHECKSUM_LOCK_STRIPES];  // by slot
+        std::shared_mutex block_locks[CHECKSUM_LOCK_STRIPES];  // by slot * blocks_per_chunk + block
+
+        uint32_t blocks_per_chunk() const { return (chunk_size + PFS_BLOCK_SIZE - 1) / PFS_BLOCK_SIZE; }
+
+        // Group commit state, guarded by commit_mutex_
+        uint64_t write_seq = 0;                         // bumped by every GROUP_COMMIT write
+        uint64_t synced_seq = 0;                        // writes up to here are durable
+        uint64_t error_seq = 0;                         // writes up to here hit sync_error
+        int sync_error = 0;
+
+        // Closed with the last reference, so a remove() never pulls the fd from under an in-flight I/O
+        ~Object() {
+            if (data_fd >= 0) ::close(data_fd);
+            if (manifest_fd >= 0) ::close(manifest_fd);
+            if (checksum_fd >= 0) ::close(checksum_fd);
+        }
+    };
+
+    std::shared_ptr<Object> lookup(const std::string& object, int chunk_size, int compression = PFS_COMPRESSION_NONE);
+    bool load_manifest(const std::string& object);
+    std::string data_path(const std::string& object) const { return root_ + "/" + object + ".dat"; }
+    std::string manifest_path(const std::string& object) const { return root_ + "/" + object + ".idx"; }
+    std::string checksum_path(const std::string& object) const { return root_ + "/" + object + ".crc"; }
+    std::string reclaim_dir() const { return root_ + "/.reclaim"; }
+    void index_object(const std::string& object);
+    void reclaimer_loop();
+    int sync_object(Object& obj);
+    void committer_loop();
+
+    // Locks held on blocks of one chunk, released together
+    struct BlockLocks {
+        std::shared_lock<std::shared_mutex> chunk_shared;
+        std::unique_lock<std::shared_mutex> chunk;
+        std::vector<std::shared_lock<std::shared_mutex>> blocks_shared;
+        std::vector<std::unique_lock<std::shared_mutex>> blocks;
+    };
+
+    // Checksums
+    static BlockLocks lock_blocks(Object& obj, uint32_t slot, uint32_t first, uint32_t last);
+    static BlockLocks lock_blocks_shared(Object& obj, uint32_t slot, uint32_t first, uint32_t last);
+    int update_checksums(Object& obj, uint32_t slot, int offset_in_chunk, const char* data, size_t len, const std::string* chunk = nullptr);
+    int verify_checksums(const std::string& object, Object& obj, uint32_t slot, int chunk_number, int offset_in_chunk,
+                         const char* data, size_t len, size_t valid);
+    void scrubber_loop();
+
+    // Compressed objects
+    int load_chunk(Object& obj, uint32_t slot, std::string& chunk);
+    ssize_t write_compressed(Object& obj, uint32_t slot, int offset_in_chunk, const char* data, size_t len);
+
+    StorageBackend* storage_;
+    std::string root_;
+    std::mutex mutex_;                                                  // guards objects_
+    std::unordered_map<std::string, std::shared_ptr<Object>> objects_;  // object name : Object
+    std::unordered_map<std::string, std::unordered_set<std::string>> objects_by_file_; // PFS filename : object names
+
+    // Background reclaimer
+    std::mutex reclaim_mutex_;
+    std::condition_variable reclaim_cv_;
+    std::deque<std::string> reclaim_queue_;     // paths inside reclaim_dir()
+    uint64_t reclaim_seq_ = 0;
+    bool stop_ = false;
+    std::thread reclaimer_;
+
+    // Group committer
+    int dir_fd_ = -1;                                   // root_, synced once new objects appear
+    std::atomic<bool> dir_dirty_{false};
+    std::mutex commit_mutex_;
+    std::condition_variable commit_cv_;                 // wakes the committer
+    std::condition_variable durable_cv_;                // wakes writers waiting for their sync
+    std::unordered_set<std::shared_ptr<Object>> dirty_;
+    size_t waiting_writers_ = 0;
+    bool commit_stop_ = false;
+    std::thread committer_;
+
+    std::atomic<uint64_t> checksum_failures_{0};
+
+    // Background scrubber
+    std::mutex scrub_mutex_;
+    std::condition_variable scrub_cv_;
+    bool scrub_stop_ = false;
+    std::atomic<uint64_t> scrub_passes_{0};
+    std::atomic<uint64_t> scrubbed_bytes_{0};
+
+    std::atomic<uint64_t> chunks_compressed_{0};
+    std::atomic<uint64_t> chunks_stored_raw_{0};
+    std::atomic<uint64_t> compression_raw_bytes_{0};
+    std::atomic<uint64_t> compression_stored_bytes_{0};
+    std::thread scrubber_;
+};
@@ -1,6 +1,17 @@
 #include "pfs_fileserver.hpp"
+#include "pfs_storage.hpp"
+#include "pfs_chunk_store.hpp"
+#include "pfs_block_cache.hpp"
+#include "pfs_fileserver_api.hpp"
+#include "../pfs_common/pfs_crc32c.hpp"
+#include "../pfs_common/pfs_compress.hpp"
+#include "../pfs_common/pfs_layout.hpp"
+#include "../pfs_common/pfs_rpc_stats.hpp"
+#include "../pfs_common/pfs_log.hpp"
 #include "../pfs_proto/pfs_fileserver.grpc.pb.h"
 #include "../pfs_proto/pfs_fileserver.pb.h"
+#include "../pfs_proto/pfs_metaserver.grpc.pb.h"
+#include "../pfs_proto/pfs_metaserver.pb.h"
 #include "../pfs_client/pfs_api.hpp"
 #include <grpcpp/grpcpp.h>
 #include <fstream>
@@ -8,10 +19,13 @@
 #include <string>
 #include <cstdlib>
 #include <cstdio>
+#include <getopt.h>
+#include <unistd.h>
 #include <iostream>
 #include <cassert>
-#include <filesystem>
-#include <regex>
+#include <cstring>
+#include <atomic>
+#include <sys/statvfs.h>
 
 using grpc::Server;
 using grpc::ServerBuilder;
@@ -22,120 +36,244 @@ using namespace pfsfile;
 // Define the gRPC service implementation
 class PFSFileServerImpl final : public PFSFileServer::Service {
 private:
-    void writeToLocalFile(const std::string& filename, 
+    std::string data_dir_;  // where the chunk store keeps its objects
+    std::unique_ptr<StorageBackend> storage_;
+    std::unique_ptr<ChunkStore> chunk_store_;
+    BlockCache block_cache_{FILESERVER_CACHE_BYTES, FILESERVER_CACHE_SHARDS};
+    std::atomic<uint64_t> requests_served_{0}; // reported to the metaserver's placement policy
+
+    // Calls, latency and bytes of every RPC and of every host calling, for GetStats
+    RpcStats rpc_stats_{"Ping", "Initialize", "WriteFile", "ReadFile", "DeleteFile", "FlushFile", "DiscardChunks", "CopyChunks", "GetStats", "GetTrace"};
+
+    // Membership: registered with the metaserver, then heartbeating until shutdown
+    std::mutex heartbeat_mutex_;
+    std::condition_variable heartbeat_cv_;
+    bool heartbeat_stop_ = false;
+    std::thread heartbeat_;
+
+    /* "<server>_<name>_<chunk_number>" -> "<server>_<name>", the object the chunk is packed into */
+    static std::string objectName(const std::string& chunk_filename, int chunk_number) {
+        std::string suffix = "_" + std::to_string(chunk_number);
+        if (chunk_filename.size() > suffix.size() &&
+            chunk_filename.compare(chunk_filename.size() - suffix.size(), suffix.size(), suffix) == 0) {
+            return chunk_filename.substr(0, chunk_filename.size() - suffix.size());
+        }
+        return chunk_filename;
+    }
+
+    /* Whether file bytes [start_byte, end_byte] are a non-empty range of a single chunk */
+    static bool rangeInChunk(int stripe_unit, int64_t start_byte, int64_t end_byte) {
+        return start_byte >= 0 && end_byte >= start_byte && pfs_offset_in_chunk(stripe_unit, start_byte) + (end_byte - start_byte) < stripe_unit;
+    }
+
+    bool writeToLocalFile(const std::string& filename, 
+                        int chunk_number,
+                        int stripe_unit,
                         const std::pair<int, int>& range_within_buffer,
-                        const std::pair<int, int>& range_within_local_file,
-                        const std::string& buffer) {
+                        const std::pair<int, int>& range_within_chunk,
+                        const std::string& buffer,
+                        ::Durability durability,
+                        int compression) {
         // Assert that the range sizes are equal
         assert((range_within_buffer.second - range_within_buffer.first) == 
-            (range_within_local_file.second - range_within_local_file.first));
+            (range_within_chunk.second - range_within_chunk.first));
+
+        std::string object = objectName(filename, chunk_number);
+        PFS_LOG_DEBUG("Writing buf[%d - %d] to chunk %d of local %s, starting from %d, till %d", range_within_buffer.first,
+                      range_within_buffer.second, chunk_number, object.c_str(), range_within_chunk.first, range_within_chunk.second);
+
+        int length = range_within_buffer.second - range_within_buffer.first + 1;
+        ssize_t written = chunk_store_->write(object, chunk_number, stripe_unit, range_within_chunk.first,
+                                              buffer.data() + range_within_buffer.first, length, durability, compression);
+        if (written != length) {
+            PFS_LOG_ERROR("Error writing chunk %d of %s (%ld)", chunk_number, object.c_str(), (long) written);
+            block_cache_.invalidate_object(object);
+            return false;
+        }
+        // Write-through: keep any cached copy of the chunk in sync with disk
+        block_cache_.write(object, chunk_number, range_within_chunk.first, buffer.data() + range_within_buffer.first, length);
+        return true;
+    }
 
-        std::string file_path = "./files/" + filename;
+    /* Returns 0, or -errno (-EBADMSG if the stored chunk fails its checksums) */
+    int readFromLocalFile(const std::string& filename,  
+                        int chunk_number,
+                        int stripe_unit,
+                        const std::pair<int, int>& range_within_chunk,
+                        std::string& buffer) {
+        std::string object = objectName(filename, chunk_number);
+        PFS_LOG_DEBUG("Reading chunk %d of local %s, starting from %d, till %d", chunk_number, object.c_str(), range_within_chunk.first,
+                      range_within_chunk.second);
 
-        std::filesystem::create_directories("./files");
-        std::cout << "Writing buf[" << range_within_buffer.first << " - " << range_within_buffer.second 
-                << "] to local " << file_path << ", starting from " << range_within_local_file.first 
-                << ", till " << range_within_local_file.second << std::endl;
+        // Calculate the size of the range to read
+        int chunk_range_size = range_within_chunk.second - range_within_chunk.first + 1;
 
-        // Open the file in read/write mode
-        std::fstream file(file_path, std::ios::in | std::ios::out | std::ios::binary);
+        // Resize the buffer to hold the data, serve it from the block cache if we can
+        buffer.resize(chunk_range_size);
+        if (block_cache_.read(object, chunk_number, range_within_chunk.first, chunk_range_size, &buffer[0])) {
+            return 0;
+        }
 
-        if (!file.is_open()) {
-            // If the file doesn't exist, create it and open it
-            file.open(file_path, std::ios::out | std::ios::binary);
-            if (!file.is_open()) {
-                std::cerr << "Error opening file: " << file_path << std::endl;
-                return;
+        // Chunks of large stripe units are read just for the range, the cache holds small chunks only
+        if (stripe_unit > FILESERVER_CACHE_MAX_CHUNK) {
+            ssize_t range_bytes = chunk_store_->read(object, chunk_number, range_within_chunk.first, &buffer[0], chunk_range_size);
+            if (range_bytes < chunk_range_size) {
+                PFS_LOG_ERROR("Error reading chunk. Bytes read: %ld", (long) range_bytes);
+                buffer.clear();
+                return range_bytes < 0 ? (int) range_bytes : 0;
             }
+            return 0;
         }
 
-        std::cout << "File is ready to write to " << std::endl;
-        // Get the current size of the file
-        file.seekg(0, std::ios::end);
-        int current_file_size = file.tellg();
-
-        // If the file's current size is less than the starting position, extend the file
-        if (current_file_size < range_within_local_file.first) {
-            file.seekp(range_within_local_file.first - 1, std::ios::beg);
-            file.write("\0", 1);  // Write a single null byte to extend the file
+        // Miss: read the whole chunk so later reads of any part of it hit
+        uint64_t epoch = block_cache_.begin_fill(object, chunk_number);
+        std::string chunk(stripe_unit, '\0');
+        ssize_t chunk_bytes = chunk_store_->read(object, chunk_number, 0, &chunk[0], chunk.size());
+        if (chunk_bytes < range_within_chunk.second + 1) {
+            PFS_LOG_ERROR("Error reading chunk. Bytes read: %ld", (long) (chunk_bytes - range_within_chunk.first));
+            buffer.clear(); // Clear buffer if reading fails
+            return chunk_bytes < 0 ? (int) chunk_bytes : 0;
         }
-
-        // Now write the buffer to the file at the appropriate location
-        file.seekp(range_within_local_file.first, std::ios::beg);
-        file.write(buffer.substr(range_within_buffer.first, range_within_buffer.second - range_within_buffer.first + 1).c_str(), 
-                range_within_buffer.second - range_within_buffer.first + 1);
-
-        // Close the file after writing
-        file.close();
+        chunk.resize(chunk_bytes);
+        std::memcpy(&buffer[0], chunk.data() + range_within_chunk.first, chunk_range_size);
+        block_cache_.fill(object, chunk_number, epoch, std::move(chunk));
+        return 0;
     }
 
-    void readFromLocalFile(const std::string& filename,  
-                        const std::pair<int, int>& range_within_local_file,
-                        std::string& buffer) {
-        std::string file_path = "./files/" + filename;
-
-        std::filesystem::create_directories("./files");
-        std::cout << "Reading from local " << file_path << ", starting from " << range_within_local_file.first 
-                << ", till " << range_within_local_file.second << std::endl;
+public:
+    explicit PFSFileServerImpl(const std::string& data_dir)
+        : data_dir_(data_dir), storage_(make_storage_backend(FILESERVER_USE_IO_URING, FILESERVER_O_DIRECT)) {
+        PFS_LOG_INFO("%s: Using %s storage backend, data in %s.", __func__, storage_->name(), data_dir_.c_str());
+        chunk_store_.reset(new ChunkStore(storage_.get(), data_dir_));
+    }
 
-        // Open the file in read mode
-        std::ifstream file(file_path, std::ios::in | std::ios::binary);
-        if (!file.is_open()) {
-            std::cerr << "Error opening file: " << file_path << std::endl;
-            return;
+    ~PFSFileServerImpl() {
+        {
+            std::lock_guard<std::mutex> lock(heartbeat_mutex_);
+            heartbeat_stop_ = true;
         }
+        heartbeat_cv_.notify_all();
+        if (heartbeat_.joinable()) heartbeat_.join();
+    }
 
-        // Calculate the size of the range to read
-        int file_range_size = range_within_local_file.second - range_within_local_file.first + 1;
-
-        // Resize the buffer to hold the data
-        buffer.resize(file_range_size);
-
-        // Move the file pointer to the starting position
-        file.seekg(range_within_local_file.first, std::ios::beg);
-
-        // Read the content from the file into the buffer
-        file.read(&buffer[0], file_range_size);
+    /* Joins the cluster as my_address: registers with the metaserver and heartbeats every HEARTBEAT_INTERVAL_SEC */
+    void startHeartbeats(const std::string& metaserver_address, const std::string& my_address) {
+        heartbeat_ = std::thread(&PFSFileServerImpl::heartbeatLoop, this, metaserver_address, my_address);
+    }
 
-        if (!file) {
-            std::cerr << "Error reading file. Bytes read: " << file.gcount() << std::endl;
-            buffer.clear(); // Clear buffer if reading fails
+    /* Registers again whenever the metaserver doesn't know our id, e.g. after it restarted */
+    void heartbeatLoop(std::string metaserver_address, std::string my_address) {
+        auto stub = pfsmeta::PFSMetadataServer::NewStub(grpc::CreateChannel(metaserver_address, grpc::InsecureChannelCredentials()));
+        int server_id = -1;
+        std::unique_lock<std::mutex> lock(heartbeat_mutex_);
+        while (!heartbeat_stop_) {
+            lock.unlock();
+            bool forgotten = false;
+            grpc::ClientContext context;
+            context.set_deadline(std::chrono::system_clock::now() + std::chrono::seconds(HEARTBEAT_INTERVAL_SEC));
+            if (server_id < 0) {
+                pfsmeta::RegisterRequest request; pfsmeta::RegisterResponse response;
+                request.set_address(my_address);
+                grpc::Status status = stub->RegisterFileserver(&context, request, &response);
+                if (status.ok()) {
+                    server_id = response.server_id();
+                    PFS_LOG_INFO("%s: Registered with the metaserver as fileserver %d, cluster map version %lu", __func__, server_id,
+                                 (unsigned long) response.map_version());
+                } else {
+                    PFS_LOG_WARN("%s: Failed to register with the metaserver: %s", __func__, status.error_message().c_str());
+                }
+            } else {
+                UsageStats stats;
+                usage(&stats);
+                pfsmeta::HeartbeatRequest request; pfsmeta::HeartbeatResponse response;
+                request.set_server_id(server_id);
+                request.set_address(my_address);
+                request.set_capacity_bytes(stats.capacity_bytes());
+                request.set_available_bytes(stats.available_bytes());
+                request.set_requests_served(stats.requests_served());
+                grpc::Status status = stub->Heartbeat(&context, request, &response);
+                if (status.ok() && !response.registered()) {
+                    server_id = -1;
+                    forgotten = true; // register right away
+                }
+                if (!status.ok()) PFS_LOG_WARN("%s: Heartbeat failed: %s", __func__, status.error_message().c_str());
+            }
+            lock.lock();
+            if (!forgotten) heartbeat_cv_.wait_for(lock, std::chrono::seconds(HEARTBEAT_INTERVAL_SEC), [this]() { return heartbeat_stop_; });
         }
+    }
 
-        // Close the file
-        file.close();
+    /* Disk capacity of the chunk store and requests served so far */
+    void usage(UsageStats* usage) {
+        struct statvfs fs;
+        if (statvfs(data_dir_.c_str(), &fs) == 0) {
+            usage->set_capacity_bytes((uint64_t) fs.f_blocks * fs.f_frsize);
+            usage->set_available_bytes((uint64_t) fs.f_bavail * fs.f_frsize);
+        }
+        usage->set_requests_served(requests_served_.load());
     }
 
-public:
     Status Ping(ServerContext* context, const PingRequest* request, PingResponse* reply) override {
+        RpcTimer timer(rpc_stats_, "Ping", context, request, reply);
         reply->set_message("Thanks for the Ping. I, the fileserver am alive!");
-        printf("%s: Received ping RPC call.\n", __func__);
+        PFS_LOG_DEBUG("%s: Received ping RPC call.", __func__);
         return Status::OK;
     }
 
     Status Initialize(ServerContext* context, const InitRequest* request, InitResponse* reply) override {
+        RpcTimer timer(rpc_stats_, "Initialize", context, request, reply);
         reply->set_message("Connection successful! File server is active.");
-        printf("%s: Received Initialize RPC call.\n", __func__);
+        PFS_LOG_DEBUG("%s: Received Initialize RPC call.", __func__);
         return Status::OK;
     }
 
     Status WriteFile(ServerContext* context, const WriteFileRequest* request, WriteFileResponse* reply) override {
-        printf("%s: Received WriteFile RPC call.\n", __func__);
+        RpcTimer timer(rpc_stats_, "WriteFile", context, request, reply);
+        PFS_LOG_DEBUG("%s: Received WriteFile RPC call.", __func__);
+        requests_served_++;
 
         std::string buf = request->buf();
         std::string filename = request->chunk_filename();
         int chunk_number = request->chunk_number();
-        int start_byte = request->start_byte();
-        int end_byte = request->end_byte();
-        int num_bytes = request->num_bytes();
-        int offset = request->offset();
+        int64_t start_byte = request->start_byte();
+        int64_t end_byte = request->end_byte();
+        int64_t num_bytes = request->num_bytes();
+        int64_t offset = request->offset();
+        int stripe_unit = pfs_stripe_unit_or_default(request->stripe_unit());
         // assert num bytes
 
-        std::pair<int, int> range_within_local_file = {start_byte - chunk_number * (PFS_BLOCK_SIZE * STRIPE_BLOCKS), end_byte - chunk_number * (PFS_BLOCK_SIZE * STRIPE_BLOCKS)};
-        std::pair<int, int> range_within_buffer = {start_byte - offset, end_byte - offset};
+        if (request->wire_compressed()) {
+            std::string raw;
+            if (!pfs_decompress(buf.data(), buf.size(), request->raw_size(), raw) || (int64_t) raw.size() != end_byte - start_byte + 1) {
+                return Status(grpc::StatusCode::DATA_LOSS, "Corrupt compressed data for chunk " + std::to_string(chunk_number) + " of " + filename);
+            }
+            buf = std::move(raw);
+        }
+
+        if (!pfs_valid_stripe_unit(stripe_unit)) return Status(grpc::StatusCode::INVALID_ARGUMENT, "Bad stripe unit " + std::to_string(stripe_unit));
+        // File offsets are 64-bit, but the range is within one chunk and within buf, so ints from here on
+        int first = pfs_offset_in_chunk(stripe_unit, start_byte);
+        if (!rangeInChunk(stripe_unit, start_byte, end_byte) || start_byte < offset || end_byte - offset >= (int64_t) buf.size()) {
+            return Status(grpc::StatusCode::INVALID_ARGUMENT, "Bad range for chunk " + std::to_string(chunk_number) + " of " + filename);
+        }
+        std::pair<int, int> range_within_chunk = {first, first + (int) (end_byte - start_byte)};
+        std::pair<int, int> range_within_buffer = {(int) (start_byte - offset), (int) (end_byte - offset)};
 
-        assert(range_within_local_file.second - range_within_local_file.first == range_within_buffer.second - range_within_buffer.first);
-        writeToLocalFile(filename, range_within_buffer, range_within_local_file, buf);
+        assert(range_within_chunk.second - range_within_chunk.first == range_within_buffer.second - range_within_buffer.first);
+
+        // End-to-end check of what the client sent before any of it reaches the disk
+        if (request->block_crcs_size() > 0) {
+            std::vector<uint32_t> crcs = crc32c_blocks(buf.data() + range_within_buffer.first, end_byte - start_byte + 1, start_byte);
+            if (crcs.size() != (size_t) request->block_crcs_size() || !std::equal(crcs.begin(), crcs.end(), request->block_crcs().begin())) {
+                return Status(grpc::StatusCode::DATA_LOSS, "Checksum mismatch in chunk " + std::to_string(chunk_number) + " of " + filename);
+            }
+        }
+
+        // Only acknowledged once the write is as durable as the client asked for
+        ::Durability durability = static_cast<::Durability>(request->durability());
+        if (!writeToLocalFile(filename, chunk_number, stripe_unit, range_within_buffer, range_within_chunk, buf, durability, request->compression())) {
+            return Status(grpc::StatusCode::INTERNAL, "Failed to write chunk " + std::to_string(chunk_number) + " of " + filename);
+        }
 
         std::string msgToSend = "Writing local " + filename + ", starting from " + std::to_string(start_byte) + ", till " + std::to_string(end_byte) + ", total bytes: " + std::to_string(buf.size());
         reply->set_message(msgToSend);
@@ -144,20 +282,40 @@ public:
     }
 
     Status ReadFile(ServerContext* context, const ReadFileRequest* request, ReadFileResponse* reply) override {
-        printf("%s: Received ReadFile RPC call.\n", __func__);
+        RpcTimer timer(rpc_stats_, "ReadFile", context, request, reply);
+        PFS_LOG_DEBUG("%s: Received ReadFile RPC call.", __func__);
+        requests_served_++;
 
         std::string filename = request->chunk_filename();
         int chunk_number = request->chunk_number();
-        int start_byte = request->start_byte();
-        int end_byte = request->end_byte();
-        int num_bytes = request->num_bytes();
-        int offset = request->offset();
+        int64_t start_byte = request->start_byte();
+        int64_t end_byte = request->end_byte();
+        int64_t num_bytes = request->num_bytes();
+        int64_t offset = request->offset();
+        int stripe_unit = pfs_stripe_unit_or_default(request->stripe_unit());
         // assert num bytes
 
-        std::pair<int, int> range_within_local_file = {start_byte - chunk_number * (PFS_BLOCK_SIZE * STRIPE_BLOCKS), end_byte - chunk_number * (PFS_BLOCK_SIZE * STRIPE_BLOCKS)};
+        if (!pfs_valid_stripe_unit(stripe_unit)) return Status(grpc::StatusCode::INVALID_ARGUMENT, "Bad stripe unit " + std::to_string(stripe_unit));
+        if (!rangeInChunk(stripe_unit, start_byte, end_byte)) {
+            return Status(grpc::StatusCode::INVALID_ARGUMENT, "Bad range for chunk " + std::to_string(chunk_number) + " of " + filename);
+        }
+        int first = pfs_offset_in_chunk(stripe_unit, start_byte);
+        std::pair<int, int> range_within_chunk = {first, first + (int) (end_byte - start_byte)};
         
         std::string buf = "";
-        readFromLocalFile(filename, range_within_local_file, buf);
+        int ret = readFromLocalFile(filename, chunk_number, stripe_unit, range_within_chunk, buf);
+        if (ret == -EBADMSG) {
+            return Status(grpc::StatusCode::DATA_LOSS, "Checksum mismatch in chunk " + std::to_string(chunk_number) + " of " + filename);
+        }
+        for (uint32_t crc : crc32c_blocks(buf.data(), buf.size(), start_byte)) {
+            reply->add_block_crcs(crc);
+        }
+        std::string compressed;
+        if (request->accept_compressed() && pfs_compress(buf.data(), buf.size(), compressed)) {
+            reply->set_wire_compressed(true);
+            reply->set_raw_size(buf.size());
+            buf = std::move(compressed);
+        }
 
         std::string msgToSend = "Reading from local " + filename + ", starting from " + std::to_string(start_byte) + ", till " + std::to_string(end_byte) + ", total bytes: " + std::to_string(buf.size());
         reply->set_content(buf);
@@ -167,28 +325,19 @@ public:
     }
 
     Status DeleteFile(ServerContext* context, const DeleteFileRequest* request, DeleteFileResponse* reply) override {
-        printf("%s: Received DeleteFile RPC call.\n", __func__);
+        RpcTimer timer(rpc_stats_, "DeleteFile", context, request, reply);
+        PFS_LOG_DEBUG("%s: Received DeleteFile RPC call.", __func__);
 
         std::string filename = request->filename();
         int fileserver_number = request->fileserver_number();
 
-        try {
-            std::string base_path = "./files";
-            // Construct the pattern for matching files
-            std::string pattern = std::to_string(fileserver_number) + "_" + filename + "_" + ".*";
-            std::regex file_regex(pattern);
-
-            // Iterate through files in the given directory
-            for (const auto& entry : std::filesystem::directory_iterator(base_path)) {
-                const std::string file_path = entry.path().string();
-                const std::string file_name = entry.path().filename().string();
-                // Check if the file matches the pattern
-                if (std::regex_match(file_name, file_regex)) {
-                    std::filesystem::remove(entry.path()); // Delete the file
-                }
-            }
-        } catch (const std::exception& e) {
-            std::cerr << "Error: " << e.what() << std::endl;
+        // Only this file's objects are touched, their space is reclaimed in the background
+        std::vector<std::string> removed = chunk_store_->remove_file(filename);
+        for (const std::string& object : removed) {
+            block_cache_.invalidate_object(object);
+        }
+        if (removed.empty()) {
+            PFS_LOG_DEBUG("No local chunks of %s on fileserver %d", filename.c_str(), fileserver_number);
         }
 
         std::string msgToSend = "Deleted " + filename;
@@ -196,56 +345,230 @@ public:
         reply->set_status_code(0);
         return Status::OK;
     }
+
+    Status FlushFile(ServerContext* context, const FlushFileRequest* request, FlushFileResponse* reply) override {
+        RpcTimer timer(rpc_stats_, "FlushFile", context, request, reply);
+        PFS_LOG_DEBUG("%s: Received FlushFile RPC call.", __func__);
+
+        std::string filename = request->filename();
+        int ret = chunk_store_->flush_file(filename);
+        if (ret < 0) {
+            return Status(grpc::StatusCode::INTERNAL, "Failed to flush " + filename + ": " + strerror(-ret));
+        }
+
+        reply->set_message("Flushed " + filename);
+        reply->set_status_code(0);
+        return Status::OK;
+    }
+
+    /* Chunk versions no file refers to any more, left behind by deleting a file that shared chunks with snapshots */
+    Status DiscardChunks(ServerContext* context, const DiscardChunksRequest* request, DiscardChunksResponse* reply) override {
+        RpcTimer timer(rpc_stats_, "DiscardChunks", context, request, reply);
+        PFS_LOG_DEBUG("%s: Received DiscardChunks RPC call.", __func__);
+
+        int discarded = 0;
+        for (const ChunkRef& chunk : request->chunks()) {
+            std::string object = objectName(chunk.chunk_filename(), chunk.chunk_number());
+            int ret = chunk_store_->discard_chunk(object, chunk.chunk_number());
+            block_cache_.invalidate(object, chunk.chunk_number());
+            if (ret < 0) {
+                return Status(grpc::StatusCode::INTERNAL, "Failed to discard chunk " + std::to_string(chunk.chunk_number()) + " of " + object + ": " + strerror(-ret));
+            }
+            discarded += ret;
+        }
+
+        reply->set_message("Discarded " + std::to_string(discarded) + " chunks");
+        reply->set_discarded(discarded);
+        return Status::OK;
+    }
+
+    Status CopyChunks(ServerContext* context, const CopyChunksRequest* request, CopyChunksResponse* reply) override {
+        RpcTimer timer(rpc_stats_, "CopyChunks", context, request, reply);
+        PFS_LOG_DEBUG("%s: Received CopyChunks RPC call.", __func__);
+        requests_served_++;
+
+        ::Durability durability = static_cast<::Durability>(request->durability());
+        int64_t bytes_copied = 0;
+        for (const TransferRange& range : request->ranges()) {
+            int src_stripe_unit = pfs_stripe_unit_or_default(range.src_stripe_unit());
+            int dst_stripe_unit = pfs_stripe_unit_or_default(range.dst_stripe_unit());
+            if (!pfs_valid_stripe_unit(src_stripe_unit) || !pfs_valid_stripe_unit(dst_stripe_unit)) {
+                return Status(grpc::StatusCode::INVALID_ARGUMENT, "Bad stripe unit in a copy of " + range.src_chunk_filename());
+            }
+            if (!rangeInChunk(src_stripe_unit, range.src_start_byte(), range.src_end_byte()) ||
+                !rangeInChunk(dst_stripe_unit, range.dst_start_byte(), range.dst_start_byte() + range.src_end_byte() - range.src_start_byte())) {
+                return Status(grpc::StatusCode::INVALID_ARGUMENT, "Bad range in a copy of " + range.src_chunk_filename());
+            }
+            int length = (int) (range.src_end_byte() - range.src_start_byte() + 1);
+            int src_first = pfs_offset_in_chunk(src_stripe_unit, range.src_start_byte());
+            std::pair<int, int> src_within_chunk = {src_first, src_first + length - 1};
+            std::string buf;
+            int ret = readFromLocalFile(range.src_chunk_filename(), range.src_chunk_number(), src_stripe_unit, src_within_chunk, buf);
+            if (ret == -EBADMSG) {
+                return Status(grpc::StatusCode::DATA_LOSS, "Checksum mismatch in chunk " + std::to_string(range.src_chunk_number()) + " of " + range.src_chunk_filename());
+            }
+            if ((int) buf.size() != length) {
+                return Status(grpc::StatusCode::NOT_FOUND, "Missing data in chunk " + std::to_string(range.src_chunk_number()) + " of " + range.src_chunk_filename());
+            }
+
+            if (range.dst_address().empty()) {
+                int dst_first = pfs_offset_in_chunk(dst_stripe_unit, range.dst_start_byte());
+                if (!writeToLocalFile(range.dst_chunk_filename(), range.dst_chunk_number(), dst_stripe_unit, {0, length - 1}, {dst_first, dst_first + length - 1},
+                                      buf, durability, request->compression())) {
+                    return Status(grpc::StatusCode::INTERNAL, "Failed to write chunk " + std::to_string(range.dst_chunk_number()) + " of " + range.dst_chunk_filename());
+                }
+            } else {
+                // Layouts differ: straight to the fileserver holding the destination, never through the client
+                int w = fileserver_api_write(range.dst_address(), buf.data(), range.dst_chunk_filename(), range.dst_chunk_number(), length,
+                                             range.dst_start_byte(), range.dst_start_byte() + length - 1, range.dst_start_byte(),
+                                             request->durability(), request->compression(), dst_stripe_unit);
+                if (w == -1) {
+                    return Status(grpc::StatusCode::UNAVAILABLE, "Failed to send chunk " + std::to_string(range.dst_chunk_number()) + " of " + range.dst_chunk_filename() + " to " + range.dst_address());
+                }
+            }
+            bytes_copied += length;
+        }
+
+        reply->set_message("Copied " + std::to_string(bytes_copied) + " bytes in " + std::to_string(request->ranges_size()) + " ranges");
+        reply->set_bytes_copied(bytes_copied);
+        return Status::OK;
+    }
+
+    Status GetStats(ServerContext* context, const StatsRequest* request, StatsResponse* reply) override {
+        RpcTimer timer(rpc_stats_, "GetStats", context, request, reply);
+        PFS_LOG_DEBUG("%s: Received GetStats RPC call.", __func__);
+
+        BlockCacheStats cache_stats = block_cache_.stats();
+        CacheStats* cache = reply->mutable_cache();
+        cache->set_hits(cache_stats.hits);
+        cache->set_misses(cache_stats.misses);
+        cache->set_insertions(cache_stats.insertions);
+        cache->set_evictions(cache_stats.evictions);
+        cache->set_bytes_cached(cache_stats.bytes_cached);
+        cache->set_entries(cache_stats.entries);
+        cache->set_capacity_bytes(cache_stats.capacity_bytes);
+
+        ChunkStoreStats store_stats = chunk_store_->stats();
+        IntegrityStats* integrity = reply->mutable_integrity();
+        integrity->set_checksum_failures(store_stats.checksum_failures);
+        integrity->set_scrub_passes(store_stats.scrub_passes);
+        integrity->set_scrubbed_bytes(store_stats.scrubbed_bytes);
+
+        CompressionStats* compression = reply->mutable_compression();
+        compression->set_chunks_compressed(store_stats.chunks_compressed);
+        compression->set_chunks_stored_raw(store_stats.chunks_stored_raw);
+        compression->set_raw_bytes(store_stats.compression_raw_bytes);
+        compression->set_stored_bytes(store_stats.compression_stored_bytes);
+        if (store_stats.compression_stored_bytes > 0) {
+            compression->set_ratio((double) store_stats.compression_raw_bytes / store_stats.compression_stored_bytes);
+        }
+
+        usage(reply->mutable_usage());
+        reply->set_storage_queue_depth(storage_->queue_depth());
+        rpc_stats_.report(reply);
+
+        reply->set_message("Stats collected");
+        return Status::OK;
+    }
+
+    Status GetTrace(ServerContext* context, const TraceRequest* request, TraceResponse* reply) override {
+        RpcTimer timer(rpc_stats_, "GetTrace", context, request, reply);
+        PFS_LOG_DEBUG("%s: Received GetTrace RPC call.", __func__);
+        trace_report(reply, request->trace_id(), getpid());
+        reply->set_message("Trace collected");
+        return Status::OK;
+    }
 };
 
-void RunGRPCServer(const std::string& listen_port) {
-    PFSFileServerImpl service;
+void RunGRPCServer(const std::string& listen_port, const std::string& metaserver_address, const std::string& my_address,
+                   const std::string& data_dir) {
+    PFSFileServerImpl service(data_dir);
     std::string server_address = "0.0.0.0:" + listen_port;
 
     // Build and start the server
     ServerBuilder builder;
     builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+    builder.SetMaxReceiveMessageSize(PFS_MAX_MESSAGE_BYTES);
+    builder.SetMaxSendMessageSize(PFS_MAX_MESSAGE_BYTES);
     builder.RegisterService(&service);
 
     std::unique_ptr<Server> server(builder.BuildAndStart());
-    printf("PFS File Server listening on %s\n", server_address.c_str());
+    PFS_LOG_INFO("PFS File Server listening on %s", server_address.c_str());
+    service.startHeartbeats(metaserver_address, my_address);
     server->Wait();
 }
 
+static void print_usage(const char *program) {
+    fprintf(stderr, "usage: %s [--list <pfs_list.txt>] [--port <port>] [--address <host:port>] [--data-dir <dir>]\n"
+                    "  --list      cluster list, default $PFS_LIST or ../pfs_list.txt\n"
+                    "  --port      listen on this port instead of the one of this host's line; a fileserver\n"
+                    "              not in the list joins the running cluster this way\n"
+                    "  --address   address to register as, default <hostname>:<port>; one in the list\n"
+                    "              keeps the id of its line (e.g. localhost:<port> for a local cluster)\n"
+                    "  --data-dir  chunk store directory, default ./files\n", program);
+}
+
 int main(int argc, char *argv[]) {
-    printf("%s:%s: PFS file server start! Hostname: %s, IP: %s\n",
-           __FILE__, __func__, getMyHostname().c_str(), getMyIP().c_str());
+    PFS_LOG_INFO("%s:%s: PFS file server start! Hostname: %s, IP: %s", __FILE__, __func__, getMyHostname().c_str(), getMyIP().c_str());
+
+    std::string list_path = pfs_list_path("../pfs_list.txt");
+    std::string listen_port, my_address, data_dir = "./files";
+    static struct option options[] = {
+        {"list", required_argument, nullptr, 'l'},
+        {"port", required_argument, nullptr, 'p'},
+        {"address", required_argument, nullptr, 'a'},
+        {"data-dir", required_argument, nullptr, 'd'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "l:p:a:d:h", options, nullptr)) != -1) {
+        switch (opt) {
+            case 'l': list_path = optarg; break;
+            case 'p': listen_port = optarg; break;
+            case 'a': my_address = optarg; break;
+            case 'd': data_dir = optarg; break;
+            default: print_usage(argv[0]); exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
 
     // Parse pfs_list.txt
-    std::ifstream pfs_list("../pfs_list.txt");
+    std::ifstream pfs_list(list_path);
     if (!pfs_list.is_open()) {
-        fprintf(stderr, "%s: can't open pfs_list.txt file.\n", __func__);
+        fprintf(stderr, "%s: can't open %s.\n", __func__, list_path.c_str());
         exit(EXIT_FAILURE);
     }
 
     bool found = false;
-    std::string line;
-    std::getline(pfs_list, line); // First line is the meta server
+    std::string line, metaserver_address;
+    std::getline(pfs_list, metaserver_address); // First line is the meta server
     while (std::getline(pfs_list, line)) {
         if (line.substr(0, line.find(':')) == getMyHostname()) {
             found = true;
             break;
         }
     }
-    if (!found) {
-        fprintf(stderr, "%s: hostname not found in pfs_list.txt.\n", __func__);
-        exit(EXIT_FAILURE);
-    }
     pfs_list.close();
-    std::string listen_port = line.substr(line.find(':') + 1);
+
+    // Without a port the role comes from pfs_list.txt: this host's line
+    if (listen_port.empty() && my_address.empty()) {
+        if (!found) {
+            fprintf(stderr, "%s: hostname not found in pfs_list.txt, give a port to join the cluster.\n", __func__);
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        my_address = line;
+    }
+    if (listen_port.empty()) listen_port = my_address.substr(my_address.find(':') + 1);
+    if (my_address.empty()) my_address = getMyHostname() + ":" + listen_port;
 
     // Run the PFS fileserver and listen to requests
-    printf("%s: Launching PFS file server on %s, with listen port %s...\n",
-           __func__, getMyHostname().c_str(), listen_port.c_str());
+    PFS_LOG_INFO("%s: Launching PFS file server on %s as %s, with listen port %s...", __func__, getMyHostname().c_str(),
+                 my_address.c_str(), listen_port.c_str());
 
     // Do something...
-    RunGRPCServer(listen_port);
+    RunGRPCServer(listen_port, metaserver_address, my_address, data_dir);
     
-    printf("%s:%s: PFS file server done!\n", __FILE__, __func__);
+    PFS_LOG_INFO("%s:%s: PFS file server done!", __FILE__, __func__);
     return 0;
 }
@@ -1,10 +1,18 @@
 #include "pfs_fileserver_api.hpp"
+#include "pfs_common/pfs_crc32c.hpp"
+#include "pfs_common/pfs_compress.hpp"
+#include "pfs_common/pfs_client_stats.hpp"
+#include "pfs_common/pfs_log.hpp"
 #include "pfs_proto/pfs_fileserver.grpc.pb.h"
 #include <grpcpp/grpcpp.h>
 #include <vector>
 
 std::unique_ptr<pfsfile::PFSFileServer::Stub> connect_to_fileserver(std::string fileserver_address) {
-    std::shared_ptr<grpc::Channel> channel = grpc::CreateChannel(fileserver_address, grpc::InsecureChannelCredentials());
+    // Whole chunks of the largest stripe unit have to fit in one message
+    grpc::ChannelArguments args;
+    args.SetMaxReceiveMessageSize(PFS_MAX_MESSAGE_BYTES);
+    args.SetMaxSendMessageSize(PFS_MAX_MESSAGE_BYTES);
+    std::shared_ptr<grpc::Channel> channel = grpc::CreateCustomChannel(fileserver_address, grpc::InsecureChannelCredentials(), args);
     std::unique_ptr<pfsfile::PFSFileServer::Stub> stub = pfsfile::PFSFileServer::NewStub(channel);
     return stub;
 }
@@ -13,10 +21,11 @@ std::unique_ptr<pfsfile::PFSFileServer::Stub> connect_to_fileserver(std::string
 std::unordered_map<std::string, std::unique_ptr<pfsfile::PFSFileServer::Stub>> server_stub_map;
 
 void fileserver_api_initialize(std::string fileserver_address) {
-    printf("%s: called.\n", __func__);
+    PFS_LOG_DEBUG("%s: called.", __func__);
+    ClientStatTimer timer(PFS_STAT_FILE_INITIALIZE);
     auto stub = connect_to_fileserver(fileserver_address);
     if (!stub) {
-        std::cerr << "Failed to connect to fileserver " << fileserver_address << std::endl;
+        PFS_LOG_ERROR("Failed to connect to fileserver %s", fileserver_address.c_str());
         return;
     }
     
@@ -24,68 +33,96 @@ void fileserver_api_initialize(std::string fileserver_address) {
     pfsfile::InitResponse response;
 
     grpc::ClientContext context;
+    trace_inject(context);
 
     grpc::Status status = stub->Initialize(&context, request, &response);    
     if (status.ok()) {
-        printf("Initialize RPC succeeded: %s\n", response.message().c_str());
+        PFS_LOG_DEBUG("Initialize RPC succeeded: %s", response.message().c_str());
     } else {
-        fprintf(stderr, "Initialize RPC failed: %s\n", status.error_message().c_str());
+        PFS_LOG_ERROR("Initialize RPC failed: %s", status.error_message().c_str());
     }
 }
 
 
-void fileserver_api_write(std::string fileserver_address, 
+int fileserver_api_write(std::string fileserver_address, 
                     const void* buf, 
                     std::string chunk_filename, 
                     int chunk_number,
-                    int num_bytes, 
-                    int start_byte, 
-                    int end_byte,
-                    int offset
+                    int64_t num_bytes, 
+                    int64_t start_byte, 
+                    int64_t end_byte,
+                    int64_t offset,
+                    int durability,
+                    int compression,
+                    int stripe_unit
                 ) {
+    ClientStatTimer timer(PFS_STAT_FILE_WRITE_FILE);
 
-    printf("%s: called.\n", __func__);
+    PFS_LOG_DEBUG("%s: called.", __func__);
     auto stub = connect_to_fileserver(fileserver_address); // stubs to each of the fileservers in NUM_FILESERVERS
     if (!stub) {
-        std::cerr << "Failed to connect to fileserver " << fileserver_address << std::endl;
-        return;
+        PFS_LOG_ERROR("Failed to connect to fileserver %s", fileserver_address.c_str());
+        return -1;
     }
     
     pfsfile::WriteFileRequest request; pfsfile::WriteFileResponse response;
-    std::string bytes_string(static_cast<const char*>(buf), num_bytes);
-    request.set_buf(bytes_string);
+    // Only this server's range goes on the wire, so it starts at offset start_byte
+    const char* range = static_cast<const char*>(buf) + (start_byte - offset);
+    int64_t range_size = end_byte - start_byte + 1;
+    std::string compressed;
+    if (PFS_WIRE_COMPRESSION && compression != PFS_COMPRESSION_NONE && pfs_compress(range, range_size, compressed)) {
+        request.set_buf(compressed);
+        request.set_wire_compressed(true);
+        request.set_raw_size(range_size);
+    } else {
+        request.set_buf(range, range_size);
+    }
+    request.set_offset(start_byte);
     request.set_chunk_filename(chunk_filename);
     request.set_chunk_number(chunk_number);
     request.set_start_byte(start_byte);
     request.set_end_byte(end_byte);
     request.set_num_bytes(num_bytes);
-    request.set_offset(offset);
+    request.set_durability(static_cast<pfsfile::Durability>(durability));
+    request.set_compression(compression);
+    request.set_stripe_unit(stripe_unit);
+
+    for (uint32_t crc : crc32c_blocks(range, range_size, start_byte)) {
+        request.add_block_crcs(crc);
+    }
 
     grpc::ClientContext context;
+    trace_inject(context);
 
     grpc::Status status = stub->WriteFile(&context, request, &response);
     if (status.ok()) {
-        printf("Write file RPC succeeded: %s\n", response.message().c_str());
+        PFS_LOG_DEBUG("Write file RPC succeeded: %s", response.message().c_str());
+        client_stats_bytes(fileserver_address, range_size, 0);
+        return 0;
     } else {
-        fprintf(stderr, "Write file RPC failed: %s\n", status.error_message().c_str());
+        PFS_LOG_ERROR("Write file RPC failed: %s", status.error_message().c_str());
+        return -1;
     }
 }
 
-void fileserver_api_read(std::string fileserver_address, 
+int fileserver_api_read(std::string fileserver_address, 
                     std::string &buf, 
                     std::string chunk_filename, 
                     int chunk_number,
-                    int num_bytes, 
-                    int start_byte, 
-                    int end_byte,
-                    int offset
+                    int64_t num_bytes, 
+                    int64_t start_byte, 
+                    int64_t end_byte,
+                    int64_t offset,
+                    int compression,
+                    int stripe_unit
                 ) {
+    ClientStatTimer timer(PFS_STAT_FILE_READ_FILE);
 
-    printf("%s: called.\n", __func__);
+    PFS_LOG_DEBUG("%s: called.", __func__);
     auto stub = connect_to_fileserver(fileserver_address); // stubs to each of the fileservers in NUM_FILESERVERS
     if (!stub) {
-        std::cerr << "Failed to connect to fileserver " << fileserver_address << std::endl;
-        return;
+        PFS_LOG_ERROR("Failed to connect to fileserver %s", fileserver_address.c_str());
+        return -1;
     }
     
     pfsfile::ReadFileRequest request; pfsfile::ReadFileResponse response;
@@ -96,23 +133,48 @@ void fileserver_api_read(std::string fileserver_address,
     request.set_end_byte(end_byte);
     request.set_num_bytes(num_bytes);
     request.set_offset(offset);
+    request.set_accept_compressed(PFS_WIRE_COMPRESSION && compression != PFS_COMPRESSION_NONE);
+    request.set_stripe_unit(stripe_unit);
 
     grpc::ClientContext context;
+    trace_inject(context);
 
     grpc::Status status = stub->ReadFile(&context, request, &response);
-    if (status.ok()) {
-        buf = response.content();
-        printf("Read file RPC succeeded: %s\n", response.message().c_str());
-    } else {
-        fprintf(stderr, "Read file RPC failed: %s\n", status.error_message().c_str());
+    if (!status.ok()) {
+        PFS_LOG_ERROR("Read file RPC failed: %s", status.error_message().c_str());
+        return -1;
+    }
+
+    std::string content = response.content();
+    if (response.wire_compressed()) {
+        std::string raw;
+        if (!pfs_decompress(content.data(), content.size(), response.raw_size(), raw)) {
+            PFS_LOG_ERROR("Read file RPC returned corrupt compressed data for %s", chunk_filename.c_str());
+            return -1;
+        }
+        content = std::move(raw);
     }
+
+    // End-to-end check: the fileserver's checksums must match what arrived here
+    if (response.block_crcs_size() > 0) {
+        std::vector<uint32_t> crcs = crc32c_blocks(content.data(), content.size(), start_byte);
+        if (crcs.size() != (size_t) response.block_crcs_size() || !std::equal(crcs.begin(), crcs.end(), response.block_crcs().begin())) {
+            PFS_LOG_ERROR("Read file RPC returned corrupt data for %s", chunk_filename.c_str());
+            return -1;
+        }
+    }
+    client_stats_bytes(fileserver_address, 0, content.size());
+    buf = std::move(content);
+    PFS_LOG_DEBUG("Read file RPC succeeded: %s", response.message().c_str());
+    return 0;
 }
 
 int fileserver_api_delete(std::string filename, std::string fileserver_address, int fileserver_number) {
-    printf("%s: called.\n", __func__);
+    PFS_LOG_DEBUG("%s: called.", __func__);
+    ClientStatTimer timer(PFS_STAT_FILE_DELETE_FILE);
     auto stub = connect_to_fileserver(fileserver_address); 
     if (!stub) {
-        std::cerr << "Failed to connect to fileserver " << fileserver_address << std::endl;
+        PFS_LOG_ERROR("Failed to connect to fileserver %s", fileserver_address.c_str());
         return -1;
     }
     
@@ -120,14 +182,163 @@ int fileserver_api_delete(std::string filename, std::string fileserver_address,
     request.set_filename(filename);
     request.set_fileserver_number(fileserver_number);
     grpc::ClientContext context;
+    trace_inject(context);
 
     grpc::Status status = stub->DeleteFile(&context, request, &response);
     if (status.ok()) {
-        printf("Delete file RPC succeeded: %s\n", response.message().c_str());
+        PFS_LOG_DEBUG("Delete file RPC succeeded: %s", response.message().c_str());
+        return 0;
+    } else {
+        PFS_LOG_ERROR("Delete file RPC failed: %s", status.error_message().c_str());
+        return -1;
+    }
+}
+
+int fileserver_api_flush(std::string filename, std::string fileserver_address) {
+    PFS_LOG_DEBUG("%s: called.", __func__);
+    ClientStatTimer timer(PFS_STAT_FILE_FLUSH_FILE);
+    auto stub = connect_to_fileserver(fileserver_address);
+    if (!stub) {
+        PFS_LOG_ERROR("Failed to connect to fileserver %s", fileserver_address.c_str());
+        return -1;
+    }
+
+    pfsfile::FlushFileRequest request; pfsfile::FlushFileResponse response;
+    request.set_filename(filename);
+    grpc::ClientContext context;
+    trace_inject(context);
+
+    grpc::Status status = stub->FlushFile(&context, request, &response);
+    if (status.ok()) {
+        PFS_LOG_DEBUG("Flush file RPC succeeded: %s", response.message().c_str());
         return 0;
     } else {
-        fprintf(stderr, "Delete file RPC failed: %s\n", status.error_message().c_str());
+        PFS_LOG_ERROR("Flush file RPC failed: %s", status.error_message().c_str());
         return -1;
     }
 }
 
+int64_t fileserver_api_copy(std::string fileserver_address, const std::vector<struct ChunkTransfer> &transfers, int durability, int compression) {
+    PFS_LOG_DEBUG("%s: called.", __func__);
+    ClientStatTimer timer(PFS_STAT_FILE_COPY_CHUNKS);
+    auto stub = connect_to_fileserver(fileserver_address);
+    if (!stub) {
+        PFS_LOG_ERROR("Failed to connect to fileserver %s", fileserver_address.c_str());
+        return -1;
+    }
+
+    pfsfile::CopyChunksRequest request; pfsfile::CopyChunksResponse response;
+    for (const struct ChunkTransfer &transfer : transfers) {
+        pfsfile::TransferRange* range = request.add_ranges();
+        range->set_src_chunk_filename(transfer.src_chunk_filename);
+        range->set_src_chunk_number(transfer.src_chunk_number);
+        range->set_src_start_byte(transfer.src_start_byte);
+        range->set_src_end_byte(transfer.src_end_byte);
+        range->set_dst_chunk_filename(transfer.dst_chunk_filename);
+        range->set_dst_chunk_number(transfer.dst_chunk_number);
+        range->set_dst_start_byte(transfer.dst_start_byte);
+        range->set_dst_address(transfer.dst_address);
+        range->set_src_stripe_unit(transfer.src_stripe_unit);
+        range->set_dst_stripe_unit(transfer.dst_stripe_unit);
+    }
+    request.set_durability(static_cast<pfsfile::Durability>(durability));
+    request.set_compression(compression);
+    grpc::ClientContext context;
+    trace_inject(context);
+
+    grpc::Status status = stub->CopyChunks(&context, request, &response);
+    if (status.ok()) {
+        PFS_LOG_DEBUG("Copy chunks RPC succeeded: %s", response.message().c_str());
+        return response.bytes_copied();
+    } else {
+        PFS_LOG_ERROR("Copy chunks RPC failed: %s", status.error_message().c_str());
+        return -1;
+    }
+}
+
+int fileserver_api_discard(std::string fileserver_address, const std::vector<std::pair<std::string, int>> &chunks) {
+    PFS_LOG_DEBUG("%s: called.", __func__);
+    ClientStatTimer timer(PFS_STAT_FILE_DISCARD_CHUNKS);
+    auto stub = connect_to_fileserver(fileserver_address);
+    if (!stub) {
+        PFS_LOG_ERROR("Failed to connect to fileserver %s", fileserver_address.c_str());
+        return -1;
+    }
+
+    pfsfile::DiscardChunksRequest request; pfsfile::DiscardChunksResponse response;
+    for (const auto &[chunk_filename, chunk_number] : chunks) {
+        pfsfile::ChunkRef* chunk = request.add_chunks();
+        chunk->set_chunk_filename(chunk_filename);
+        chunk->set_chunk_number(chunk_number);
+    }
+    grpc::ClientContext context;
+    trace_inject(context);
+
+    grpc::Status status = stub->DiscardChunks(&context, request, &response);
+    if (status.ok()) {
+        PFS_LOG_DEBUG("Discard chunks RPC succeeded: %s", response.message().c_str());
+        return 0;
+    } else {
+        PFS_LOG_ERROR("Discard chunks RPC failed: %s", status.error_message().c_str());
+        return -1;
+    }
+}
+
+int fileserver_api_stats(std::string fileserver_address, struct pfs_server_stats &stats) {
+    ClientStatTimer timer(PFS_STAT_FILE_GET_STATS);
+    auto stub = connect_to_fileserver(fileserver_address);
+    if (!stub) {
+        PFS_LOG_ERROR("Failed to connect to fileserver %s", fileserver_address.c_str());
+        return -1;
+    }
+
+    pfsfile::StatsRequest request; pfsfile::StatsResponse response;
+    grpc::ClientContext context;
+    trace_inject(context);
+
+    grpc::Status status = stub->GetStats(&context, request, &response);
+    if (!status.ok()) {
+        PFS_LOG_ERROR("GetStats RPC to %s failed: %s", fileserver_address.c_str(), status.error_message().c_str());
+        return -1;
+    }
+    stats.address = fileserver_address;
+    rpc_stats_read(response, stats);
+    const pfsfile::CacheStats& cache = response.cache();
+    uint64_t lookups = cache.hits() + cache.misses();
+    stats.values = {
+        {"cache_hits_total", cache.hits()},
+        {"cache_misses_total", cache.misses()},
+        {"cache_hit_ratio", lookups == 0 ? 0.0 : (double) cache.hits() / lookups},
+        {"cache_evictions_total", cache.evictions()},
+        {"cache_bytes", cache.bytes_cached()},
+        {"checksum_failures_total", response.integrity().checksum_failures()},
+        {"scrubbed_bytes_total", response.integrity().scrubbed_bytes()},
+        {"compression_ratio", response.compression().ratio()},
+        {"capacity_bytes", response.usage().capacity_bytes()},
+        {"available_bytes", response.usage().available_bytes()},
+        {"storage_queue_depth", response.storage_queue_depth()},
+    };
+    stats.files.clear();
+    return 0;
+}
+
+int fileserver_api_trace(std::string fileserver_address, uint64_t trace_id, std::vector<TraceSpan> &spans, uint32_t &pid) {
+    auto stub = connect_to_fileserver(fileserver_address);
+    if (!stub) {
+        PFS_LOG_ERROR("Failed to connect to fileserver %s", fileserver_address.c_str());
+        return -1;
+    }
+
+    pfsfile::TraceRequest request; pfsfile::TraceResponse response;
+    request.set_trace_id(trace_id);
+    grpc::ClientContext context;
+
+    grpc::Status status = stub->GetTrace(&context, request, &response);
+    if (!status.ok()) {
+        PFS_LOG_ERROR("GetTrace RPC to %s failed: %s", fileserver_address.c_str(), status.error_message().c_str());
+        return -1;
+    }
+    trace_read(response, spans);
+    pid = response.pid();
+    return 0;
+}
@@ -2,30 +2,71 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
 
 #include "pfs_common/pfs_config.hpp"
 #include "pfs_common/pfs_common.hpp"
+#include "pfs_common/pfs_rpc_stats.hpp"
 
 void fileserver_api_initialize(std::string fileserver_address);
 
-void fileserver_api_write(std::string fileserver_address, 
+int fileserver_api_write(std::string fileserver_address, 
                             const void* buf, 
                             std::string chunk_filename, 
                             int chunk_number, 
-                            int num_bytes, 
-                            int start_byte, 
-                            int end_byte, 
-                            int offset                            
+                            int64_t num_bytes, 
+                            int64_t start_byte, 
+                            int64_t end_byte, 
+                            int64_t offset,
+                            int durability,
+                            int compression,
+                            int stripe_unit
 );
 
-void fileserver_api_read(std::string fileserver_address, 
+int fileserver_api_read(std::string fileserver_address, 
                             std::string &buf, 
                             std::string chunk_filename, 
                             int chunk_number, 
-                            int num_bytes, 
-                            int start_byte, 
-                            int end_byte, 
-                            int offset                            
+                            int64_t num_bytes, 
+                            int64_t start_byte, 
+                            int64_t end_byte, 
+                            int64_t offset,
+                            int compression,
+                            int stripe_unit
 );
 
 int fileserver_api_delete(std::string filename, std::string server_address, int fileserver_number);
+
+int fileserver_api_flush(std::string filename, std::string fileserver_address);
+
+/* Frees chunks no file refers to any more, <chunk_filename, chunk_number> pairs. Returns 0 or -1 */
+int fileserver_api_discard(std::string fileserver_address, const std::vector<std::pair<std::string, int>> &chunks);
+
+/* A server-side copy of part of a chunk, see fileserver_api_copy() */
+struct ChunkTransfer {
+    std::string src_chunk_filename;
+    int src_chunk_number;
+    int64_t src_start_byte;
+    int64_t src_end_byte;
+    std::string dst_chunk_filename;
+    int dst_chunk_number;
+    int64_t dst_start_byte;
+    std::string dst_address;    // empty: the destination chunk is on the same fileserver
+    int src_stripe_unit = PFS_DEFAULT_STRIPE_UNIT;
+    int dst_stripe_unit = PFS_DEFAULT_STRIPE_UNIT;
+};
+
+/* Has the fileserver copy its own chunk data, locally or straight to the destination fileservers. Returns bytes copied or -1 */
+int64_t fileserver_api_copy(std::string fileserver_address, const std::vector<struct ChunkTransfer> &transfers, int durability, int compression);
+
+/*
+    Everything the fileserver's GetStats reports: the RPCs, its callers by host, and the
+    block cache, checksum, compression, capacity and storage queue numbers as values, e.g.
+    "cache_hits_total" or "storage_queue_depth". Returns 0 or -1
+ */
+int fileserver_api_stats(std::string fileserver_address, struct pfs_server_stats &stats);
+
+/* The fileserver's recorded trace spans, of trace_id or all if it is 0, and its pid. Returns 0 or -1 */
+int fileserver_api_trace(std::string fileserver_address, uint64_t trace_id, std::vector<TraceSpan> &spans, uint32_t &pid);
@@ -0,0 +1,390 @@
+#include "pfs_storage.hpp"
+#include "pfs_common/pfs_log.hpp"
+
+#include <cerrno>
+#include <algorithm>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* ------------------------------ StorageBackend ------------------------------ */
+
+int StorageBackend::open_file(const std::string& path, bool create) {
+    return ::open(path.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0644);
+}
+
+void StorageBackend::close_file(int fd) {
+    if (fd >= 0) ::close(fd);
+}
+
+/* --------------------------- PosixStorageBackend ---------------------------- */
+
+/* Counts the calling thread in active while it is in scope */
+struct ActiveRequest {
+    std::atomic<unsigned>& active;
+    explicit ActiveRequest(std::atomic<unsigned>& active) : active(active) { active.fetch_add(1, std::memory_order_relaxed); }
+    ~ActiveRequest() { active.fetch_sub(1, std::memory_order_relaxed); }
+};
+
+ssize_t PosixStorageBackend::read_at(int fd, void* buf, size_t len, off_t offset) {
+    ActiveRequest request(active_);
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = ::pread(fd, static_cast<char*>(buf) + done, len - done, offset + done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+        if (n == 0) break; // EOF
+        done += n;
+    }
+    return done;
+}
+
+ssize_t PosixStorageBackend::write_at(int fd, const void* buf, size_t len, off_t offset) {
+    ActiveRequest request(active_);
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = ::pwrite(fd, static_cast<const char*>(buf) + done, len - done, offset + done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+        done += n;
+    }
+    return done;
+}
+
+int PosixStorageBackend::sync(int fd) {
+    ActiveRequest request(active_);
+    return ::fdatasync(fd) == 0 ? 0 : -errno;
+}
+
+/* -------------------------- IoUringStorageBackend --------------------------- */
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int sys_io_uring_register(int ring_fd, unsigned opcode, const void* arg, unsigned nr_args) {
+    return (int) syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+IoUringStorageBackend::IoUringStorageBackend(unsigned queue_depth, bool direct_io) : direct_io_(direct_io) {
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    ring_fd_ = sys_io_uring_setup(queue_depth, &params);
+    if (ring_fd_ < 0) {
+        PFS_LOG_WARN("io_uring_setup failed: %s", std::strerror(errno));
+        ring_fd_ = -1;
+        return;
+    }
+    sq_entries_ = params.sq_entries;
+
+    // Map the submission and completion rings (a single mapping on 5.4+ kernels)
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    sq_ptr_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED) {
+        sq_ptr_ = nullptr;
+        ::close(ring_fd_);
+        ring_fd_ = -1;
+        return;
+    }
+    if (single_mmap) {
+        cq_ptr_ = sq_ptr_;
+    } else {
+        cq_ptr_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+        if (cq_ptr_ == MAP_FAILED) {
+            cq_ptr_ = nullptr;
+            munmap(sq_ptr_, sq_ring_size_);
+            sq_ptr_ = nullptr;
+            ::close(ring_fd_);
+            ring_fd_ = -1;
+            return;
+        }
+    }
+    void* sqes = mmap(nullptr, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        if (cq_ptr_ != sq_ptr_) munmap(cq_ptr_, cq_ring_size_);
+        munmap(sq_ptr_, sq_ring_size_);
+        sq_ptr_ = cq_ptr_ = nullptr;
+        ::close(ring_fd_);
+        ring_fd_ = -1;
+        return;
+    }
+    sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(sq_ptr_);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    char* cq = static_cast<char*>(cq_ptr_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // Aligned buffer pool, registered with the kernel so it is pinned once instead of per I/O
+    size_t pool_size = (size_t) IO_URING_FIXED_BUFFERS * IO_URING_FIXED_BUFFER_SIZE;
+    if (posix_memalign(reinterpret_cast<void**>(&fixed_pool_), DIRECT_IO_ALIGNMENT, pool_size) == 0) {
+        std::vector<struct iovec> iovecs(IO_URING_FIXED_BUFFERS);
+        for (int i = 0; i < IO_URING_FIXED_BUFFERS; i++) {
+            iovecs[i].iov_base = fixed_pool_ + (size_t) i * IO_URING_FIXED_BUFFER_SIZE;
+            iovecs[i].iov_len = IO_URING_FIXED_BUFFER_SIZE;
+        }
+        if (sys_io_uring_register(ring_fd_, IORING_REGISTER_BUFFERS, iovecs.data(), IO_URING_FIXED_BUFFERS) == 0) {
+            fixed_registered_ = true;
+        } else {
+            PFS_LOG_WARN("io_uring buffer registration failed, using unregistered buffers: %s", std::strerror(errno));
+        }
+        for (int i = IO_URING_FIXED_BUFFERS - 1; i >= 0; i--) free_buffers_.push_back(i);
+    } else {
+        fixed_pool_ = nullptr;
+    }
+
+    submitter_ = std::thread(&IoUringStorageBackend::submitter_loop, this);
+}
+
+IoUringStorageBackend::~IoUringStorageBackend() {
+    if (ring_fd_ < 0) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    submit_cv_.notify_all();
+    if (submitter_.joinable()) submitter_.join();
+
+    if (fixed_registered_) sys_io_uring_register(ring_fd_, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+    free(fixed_pool_);
+    munmap(sqes_, sq_entries_ * sizeof(struct io_uring_sqe));
+    if (cq_ptr_ != sq_ptr_) munmap(cq_ptr_, cq_ring_size_);
+    munmap(sq_ptr_, sq_ring_size_);
+    ::close(ring_fd_);
+}
+
+int IoUringStorageBackend::open_file(const std::string& path, bool create) {
+    if (!direct_io_) return StorageBackend::open_file(path, create);
+    int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC | O_DIRECT | (create ? O_CREAT : 0), 0644);
+    if (fd < 0 && errno == EINVAL) {
+        // Filesystem without O_DIRECT support (e.g. tmpfs): the aligned path still works on a buffered fd
+        fd = StorageBackend::open_file(path, create);
+    }
+    return fd;
+}
+
+int IoUringStorageBackend::acquire_fixed_buffer(size_t len) {
+    if (fixed_pool_ == nullptr || len > IO_URING_FIXED_BUFFER_SIZE) return -1;
+    std::unique_lock<std::mutex> lock(mutex_);
+    slot_cv_.wait(lock, [this] { return !free_buffers_.empty(); });
+    int index = free_buffers_.back();
+    free_buffers_.pop_back();
+    return index;
+}
+
+void IoUringStorageBackend::release_fixed_buffer(int index) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_buffers_.push_back(index);
+    }
+    slot_cv_.notify_all();
+}
+
+int IoUringStorageBackend::submit_and_wait(uint8_t opcode, int fd, void* addr, unsigned len, off_t offset, int buf_index, unsigned op_flags) {
+    IoRequest request;
+    std::unique_lock<std::mutex> lock(mutex_);
+    // Keep queued + in-flight requests within the ring so neither SQ nor CQ can overflow
+    slot_cv_.wait(lock, [this] { return pending_ + inflight_ < sq_entries_; });
+
+    unsigned tail = *sq_tail_;
+    unsigned index = tail & *sq_mask_;
+    struct io_uring_sqe* sqe = &sqes_[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(addr);
+    sqe->len = len;
+    sqe->off = offset;
+    if (buf_index >= 0) sqe->buf_index = buf_index;
+    sqe->rw_flags = op_flags; // shares the union with fsync_flags
+    sqe->user_data = reinterpret_cast<uint64_t>(&request);
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    pending_++;
+
+    submit_cv_.notify_one();
+    request.cv.wait(lock, [&request] { return request.done; });
+    return request.result;
+}
+
+void IoUringStorageBackend::submitter_loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        submit_cv_.wait(lock, [this] { return stop_ || pending_ > 0 || inflight_ > 0; });
+        if (stop_ && pending_ == 0 && inflight_ == 0) break;
+
+        // Everything queued since the last round goes to the kernel in one syscall
+        unsigned to_submit = pending_;
+        pending_ = 0;
+        inflight_ += to_submit;
+        lock.unlock();
+
+        int submitted = sys_io_uring_enter(ring_fd_, to_submit, 1, IORING_ENTER_GETEVENTS);
+
+        lock.lock();
+        if (submitted < 0) {
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                PFS_LOG_ERROR("io_uring_enter failed: %s", std::strerror(errno));
+            }
+            submitted = 0;
+        }
+        if ((unsigned) submitted < to_submit) {
+            // The kernel left some SQEs on the ring, retry them next round
+            pending_ += to_submit - submitted;
+            inflight_ -= to_submit - submitted;
+        }
+
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        bool reaped = false;
+        while (head != tail) {
+            struct io_uring_cqe* cqe = &cqes_[head & *cq_mask_];
+            IoRequest* request = reinterpret_cast<IoRequest*>(cqe->user_data);
+            request->result = cqe->res;
+            request->done = true;
+            request->cv.notify_one();
+            inflight_--;
+            head++;
+            reaped = true;
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        if (reaped) slot_cv_.notify_all();
+    }
+}
+
+ssize_t IoUringStorageBackend::raw_read(int fd, void* buf, size_t len, off_t offset) {
+    int buf_index = fixed_registered_ ? acquire_fixed_buffer(len) : -1;
+    char* target = buf_index >= 0 ? fixed_pool_ + (size_t) buf_index * IO_URING_FIXED_BUFFER_SIZE : static_cast<char*>(buf);
+
+    size_t done = 0;
+    ssize_t ret = 0;
+    while (done < len) {
+        int n = buf_index >= 0 ? submit_and_wait(IORING_OP_READ_FIXED, fd, target + done, len - done, offset + done, buf_index)
+                               : submit_and_wait(IORING_OP_READ, fd, target + done, len - done, offset + done, -1);
+        if (n == -EINTR || n == -EAGAIN) continue;
+        if (n < 0) { ret = n; break; }
+        if (n == 0) break; // EOF
+        done += n;
+    }
+    if (buf_index >= 0) {
+        if (ret >= 0) std::memcpy(buf, target, done);
+        release_fixed_buffer(buf_index);
+    }
+    return ret < 0 ? ret : (ssize_t) done;
+}
+
+ssize_t IoUringStorageBackend::raw_write(int fd, const void* buf, size_t len, off_t offset) {
+    int buf_index = fixed_registered_ ? acquire_fixed_buffer(len) : -1;
+    char* source = const_cast<char*>(static_cast<const char*>(buf));
+    if (buf_index >= 0) {
+        source = fixed_pool_ + (size_t) buf_index * IO_URING_FIXED_BUFFER_SIZE;
+        std::memcpy(source, buf, len);
+    }
+
+    size_t done = 0;
+    ssize_t ret = 0;
+    while (done < len) {
+        int n = buf_index >= 0 ? submit_and_wait(IORING_OP_WRITE_FIXED, fd, source + done, len - done, offset + done, buf_index)
+                               : submit_and_wait(IORING_OP_WRITE, fd, source + done, len - done, offset + done, -1);
+        if (n == -EINTR || n == -EAGAIN) continue;
+        if (n < 0) { ret = n; break; }
+        done += n;
+    }
+    if (buf_index >= 0) release_fixed_buffer(buf_index);
+    return ret < 0 ? ret : (ssize_t) done;
+}
+
+/* O_DIRECT: widen to aligned blocks, going through an aligned bounce buffer when the pool can't hold it */
+ssize_t IoUringStorageBackend::aligned_read(int fd, void* buf, size_t len, off_t offset) {
+    off_t aligned_start = offset & ~((off_t) DIRECT_IO_ALIGNMENT - 1);
+    off_t aligned_end = (offset + len + DIRECT_IO_ALIGNMENT - 1) & ~((off_t) DIRECT_IO_ALIGNMENT - 1);
+    size_t aligned_len = aligned_end - aligned_start;
+
+    char* bounce = nullptr;
+    if (posix_memalign(reinterpret_cast<void**>(&bounce), DIRECT_IO_ALIGNMENT, aligned_len) != 0) return -ENOMEM;
+    ssize_t n = raw_read(fd, bounce, aligned_len, aligned_start);
+    ssize_t copied = 0;
+    if (n > offset - aligned_start) {
+        copied = std::min((ssize_t) len, n - (ssize_t) (offset - aligned_start));
+        std::memcpy(buf, bounce + (offset - aligned_start), copied);
+    }
+    free(bounce);
+    return n < 0 ? n : copied;
+}
+
+ssize_t IoUringStorageBackend::aligned_write(int fd, const void* buf, size_t len, off_t offset) {
+    off_t aligned_start = offset & ~((off_t) DIRECT_IO_ALIGNMENT - 1);
+    off_t aligned_end = (offset + len + DIRECT_IO_ALIGNMENT - 1) & ~((off_t) DIRECT_IO_ALIGNMENT - 1);
+    size_t aligned_len = aligned_end - aligned_start;
+
+    char* bounce = nullptr;
+    if (posix_memalign(reinterpret_cast<void**>(&bounce), DIRECT_IO_ALIGNMENT, aligned_len) != 0) return -ENOMEM;
+    std::memset(bounce, 0, aligned_len);
+
+    // Note: the local file grows to a DIRECT_IO_ALIGNMENT multiple, the metaserver's byte ranges bound all reads
+    std::lock_guard<std::mutex> rmw_lock(rmw_locks_[fd % 16]);
+    if (aligned_start != offset || aligned_end != (off_t) (offset + len)) {
+        ssize_t n = raw_read(fd, bounce, aligned_len, aligned_start);
+        if (n < 0) {
+            free(bounce);
+            return n;
+        }
+    }
+    std::memcpy(bounce + (offset - aligned_start), buf, len);
+    ssize_t n = raw_write(fd, bounce, aligned_len, aligned_start);
+    free(bounce);
+    return n < 0 ? n : (ssize_t) len;
+}
+
+ssize_t IoUringStorageBackend::read_at(int fd, void* buf, size_t len, off_t offset) {
+    if (direct_io_) return aligned_read(fd, buf, len, offset);
+    return raw_read(fd, buf, len, offset);
+}
+
+ssize_t IoUringStorageBackend::write_at(int fd, const void* buf, size_t len, off_t offset) {
+    if (direct_io_) return aligned_write(fd, buf, len, offset);
+    return raw_write(fd, buf, len, offset);
+}
+
+unsigned IoUringStorageBackend::queue_depth() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_ + inflight_;
+}
+
+int IoUringStorageBackend::sync(int fd) {
+    int ret;
+    do {
+        ret = submit_and_wait(IORING_OP_FSYNC, fd, nullptr, 0, 0, -1, IORING_FSYNC_DATASYNC);
+    } while (ret == -EINTR || ret == -EAGAIN);
+    return ret;
+}
+
+/* ---------------------------------- Factory --------------------------------- */
+
+std::unique_ptr<StorageBackend> make_storage_backend(bool use_io_uring, bool direct_io) {
+    if (use_io_uring) {
+        std::unique_ptr<IoUringStorageBackend> uring(new IoUringStorageBackend(IO_URING_QUEUE_DEPTH, direct_io));
+        if (uring->ok()) return uring;
+        PFS_LOG_WARN("io_uring unavailable, falling back to pread/pwrite");
+    }
+    return std::unique_ptr<StorageBackend>(new PosixStorageBackend());
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <linux/io_uring.h>
+
+#include "pfs_common/pfs_config.hpp"
+
+/*
+    Storage backend used by PFSFileServerImpl for all local chunk I/O.
+    Offsets are absolute positions within the local file, lengths are in bytes.
+    read_at / write_at return the number of bytes transferred, or -errno.
+ */
+class StorageBackend {
+public:
+    virtual ~StorageBackend() {}
+
+    virtual const char* name() const = 0;
+
+    /* Opens a local file for read/write, creating it if asked to. Returns fd or -1 */
+    virtual int open_file(const std::string& path, bool create);
+    virtual void close_file(int fd);
+
+    virtual ssize_t read_at(int fd, void* buf, size_t len, off_t offset) = 0;
+    virtual ssize_t write_at(int fd, const void* buf, size_t len, off_t offset) = 0;
+
+    /* fdatasync. Returns 0 or -errno */
+    virtual int sync(int fd) = 0;
+
+    /* Requests queued or being served right now, for GetStats */
+    virtual unsigned queue_depth() = 0;
+};
+
+/* Plain pread/pwrite, one blocking syscall per request. Works on every kernel. */
+class PosixStorageBackend : public StorageBackend {
+public:
+    const char* name() const override { return "pread/pwrite"; }
+    ssize_t read_at(int fd, void* buf, size_t len, off_t offset) override;
+    ssize_t write_at(int fd, const void* buf, size_t len, off_t offset) override;
+    int sync(int fd) override;
+    unsigned queue_depth() override { return active_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<unsigned> active_{0}; // threads in a syscall
+};
+
+/*
+    io_uring backend. Requests from all gRPC threads are queued onto one ring and a
+    single submitter thread hands them to the kernel in batches (one io_uring_enter
+    for everything that queued up while the previous batch was in flight).
+    Requests that fit in IO_URING_FIXED_BUFFER_SIZE use a registered buffer from the
+    aligned pool (READ_FIXED / WRITE_FIXED), larger ones use a plain READ / WRITE.
+    With direct_io, files are opened O_DIRECT and unaligned requests are widened to
+    DIRECT_IO_ALIGNMENT, with read-modify-write for partial blocks.
+ */
+class IoUringStorageBackend : public StorageBackend {
+public:
+    IoUringStorageBackend(unsigned queue_depth, bool direct_io);
+    ~IoUringStorageBackend();
+
+    /* false if io_uring_setup failed (old kernel, seccomp, ...) */
+    bool ok() const { return ring_fd_ >= 0; }
+
+    const char* name() const override { return direct_io_ ? "io_uring (O_DIRECT)" : "io_uring"; }
+    int open_file(const std::string& path, bool create) override;
+    ssize_t read_at(int fd, void* buf, size_t len, off_t offset) override;
+    ssize_t write_at(int fd, const void* buf, size_t len, off_t offset) override;
+    int sync(int fd) override;
+    unsigned queue_depth() override;
+
+private:
+    struct IoRequest {
+        int result = 0;
+        bool done = false;
+        std::condition_variable cv;
+    };
+
+    /* Queues one SQE and blocks until its CQE arrives */
+    int submit_and_wait(uint8_t opcode, int fd, void* addr, unsigned len, off_t offset, int buf_index, unsigned op_flags = 0);
+    ssize_t raw_read(int fd, void* buf, size_t len, off_t offset);
+    ssize_t raw_write(int fd, const void* buf, size_t len, off_t offset);
+    ssize_t aligned_read(int fd, void* buf, size_t len, off_t offset);
+    ssize_t aligned_write(int fd, const void* buf, size_t len, off_t offset);
+
+    int acquire_fixed_buffer(size_t len);
+    void release_fixed_buffer(int index);
+    void submitter_loop();
+
+    bool direct_io_;
+    int ring_fd_ = -1;
+    unsigned sq_entries_ = 0;
+
+    // Ring mappings
+    void* sq_ptr_ = nullptr;
+    void* cq_ptr_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    size_t cq_ring_size_ = 0;
+    struct io_uring_sqe* sqes_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_mask_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned* cq_mask_ = nullptr;
+    struct io_uring_cqe* cqes_ = nullptr;
+
+    // Registered, DIRECT_IO_ALIGNMENT aligned buffer pool
+    char* fixed_pool_ = nullptr;
+    bool fixed_registered_ = false;
+    std::vector<int> free_buffers_;
+
+    std::mutex mutex_;                      // guards the SQ, counters and the buffer pool
+    std::condition_variable submit_cv_;     // wakes the submitter
+    std::condition_variable slot_cv_;       // wakes producers waiting for SQ space / buffers
+    unsigned pending_ = 0;                  // SQEs written but not yet handed to the kernel
+    unsigned inflight_ = 0;                 // submitted, CQE not reaped yet
+    bool stop_ = false;
+    std::thread submitter_;
+
+    std::mutex rmw_locks_[16];              // serializes O_DIRECT read-modify-write per fd stripe
+};
+
+/* io_uring if enabled and supported, otherwise pread/pwrite */
+std::unique_ptr<StorageBackend> make_storage_backend(bool use_io_uring, bool direct_io);
@@ -0,0 +1,86 @@
+#include "pfs_membership.hpp"
+#include "pfs_metaserver/pfs_metaserver_api.hpp"
+#include "pfs_common/pfs_log.hpp"
+
+ClusterMembership::ClusterMembership(const std::vector<std::string>& configured) {
+    auto now = std::chrono::steady_clock::now();
+    for (const std::string& address : configured) {
+        members_.push_back(FileserverMember{address, PFS_MEMBER_UP, now});
+    }
+}
+
+int ClusterMembership::join(const std::string& address, bool* joined) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = std::chrono::steady_clock::now();
+    if (joined) *joined = false;
+    for (int id = 0; id < (int) members_.size(); id++) {
+        if (members_[id].address != address) continue;
+        if (members_[id].state != PFS_MEMBER_UP) {
+            PFS_LOG_INFO("Fileserver %d (%s) is back", id, address.c_str());
+            members_[id].state = PFS_MEMBER_UP;
+            version_++;
+        }
+        members_[id].last_heartbeat = now;
+        return id;
+    }
+    members_.push_back(FileserverMember{address, PFS_MEMBER_UP, now});
+    version_++;
+    if (joined) *joined = true;
+    PFS_LOG_INFO("Fileserver %d (%s) joined, cluster map version %lu", (int) members_.size() - 1, address.c_str(), (unsigned long) version_);
+    return members_.size() - 1;
+}
+
+bool ClusterMembership::heartbeat(int server_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (server_id < 0 || server_id >= (int) members_.size()) return false;
+    FileserverMember& member = members_[server_id];
+    member.last_heartbeat = std::chrono::steady_clock::now();
+    if (member.state != PFS_MEMBER_UP) {
+        PFS_LOG_INFO("Fileserver %d (%s) is back", server_id, member.address.c_str());
+        member.state = PFS_MEMBER_UP;
+        version_++;
+    }
+    return true;
+}
+
+int ClusterMembership::expire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto deadline = std::chrono::steady_clock::now() - std::chrono::seconds(HEARTBEAT_TIMEOUT_SEC);
+    int expired = 0;
+    for (int id = 0; id < (int) members_.size(); id++) {
+        FileserverMember& member = members_[id];
+        if (member.state == PFS_MEMBER_UP && member.last_heartbeat < deadline) {
+            PFS_LOG_WARN("Fileserver %d (%s) missed its heartbeats, marking it down", id, member.address.c_str());
+            member.state = PFS_MEMBER_DOWN;
+            expired++;
+        }
+    }
+    if (expired > 0) version_++;
+    return expired;
+}
+
+uint64_t ClusterMembership::version() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return version_;
+}
+
+std::vector<FileserverMember> ClusterMembership::members(uint64_t* version) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (version) *version = version_;
+    return members_;
+}
+
+std::vector<int> ClusterMembership::up_servers() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<int> up;
+    for (int id = 0; id < (int) members_.size(); id++) {
+        if (members_[id].state == PFS_MEMBER_UP) up.push_back(id);
+    }
+    return up;
+}
+
+std::string ClusterMembership::address(int server_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (server_id < 0 || server_id >= (int) members_.size()) return "";
+    return members_[server_id].address;
+}
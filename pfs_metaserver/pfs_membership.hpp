@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+
+#include "pfs_common/pfs_config.hpp"
+
+/* One fileserver as the metaserver sees it, its id is its index in the member list */
+struct FileserverMember {
+    std::string address;
+    int state;  // PFS_MEMBER_*
+    std::chrono::steady_clock::time_point last_heartbeat;
+};
+
+/*
+    Registry of the fileservers, the cluster map. The ones in pfs_list.txt get the ids of their
+    lines, so layouts from before keep their meaning; a fileserver registering with an unknown
+    address joins with the next id. Ids are never reused, a silent server is only marked down.
+    Every change of the member list or of a member's state bumps the map version.
+ */
+class ClusterMembership {
+public:
+    /* configured: fileserver addresses of pfs_list.txt, up until they miss HEARTBEAT_TIMEOUT_SEC of heartbeats */
+    explicit ClusterMembership(const std::vector<std::string>& configured);
+
+    /* Id of the fileserver at address, added to the map if it's new. *joined is set for a new member */
+    int join(const std::string& address, bool* joined = nullptr);
+
+    /* Records a heartbeat, false if there is no such member */
+    bool heartbeat(int server_id);
+
+    /* Marks members silent for HEARTBEAT_TIMEOUT_SEC down, returns how many went down */
+    int expire();
+
+    uint64_t version();
+    std::vector<FileserverMember> members(uint64_t* version = nullptr);
+
+    /* Ids of the members that are up */
+    std::vector<int> up_servers();
+
+    /* Address of a member, empty if there is no such member */
+    std::string address(int server_id);
+
+private:
+    std::mutex mutex_;
+    uint64_t version_ = 1;
+    std::vector<FileserverMember> members_;
+};
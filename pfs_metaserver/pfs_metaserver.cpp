@@ -2,12 +2,23 @@
 #include "../pfs_proto/pfs_metaserver.grpc.pb.h"
 #include "../pfs_proto/pfs_metaserver.pb.h"
 #include "../pfs_client/pfs_api.hpp"
+#include "../pfs_client/pfs_tokens.hpp"
+#include "../pfs_fileserver/pfs_fileserver_api.hpp"
+#include "../pfs_common/pfs_layout.hpp"
+#include "pfs_plan.hpp"
+#include "pfs_placement.hpp"
+#include "pfs_membership.hpp"
+#include "pfs_metaserver_api.hpp"
+#include "../pfs_common/pfs_rpc_stats.hpp"
+#include "../pfs_common/pfs_log.hpp"
 #include <grpcpp/grpcpp.h>
 #include <fstream>
 #include <iostream>
 #include <string>
 #include <cstdlib>
 #include <cstdio>
+#include <getopt.h>
+#include <unistd.h>
 
 using grpc::Server;
 using grpc::ServerBuilder;
@@ -22,26 +33,255 @@ const int MODE_WRITE = 2;
 class PFSMetadataServerImpl final : public PFSMetadataServer::Service {
 private:
     std::unordered_map<std::string, struct pfs_metadata> files;                     // filename: Metadata
+    // Like the files themselves, the open descriptors are guarded by recipe_mutex_
     std::unordered_map<int, std::pair<std::string, int>> descriptor;                // descriptor : <filename, mode>
     std::unordered_map<std::string, int> fileNameToDescriptor;                      // filename: descriptor
 
-    // filename: [{token - connection to client who owns it}]
+    // filename: [{token - connection to client who owns it}], guarded by mutex_ like the rest of the token state
     std::map<std::string, std::map<FileToken, ServerReaderWriter<pfsmeta::ServerNotification, pfsmeta::TokenRequest>*>> file_tokens_;
     std::set<ServerReaderWriter<pfsmeta::ServerNotification, pfsmeta::TokenRequest>*> client_streams_;
+    struct TokenActivity {
+        uint64_t requests = 0;
+        uint64_t revocations = 0;
+    };
+    std::unordered_map<std::string, TokenActivity> token_activity_;    // filename : token traffic, for GetStats
     std::mutex mutex_;
 
-    int next_fd = 3;
-    int next_client_id = 1;
+    int next_fd = 3;                // guarded by recipe_mutex_, as is used_fds
+    int next_client_id = 1;         // guarded by mutex_
     std::set<int> used_fds;
 
+    // Copy-on-write snapshots: a file and its snapshots share chunk versions until one of them writes
+    std::mutex recipe_mutex_;                                       // guards chunk versions and the maps below
+    std::unordered_map<std::string, int> chunk_refs_;               // "<storage>#<chunk>#<version>" : files referring to it
+    std::unordered_map<std::string, int> storage_files_;            // storage name : files whose chunks are stored under it
+    std::unordered_map<std::string, int> storage_generations_;      // storage name : last generation handed out
+
+    // Calls and handler time of every RPC, TokenRequest being one request on a token stream
+    RpcStats rpc_stats_{"Ping", "Initialize", "CreateFile", "OpenFile", "CloseFile", "WriteToFile", "ReadFile", "FileMetadata",
+                        "DeleteFile", "CopyFile", "SnapshotFile", "TokenRequest", "RegisterFileserver", "Heartbeat", "GetClusterMap", "GetStats", "GetTrace"};
+
+    // The fileservers, registered and heartbeating, and where new files go, fed by their heartbeats
+    ClusterMembership membership_;
+    PlacementPolicy placement_;
+
+    // Online rebalancing: one copy of one slot of one file moves at a time, guarded by recipe_mutex_
+    struct Migration {
+        std::string filename;
+        int index = -1;         // entry of recipe.servers being moved, -1 when nothing is
+        int target = -1;        // server it moves to, written along with the old one meanwhile
+        std::set<int> copying;  // chunk numbers being copied right now, writes to them wait
+    };
+    Migration migration_;
+
+    // Chunks the metaserver writes with recipe_mutex_ released (whileBusy), guarded by it. Requests touching them wait.
+    std::unordered_map<std::string, std::set<int>> busy_chunks_;   // filename : chunk numbers
+    std::condition_variable chunks_cv_;                             // wakes requests waiting for busy or migrating chunks
+
+    // Expires silent members and runs the rebalancer
+    std::mutex background_mutex_;
+    std::condition_variable background_cv_;
+    bool background_stop_ = false;
+    bool rebalance_requested_ = false;
+    std::thread background_;
+
+    // Data of the files still inlined in their record (recipe.inlined), guarded by recipe_mutex_
+    std::unordered_map<std::string, std::string> inline_data_;      // filename : the whole file
+
+    static std::string chunkKey(const std::string& storage_name, const struct Chunk& chunk) {
+        return storage_name + "#" + std::to_string(chunk.chunk_number) + "#" + std::to_string(chunk.version);
+    }
+
     template <typename ReplyType>
     grpc::Status error(const std::string& msg, ReplyType* reply) {
-        std::cerr << msg << std::endl;
+        PFS_LOG_WARN("%s", msg.c_str());
         reply->set_message(msg);
         reply->set_status_code(1);
         return Status(grpc::StatusCode::INVALID_ARGUMENT, msg);
     }
 
+    /* Everything in a recipe but its chunks */
+    static void setLayout(const struct pfs_filerecipe& recipe, PFSFileRecipe* layout) {
+        layout->set_stripe_width(recipe.stripe_width);
+        layout->set_stripe_unit(recipe.stripe_unit);
+        layout->set_compression(recipe.compression);
+        layout->set_replication(recipe.replication);
+        layout->set_ec_parity(recipe.ec_parity);
+        layout->set_storage_name(recipe.storage_name);
+        layout->set_generation(recipe.generation);
+        layout->set_inlined(recipe.inlined);
+        for (int server : recipe.servers) {
+            layout->add_servers(server);
+        }
+    }
+
+    /*
+        Splits a write of [offset, offset + num_bytes) into per-chunk instructions, growing the file's chunks and size.
+        A chunk version shared with a snapshot is forked: the file moves to a new version in its own generation, and
+        the old version is appended to forks so its data can be copied over before the write lands.
+     */
+    std::vector<struct Chunk> planWrite(struct pfs_metadata &file_metadata, int64_t offset, int64_t num_bytes, std::vector<struct Chunk> &forks) {
+        std::vector<struct Chunk> &chunks = file_metadata.recipe.chunks;
+        const std::string& storage_name = file_metadata.recipe.storage_name;
+
+        std::vector<struct Chunk> write_instructions;
+        pfs_with_stripe_unit(file_metadata.recipe.stripe_unit, [&](auto unit) {
+            pfs_for_each_chunk(unit, offset, num_bytes, [&](int chunk_number, int64_t start_byte_for_instruction, int64_t end_byte_for_instruction) {
+                int server_number = file_metadata.recipe.data_server(chunk_number);
+
+                // check if this chunk exists
+                auto it = std::find_if(chunks.begin(), chunks.end(), [chunk_number](const Chunk& c) {
+                    return c.chunk_number == chunk_number;
+                });
+
+                struct Chunk chunk_for_instruction = Chunk{chunk_number, server_number, start_byte_for_instruction, end_byte_for_instruction};
+                if (it == chunks.end()) {
+                    chunk_for_instruction.version = file_metadata.recipe.generation;
+                    chunks.push_back(chunk_for_instruction); // it's a brand new chunk
+                    chunk_refs_[chunkKey(storage_name, chunk_for_instruction)] = 1;
+                    file_metadata.file_size += (end_byte_for_instruction - start_byte_for_instruction + 1);
+                } else {
+                    struct Chunk& existing_chunk = *it;
+                    if (chunk_refs_[chunkKey(storage_name, existing_chunk)] > 1) {
+                        forks.push_back(existing_chunk);
+                        chunk_refs_[chunkKey(storage_name, existing_chunk)]--;
+                        existing_chunk.version = file_metadata.recipe.generation;
+                        chunk_refs_[chunkKey(storage_name, existing_chunk)] = 1;
+                    }
+                    chunk_for_instruction.version = existing_chunk.version;
+                    int64_t current_chunk_size = existing_chunk.end_byte - existing_chunk.start_byte + 1;
+                    if (end_byte_for_instruction > existing_chunk.end_byte) {
+                        existing_chunk.end_byte = end_byte_for_instruction;
+                        int64_t new_chunk_size = existing_chunk.end_byte - existing_chunk.start_byte + 1;
+                        file_metadata.file_size += (new_chunk_size - current_chunk_size);
+                    }
+                }
+                write_instructions.push_back(chunk_for_instruction);
+            });
+        });
+        return write_instructions;
+    }
+
+    /* Copies the data of forked chunks from their old versions into the file's new ones, on every server holding a copy */
+    bool forkChunks(const struct pfs_filerecipe& recipe, const std::vector<struct Chunk>& forks) {
+        if (forks.empty()) return true;
+        std::map<int, std::vector<struct ChunkTransfer>> transfers;
+        for (const struct Chunk& old_chunk : forks) {
+            for (int server : readServers(recipe, old_chunk.chunk_number)) {
+                struct ChunkTransfer transfer;
+                transfer.src_chunk_filename = pfs_chunk_filename(server, recipe.storage_name, old_chunk.chunk_number, old_chunk.version);
+                transfer.src_chunk_number = old_chunk.chunk_number;
+                transfer.src_start_byte = old_chunk.start_byte;
+                transfer.src_end_byte = old_chunk.end_byte;
+                transfer.dst_chunk_filename = pfs_chunk_filename(server, recipe.storage_name, old_chunk.chunk_number, recipe.generation);
+                transfer.dst_chunk_number = old_chunk.chunk_number;
+                transfer.dst_start_byte = old_chunk.start_byte;
+                transfer.src_stripe_unit = recipe.stripe_unit;
+                transfer.dst_stripe_unit = recipe.stripe_unit;
+                transfers[server].push_back(transfer);
+            }
+        }
+
+        std::map<int, int64_t> results;
+        std::vector<std::thread> copiers;
+        for (const auto& transfer : transfers) {
+            std::string address = membership_.address(transfer.first);
+            int64_t* result = &results[transfer.first];
+            *result = address.empty() ? -1 : 0;
+            if (address.empty()) continue;
+            copiers.emplace_back([&, address, result, queue = &transfer.second]() {
+                *result = fileserver_api_copy(address, *queue, PFS_DEFAULT_DURABILITY, recipe.compression);
+            });
+        }
+        for (std::thread& copier : copiers) {
+            copier.join();
+        }
+        return std::none_of(results.begin(), results.end(), [](const auto& result) { return result.second == -1; });
+    }
+
+    /* Writes data, which starts at offset of the file, as planned in instructions to the servers each of them lists */
+    bool writeChunks(const struct pfs_filerecipe& recipe, const std::vector<struct Chunk>& instructions, const std::string& data, int64_t offset) {
+        std::vector<int> results;
+        std::vector<std::thread> writers;
+        results.reserve(instructions.size() * (recipe.replication + 1));
+        for (const struct Chunk& chunk : instructions) {
+            for (int server : chunk.servers) {
+                std::string address = membership_.address(server);
+                results.push_back(address.empty() ? -1 : 0);
+                if (address.empty()) continue;
+                writers.emplace_back([&, chunk, server, address, i = results.size() - 1]() {
+                    results[i] = fileserver_api_write(address, data.data(),
+                                                      pfs_chunk_filename(server, recipe.storage_name, chunk.chunk_number, chunk.version),
+                                                      chunk.chunk_number, data.size(), chunk.start_byte, chunk.end_byte, offset,
+                                                      PFS_DEFAULT_DURABILITY, recipe.compression, recipe.stripe_unit);
+                });
+            }
+        }
+        for (std::thread& writer : writers) {
+            writer.join();
+        }
+        return std::find(results.begin(), results.end(), -1) == results.end();
+    }
+
+    /*
+        Runs io, the fileserver RPCs of a request, with lock released. The chunks of the file it
+        touches are busy meanwhile, requests for them wait until it's done.
+     */
+    template <typename IO>
+    bool whileBusy(std::unique_lock<std::mutex>& lock, const std::string& filename, const std::vector<int>& chunks, IO&& io) {
+        busy_chunks_[filename].insert(chunks.begin(), chunks.end());
+        lock.unlock();
+        bool ok = io();
+        lock.lock();
+        auto busy = busy_chunks_.find(filename);
+        for (int chunk_number : chunks) busy->second.erase(chunk_number);
+        if (busy->second.empty()) busy_chunks_.erase(busy);
+        chunks_cv_.notify_all();
+        return ok;
+    }
+
+    static std::vector<int> chunkNumbers(const std::vector<struct Chunk>& chunks) {
+        std::vector<int> numbers;
+        for (const struct Chunk& chunk : chunks) numbers.push_back(chunk.chunk_number);
+        return numbers;
+    }
+
+    /*
+        Moves an inlined file out to chunks, which the file keeps from then on. The client finishes
+        the write that didn't fit, erasure-coded files get their first stripe's parity with it.
+        The data is written with lock released, the file stays inlined until it's all out.
+     */
+    bool spillInline(std::unique_lock<std::mutex>& lock, const std::string& filename) {
+        std::string data = inline_data_[filename];
+        struct pfs_metadata spilled = files[filename];
+        spilled.file_size = 0;
+        if (!data.empty()) {
+            std::vector<struct Chunk> forks;
+            std::vector<struct Chunk> instructions = planWrite(spilled, 0, data.size(), forks);
+            for (struct Chunk& chunk : instructions) {
+                chunk.servers = writeServers(filename, spilled.recipe, chunk.chunk_number);
+            }
+            // Every request to an inlined file is for its first INLINE_FILE_THRESHOLD + 1 bytes
+            std::vector<int> busy;
+            pfs_with_stripe_unit(spilled.recipe.stripe_unit, [&](auto unit) {
+                pfs_for_each_chunk(unit, 0, INLINE_FILE_THRESHOLD + 1, [&](int chunk_number, int64_t, int64_t) { busy.push_back(chunk_number); });
+            });
+            if (!whileBusy(lock, filename, busy, [&]() { return writeChunks(spilled.recipe, instructions, data, 0); })) {
+                for (const struct Chunk& chunk : spilled.recipe.chunks) {
+                    chunk_refs_.erase(chunkKey(spilled.recipe.storage_name, chunk));
+                }
+                return false;
+            }
+        }
+        struct pfs_metadata& file_metadata = files[filename];
+        file_metadata.recipe.chunks = spilled.recipe.chunks;
+        file_metadata.file_size = spilled.file_size;
+        file_metadata.recipe.inlined = false;
+        inline_data_.erase(filename);
+        PFS_LOG_INFO("Spilled %s (%ld bytes) out of its record", filename.c_str(), (long) file_metadata.file_size);
+        return true;
+    }
+
     template <typename ReplyType>
     grpc::Status success(const std::string& msg, ReplyType* reply) {
         reply->set_message(msg);
@@ -50,34 +290,348 @@ private:
     }
 
 public:
+    /* list_path: the cluster list, its first line is this metaserver and the rest the configured fileservers */
+    explicit PFSMetadataServerImpl(const std::string& list_path) : membership_(configuredFileservers(list_path)) {
+        background_ = std::thread(&PFSMetadataServerImpl::backgroundLoop, this);
+    }
+
+    ~PFSMetadataServerImpl() {
+        {
+            std::lock_guard<std::mutex> lock(background_mutex_);
+            background_stop_ = true;
+        }
+        background_cv_.notify_all();
+        if (background_.joinable()) background_.join();
+    }
+
+    /* The fileservers of pfs_list.txt, they keep the ids of their lines */
+    static std::vector<std::string> configuredFileservers(const std::string& list_path) {
+        std::ifstream pfs_list(list_path);
+        std::vector<std::string> addresses;
+        std::string line;
+        std::getline(pfs_list, line); // First line is the meta server
+        while (std::getline(pfs_list, line)) {
+            addresses.push_back(line);
+        }
+        return addresses;
+    }
+
+    /* Marks silent fileservers down every heartbeat interval, rebalances every REBALANCE_INTERVAL_SEC and when a server joins */
+    void backgroundLoop() {
+        auto last_rebalance = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(background_mutex_);
+        while (!background_stop_) {
+            background_cv_.wait_for(lock, std::chrono::seconds(HEARTBEAT_INTERVAL_SEC), [this]() { return background_stop_ || rebalance_requested_; });
+            if (background_stop_) break;
+            bool rebalance = rebalance_requested_ || std::chrono::steady_clock::now() - last_rebalance >= std::chrono::seconds(REBALANCE_INTERVAL_SEC);
+            rebalance_requested_ = false;
+            lock.unlock();
+            membership_.expire();
+            if (rebalance) {
+                rebalanceOnce();
+                last_rebalance = std::chrono::steady_clock::now();
+            }
+            lock.lock();
+        }
+    }
+
+    bool stopping() {
+        std::lock_guard<std::mutex> lock(background_mutex_);
+        return background_stop_;
+    }
+
+    /*
+        A file the rebalancer may move: it has chunks, no parity (parity chunks aren't in the
+        recipe and are written by the client from its own layout), and no snapshot shares them.
+     */
+    bool movable(const struct pfs_filerecipe& recipe) {
+        if (recipe.inlined || recipe.ec_parity > 0 || recipe.chunks.empty()) return false;
+        if ((int) recipe.servers.size() != recipe.stripe_width * recipe.replication) return false;
+        auto shared = storage_files_.find(recipe.storage_name);
+        return shared == storage_files_.end() || shared->second <= 1;
+    }
+
+    /* Migrates slot copies from the fullest up fileserver to the emptiest until they're within REBALANCE_IMBALANCE of the mean */
+    void rebalanceOnce() {
+        while (!stopping()) {
+            std::string filename;
+            int index = -1, target = -1;
+            {
+                std::lock_guard<std::mutex> lock(recipe_mutex_);
+                std::vector<int> up = membership_.up_servers();
+                if (up.size() < 2) return;
+
+                // Bytes every up server holds of movable files, and what each slot copy would take along
+                struct Candidate { std::string filename; int index; int server; int64_t bytes; };
+                std::map<int, int64_t> held;
+                for (int server : up) held[server] = 0;
+                std::vector<Candidate> candidates;
+                for (const auto& [name, metadata] : files) {
+                    const struct pfs_filerecipe& recipe = metadata.recipe;
+                    if (!movable(recipe)) continue;
+                    std::vector<int64_t> slot_bytes(recipe.stripe_width, 0);
+                    for (const struct Chunk& chunk : recipe.chunks) {
+                        slot_bytes[chunk.chunk_number % recipe.stripe_width] += chunk.end_byte - chunk.start_byte + 1;
+                    }
+                    for (int i = 0; i < (int) recipe.servers.size(); i++) {
+                        int server = recipe.servers[i];
+                        if (held.count(server) == 0) continue; // down, nothing can be read from it
+                        held[server] += slot_bytes[i / recipe.replication];
+                        candidates.push_back(Candidate{name, i, server, slot_bytes[i / recipe.replication]});
+                    }
+                }
+
+                int64_t total = 0;
+                for (const auto& [server, bytes] : held) total += bytes;
+                auto fullest = std::max_element(held.begin(), held.end(), [](const auto& a, const auto& b) { return a.second < b.second; });
+                auto emptiest = std::min_element(held.begin(), held.end(), [](const auto& a, const auto& b) { return a.second < b.second; });
+                double mean = (double) total / held.size();
+                if (fullest->second <= mean * (1 + REBALANCE_IMBALANCE)) return;
+
+                // The biggest slot copy that narrows the gap, of a file not on the emptiest server yet
+                int64_t gap = fullest->second - emptiest->second;
+                int64_t best = 0;
+                for (const Candidate& candidate : candidates) {
+                    if (candidate.server != fullest->first || candidate.bytes <= best || candidate.bytes * 2 > gap) continue;
+                    const std::vector<int>& servers = files[candidate.filename].recipe.servers;
+                    if (std::find(servers.begin(), servers.end(), emptiest->first) != servers.end()) continue;
+                    filename = candidate.filename;
+                    index = candidate.index;
+                    best = candidate.bytes;
+                }
+                if (index < 0) return;
+                target = emptiest->first;
+            }
+            if (!migrate(filename, index, target)) return;
+        }
+    }
+
+    /*
+        Moves copy `index` of a file's slots to server target while the file stays in use. Writes
+        planned from now on go to the target as well; after MIGRATION_GRACE_MS for writes planned
+        before, the chunks are copied over in batches, each one's writers waiting for it, at up to
+        REBALANCE_BYTES_PER_SEC. Then the recipe switches to the target, and the old copies are
+        discarded once reads planned against them had their grace period.
+     */
+    bool migrate(const std::string& filename, int index, int target) {
+        using Clock = std::chrono::steady_clock;
+        const auto grace = std::chrono::milliseconds(MIGRATION_GRACE_MS);
+        int source;
+        std::string storage_name;
+        int compression, stripe_unit;
+        {
+            std::lock_guard<std::mutex> lock(recipe_mutex_);
+            auto it = files.find(filename);
+            if (it == files.end() || !movable(it->second.recipe)) return false;
+            const struct pfs_filerecipe& recipe = it->second.recipe;
+            source = recipe.servers[index];
+            storage_name = recipe.storage_name;
+            compression = recipe.compression;
+            stripe_unit = recipe.stripe_unit;
+            migration_ = Migration{filename, index, target, {}};
+        }
+        std::string source_address = membership_.address(source), target_address = membership_.address(target);
+        PFS_LOG_INFO("Rebalancer: moving copy %d of %s from fileserver %d to %d", index, filename.c_str(), source, target);
+        std::this_thread::sleep_for(grace);
+
+        bool ok = true;
+        int next_chunk = 0;
+        int64_t moved = 0;
+        auto started = Clock::now();
+        while (ok) {
+            std::vector<struct ChunkTransfer> batch;
+            {
+                std::lock_guard<std::mutex> lock(recipe_mutex_);
+                auto it = files.find(filename);
+                if (it == files.end() || !movable(it->second.recipe)) {
+                    ok = false;
+                    break;
+                }
+                const struct pfs_filerecipe& recipe = it->second.recipe;
+                std::vector<struct Chunk> slot_chunks;
+                for (const struct Chunk& chunk : recipe.chunks) {
+                    if (chunk.chunk_number % recipe.stripe_width == index / recipe.replication && chunk.chunk_number >= next_chunk) {
+                        slot_chunks.push_back(chunk);
+                    }
+                }
+                std::sort(slot_chunks.begin(), slot_chunks.end(), [](const Chunk& a, const Chunk& b) { return a.chunk_number < b.chunk_number; });
+                if (slot_chunks.size() > COPY_BATCH_RANGES) slot_chunks.resize(COPY_BATCH_RANGES);
+                if (slot_chunks.empty()) break;
+                for (const struct Chunk& chunk : slot_chunks) {
+                    struct ChunkTransfer transfer;
+                    transfer.src_chunk_filename = pfs_chunk_filename(source, storage_name, chunk.chunk_number, chunk.version);
+                    transfer.src_chunk_number = chunk.chunk_number;
+                    transfer.src_start_byte = chunk.start_byte;
+                    transfer.src_end_byte = chunk.end_byte;
+                    transfer.dst_chunk_filename = pfs_chunk_filename(target, storage_name, chunk.chunk_number, chunk.version);
+                    transfer.dst_chunk_number = chunk.chunk_number;
+                    transfer.dst_start_byte = chunk.start_byte;
+                    transfer.dst_address = target_address;
+                    transfer.src_stripe_unit = stripe_unit;
+                    transfer.dst_stripe_unit = stripe_unit;
+                    batch.push_back(transfer);
+                    migration_.copying.insert(chunk.chunk_number);
+                }
+                next_chunk = slot_chunks.back().chunk_number + 1;
+            }
+
+            // Writes to these chunks planned before they were marked land first
+            std::this_thread::sleep_for(grace);
+            int64_t copied = fileserver_api_copy(source_address, batch, PFS_DEFAULT_DURABILITY, compression);
+            {
+                std::lock_guard<std::mutex> lock(recipe_mutex_);
+                migration_.copying.clear();
+            }
+            chunks_cv_.notify_all();
+            if (copied == -1) {
+                ok = false;
+                break;
+            }
+
+            moved += copied;
+            auto due = started + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>((double) moved / REBALANCE_BYTES_PER_SEC));
+            if (due > Clock::now()) std::this_thread::sleep_until(due);
+        }
+
+        // Switch to the target, or give up on it, and drop the copy no one reads any more
+        std::vector<std::pair<std::string, int>> discards;
+        int discard_server;
+        {
+            std::lock_guard<std::mutex> lock(recipe_mutex_);
+            auto it = files.find(filename);
+            ok = ok && it != files.end() && movable(it->second.recipe) && it->second.recipe.servers[index] == source;
+            discard_server = ok ? source : target;
+            if (it != files.end()) {
+                const struct pfs_filerecipe& recipe = it->second.recipe;
+                for (const struct Chunk& chunk : recipe.chunks) {
+                    if (chunk.chunk_number % recipe.stripe_width != index / recipe.replication) continue;
+                    discards.push_back({pfs_chunk_filename(discard_server, storage_name, chunk.chunk_number, chunk.version), chunk.chunk_number});
+                }
+                if (ok) it->second.recipe.servers[index] = target;
+            }
+            migration_ = Migration{};
+        }
+        chunks_cv_.notify_all();
+        PFS_LOG_INFO("Rebalancer: %s copy %d of %s, %ld bytes moved", ok ? "moved" : "gave up moving", index, filename.c_str(), (long) moved);
+
+        std::this_thread::sleep_for(grace);
+        if (!discards.empty()) fileserver_api_discard(membership_.address(discard_server), discards);
+        return ok;
+    }
+
+    /* Every server a copy of data chunk chunk_number is written to: its replicas, and a migration target */
+    std::vector<int> writeServers(const std::string& filename, const struct pfs_filerecipe& recipe, int chunk_number) {
+        std::vector<int> servers = readServers(recipe, chunk_number);
+        if (migration_.index >= 0 && migration_.filename == filename && migration_.index / recipe.replication == chunk_number % recipe.stripe_width) {
+            servers.push_back(migration_.target);
+        }
+        return servers;
+    }
+
+    /* Every server holding a copy of data chunk chunk_number, the first copy first */
+    static std::vector<int> readServers(const struct pfs_filerecipe& recipe, int chunk_number) {
+        std::vector<int> servers;
+        for (int r = 0; r < recipe.replication; r++) {
+            servers.push_back(recipe.replica_server(chunk_number, r));
+        }
+        return servers;
+    }
+
+    /* Whether any of chunks first to last is in chunks */
+    static bool anyChunk(const std::set<int>& chunks, int64_t first, int64_t last) {
+        if (first > INT32_MAX) return false;
+        auto it = chunks.lower_bound((int) first);
+        return it != chunks.end() && *it <= last;
+    }
+
+    /* Whether no chunk of [offset, offset + num_bytes) of a file is busy, nor, for a write, being copied by the rebalancer */
+    bool chunksIdle(const std::string& filename, int64_t offset, int64_t num_bytes, bool writing) {
+        auto file = files.find(filename);
+        if (file == files.end() || offset < 0 || num_bytes <= 0 || num_bytes > INT64_MAX - offset) return true;
+        auto busy = busy_chunks_.find(filename);
+        bool migrating = writing && migration_.filename == filename && !migration_.copying.empty();
+        if (busy == busy_chunks_.end() && !migrating) return true;
+        int64_t first = pfs_with_stripe_unit(file->second.recipe.stripe_unit, [&](auto unit) { return unit.chunk_of(offset); });
+        int64_t last = pfs_with_stripe_unit(file->second.recipe.stripe_unit, [&](auto unit) { return unit.chunk_of(offset + num_bytes - 1); });
+        return !(busy != busy_chunks_.end() && anyChunk(busy->second, first, last)) && !(migrating && anyChunk(migration_.copying, first, last));
+    }
+
+    /* Whether a file, or one sharing its storage and so maybe its chunk versions, has busy chunks */
+    bool storageBusy(const std::string& filename) {
+        auto file = files.find(filename);
+        if (file == files.end()) return false;
+        for (const auto& [name, chunks] : busy_chunks_) {
+            auto other = files.find(name);
+            if (other != files.end() && other->second.recipe.storage_name == file->second.recipe.storage_name) return true;
+        }
+        return false;
+    }
+
+    /* Holds a request for [offset, offset + num_bytes) of a file back while any of its chunks is busy, or for a write, migrating */
+    void waitForChunks(std::unique_lock<std::mutex>& lock, const std::string& filename, int64_t offset, int64_t num_bytes, bool writing) {
+        chunks_cv_.wait(lock, [&]() { return chunksIdle(filename, offset, num_bytes, writing); });
+    }
+
     Status Ping(ServerContext* context, const PingRequest* request, PingResponse* reply) override {
-        printf("%s: Received ping RPC call.\n", __func__);
+        RpcTimer timer(rpc_stats_, "Ping", context, request, reply);
+        PFS_LOG_DEBUG("%s: Received ping RPC call.", __func__);
         reply->set_message("Thanks for the Ping. I, the metaserver am alive!");
         return Status::OK;
     }
 
     Status Initialize(ServerContext* context, const InitRequest* request, InitResponse* reply) override {
-        printf("%s: Received Initialize RPC call.\n", __func__);
+        RpcTimer timer(rpc_stats_, "Initialize", context, request, reply);
+        PFS_LOG_DEBUG("%s: Received Initialize RPC call.", __func__);
         reply->set_message("Initialize successful!");
-        reply->set_client_id(next_client_id);
-        next_client_id++;
+        std::lock_guard<std::mutex> lock(mutex_);
+        reply->set_client_id(next_client_id++);
         return Status::OK;
     }
 
     Status CreateFile(ServerContext* context, const pfsmeta::CreateFileRequest* request, pfsmeta::CreateFileResponse* reply) override {        
+        RpcTimer timer(rpc_stats_, "CreateFile", context, request, reply);
         std::string filename = request->filename();
         int stripe_width = request->stripe_width();
         int client_id = request->client_id();
+        int compression = request->compression();
+        int replication = std::max(request->replication(), 1);
+        int ec_parity = request->ec_parity();
+        int stripe_unit = pfs_stripe_unit_or_default(request->stripe_unit());
 
-        if(stripe_width > NUM_FILE_SERVERS) return error("Stripe width cannot exceed the number of file servers!", reply);
-        
+        // The file servers up right now, new files only go on them
+        std::vector<int> up = membership_.up_servers();
+        int num_servers = up.size();
+        if(stripe_width > num_servers) return error("Stripe width cannot exceed the number of file servers!", reply);
+        if (compression != PFS_COMPRESSION_NONE && compression != PFS_COMPRESSION_ZLIB) return error("Unknown compression mode!", reply);
+        if (replication > num_servers) return error("Replication factor cannot exceed the number of file servers!", reply);
+        if (request->placement() < PFS_PLACEMENT_DEFAULT || request->placement() > PFS_PLACEMENT_LOAD) return error("Unknown placement policy!", reply);
+        if (!pfs_valid_stripe_unit(stripe_unit)) return error("Stripe unit must be a power of two from " + std::to_string(PFS_BLOCK_SIZE) + " to " + std::to_string(PFS_MAX_STRIPE_UNIT) + " bytes!", reply);
+        if (ec_parity < 0) return error("Parity chunk count cannot be negative!", reply);
+        if (ec_parity > 0 && stripe_width + ec_parity > num_servers) return error("Data and parity chunks of a stripe need a file server each!", reply);
+        if (ec_parity > 0 && replication > 1) return error("A file is either replicated or erasure coded, not both!", reply);
+
+        // Checked and inserted under one lock, two creates of the same name can't both get through
+        std::lock_guard<std::mutex> lock(recipe_mutex_);
         if (files.find(filename) != files.end()) return error("Cannot create file. File already exists!", reply);
             
         struct pfs_metadata file_metadata;
         struct pfs_filerecipe recipe;
         recipe.stripe_width = stripe_width;
+        recipe.stripe_unit = stripe_unit;
+        recipe.servers = placement_.place(request->placement(), filename, stripe_width + ec_parity, replication, up);
+        recipe.compression = compression;
+        recipe.replication = replication;
+        recipe.ec_parity = ec_parity;
         recipe.chunks = std::vector<struct Chunk> (); // initialize empty chunks vector      
 
+        // Chunks are stored under the name without extension, as the client names them. A name still used
+        // by snapshots of a deleted file continues at a fresh generation, never touching their versions.
+        recipe.storage_name = filename.substr(0, filename.find('.'));
+        recipe.generation = storage_files_[recipe.storage_name]++ > 0 ? ++storage_generations_[recipe.storage_name] : 0;
+        // Small files never reach the fileservers, they're spilled to chunks once they outgrow the record
+        recipe.inlined = INLINE_FILE_THRESHOLD > 0;
+        if (recipe.inlined) inline_data_[filename] = "";
+
         std::strncpy(file_metadata.filename, filename.c_str(), sizeof(file_metadata.filename) - 1);
         file_metadata.filename[sizeof(file_metadata.filename) - 1] = '\0'; // Ensure null termination
         file_metadata.file_size = 0;
@@ -91,8 +645,11 @@ public:
     }
 
     Status OpenFile(ServerContext* context, const OpenFileRequest* request, OpenFileResponse* reply) override {
-        printf("%s: Received Open RPC call to read.\n", __func__);
+        RpcTimer timer(rpc_stats_, "OpenFile", context, request, reply);
+        PFS_LOG_DEBUG("%s: Received Open RPC call to read.", __func__);
         std::string filename = request->filename();
+        // The rebalancer moves recipe slots under recipe_mutex_, the layout is read under it too
+        std::lock_guard<std::mutex> lock(recipe_mutex_);
         if(files.find(filename) == files.end()) return error("File does not exist!", reply);
         
         int client_id = request->client_id();
@@ -104,6 +661,7 @@ public:
             descriptor[fd] = {filename, MODE_READ};
             fileNameToDescriptor[filename] = fd;
             reply->set_file_descriptor(fd);
+            setLayout(files[filename].recipe, reply->mutable_layout());
             return success("File opened for you to read.", reply);
         } else if (mode == MODE_WRITE) {
             int fd = next_fd++;
@@ -111,6 +669,7 @@ public:
             descriptor[fd] = {filename, MODE_WRITE};
             fileNameToDescriptor[filename] = fd;
             reply->set_file_descriptor(fd);
+            setLayout(files[filename].recipe, reply->mutable_layout());
             return success("File opened for you to write.", reply);
         } else {
             return error("Wrong Mode", reply);
@@ -118,22 +677,26 @@ public:
     }
 
     Status FileMetadata(ServerContext* context, const FileMetadataRequest* request, FileMetadataResponse* reply) override {
-        printf("%s: Received File Metadata RPC call to read.\n", __func__);
+        RpcTimer timer(rpc_stats_, "FileMetadata", context, request, reply);
+        PFS_LOG_DEBUG("%s: Received File Metadata RPC call to read.", __func__);
         int fd = request->file_descriptor();
-        if (descriptor.find(fd) == descriptor.end()) return error("File is not open", reply);
-        std::string filename = descriptor[fd].first;
+        std::unique_lock<std::mutex> lock(recipe_mutex_);
+        auto open = descriptor.find(fd);
+        if (open == descriptor.end()) return error("File is not open", reply);
+        std::string filename = open->second.first;
         if (files.find(filename) == files.end()) return error("Something went wrong, couldn't find file", reply);
         
         int client_id = request->client_id();
 
         struct pfs_metadata meta_data = files[filename];
+        lock.unlock();
         PFSMetadata* pfs_meta = reply->mutable_meta_data();
         pfs_meta->set_filename(meta_data.filename);
         pfs_meta->set_file_size(meta_data.file_size);
         pfs_meta->set_ctime(meta_data.ctime);
         pfs_meta->set_mtime(meta_data.mtime);
         PFSFileRecipe* file_recipe = pfs_meta->mutable_recipe();
-        file_recipe->set_stripe_width(meta_data.recipe.stripe_width);
+        setLayout(meta_data.recipe, file_recipe);
 
         // Convert chunks from pfs_filerecipe to ProtoChunk
         for (const Chunk& chunk : meta_data.recipe.chunks) {
@@ -142,45 +705,101 @@ public:
             proto_chunk->set_server_number(chunk.server_number);
             proto_chunk->set_start_byte(chunk.start_byte);
             proto_chunk->set_end_byte(chunk.end_byte);
+            proto_chunk->set_version(chunk.version);
         }
 
         return success("Sent File Metadata", reply);
     }
 
     Status DeleteFile(ServerContext* context, const DeleteFileRequest* request, DeleteFileResponse* reply) override {
-        printf("%s: Received Delete File RPC call to read.\n", __func__);
+        RpcTimer timer(rpc_stats_, "DeleteFile", context, request, reply);
+        PFS_LOG_DEBUG("%s: Received Delete File RPC call to read.", __func__);
         std::string filename = request->filename();
+        // Its chunk versions may be what a fork in flight copies from, they're only freed after it
+        std::unique_lock<std::mutex> lock(recipe_mutex_);
+        chunks_cv_.wait(lock, [&]() { return !storageBusy(filename); });
         if (files.find(filename) == files.end()) return error("Something went wrong, couldn't find file", reply);
         
         int client_id = request->client_id();
 
         if (fileNameToDescriptor.find(filename) != fileNameToDescriptor.end()) return error("File is still open. Cannot Delete", reply);
-        
+
+        // Drop the file's references, only chunk versions no snapshot still uses go away
+        const struct pfs_filerecipe& recipe = files[filename].recipe;
+        const std::string& storage_name = recipe.storage_name;
+        std::vector<struct Chunk> freed;
+        for (const struct Chunk& chunk : recipe.chunks) {
+            std::string key = chunkKey(storage_name, chunk);
+            if (--chunk_refs_[key] <= 0) {
+                chunk_refs_.erase(key);
+                for (int server : readServers(recipe, chunk.chunk_number)) {
+                    freed.push_back(chunk);
+                    freed.back().server_number = server;
+                }
+            }
+        }
+        reply->set_storage_name(storage_name);
+        // Unless the storage goes and someone else may have left chunk objects there, there's nothing to clean up
+        bool storage_deleted = storage_files_[storage_name] <= 1;
+        reply->set_inlined(recipe.inlined && (!storage_deleted || storage_generations_[storage_name] == 0));
+        inline_data_.erase(filename);
+        if (--storage_files_[storage_name] <= 0) {
+            storage_files_.erase(storage_name);
+            storage_generations_.erase(storage_name);
+            reply->set_storage_deleted(true);
+        } else {
+            if (recipe.ec_parity > 0 && !recipe.chunks.empty()) {
+                // Parity chunk p of stripe s is chunk s of the parity server, in the file's generation
+                int last_stripe = 0;
+                for (const struct Chunk& chunk : recipe.chunks) last_stripe = std::max(last_stripe, chunk.chunk_number / recipe.stripe_width);
+                for (int stripe = 0; stripe <= last_stripe; stripe++) {
+                    for (int p = 0; p < recipe.ec_parity; p++) {
+                        freed.push_back(Chunk{stripe, recipe.parity_server(p), 0, 0, recipe.generation});
+                    }
+                }
+            }
+            for (const struct Chunk& chunk : freed) {
+                ProtoChunk* proto_chunk = reply->add_freed_chunks();
+                proto_chunk->set_chunk_number(chunk.chunk_number);
+                proto_chunk->set_server_number(chunk.server_number);
+                proto_chunk->set_version(chunk.version);
+            }
+        }
+
         // remove file, fds from maps
         fileNameToDescriptor.erase(filename);
         files.erase(filename);
+        {
+            std::lock_guard<std::mutex> tokens_lock(mutex_);
+            token_activity_.erase(filename);
+        }
 
         return success("File records Deleted from Metaserver", reply);
     }
 
     Status CloseFile(ServerContext* context, const pfsmeta::CloseFileRequest* request, pfsmeta::CloseFileResponse* reply) override {        
-        printf("%s: Received File Metadata RPC call to close file.\n", __func__);
+        RpcTimer timer(rpc_stats_, "CloseFile", context, request, reply);
+        PFS_LOG_DEBUG("%s: Received File Metadata RPC call to close file.", __func__);
         int fd = request->file_descriptor();
-        if (descriptor.find(fd) == descriptor.end()) return success("File may already be closed!", reply);
-        std::string filename = descriptor[fd].first;
+        std::lock_guard<std::mutex> lock(recipe_mutex_);
+        auto open = descriptor.find(fd);
+        if (open == descriptor.end()) return success("File may already be closed!", reply);
+        std::string filename = open->second.first;
 
-        files[filename].mtime = std::time(nullptr);
+        auto it = files.find(filename);
+        if (it != files.end()) it->second.mtime = std::time(nullptr);
         // remove all records of the file being open, i.e, erase from the maps.
         fileNameToDescriptor.erase(filename);
-        descriptor.erase(fd);
+        descriptor.erase(open);
 
         // delete tokens held by client, since they are closing the file now
+        std::lock_guard<std::mutex> tokens_lock(mutex_);
         auto& ranges = file_tokens_[filename]; // map<FileToken, stream>
         for (auto it = ranges.begin(); it != ranges.end(); ) {
             struct FileToken existing_token = it->first;
             auto* conflicting_stream = it->second;
             if (existing_token.client_id == request->client_id()) {
-                std::cout << "Deleting this token from my record: " << existing_token.to_string();
+                PFS_LOG_DEBUG("Deleting this token from my record: %s", existing_token.to_string().c_str());
                 it = ranges.erase(it);
             } else {
                 ++it;
@@ -191,118 +810,339 @@ public:
 
 
     Status WriteToFile(ServerContext* context, const pfsmeta::WriteToFileRequest* request, pfsmeta::WriteToFileResponse* reply) override {        
+        RpcTimer timer(rpc_stats_, "WriteToFile", context, request, reply);
         int fd = request->file_descriptor();
         std::string buf = request->buf();
-        int num_bytes = request->num_bytes();
-        int offset = request->offset();
+        int64_t num_bytes = request->num_bytes();
+        int64_t offset = request->offset();
         int client_id = request->client_id();
 
-        std::cout << "\nClient " << client_id << " requested to write: " << num_bytes << " from " << offset << std::endl << std::endl;
+        PFS_LOG_DEBUG("Client %d requested to write: %ld from %ld", client_id, (long) num_bytes, (long) offset);
         
-        if (descriptor.find(fd) == descriptor.end()) return error("File doesn't exist or is not open!", reply);
+        // Forks are copied before anyone is told where to write, concurrent writers of the chunk wait here
+        std::unique_lock<std::mutex> lock(recipe_mutex_);
+        auto open = descriptor.find(fd);
+        if (open == descriptor.end()) return error("File doesn't exist or is not open!", reply);
 
-        std::string filename = descriptor[fd].first;
+        std::string filename = open->second.first;
+        waitForChunks(lock, filename, offset, num_bytes, true);
         if (files.find(filename) == files.end()) return error("File does not exist or was already deleted!", reply);
 
         struct pfs_metadata &file_metadata = files[filename];
-        int cur_file_size = file_metadata.file_size;
+        int64_t cur_file_size = file_metadata.file_size;
         if (offset > cur_file_size) return error("Requested Offset " + std::to_string(offset) + ", cannot be greater than current file size, " + std::to_string(cur_file_size), reply);
+        if (offset < 0 || num_bytes < 0) return error("Invalid write of " + std::to_string(num_bytes) + " bytes at " + std::to_string(offset), reply);
+        if (!pfs_byte_addressable(file_metadata.recipe.stripe_unit, offset + num_bytes - 1)) return error("Write past the largest file of the stripe unit", reply);
 
-        std::vector<struct Chunk> &chunks = file_metadata.recipe.chunks;
-        int start_chunk = offset / (PFS_BLOCK_SIZE * STRIPE_BLOCKS); 
-        int end_chunk = (offset + num_bytes - 1) / (PFS_BLOCK_SIZE * STRIPE_BLOCKS);
-        int bytes_written = 0;
-
-        std::vector<struct Chunk> write_instructions;
-        for (int chunk_number = start_chunk; chunk_number <= end_chunk; chunk_number++) {
-            int start_byte_for_instruction = std::max(chunk_number * (PFS_BLOCK_SIZE * STRIPE_BLOCKS), offset); // start from the beginning of the chunk, or from the offset.
-            int end_byte_for_instruction = std::min((chunk_number + 1) * (PFS_BLOCK_SIZE * STRIPE_BLOCKS) - 1, offset + num_bytes - 1); // end of the chunk, or offset + bytes, MINIMUM
-            int server_number = chunk_number % file_metadata.recipe.stripe_width;
-
-            // check if this chunk exists
-            auto it = std::find_if(chunks.begin(), chunks.end(), [chunk_number](const Chunk& c) {
-                return c.chunk_number == chunk_number;
-            });
-            
-            struct Chunk chunk_for_instruction = Chunk{chunk_number, server_number, start_byte_for_instruction, end_byte_for_instruction};
-            bytes_written += (end_byte_for_instruction - start_byte_for_instruction + 1);
-            if (it == chunks.end()) {
-                chunks.push_back(chunk_for_instruction); // it's a brand new chunk
-                file_metadata.file_size += (end_byte_for_instruction - start_byte_for_instruction + 1);
-            } else {
-                struct Chunk& existing_chunk = *it;
-                int current_chunk_size = existing_chunk.end_byte - existing_chunk.start_byte + 1;
-                if (end_byte_for_instruction > existing_chunk.end_byte) {
-                    existing_chunk.end_byte = end_byte_for_instruction;
-                    int new_chunk_size = existing_chunk.end_byte - existing_chunk.start_byte + 1;
-                    file_metadata.file_size += (new_chunk_size - current_chunk_size);
-                }
+        reply->set_map_version(membership_.version());
+        if (file_metadata.recipe.inlined) {
+            if (offset + num_bytes <= INLINE_FILE_THRESHOLD) {
+                std::string& data = inline_data_[filename];
+                if (offset + num_bytes > (int64_t) data.size()) data.resize(offset + num_bytes);
+                data.replace(offset, num_bytes, buf, 0, num_bytes);
+                file_metadata.file_size = data.size();
+                reply->set_filename(file_metadata.recipe.storage_name);
+                reply->set_inlined(true);
+                return success("Done", reply);
             }
-            write_instructions.push_back(chunk_for_instruction);
-        }    
+            if (!spillInline(lock, filename)) return error("Failed to move " + filename + " out to the fileservers", reply);
+        }
+        std::vector<struct Chunk> forks;
+        std::vector<struct Chunk> write_instructions = planWrite(file_metadata, offset, num_bytes, forks);
+        if (!forks.empty()) {
+            // The recipe points at the new versions already, their chunks are busy until the old data is copied over
+            struct pfs_filerecipe recipe = file_metadata.recipe;
+            if (!whileBusy(lock, filename, chunkNumbers(forks), [&]() { return forkChunks(recipe, forks); })) {
+                return error("Failed to copy shared chunks of " + filename, reply);
+            }
+        }
 
-        std::cout << "\nWrite Confirmation: \n" << filename << "\n" << files[filename].to_string() << std::endl;
-        reply->set_filename(filename);
+        PFS_LOG_DEBUG("Write Confirmation: %s %s", filename.c_str(), files[filename].to_string().c_str());
+        reply->set_filename(file_metadata.recipe.storage_name);
         for (const struct Chunk &instr: write_instructions) {
             WriteInstruction* write_instruction = reply->add_instructions();
             write_instruction->set_chunk_number(instr.chunk_number);
             write_instruction->set_server_number(instr.server_number);
             write_instruction->set_start_byte(instr.start_byte);
             write_instruction->set_end_byte(instr.end_byte);
+            write_instruction->set_version(instr.version);
+            for (int server : writeServers(filename, file_metadata.recipe, instr.chunk_number)) {
+                write_instruction->add_servers(server);
+            }
         }
         return success("Done", reply);
     }
 
     Status ReadFile(ServerContext* context, const pfsmeta::ReadFileRequest* request, pfsmeta::ReadFileResponse* reply) override {        
+        RpcTimer timer(rpc_stats_, "ReadFile", context, request, reply);
         int fd = request->file_descriptor();
         std::string buf = request->buf();
-        int num_bytes = request->num_bytes();
-        int offset = request->offset();
+        int64_t num_bytes = request->num_bytes();
+        int64_t offset = request->offset();
         int client_id = request->client_id();
 
-        std::cout << "\nClient " << client_id << " requested to read: " << num_bytes << " from " << offset << std::endl << std::endl;
+        PFS_LOG_DEBUG("Client %d requested to read: %ld from %ld", client_id, (long) num_bytes, (long) offset);
         
-        if (descriptor.find(fd) == descriptor.end()) return error("File doesn't exist or is not open!", reply);
+        std::unique_lock<std::mutex> lock(recipe_mutex_);
+        auto open = descriptor.find(fd);
+        if (open == descriptor.end()) return error("File doesn't exist or is not open!", reply);
 
-        std::string filename = descriptor[fd].first;
+        std::string filename = open->second.first;
+        waitForChunks(lock, filename, offset, num_bytes, false);
         if (files.find(filename) == files.end()) return error("File does not exist or was already deleted!", reply);
 
         struct pfs_metadata &file_metadata = files[filename];
-        std::vector<struct Chunk> &chunks = file_metadata.recipe.chunks;
-        int start_chunk = offset / (PFS_BLOCK_SIZE * STRIPE_BLOCKS); 
-        int end_chunk = (offset + num_bytes - 1) / (PFS_BLOCK_SIZE * STRIPE_BLOCKS);
-        int bytes_read = 0;
-
-        std::vector<struct Chunk> read_instructions;
-        for (int chunk_number = start_chunk; chunk_number <= end_chunk; chunk_number++) {
-            int start_byte_for_instruction = std::max(chunk_number * (PFS_BLOCK_SIZE * STRIPE_BLOCKS), offset); // start from the beginning of the chunk, or from the offset.
-            int end_byte_for_instruction = std::min((chunk_number + 1) * (PFS_BLOCK_SIZE * STRIPE_BLOCKS) - 1, std::min((int) file_metadata.file_size - 1, offset + num_bytes - 1)); // end of the chunk, or end of file or, offset + bytes, MINIMUM
-            int server_number = chunk_number % file_metadata.recipe.stripe_width;
-
-            // check if this chunk exists
-            auto it = std::find_if(chunks.begin(), chunks.end(), [chunk_number](const Chunk& c) {
-                return c.chunk_number == chunk_number;
-            });
-            
-            struct Chunk chunk_for_instruction = Chunk{chunk_number, server_number, start_byte_for_instruction, end_byte_for_instruction};
-            if (it == chunks.end()) {
-                break;
-            }
-            bytes_read += (end_byte_for_instruction - start_byte_for_instruction + 1);
-            read_instructions.push_back(chunk_for_instruction);
-        }    
+        reply->set_map_version(membership_.version());
+        if (file_metadata.recipe.inlined) {
+            const std::string& data = inline_data_[filename];
+            reply->set_filename(file_metadata.recipe.storage_name);
+            reply->set_inlined(true);
+            if (offset >= 0 && offset < (int64_t) data.size()) reply->set_inline_data(data.substr(offset, num_bytes));
+            return success("Done", reply);
+        }
+        std::vector<struct Chunk> read_instructions = pfs_plan_read(file_metadata, offset, num_bytes);
 
-        reply->set_filename(filename); 
+        reply->set_filename(file_metadata.recipe.storage_name);
         for (const struct Chunk &instr: read_instructions) {
             ReadInstruction* read_instruction = reply->add_instructions();
             read_instruction->set_chunk_number(instr.chunk_number);
             read_instruction->set_server_number(instr.server_number);
             read_instruction->set_start_byte(instr.start_byte);
             read_instruction->set_end_byte(instr.end_byte);
+            read_instruction->set_version(instr.version);
+            for (int server : readServers(file_metadata.recipe, instr.chunk_number)) {
+                read_instruction->add_servers(server);
+            }
+        }
+        return success("Done", reply);
+    }
+
+    /* Plans a server-side copy: pieces that each lie within one source and one destination chunk */
+    Status CopyFile(ServerContext* context, const pfsmeta::CopyFileRequest* request, pfsmeta::CopyFileResponse* reply) override {
+        RpcTimer timer(rpc_stats_, "CopyFile", context, request, reply);
+        int src_fd = request->src_file_descriptor();
+        int dst_fd = request->dst_file_descriptor();
+        int64_t src_offset = request->src_offset();
+        int64_t dst_offset = request->dst_offset();
+        int64_t num_bytes = request->num_bytes();
+        int client_id = request->client_id();
+
+        PFS_LOG_DEBUG("Client %d requested to copy: %ld from %ld of fd %d to %ld of fd %d", client_id, (long) num_bytes, (long) src_offset,
+                      src_fd, (long) dst_offset, dst_fd);
+
+        std::unique_lock<std::mutex> lock(recipe_mutex_);
+        auto src_open = descriptor.find(src_fd), dst_open = descriptor.find(dst_fd);
+        if (src_open == descriptor.end() || dst_open == descriptor.end()) return error("File doesn't exist or is not open!", reply);
+
+        std::string src_filename = src_open->second.first;
+        std::string dst_filename = dst_open->second.first;
+        chunks_cv_.wait(lock, [&]() {
+            return chunksIdle(src_filename, src_offset, num_bytes, false) && chunksIdle(dst_filename, dst_offset, num_bytes, true);
+        });
+        if (files.find(src_filename) == files.end() || files.find(dst_filename) == files.end()) return error("File does not exist or was already deleted!", reply);
+
+        struct pfs_metadata &src_metadata = files[src_filename];
+        struct pfs_metadata &dst_metadata = files[dst_filename];
+        int64_t src_file_size = src_metadata.file_size;
+        int64_t dst_file_size = dst_metadata.file_size;
+        if (src_offset >= src_file_size) return error("Requested Offset " + std::to_string(src_offset) + " is past the end of the source, " + std::to_string(src_file_size), reply);
+        if (dst_offset > dst_file_size) return error("Requested Offset " + std::to_string(dst_offset) + ", cannot be greater than current file size, " + std::to_string(dst_file_size), reply);
+        if (src_offset < 0 || dst_offset < 0 || num_bytes < 0) return error("Invalid copy of " + std::to_string(num_bytes) + " bytes", reply);
+
+        num_bytes = std::min(num_bytes, src_file_size - src_offset);
+        if (!pfs_byte_addressable(dst_metadata.recipe.stripe_unit, dst_offset + num_bytes - 1)) return error("Copy past the largest file of the stripe unit", reply);
+        if (src_filename == dst_filename && src_offset < dst_offset + num_bytes && dst_offset < src_offset + num_bytes) {
+            return error("Source and destination ranges overlap!", reply);
+        }
+        if (num_bytes <= 0) return success("Nothing to copy", reply);
+
+        reply->set_map_version(membership_.version());
+        reply->set_bytes_copied(num_bytes);
+        reply->set_src_storage_name(src_metadata.recipe.storage_name);
+        reply->set_dst_storage_name(dst_metadata.recipe.storage_name);
+        if (src_metadata.recipe.inlined) {
+            // The source is right here: nothing for the client to do, the data goes inline or out to the chunks from here
+            std::string data = inline_data_[src_filename].substr(src_offset, num_bytes);
+            if (dst_metadata.recipe.inlined && dst_offset + num_bytes <= INLINE_FILE_THRESHOLD) {
+                std::string& dst_data = inline_data_[dst_filename];
+                if (dst_offset + num_bytes > (int64_t) dst_data.size()) dst_data.resize(dst_offset + num_bytes);
+                dst_data.replace(dst_offset, num_bytes, data);
+                dst_metadata.file_size = dst_data.size();
+                reply->set_inlined(true);
+                return success("Done", reply);
+            }
+            if (dst_metadata.recipe.inlined && !spillInline(lock, dst_filename)) return error("Failed to move " + dst_filename + " out to the fileservers", reply);
+            std::vector<struct Chunk> forks;
+            std::vector<struct Chunk> dst_instructions = planWrite(dst_metadata, dst_offset, num_bytes, forks);
+            for (struct Chunk& chunk : dst_instructions) {
+                chunk.servers = writeServers(dst_filename, dst_metadata.recipe, chunk.chunk_number);
+            }
+            struct pfs_filerecipe recipe = dst_metadata.recipe;
+            bool forked = false;
+            bool written = whileBusy(lock, dst_filename, chunkNumbers(dst_instructions), [&]() {
+                forked = forkChunks(recipe, forks);
+                return forked && writeChunks(recipe, dst_instructions, data, dst_offset);
+            });
+            if (!forked) return error("Failed to copy shared chunks of " + dst_filename, reply);
+            if (!written) return error("Failed to write " + dst_filename, reply);
+            return success("Done", reply);
         }
+        if (dst_metadata.recipe.inlined && !spillInline(lock, dst_filename)) return error("Failed to move " + dst_filename + " out to the fileservers", reply);
+
+        std::vector<struct Chunk> forks;
+        std::vector<struct Chunk> src_instructions = pfs_plan_read(src_metadata, src_offset, num_bytes);
+        std::vector<struct Chunk> dst_instructions = planWrite(dst_metadata, dst_offset, num_bytes, forks);
+        if (!forks.empty()) {
+            struct pfs_filerecipe recipe = dst_metadata.recipe;
+            if (!whileBusy(lock, dst_filename, chunkNumbers(forks), [&]() { return forkChunks(recipe, forks); })) {
+                return error("Failed to copy shared chunks of " + dst_filename, reply);
+            }
+        }
+
+        // Walk both chunk lists at once, cutting wherever either side crosses a chunk boundary
+        size_t s = 0, d = 0;
+        int64_t src_pos = src_instructions[0].start_byte, dst_pos = dst_instructions[0].start_byte;
+        while (s < src_instructions.size() && d < dst_instructions.size()) {
+            int64_t length = std::min(src_instructions[s].end_byte - src_pos, dst_instructions[d].end_byte - dst_pos) + 1;
+            CopyInstruction* copy_instruction = reply->add_instructions();
+            copy_instruction->set_src_chunk_number(src_instructions[s].chunk_number);
+            copy_instruction->set_src_server_number(src_instructions[s].server_number);
+            copy_instruction->set_src_start_byte(src_pos);
+            copy_instruction->set_src_end_byte(src_pos + length - 1);
+            copy_instruction->set_dst_chunk_number(dst_instructions[d].chunk_number);
+            copy_instruction->set_dst_server_number(dst_instructions[d].server_number);
+            copy_instruction->set_dst_start_byte(dst_pos);
+            copy_instruction->set_src_version(src_instructions[s].version);
+            copy_instruction->set_dst_version(dst_instructions[d].version);
+            for (int server : writeServers(dst_filename, dst_metadata.recipe, dst_instructions[d].chunk_number)) {
+                copy_instruction->add_dst_servers(server);
+            }
+
+            src_pos += length;
+            dst_pos += length;
+            if (src_pos > src_instructions[s].end_byte && ++s < src_instructions.size()) src_pos = src_instructions[s].start_byte;
+            if (dst_pos > dst_instructions[d].end_byte && ++d < dst_instructions.size()) dst_pos = dst_instructions[d].start_byte;
+        }
+
+        PFS_LOG_DEBUG("Copy Confirmation: %s %s", dst_filename.c_str(), files[dst_filename].to_string().c_str());
         return success("Done", reply);
     }
 
+    /* Copy-on-write snapshot: shares every chunk of the file, O(number of chunks) and no data is copied */
+    Status SnapshotFile(ServerContext* context, const pfsmeta::SnapshotFileRequest* request, pfsmeta::SnapshotFileResponse* reply) override {
+        RpcTimer timer(rpc_stats_, "SnapshotFile", context, request, reply);
+        PFS_LOG_DEBUG("%s: Received Snapshot File RPC call.", __func__);
+        std::string filename = request->filename();
+        std::string snapshot_name = request->snapshot_name();
+        // A fork in flight would leave the snapshot sharing a version still being copied
+        std::unique_lock<std::mutex> lock(recipe_mutex_);
+        chunks_cv_.wait(lock, [&]() { return !storageBusy(filename); });
+        if (files.find(filename) == files.end()) return error("File does not exist!", reply);
+        if (files.find(snapshot_name) != files.end()) return error("Cannot create snapshot. File already exists!", reply);
+
+        struct pfs_metadata& source = files[filename];
+        if (source.recipe.ec_parity > 0) return error("Erasure-coded files can't be snapshotted, their parity isn't versioned!", reply);
+
+        struct pfs_metadata snapshot = source;
+        std::strncpy(snapshot.filename, snapshot_name.c_str(), sizeof(snapshot.filename) - 1);
+        snapshot.filename[sizeof(snapshot.filename) - 1] = '\0';
+        snapshot.ctime = std::time(nullptr);
+        snapshot.mtime = 0;
+
+        const std::string& storage_name = source.recipe.storage_name;
+        for (const struct Chunk& chunk : source.recipe.chunks) {
+            chunk_refs_[chunkKey(storage_name, chunk)]++;
+        }
+        storage_files_[storage_name]++;
+        // Both write new versions from here on, what's there now stays shared until one of them overwrites it
+        source.recipe.generation = ++storage_generations_[storage_name];
+        snapshot.recipe.generation = ++storage_generations_[storage_name];
+        files[snapshot_name] = snapshot;
+        if (source.recipe.inlined) inline_data_[snapshot_name] = inline_data_[filename];
+
+        return success("Snapshot " + snapshot_name + " of " + filename + " created.\n", reply);
+    }
+
+    /* A fileserver joining, or coming back: the same id for an address the map already has */
+    Status RegisterFileserver(ServerContext* context, const RegisterRequest* request, RegisterResponse* reply) override {
+        RpcTimer timer(rpc_stats_, "RegisterFileserver", context, request, reply);
+        PFS_LOG_DEBUG("%s: Received RegisterFileserver RPC call from %s.", __func__, request->address().c_str());
+        if (request->address().empty()) return error("A fileserver registers with its address!", reply);
+        bool joined = false;
+        reply->set_server_id(membership_.join(request->address(), &joined));
+        reply->set_map_version(membership_.version());
+        if (joined) {
+            // A new server only has what new files put on it, move some of the existing chunks over
+            std::lock_guard<std::mutex> lock(background_mutex_);
+            rebalance_requested_ = true;
+            background_cv_.notify_all();
+        }
+        return success("Registered", reply);
+    }
+
+    Status Heartbeat(ServerContext* context, const HeartbeatRequest* request, HeartbeatResponse* reply) override {
+        RpcTimer timer(rpc_stats_, "Heartbeat", context, request, reply);
+        int server_id = request->server_id();
+        // An id from before a metaserver restart may belong to someone else now
+        bool known = membership_.address(server_id) == request->address() && membership_.heartbeat(server_id);
+        reply->set_registered(known);
+        reply->set_map_version(membership_.version());
+        if (known) placement_.report(server_id, request->capacity_bytes(), request->available_bytes(), request->requests_served());
+        return success(known ? "Alive" : "Unknown fileserver, register again", reply);
+    }
+
+    Status GetClusterMap(ServerContext* context, const ClusterMapRequest* request, ClusterMapResponse* reply) override {
+        RpcTimer timer(rpc_stats_, "GetClusterMap", context, request, reply);
+        uint64_t version;
+        std::vector<FileserverMember> members = membership_.members(&version);
+        reply->set_map_version(version);
+        for (int id = 0; id < (int) members.size(); id++) {
+            pfsmeta::ClusterMember* member = reply->add_members();
+            member->set_server_id(id);
+            member->set_address(members[id].address);
+            member->set_state(members[id].state);
+        }
+        return success("Cluster map", reply);
+    }
+
+    Status GetStats(ServerContext* context, const StatsRequest* request, StatsResponse* reply) override {
+        RpcTimer timer(rpc_stats_, "GetStats", context, request, reply);
+        rpc_stats_.report(reply);
+        {
+            std::lock_guard<std::mutex> lock(recipe_mutex_);
+            reply->set_files(files.size());
+            reply->set_open_files(descriptor.size());
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t tokens = 0;
+        for (const auto& [filename, ranges] : file_tokens_) tokens += ranges.size();
+        reply->set_tokens(tokens);
+        reply->set_token_streams(client_streams_.size());
+        // The most revoked files first, the busiest among equals
+        std::vector<std::pair<std::string, TokenActivity>> contended(token_activity_.begin(), token_activity_.end());
+        size_t top = std::min<size_t>(contended.size(), STATS_TOP_FILES);
+        std::partial_sort(contended.begin(), contended.begin() + top, contended.end(), [](const auto& a, const auto& b) {
+            return a.second.revocations != b.second.revocations ? a.second.revocations > b.second.revocations
+                                                                : a.second.requests > b.second.requests;
+        });
+        for (size_t i = 0; i < top; i++) {
+            FileContention* file = reply->add_contended_files();
+            file->set_filename(contended[i].first);
+            auto it = file_tokens_.find(contended[i].first);
+            file->set_tokens(it == file_tokens_.end() ? 0 : it->second.size());
+            file->set_token_requests(contended[i].second.requests);
+            file->set_revocations(contended[i].second.revocations);
+        }
+        return success("Stats collected", reply);
+    }
+
+    Status GetTrace(ServerContext* context, const TraceRequest* request, TraceResponse* reply) override {
+        RpcTimer timer(rpc_stats_, "GetTrace", context, request, reply);
+        trace_report(reply, request->trace_id(), getpid());
+        return success("Trace collected", reply);
+    }
+
     Status TokenStream(ServerContext* context, ServerReaderWriter<ServerNotification, TokenRequest>* stream) override {
         std::string client_id;
         // Store the stream for this client
@@ -315,9 +1155,15 @@ public:
         TokenRequest request;
         while (stream->Read(&request)) {
             int fd = request.file_descriptor();
-            if (descriptor.find(fd) == descriptor.end()) return Status(grpc::StatusCode::INVALID_ARGUMENT, "Please open the file first\n");
-
-            std::string filename = descriptor[fd].first;
+            std::string filename;
+            {
+                std::lock_guard<std::mutex> lock(recipe_mutex_);
+                auto open = descriptor.find(fd);
+                if (open == descriptor.end()) return Status(grpc::StatusCode::INVALID_ARGUMENT, "Please open the file first\n");
+                filename = open->second.first;
+            }
+            // Grants and revocations go out on the stream, there is no reply to measure
+            RpcTimer timer(rpc_stats_, "TokenRequest", context, &request, static_cast<const ServerNotification*>(nullptr));
             handleTokenRequest(filename, request, stream);
         }
 
@@ -330,59 +1176,52 @@ public:
     }
 
     void handleTokenRequest(std::string filename, const TokenRequest& request, ServerReaderWriter<ServerNotification, TokenRequest>* stream) {
-        int start_byte = request.start_byte();
-        int end_byte = request.end_byte();
+        int64_t start_byte = request.start_byte();
+        int64_t end_byte = request.end_byte();
         int type = request.type();
         int client_id = request.client_id();
         
-        std::cout << "Receieved token request from " << client_id << " for " << filename << (type == 1 ? " read " : " write ") << start_byte << "-" << end_byte << std::endl;
+        PFS_LOG_DEBUG("Receieved token request from %d for %s %s %ld-%ld", client_id, filename.c_str(), type == 1 ? "read" : "write",
+                      (long) start_byte, (long) end_byte);
 
         FileToken requested_range{start_byte, end_byte, type, client_id};
 
         std::unique_lock<std::mutex> lock(mutex_);
 
         auto& ranges = file_tokens_[filename]; // map<FileToken, stream>
-        for (auto it = ranges.begin(); it != ranges.end(); ) {
-            struct FileToken existing_token = it->first;
-            auto* conflicting_stream = it->second;
-
-            std::cout << "Checking Ranges for Overlap: " << existing_token.start_byte << "-" << existing_token.end_byte << " VS " << start_byte << "-" << end_byte << std::endl;
-            if (existing_token.client_id != client_id && existing_token.overlaps(requested_range)) {
-                std::cout << "They Overlap" << std::endl;
-                std::vector<FileToken> new_ranges = existing_token.subtract(requested_range);
+        TokenActivity& activity = token_activity_[filename];
+        activity.requests++;
+        pfs_revoke_overlapping(ranges, requested_range, [&](const FileToken& existing_token, auto* conflicting_stream,
+                                                            const std::vector<FileToken>& new_ranges) {
+            activity.revocations++;
+            PFS_LOG_DEBUG("Sending revocation of %ld-%ld to client %d", (long) existing_token.start_byte, (long) existing_token.end_byte,
+                          existing_token.client_id);
+            ServerNotification notification;
+            auto* revocation = notification.mutable_revocation();
+            revocation->set_filename(filename);
 
-                std::cout << "Sending revocation to client " << existing_token.client_id << std::endl;
-                ServerNotification notification;
-                auto* revocation = notification.mutable_revocation();
-                revocation->set_filename(filename);
+            auto* new_token = revocation->add_new_tokens();
+            new_token->set_start_byte(existing_token.start_byte);
+            new_token->set_end_byte(existing_token.end_byte);
+            new_token->set_type(existing_token.type);
+            new_token->set_client_id(existing_token.client_id);
 
+            for (const auto& range : new_ranges) {
                 auto* new_token = revocation->add_new_tokens();
-                new_token->set_start_byte(existing_token.start_byte);
-                new_token->set_end_byte(existing_token.end_byte);
-                new_token->set_type(existing_token.type);
-                new_token->set_client_id(existing_token.client_id);
-
-                for (const auto& range : new_ranges) {
-                    auto* new_token = revocation->add_new_tokens();
-                    new_token->set_start_byte(range.start_byte);
-                    new_token->set_end_byte(range.end_byte);
-                    new_token->set_type(range.type);
-                    new_token->set_client_id(range.client_id);
-                }
-                conflicting_stream->Write(notification);
-                it = ranges.erase(it);
-            } else {
-                std::cout << "They don't overlap" << std::endl;
-                ++it;
+                new_token->set_start_byte(range.start_byte);
+                new_token->set_end_byte(range.end_byte);
+                new_token->set_type(range.type);
+                new_token->set_client_id(range.client_id);
             }
-        }
+            conflicting_stream->Write(notification);
+        });
         ranges[requested_range] = stream;
         sendGrant(stream, filename, requested_range, client_id, type);
     }
 
     void sendGrant(ServerReaderWriter<ServerNotification, TokenRequest>* stream,
                    const std::string& filename, const FileToken& range, int client_id, int type) {
-        std::cout << "Granting to this client, i.e, " << client_id << std::endl;
+        PFS_LOG_DEBUG("Granting to this client, i.e, %d", client_id);
         ServerNotification notification;
         auto* grant = notification.mutable_grant();
         grant->set_start_byte(range.start_byte);
@@ -394,8 +1233,8 @@ public:
     }
 };
 
-void RunGRPCServer(const std::string& listen_port) {
-    PFSMetadataServerImpl service;
+void RunGRPCServer(const std::string& listen_port, const std::string& list_path) {
+    PFSMetadataServerImpl service(list_path);
     std::string server_address = "0.0.0.0:" + listen_port;
 
     // Build and start the server
@@ -404,38 +1243,63 @@ void RunGRPCServer(const std::string& listen_port) {
     builder.RegisterService(&service);
 
     std::unique_ptr<Server> server(builder.BuildAndStart());
-    printf("PFS Metadata Server listening on %s\n", server_address.c_str());
+    PFS_LOG_INFO("PFS Metadata Server listening on %s", server_address.c_str());
     server->Wait();
 }
 
+static void print_usage(const char *program) {
+    fprintf(stderr, "usage: %s [--list <pfs_list.txt>] [--port <port>]\n"
+                    "  --list  cluster list, default $PFS_LIST or ../pfs_list.txt\n"
+                    "  --port  listen on this port instead of the one of the first line, which then\n"
+                    "          doesn't have to be this host (e.g. a local cluster on localhost)\n", program);
+}
+
 int main(int argc, char *argv[]) {
-    printf("%s:%s: PFS meta server start! Hostname: %s, IP: %s\n", __FILE__,
-           __func__, getMyHostname().c_str(), getMyIP().c_str());
+    PFS_LOG_INFO("%s:%s: PFS meta server start! Hostname: %s, IP: %s", __FILE__, __func__, getMyHostname().c_str(), getMyIP().c_str());
+
+    std::string list_path = pfs_list_path("../pfs_list.txt");
+    std::string listen_port;
+    static struct option options[] = {
+        {"list", required_argument, nullptr, 'l'},
+        {"port", required_argument, nullptr, 'p'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "l:p:h", options, nullptr)) != -1) {
+        switch (opt) {
+            case 'l': list_path = optarg; break;
+            case 'p': listen_port = optarg; break;
+            default: print_usage(argv[0]); exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
 
     // Parse pfs_list.txt
-    std::ifstream pfs_list("../pfs_list.txt");
+    std::ifstream pfs_list(list_path);
     if (!pfs_list.is_open()) {
-        fprintf(stderr, "%s: can't open pfs_list.txt file.\n", __func__);
+        fprintf(stderr, "%s: can't open %s.\n", __func__, list_path.c_str());
         exit(EXIT_FAILURE);
     }
 
     std::string line;
     std::getline(pfs_list, line);
-    if (line.substr(0, line.find(':')) != getMyHostname()) {
-        fprintf(stderr, "%s: hostname not on the first line of pfs_list.txt.\n",
-                __func__);
-        exit(EXIT_FAILURE);
-    }
     pfs_list.close();
-    std::string listen_port = line.substr(line.find(':') + 1);
+    if (listen_port.empty()) {
+        if (line.substr(0, line.find(':')) != getMyHostname()) {
+            fprintf(stderr, "%s: hostname not on the first line of pfs_list.txt.\n",
+                    __func__);
+            exit(EXIT_FAILURE);
+        }
+        listen_port = line.substr(line.find(':') + 1);
+    }
 
     // Run the PFS metadata server and listen to requests
-    printf("%s: Launching PFS metadata server on %s, with listen port %s...\n",
-           __func__, getMyHostname().c_str(), listen_port.c_str());
+    PFS_LOG_INFO("%s: Launching PFS metadata server on %s, with listen port %s...", __func__, getMyHostname().c_str(),
+                 listen_port.c_str());
 
     // Do something...
-    RunGRPCServer(listen_port);
+    RunGRPCServer(listen_port, list_path);
 
-    printf("%s:%s: PFS meta server done!\n", __FILE__, __func__);
+    PFS_LOG_INFO("%s:%s: PFS meta server done!", __FILE__, __func__);
     return 0;
 }
@@ -3,10 +3,16 @@
 #include "pfs_proto/pfs_metaserver.pb.h"
 #include "pfs_client/pfs_api.hpp"
 #include "pfs_client/pfs_cache.hpp"
+#include "pfs_client/pfs_tokens.hpp"
+#include "pfs_common/pfs_layout.hpp"
+#include "pfs_common/pfs_client_stats.hpp"
+#include "pfs_common/pfs_log.hpp"
 #include <grpcpp/grpcpp.h>
+#include <atomic>
 
 std::unordered_map<std::string, std::set<FileToken>> my_tokens;
 std::unordered_map<int, std::string> descriptor_to_filename; // maps descriptor to filename
+std::unordered_map<int, struct pfs_filerecipe> descriptor_to_layout; // maps descriptor to its file's layout, no chunks
 int this_client_id;
 std::unique_ptr<grpc::ClientReaderWriter<pfsmeta::TokenRequest, pfsmeta::ServerNotification>> stream;
 
@@ -19,13 +25,23 @@ struct FileSync {
 // <filename, type> --> FileSync object
 std::map<std::pair<std::string, int>, FileSync> file_sync_map;
 
+// Cluster map, fetched again once a metaserver reply shows a newer version
+std::mutex cluster_map_mutex;
+struct pfs_cluster_map cluster_map;
+std::atomic<uint64_t> latest_map_version{0};
+
+static void saw_map_version(uint64_t version) {
+    uint64_t latest = latest_map_version.load();
+    while (version > latest && !latest_map_version.compare_exchange_weak(latest, version)) {}
+}
+
 std::unique_ptr<pfsmeta::PFSMetadataServer::Stub> connect_to_metaserver() {
     // Step 0: Read the server's address and port from a file or configuration
     std::filesystem::path current_path = std::filesystem::current_path();
 
-    std::ifstream config_file("pfs_list.txt");
+    std::ifstream config_file(pfs_list_path("pfs_list.txt"));
     if (!config_file.is_open()) {
-        std::cerr << "Failed to open config file!" << std::endl;
+        PFS_LOG_ERROR("Failed to open config file!");
         return nullptr;
     }
     std::string server_address;
@@ -42,13 +58,11 @@ std::unique_ptr<pfsmeta::PFSMetadataServer::Stub> connect_to_metaserver() {
 void listenForNotifications(grpc::ClientReaderWriter<pfsmeta::TokenRequest, pfsmeta::ServerNotification>* stream) {
     pfsmeta::ServerNotification notification;
     while (stream->Read(&notification)) {
-        std::cout << "\n\nHave received a notification" << std::endl;
         // Process notifications (grants or revocations)
         if (notification.has_grant()) {
             const auto& grant = notification.grant();
-            std::cout << "Received token grant for filename " << grant.filename() << ": ["
-                      << grant.start_byte() << "-"
-                      << grant.end_byte() << "]\n";
+            PFS_LOG_DEBUG("Received token grant for filename %s: [%ld-%ld]", grant.filename().c_str(), (long) grant.start_byte(),
+                          (long) grant.end_byte());
             FileToken granted_token = {grant.start_byte(), grant.end_byte(), grant.type(), grant.client_id()};
 
             my_tokens[grant.filename()].insert(granted_token);
@@ -61,7 +75,7 @@ void listenForNotifications(grpc::ClientReaderWriter<pfsmeta::TokenRequest, pfsm
             file_sync.cv.notify_one();  
         } else if (notification.has_revocation()) {
             const auto& revocation = notification.revocation();
-            std::cout << "Received token revocation for filename " << revocation.filename() << "\n";
+            PFS_LOG_DEBUG("Received token revocation for filename %s", revocation.filename().c_str());
             bool first = true;
             for (const auto& range : revocation.new_tokens()) {
                 if (first) {
@@ -72,7 +86,7 @@ void listenForNotifications(grpc::ClientReaderWriter<pfsmeta::TokenRequest, pfsm
                     /* Finally, invalidate the token */
                     my_tokens[revocation.filename()].erase(revoked_token);
                 } else {
-                    std::cout << "\nGranting Split: [" << range.start_byte() << "-" << range.end_byte() << "]\n";
+                    PFS_LOG_DEBUG("Granting Split: [%ld-%ld]", (long) range.start_byte(), (long) range.end_byte());
                     FileToken split_token = {range.start_byte(), range.end_byte(), range.type(), this_client_id};
                     if (range.start_byte() <= range.end_byte()) {
                         my_tokens[revocation.filename()].insert(split_token);
@@ -80,14 +94,13 @@ void listenForNotifications(grpc::ClientReaderWriter<pfsmeta::TokenRequest, pfsm
                 }
             }
         }
-        std::cout << std::endl;
     }
 }
 
 void Run(int client_id) {
     auto stub = connect_to_metaserver();
     if (!stub) {
-        std::cout << "Failed to connect to metaserver" << std::endl;
+        PFS_LOG_ERROR("Failed to connect to metaserver");
         return;
     }
     grpc::ClientContext *context = new grpc::ClientContext();
@@ -101,10 +114,11 @@ void Run(int client_id) {
 }
 
 int metaserver_api_initialize() {
-    printf("%s: called.\n", __func__);
+    PFS_LOG_DEBUG("%s: called.", __func__);
+    ClientStatTimer timer(PFS_STAT_META_INITIALIZE);
     auto stub = connect_to_metaserver();
     if (!stub) {
-        std::cout << "Failed to connect to metaserver" << std::endl;
+        PFS_LOG_ERROR("Failed to connect to metaserver");
         return -1;
     }
 
@@ -112,52 +126,61 @@ int metaserver_api_initialize() {
     pfsmeta::InitResponse response;
 
     grpc::ClientContext context;
+    trace_inject(context);
     
     grpc::Status status = stub->Initialize(&context, request, &response);
     if (status.ok()) {
-        printf("Initialize RPC succeeded: %s\n", response.message().c_str());
+        PFS_LOG_DEBUG("Initialize RPC succeeded: %s", response.message().c_str());
 
         this_client_id = response.client_id();
         Run(this_client_id);
         return this_client_id;
     } else {
-        fprintf(stderr, "Initialize RPC failed: %s\n", status.error_message().c_str());
+        PFS_LOG_ERROR("Initialize RPC failed: %s", status.error_message().c_str());
         return -1;
     }
 }
 
-int metaserver_api_create(const char *filename, int stripe_width, int client_id) {
-    printf("%s: called to create file.\n", __func__);
+int metaserver_api_create(const char *filename, int stripe_width, const struct pfs_create_options &options, int client_id) {
+    PFS_LOG_DEBUG("%s: called to create file.", __func__);
+    ClientStatTimer timer(PFS_STAT_META_CREATE_FILE);
 
     auto stub = connect_to_metaserver();
     if (!stub) {
-        std::cout << "Failed to connect to metaserver" << std::endl;
+        PFS_LOG_ERROR("Failed to connect to metaserver");
         return -1;
     }
 
     pfsmeta::CreateFileRequest request; pfsmeta::CreateFileResponse response;
     request.set_filename(filename);
     request.set_stripe_width(stripe_width);
+    request.set_compression(options.compression);
+    request.set_replication(options.replication);
+    request.set_ec_parity(options.ec_parity);
+    request.set_stripe_unit(options.stripe_unit);
+    request.set_placement(options.placement);
     request.set_client_id(client_id);
 
     grpc::ClientContext context;
+    trace_inject(context);
 
     grpc::Status status = stub->CreateFile(&context, request, &response);
     if (status.ok()) {
-        printf("CreateFile RPC succeeded: %s\n", response.message().c_str());
+        PFS_LOG_DEBUG("CreateFile RPC succeeded: %s", response.message().c_str());
         return 0;
     } else {
-        fprintf(stderr, "CreateFile RPC failed: %s\n", status.error_message().c_str());
+        PFS_LOG_ERROR("CreateFile RPC failed: %s", status.error_message().c_str());
         return -1;
     }
 }
 
 int metaserver_api_open(const char *filename, int mode, int client_id) {
-    printf("%s: called to open file.\n", __func__);
+    PFS_LOG_DEBUG("%s: called to open file.", __func__);
+    ClientStatTimer timer(PFS_STAT_META_OPEN_FILE);
 
     auto stub = connect_to_metaserver();
     if (!stub) {
-        std::cout << "Failed to connect to metaserver" << std::endl;
+        PFS_LOG_ERROR("Failed to connect to metaserver");
         return -1;
     }
 
@@ -167,25 +190,38 @@ int metaserver_api_open(const char *filename, int mode, int client_id) {
     request.set_client_id(client_id);
 
     grpc::ClientContext context;
+    trace_inject(context);
 
     grpc::Status status = stub->OpenFile(&context, request, &response);
     if (status.ok()) {
-        printf("OpenFile RPC succeeded: %s\n", response.message().c_str());
+        PFS_LOG_DEBUG("OpenFile RPC succeeded: %s", response.message().c_str());
         int received_fd = response.file_descriptor();
         descriptor_to_filename[received_fd] = filename;
+        struct pfs_filerecipe layout;
+        layout.stripe_width = response.layout().stripe_width();
+        layout.stripe_unit = pfs_stripe_unit_or_default(response.layout().stripe_unit());
+        layout.compression = response.layout().compression();
+        layout.replication = std::max(response.layout().replication(), 1);
+        layout.ec_parity = response.layout().ec_parity();
+        layout.storage_name = response.layout().storage_name();
+        layout.generation = response.layout().generation();
+        layout.inlined = response.layout().inlined();
+        layout.servers.assign(response.layout().servers().begin(), response.layout().servers().end());
+        descriptor_to_layout[received_fd] = layout;
         return received_fd;
     } else {
-        fprintf(stderr, "OpenFile RPC failed: %s\n", status.error_message().c_str());
+        PFS_LOG_ERROR("OpenFile RPC failed: %s", status.error_message().c_str());
     }
     return -1;
 }
 
 int metaserver_api_close(int file_descriptor, int client_id) {
-    printf("%s: called to close file.\n", __func__);
+    PFS_LOG_DEBUG("%s: called to close file.", __func__);
+    ClientStatTimer timer(PFS_STAT_META_CLOSE_FILE);
 
     auto stub = connect_to_metaserver();
     if (!stub) {
-        std::cout << "Failed to connect to metaserver" << std::endl;
+        PFS_LOG_ERROR("Failed to connect to metaserver");
         return -1;
     }
 
@@ -194,40 +230,46 @@ int metaserver_api_close(int file_descriptor, int client_id) {
     request.set_client_id(client_id);
 
     grpc::ClientContext context;
+    trace_inject(context);
 
     grpc::Status status = stub->CloseFile(&context, request, &response);
     if (status.ok()) {
-        printf("CloseFile RPC succeeded: %s\n", response.message().c_str());
+        PFS_LOG_DEBUG("CloseFile RPC succeeded: %s", response.message().c_str());
         return 0;
     } else {
-        fprintf(stderr, "CreateFile RPC failed: %s\n", status.error_message().c_str());
+        PFS_LOG_ERROR("CreateFile RPC failed: %s", status.error_message().c_str());
         return -1;
     }
 }
 
-std::pair<std::vector<struct Chunk>, std::string> metaserver_api_write(int fd, const void *buf, size_t num_bytes, off_t offset, int client_id) {
-    printf("%s: called to write to file.\n", __func__);
+std::pair<std::vector<struct Chunk>, std::string> metaserver_api_write(int fd, const void *buf, size_t num_bytes, off_t offset, int client_id,
+                                                                       bool *inlined) {
+    PFS_LOG_DEBUG("%s: called to write to file.", __func__);
+    ClientStatTimer timer(PFS_STAT_META_WRITE_TO_FILE);
 
     auto stub = connect_to_metaserver();
     if (!stub) {
-        std::cout << "Failed to connect to metaserver" << std::endl;
+        PFS_LOG_ERROR("Failed to connect to metaserver");
         return {{}, "FAIL"};
     }
 
     pfsmeta::WriteToFileRequest request; pfsmeta::WriteToFileResponse response;
     request.set_file_descriptor(fd);
 
-    std::string bytes_string(static_cast<const char*>(buf), num_bytes);
-    request.set_buf(bytes_string);
+    // The data is only any use to the metaserver if it can keep the file inlined, it goes to the fileservers otherwise
+    if (offset + num_bytes <= INLINE_FILE_THRESHOLD) {
+        request.set_buf(static_cast<const char*>(buf), num_bytes);
+    }
     request.set_num_bytes(num_bytes);
     request.set_offset(offset);
     request.set_client_id(client_id);
 
     grpc::ClientContext context;
+    trace_inject(context);
 
     grpc::Status status = stub->WriteToFile(&context, request, &response);
     if (status.ok()) {
-        printf("WriteFile RPC succeeded: %s\n", response.message().c_str());
+        PFS_LOG_DEBUG("WriteFile RPC succeeded: %s", response.message().c_str());
 
         std::vector<struct Chunk> instructions;
         for (const auto& instruction: response.instructions()) {
@@ -236,22 +278,76 @@ std::pair<std::vector<struct Chunk>, std::string> metaserver_api_write(int fd, c
             chunk.server_number = instruction.server_number();
             chunk.start_byte = instruction.start_byte();
             chunk.end_byte = instruction.end_byte();
+            chunk.version = instruction.version();
+            chunk.servers.assign(instruction.servers().begin(), instruction.servers().end());
             instructions.push_back(chunk);
         }
-        std::cout << "I have received the instructions from server" << std::endl;
+        if (inlined) *inlined = response.inlined();
+        saw_map_version(response.map_version());
+        PFS_LOG_DEBUG("I have received the instructions from server");
         return {instructions, response.filename()};
     } else {
-        fprintf(stderr, "WriteToFile RPC failed: %s\n", status.error_message().c_str());
+        PFS_LOG_ERROR("WriteToFile RPC failed: %s", status.error_message().c_str());
     }
     return {{}, "FAIL"};
 }
 
-std::pair<std::vector<struct Chunk>, std::string> metaserver_api_read(int fd, const void *buf, size_t num_bytes, off_t offset, int client_id) {
-    printf("%s: called to read from file.\n", __func__);
+int64_t metaserver_api_copy(int src_fd, off_t src_offset, int dst_fd, off_t dst_offset, size_t num_bytes, int client_id,
+                            std::vector<struct ChunkCopy> &plan, std::string &src_storage_name, std::string &dst_storage_name,
+                            bool *inlined) {
+    PFS_LOG_DEBUG("%s: called to copy between files.", __func__);
+    ClientStatTimer timer(PFS_STAT_META_COPY_FILE);
+
+    auto stub = connect_to_metaserver();
+    if (!stub) {
+        PFS_LOG_ERROR("Failed to connect to metaserver");
+        return -1;
+    }
+
+    pfsmeta::CopyFileRequest request; pfsmeta::CopyFileResponse response;
+    request.set_src_file_descriptor(src_fd);
+    request.set_src_offset(src_offset);
+    request.set_dst_file_descriptor(dst_fd);
+    request.set_dst_offset(dst_offset);
+    request.set_num_bytes(num_bytes);
+    request.set_client_id(client_id);
+
+    grpc::ClientContext context;
+    trace_inject(context);
+
+    grpc::Status status = stub->CopyFile(&context, request, &response);
+    if (!status.ok()) {
+        PFS_LOG_ERROR("CopyFile RPC failed: %s", status.error_message().c_str());
+        return -1;
+    }
+    PFS_LOG_DEBUG("CopyFile RPC succeeded: %s", response.message().c_str());
+
+    plan.clear();
+    for (const auto& instruction: response.instructions()) {
+        struct ChunkCopy copy;
+        int64_t length = instruction.src_end_byte() - instruction.src_start_byte() + 1;
+        copy.src = Chunk{instruction.src_chunk_number(), instruction.src_server_number(), instruction.src_start_byte(), instruction.src_end_byte()};
+        copy.dst = Chunk{instruction.dst_chunk_number(), instruction.dst_server_number(), instruction.dst_start_byte(), instruction.dst_start_byte() + length - 1};
+        copy.src.version = instruction.src_version();
+        copy.dst.version = instruction.dst_version();
+        copy.dst.servers.assign(instruction.dst_servers().begin(), instruction.dst_servers().end());
+        plan.push_back(copy);
+    }
+    if (inlined) *inlined = response.inlined();
+    saw_map_version(response.map_version());
+    src_storage_name = response.src_storage_name();
+    dst_storage_name = response.dst_storage_name();
+    return response.bytes_copied();
+}
+
+std::pair<std::vector<struct Chunk>, std::string> metaserver_api_read(int fd, const void *buf, size_t num_bytes, off_t offset, int client_id,
+                                                                      bool *inlined, std::string *inline_data) {
+    PFS_LOG_DEBUG("%s: called to read from file.", __func__);
+    ClientStatTimer timer(PFS_STAT_META_READ_FILE);
 
     auto stub = connect_to_metaserver();
     if (!stub) {
-        std::cout << "Failed to connect to metaserver" << std::endl;
+        PFS_LOG_ERROR("Failed to connect to metaserver");
         return {{}, "FAIL"};
     }
 
@@ -265,10 +361,11 @@ std::pair<std::vector<struct Chunk>, std::string> metaserver_api_read(int fd, co
     request.set_client_id(client_id);
 
     grpc::ClientContext context;
+    trace_inject(context);
 
     grpc::Status status = stub->ReadFile(&context, request, &response);
     if (status.ok()) {
-        printf("ReadFile RPC succeeded: %s\n", response.message().c_str());
+        PFS_LOG_DEBUG("ReadFile RPC succeeded: %s", response.message().c_str());
 
         std::vector<struct Chunk> instructions;
         for (const auto& instruction: response.instructions()) {
@@ -277,21 +374,27 @@ std::pair<std::vector<struct Chunk>, std::string> metaserver_api_read(int fd, co
             chunk.server_number = instruction.server_number();
             chunk.start_byte = instruction.start_byte();
             chunk.end_byte = instruction.end_byte();
+            chunk.version = instruction.version();
+            chunk.servers.assign(instruction.servers().begin(), instruction.servers().end());
             instructions.push_back(chunk);
         }
+        if (inlined) *inlined = response.inlined();
+        saw_map_version(response.map_version());
+        if (inline_data) *inline_data = response.inline_data();
         return {instructions, response.filename()};
     } else {
-        fprintf(stderr, "WriteToFile RPC failed: %s\n", status.error_message().c_str());
+        PFS_LOG_ERROR("WriteToFile RPC failed: %s", status.error_message().c_str());
     }
     return {{}, "FAIL"};
 }
 
 int metaserver_api_fstat(int fd, struct pfs_metadata *meta_data, int client_id) {
-    printf("%s: called to fetch metadata from file.\n", __func__);
+    PFS_LOG_DEBUG("%s: called to fetch metadata from file.", __func__);
+    ClientStatTimer timer(PFS_STAT_META_FILE_METADATA);
 
     auto stub = connect_to_metaserver();
     if (!stub) {
-        std::cout << "Failed to connect to metaserver" << std::endl;
+        PFS_LOG_ERROR("Failed to connect to metaserver");
         return -1;
     }
 
@@ -300,10 +403,11 @@ int metaserver_api_fstat(int fd, struct pfs_metadata *meta_data, int client_id)
     request.set_client_id(client_id);
 
     grpc::ClientContext context;
+    trace_inject(context);
 
     grpc::Status status = stub->FileMetadata(&context, request, &response);
     if (status.ok()) {
-        printf("File Metadata RPC succeeded: %s\n", response.message().c_str());
+        PFS_LOG_DEBUG("File Metadata RPC succeeded: %s", response.message().c_str());
 
         const pfsmeta::PFSMetadata& received_meta_data = response.meta_data();
 
@@ -316,6 +420,14 @@ int metaserver_api_fstat(int fd, struct pfs_metadata *meta_data, int client_id)
 
         const pfsmeta::PFSFileRecipe& recipe = received_meta_data.recipe();
         meta_data->recipe.stripe_width = recipe.stripe_width();
+        meta_data->recipe.stripe_unit = pfs_stripe_unit_or_default(recipe.stripe_unit());
+        meta_data->recipe.compression = recipe.compression();
+        meta_data->recipe.replication = recipe.replication();
+        meta_data->recipe.ec_parity = recipe.ec_parity();
+        meta_data->recipe.storage_name = recipe.storage_name();
+        meta_data->recipe.generation = recipe.generation();
+        meta_data->recipe.inlined = recipe.inlined();
+        meta_data->recipe.servers.assign(recipe.servers().begin(), recipe.servers().end());
 
         // Populate chunks
         meta_data->recipe.chunks.clear(); // Clear any existing chunks in case of re-population
@@ -325,23 +437,25 @@ int metaserver_api_fstat(int fd, struct pfs_metadata *meta_data, int client_id)
             chunk.server_number = proto_chunk.server_number();
             chunk.start_byte = proto_chunk.start_byte();
             chunk.end_byte = proto_chunk.end_byte();
+            chunk.version = proto_chunk.version();
 
             // Add the chunk to the recipe's chunks vector
             meta_data->recipe.chunks.push_back(chunk);
         }
         return 0;
     } else {
-        fprintf(stderr, "File Metadata RPC failed: %s\n", status.error_message().c_str());
+        PFS_LOG_ERROR("File Metadata RPC failed: %s", status.error_message().c_str());
         return -1;
     }
 }
 
-int metaserver_api_delete(const char *filename, int client_id) {
-    printf("%s: called to delete file.\n", __func__);
+int metaserver_api_delete(const char *filename, int client_id, struct pfs_delete_result &result) {
+    PFS_LOG_DEBUG("%s: called to delete file.", __func__);
+    ClientStatTimer timer(PFS_STAT_META_DELETE_FILE);
 
     auto stub = connect_to_metaserver();
     if (!stub) {
-        std::cout << "Failed to connect to metaserver" << std::endl;
+        PFS_LOG_ERROR("Failed to connect to metaserver");
         return -1;
     }
 
@@ -350,23 +464,65 @@ int metaserver_api_delete(const char *filename, int client_id) {
     request.set_client_id(client_id);
 
     grpc::ClientContext context;
+    trace_inject(context);
 
     grpc::Status status = stub->DeleteFile(&context, request, &response);
     if (status.ok()) {
-        printf("Delete File RPC succeeded: %s\n", response.message().c_str());
+        PFS_LOG_DEBUG("Delete File RPC succeeded: %s", response.message().c_str());
+        result.storage_name = response.storage_name();
+        result.storage_deleted = response.storage_deleted();
+        result.inlined = response.inlined();
+        result.freed_chunks.clear();
+        for (const pfsmeta::ProtoChunk& proto_chunk : response.freed_chunks()) {
+            Chunk chunk;
+            chunk.chunk_number = proto_chunk.chunk_number();
+            chunk.server_number = proto_chunk.server_number();
+            chunk.start_byte = proto_chunk.start_byte();
+            chunk.end_byte = proto_chunk.end_byte();
+            chunk.version = proto_chunk.version();
+            result.freed_chunks.push_back(chunk);
+        }
+        return 0;
+    } else {
+        PFS_LOG_ERROR("File Metadata RPC failed: %s", status.error_message().c_str());
+        return -1;
+    }
+}
+
+int metaserver_api_snapshot(const char *filename, const char *snapshot_name, int client_id) {
+    PFS_LOG_DEBUG("%s: called to snapshot file.", __func__);
+    ClientStatTimer timer(PFS_STAT_META_SNAPSHOT_FILE);
+
+    auto stub = connect_to_metaserver();
+    if (!stub) {
+        PFS_LOG_ERROR("Failed to connect to metaserver");
+        return -1;
+    }
+
+    pfsmeta::SnapshotFileRequest request; pfsmeta::SnapshotFileResponse response;
+    request.set_filename(filename);
+    request.set_snapshot_name(snapshot_name);
+    request.set_client_id(client_id);
+
+    grpc::ClientContext context;
+    trace_inject(context);
+
+    grpc::Status status = stub->SnapshotFile(&context, request, &response);
+    if (status.ok()) {
+        PFS_LOG_DEBUG("SnapshotFile RPC succeeded: %s", response.message().c_str());
         return 0;
     } else {
-        fprintf(stderr, "File Metadata RPC failed: %s\n", status.error_message().c_str());
+        PFS_LOG_ERROR("SnapshotFile RPC failed: %s", status.error_message().c_str());
         return -1;
     }
 }
 
-void metaserver_api_request_token(int fd, int start_byte, int end_byte, int type, int client_id) {
-    printf("%s: called to request token.\n", __func__);
+void metaserver_api_request_token(int fd, int64_t start_byte, int64_t end_byte, int type, int client_id) {
+    PFS_LOG_DEBUG("%s: called to request token.", __func__);
 
     auto stub = connect_to_metaserver();
     if (!stub) {
-        std::cout << "Failed to connect to metaserver" << std::endl;
+        PFS_LOG_ERROR("Failed to connect to metaserver");
         return;
     }
     pfsmeta::TokenRequest request;
@@ -376,52 +532,130 @@ void metaserver_api_request_token(int fd, int start_byte, int end_byte, int type
     request.set_type(type);
     request.set_client_id(client_id);
 
+    ClientStatTimer timer(PFS_STAT_TOKEN_WAIT);
+    // The stream outlives any one trace, so each request carries its own
+    TraceContext trace = trace_current();
+    request.set_trace_id(trace.trace_id);
+    request.set_span_id(trace.span_id);
     stream->Write(request);
 
     auto& file_sync = file_sync_map[{descriptor_to_filename[fd], type}];
     std::unique_lock<std::mutex> lock(file_sync.mtx);
-    std::cout << "I have sent the request, now I'll block myself until token arrives" << std::endl;
+    PFS_LOG_DEBUG("I have sent the request, now I'll block myself until token arrives");
     file_sync.cv.wait(lock, [&file_sync] { return file_sync.token_ready; });  // Wait until token is ready
 }
 
-bool metaserver_api_check_tokens(int fd, int start_byte, int end_byte, int type, int client_id) {
-    printf("%s: called to check token.\n", __func__);
+struct pfs_filerecipe metaserver_api_layout(int fd) {
+    auto it = descriptor_to_layout.find(fd);
+    if (it != descriptor_to_layout.end()) return it->second;
+    struct pfs_filerecipe layout;
+    layout.stripe_width = 1;
+    layout.compression = PFS_COMPRESSION_NONE;
+    layout.replication = 1;
+    layout.ec_parity = 0;
+    return layout;
+}
+
+bool metaserver_api_check_tokens(int fd, int64_t start_byte, int64_t end_byte, int type, int client_id) {
+    PFS_LOG_DEBUG("%s: called to check token.", __func__);
     if (descriptor_to_filename.find(fd) == descriptor_to_filename.end()) {
-        std::cerr << "Something went wrong!" << std::endl;
+        PFS_LOG_ERROR("Something went wrong!");
         return false;
     }
     std::string filename = descriptor_to_filename[fd];
 
     if (my_tokens.find(filename) == my_tokens.end()) return false;
 
-    int current_start = start_byte;
-    for (const auto& token : my_tokens[filename]) {
-        std::cout << "Trying to cover with token " << token.to_string() << std::endl;
-        int token_start = token.start_byte;
-        int token_end = token.end_byte;
-        int token_type = token.type;
-
-        // Check if the token overlaps with the current uncovered range
-        if (token_start <= current_start && token_end >= current_start) {
-            // If type is read (1), any token can contribute
-            if (type == 1 && (token_type == 1 || token_type == 2)) {
-                current_start = token_end + 1;
-            }
-            // If type is write/read (2), only write/read tokens can contribute
-            else if (type == 2 && token_type == 2) {
-                current_start = token_end + 1;
-            }
-        }
-        // If the entire range is covered, return true
-        if (current_start >= end_byte) {
-            return true;
-        }
+    return pfs_tokens_cover(my_tokens[filename], start_byte, end_byte, type);
+}
+
+int metaserver_api_cluster_map(struct pfs_cluster_map &map) {
+    ClientStatTimer timer(PFS_STAT_META_GET_CLUSTER_MAP);
+    std::lock_guard<std::mutex> lock(cluster_map_mutex);
+    if (cluster_map.version > 0 && cluster_map.version >= latest_map_version.load()) {
+        map = cluster_map;
+        return 0;
+    }
+
+    auto stub = connect_to_metaserver();
+    if (!stub) {
+        PFS_LOG_ERROR("Failed to connect to metaserver");
+        return -1;
+    }
+
+    pfsmeta::ClusterMapRequest request; pfsmeta::ClusterMapResponse response;
+    grpc::ClientContext context;
+    trace_inject(context);
+
+    grpc::Status status = stub->GetClusterMap(&context, request, &response);
+    if (!status.ok()) {
+        PFS_LOG_ERROR("GetClusterMap RPC failed: %s", status.error_message().c_str());
+        return -1;
+    }
+    cluster_map.version = response.map_version();
+    cluster_map.addresses.clear();
+    cluster_map.states.clear();
+    for (const pfsmeta::ClusterMember& member : response.members()) {
+        cluster_map.addresses.push_back(member.address());
+        cluster_map.states.push_back(member.state());
     }
-    // If the range is not fully covered, return false
-    return false;
+    saw_map_version(cluster_map.version);
+    PFS_LOG_DEBUG("%s: cluster map version %lu, %d fileservers", __func__, (unsigned long) cluster_map.version, (int) cluster_map.addresses.size());
+    map = cluster_map;
+    return 0;
 }
 
-int metaserver_api_execstat(struct pfs_execstat *execstat_data) {
+int metaserver_api_stats(std::vector<struct pfs_rpc_timing> &timings) {
+    struct pfs_server_stats stats;
+    if (metaserver_api_server_stats(stats) == -1) return -1;
+    timings = stats.rpcs;
+    return 0;
+}
+
+int metaserver_api_server_stats(struct pfs_server_stats &stats) {
+    ClientStatTimer timer(PFS_STAT_META_GET_STATS);
+    auto stub = connect_to_metaserver();
+    if (!stub) {
+        PFS_LOG_ERROR("Failed to connect to metaserver");
+        return -1;
+    }
 
+    pfsmeta::StatsRequest request; pfsmeta::StatsResponse response;
+    grpc::ClientContext context;
+    trace_inject(context);
+
+    grpc::Status status = stub->GetStats(&context, request, &response);
+    if (!status.ok()) {
+        PFS_LOG_ERROR("GetStats RPC failed: %s", status.error_message().c_str());
+        return -1;
+    }
+    rpc_stats_read(response, stats);
+    stats.values = {{"files", response.files()}, {"open_files", response.open_files()},
+                    {"tokens", response.tokens()}, {"token_streams", response.token_streams()}};
+    stats.files.clear();
+    for (const pfsmeta::FileContention& file : response.contended_files()) {
+        stats.files.push_back({file.filename(), file.tokens(), file.token_requests(), file.revocations()});
+    }
+    return 0;
 }
 
+int metaserver_api_trace(uint64_t trace_id, std::vector<TraceSpan> &spans, uint32_t &pid) {
+    auto stub = connect_to_metaserver();
+    if (!stub) {
+        PFS_LOG_ERROR("Failed to connect to metaserver");
+        return -1;
+    }
+
+    pfsmeta::TraceRequest request; pfsmeta::TraceResponse response;
+    request.set_trace_id(trace_id);
+    grpc::ClientContext context;
+
+    grpc::Status status = stub->GetTrace(&context, request, &response);
+    if (!status.ok()) {
+        PFS_LOG_ERROR("GetTrace RPC failed: %s", status.error_message().c_str());
+        return -1;
+    }
+    trace_read(response, spans);
+    pid = response.pid();
+    return 0;
+}
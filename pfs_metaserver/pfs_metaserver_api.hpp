@@ -5,28 +5,81 @@
 
 #include "pfs_common/pfs_config.hpp"
 #include "pfs_common/pfs_common.hpp"
+#include "pfs_common/pfs_rpc_stats.hpp"
 #include "pfs_client/pfs_api.hpp"
 
 int metaserver_api_initialize();
 
-int metaserver_api_create(const char *filename, int stripe_width, int client_id);
+int metaserver_api_create(const char *filename, int stripe_width, const struct pfs_create_options &options, int client_id);
 
 int metaserver_api_open(const char *filename, int mode, int client_id);
 
+/* Layout (the recipe without chunks) of a file this client has open */
+struct pfs_filerecipe metaserver_api_layout(int fd);
+
 int metaserver_api_close(int mode, int client_id);
 
 int metaserver_api_fstat(int fd, struct pfs_metadata *meta_data, int client_id);
 
-int metaserver_api_delete(const char *filename, int client_id);
+/* What a delete leaves for the fileservers to free */
+struct pfs_delete_result {
+    std::string storage_name;
+    bool storage_deleted = false;           // no file or snapshot uses the storage any more, all of it goes
+    std::vector<struct Chunk> freed_chunks; // otherwise only these chunk versions, one entry per copy
+    bool inlined = false;                   // nothing of the file was ever on the fileservers
+};
+
+#define PFS_MEMBER_UP 0     // heartbeating, takes new files and migrated chunks
+#define PFS_MEMBER_DOWN 1   // silent for HEARTBEAT_TIMEOUT_SEC, keeps its id and its chunks
+
+/* The fileservers the metaserver knows, server id i at addresses[i] */
+struct pfs_cluster_map {
+    uint64_t version = 0;
+    std::vector<std::string> addresses;
+    std::vector<int> states; // PFS_MEMBER_*
+};
+
+/*
+    The cluster map, fetched again whenever a metaserver reply showed a newer version than the
+    one cached, so clients see new fileservers on their next I/O. Returns 0 or -1.
+ */
+int metaserver_api_cluster_map(struct pfs_cluster_map &map);
+
+/* The metaserver's per-RPC timings, works without pfs_initialize(). Returns 0 or -1 */
+int metaserver_api_stats(std::vector<struct pfs_rpc_timing> &timings);
+
+/*
+    Everything the metaserver's GetStats reports: the RPCs, its callers by client id, the
+    files with the most token revocations and the values "files", "open_files", "tokens" and
+    "token_streams". Works without pfs_initialize(). Returns 0 or -1
+ */
+int metaserver_api_server_stats(struct pfs_server_stats &stats);
+
+/* The metaserver's recorded trace spans, of trace_id or all if it is 0, and its pid. Returns 0 or -1 */
+int metaserver_api_trace(uint64_t trace_id, std::vector<TraceSpan> &spans, uint32_t &pid);
+
+int metaserver_api_delete(const char *filename, int client_id, struct pfs_delete_result &result);
+
+/* Copy-on-write snapshot of filename as snapshot_name, no data is copied */
+int metaserver_api_snapshot(const char *filename, const char *snapshot_name, int client_id);
 
-void metaserver_api_request_token(int fd, int start_byte, int end_byte, int mode, int client_id);
+void metaserver_api_request_token(int fd, int64_t start_byte, int64_t end_byte, int mode, int client_id);
 
-bool metaserver_api_check_tokens(int fd, int start_byte, int end_byte, int mode, int client_id);
+bool metaserver_api_check_tokens(int fd, int64_t start_byte, int64_t end_byte, int mode, int client_id);
 
-int metaserver_api_execstat(struct pfs_execstat *execstat_data);
+/* <instructions, filename>. *inlined is set if the metaserver stored the write in the file's record, there are no instructions then */
+std::pair<std::vector<struct Chunk>, std::string> metaserver_api_write(int fd, const void *buf, size_t num_bytes, off_t offset, int client_id,
+                                                                       bool *inlined = nullptr);
 
-/* <instructions, filename */
-std::pair<std::vector<struct Chunk>, std::string> metaserver_api_write(int fd, const void *buf, size_t num_bytes, off_t offset, int client_id);
+/*
+    Plan of a server-side copy into plan, and the names both files' chunks are stored under.
+    *inlined is set if the metaserver copied the data into the destination's record, the plan is empty then.
+    Returns the bytes to copy (clipped at the end of the source), or -1
+ */
+int64_t metaserver_api_copy(int src_fd, off_t src_offset, int dst_fd, off_t dst_offset, size_t num_bytes, int client_id,
+                            std::vector<struct ChunkCopy> &plan, std::string &src_storage_name, std::string &dst_storage_name,
+                            bool *inlined = nullptr);
 
-/* <instructions, filename */
-std::pair<std::vector<struct Chunk>, std::string> metaserver_api_read(int fd, const void *buf, size_t num_bytes, off_t offset, int client_id);
+/* <instructions, filename>. For a file inlined in its record *inlined is set and the data read is in inline_data instead */
+std::pair<std::vector<struct Chunk>, std::string> metaserver_api_read(int fd, const void *buf, size_t num_bytes, off_t offset, int client_id,
+                                                                      bool *inlined = nullptr, std::string *inline_data = nullptr);
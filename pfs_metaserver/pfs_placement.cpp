@@ -0,0 +1,92 @@
+#include "pfs_placement.hpp"
+#include "pfs_client/pfs_api.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+
+/* FNV-1a, stable across builds so a name always starts on the same server */
+uint32_t PlacementPolicy::hash_name(const std::string& filename) {
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : filename) {
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash;
+}
+
+/* Makes room for a server id the policy hasn't seen, members join at run time */
+void PlacementPolicy::track(int server) {
+    if (server < (int) loads_.size()) return;
+    loads_.resize(server + 1);
+    last_requests_.resize(server + 1, 0);
+    last_report_.resize(server + 1);
+}
+
+std::vector<int> PlacementPolicy::place(int policy, const std::string& filename, int num_slots, int replication, const std::vector<int>& candidates) {
+    if (policy == PFS_PLACEMENT_DEFAULT) policy = PFS_DEFAULT_PLACEMENT;
+    if (candidates.empty()) return {};
+    const int n = candidates.size();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int server : candidates) track(server);
+    int rotation = next_start_++ % n;
+
+    std::vector<int> order(candidates);
+    bool all_reported = std::all_of(candidates.begin(), candidates.end(), [&](int server) { return loads_[server].reported; });
+    if (policy == PFS_PLACEMENT_HASH) {
+        std::rotate(order.begin(), order.begin() + hash_name(filename) % n, order.end());
+    } else if (policy != PFS_PLACEMENT_LOAD || !all_reported) {
+        std::rotate(order.begin(), order.begin() + rotation, order.end());
+    } else {
+        // Each term is relative to the busiest server, so none of them dominates by its unit
+        double max_rate = 0;
+        int max_placed = 0;
+        for (int server : candidates) {
+            max_rate = std::max(max_rate, loads_[server].requests_per_sec);
+            max_placed = std::max(max_placed, loads_[server].files_placed);
+        }
+        std::unordered_map<int, double> score;
+        for (int server : candidates) {
+            const FileserverLoad& load = loads_[server];
+            double used = load.capacity_bytes > 0 ? 1.0 - (double) load.available_bytes / load.capacity_bytes : 0;
+            score[server] = used;
+            if (max_rate > 0) score[server] += PLACEMENT_LOAD_WEIGHT * load.requests_per_sec / max_rate;
+            if (max_placed > 0) score[server] += PLACEMENT_LOAD_WEIGHT * load.files_placed / max_placed;
+        }
+
+        // Lowest score first, ties broken by rotation so equally loaded servers still take turns
+        std::rotate(order.begin(), order.begin() + rotation, order.end());
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return score[a] < score[b]; });
+    }
+
+    std::vector<int> servers;
+    for (int slot = 0; slot < num_slots; slot++) {
+        for (int r = 0; r < replication; r++) {
+            servers.push_back(order[(slot + r) % n]);
+            loads_[servers.back()].files_placed++;
+        }
+    }
+    return servers;
+}
+
+void PlacementPolicy::report(int server, uint64_t capacity_bytes, uint64_t available_bytes, uint64_t requests_served) {
+    if (server < 0) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    track(server);
+    auto now = std::chrono::steady_clock::now();
+    FileserverLoad& load = loads_[server];
+    if (load.reported && requests_served >= last_requests_[server]) {
+        double seconds = std::chrono::duration<double>(now - last_report_[server]).count();
+        if (seconds > 0) load.requests_per_sec = (requests_served - last_requests_[server]) / seconds;
+    }
+    load.reported = true;
+    load.capacity_bytes = capacity_bytes;
+    load.available_bytes = available_bytes;
+    load.files_placed = 0;
+    last_requests_[server] = requests_served;
+    last_report_[server] = now;
+}
+
+std::vector<FileserverLoad> PlacementPolicy::loads() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return loads_;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+
+#include "pfs_common/pfs_config.hpp"
+
+/* What a fileserver last reported about itself */
+struct FileserverLoad {
+    bool reported = false;
+    uint64_t capacity_bytes = 0;
+    uint64_t available_bytes = 0;
+    double requests_per_sec = 0;    // between its last two reports
+    int files_placed = 0;           // files placed on it since its last report
+};
+
+/*
+    Picks the fileservers of a new file at create time, recorded in its recipe. Each slot (the
+    stripe_width data slots, then one per parity chunk) gets `replication` entries: slot s is
+    held by servers[s * replication + r] for every copy r. The candidates, the fileservers that
+    are up, are put in an order and slot s copy r goes to the (s + r)th of them:
+        PFS_PLACEMENT_ROTATE : in id order, every file starting one server further
+        PFS_PLACEMENT_HASH   : in id order, starting where the file name hashes to
+        PFS_PLACEMENT_LOAD   : the servers with the most free space and the fewest requests first
+    LOAD scores servers by used capacity, request rate and files placed since they last
+    reported, so a burst of creates between reports still spreads out. It falls back to
+    ROTATE until every candidate has reported.
+ */
+class PlacementPolicy {
+public:
+    /*
+        Servers for filename, num_slots * replication of them, drawn from candidates (which must
+        hold at least num_slots and replication servers). policy is one of PFS_PLACEMENT_*,
+        PFS_PLACEMENT_DEFAULT picks PFS_DEFAULT_PLACEMENT.
+     */
+    std::vector<int> place(int policy, const std::string& filename, int num_slots, int replication, const std::vector<int>& candidates);
+
+    /* A fileserver's capacity and the total number of requests it has served */
+    void report(int server, uint64_t capacity_bytes, uint64_t available_bytes, uint64_t requests_served);
+
+    std::vector<FileserverLoad> loads();
+
+private:
+    static uint32_t hash_name(const std::string& filename);
+    void track(int server);
+
+    std::mutex mutex_;
+    int next_start_ = 0;
+    std::vector<FileserverLoad> loads_;
+    std::vector<uint64_t> last_requests_;
+    std::vector<std::chrono::steady_clock::time_point> last_report_;
+};
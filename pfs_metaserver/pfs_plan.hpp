@@ -0,0 +1,41 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "pfs_common/pfs_layout.hpp"
+#include "pfs_client/pfs_api.hpp"
+
+/*
+    Read planning of the metaserver, a pure function of the file's metadata so that it can be
+    measured on its own (bench/bench_micro.cpp).
+ */
+
+/* Splits a read of [offset, offset + num_bytes) into per-chunk instructions, stopping at the end of the file */
+inline std::vector<struct Chunk> pfs_plan_read(const struct pfs_metadata &file_metadata, int64_t offset, int64_t num_bytes) {
+    const std::vector<struct Chunk> &chunks = file_metadata.recipe.chunks;
+    num_bytes = std::min(num_bytes, (int64_t) file_metadata.file_size - offset); // stop at the end of the file
+
+    std::vector<struct Chunk> read_instructions;
+    pfs_with_stripe_unit(file_metadata.recipe.stripe_unit, [&](auto unit) {
+        bool missing = false;
+        pfs_for_each_chunk(unit, offset, num_bytes, [&](int chunk_number, int64_t start_byte_for_instruction, int64_t end_byte_for_instruction) {
+            if (missing) return;
+            int server_number = file_metadata.recipe.data_server(chunk_number);
+
+            // check if this chunk exists
+            auto it = std::find_if(chunks.begin(), chunks.end(), [chunk_number](const Chunk& c) {
+                return c.chunk_number == chunk_number;
+            });
+            if (it == chunks.end()) {
+                missing = true;
+                return;
+            }
+
+            struct Chunk chunk_for_instruction = Chunk{chunk_number, server_number, start_byte_for_instruction, end_byte_for_instruction};
+            chunk_for_instruction.version = it->version;
+            read_instructions.push_back(chunk_for_instruction);
+        });
+    });
+    return read_instructions;
+}
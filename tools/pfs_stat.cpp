@@ -0,0 +1,308 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "pfs_common/pfs_config.hpp"
+#include "pfs_common/pfs_common.hpp"
+#include "pfs_common/pfs_rpc_stats.hpp"
+#include "pfs_metaserver/pfs_metaserver_api.hpp"
+#include "pfs_fileserver/pfs_fileserver_api.hpp"
+
+/*
+    Polls the GetStats RPC of the metaserver and of every fileserver in the cluster map and
+    prints, per server and per poll interval:
+        req/s, calls in flight, p50/p99 handler time and request/reply bytes of each RPC
+        the server's own numbers: files, open files and tokens of the metaserver, block
+        cache hit rate, storage queue depth and capacity of the fileservers
+        req/s and bytes of each caller: client ids on the metaserver, hosts on fileservers
+        the files whose tokens were revoked the most
+    The first poll covers everything since each server started. With -p it also writes the
+    latest poll in the Prometheus text format to a file, replaced atomically on every poll,
+    for a node exporter's textfile collector or anything else that scrapes files. Prometheus
+    gets the totals since startup and computes rates itself.
+
+    Usage: ./pfs_stat [options], -h lists them. Needs pfs_list.txt or $PFS_LIST, like any client.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    double interval = 2;
+    int polls = 0;              // 0: until interrupted
+    std::string prometheus;
+    bool quiet = false;
+    bool verbose = false;
+};
+
+/* One server in one poll */
+struct ServerPoll {
+    std::string role;           // "metaserver" or "fileserver"
+    std::string address;
+    bool up = false;
+    struct pfs_server_stats stats;
+};
+
+static void print_usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -i <seconds>    time between polls (2)\n"
+            "  -n <polls>      stop after this many polls (until interrupted)\n"
+            "  -p <file>       write every poll in Prometheus text format to a file\n"
+            "  -q              no table on stdout, only the Prometheus file\n"
+            "  -V              keep the client library's output\n",
+            program);
+}
+
+static std::string metaserver_address() {
+    std::ifstream list(pfs_list_path("pfs_list.txt"));
+    std::string address;
+    std::getline(list, address);
+    return address;
+}
+
+static std::vector<ServerPoll> poll_servers() {
+    std::vector<ServerPoll> servers(1);
+    servers[0].role = "metaserver";
+    servers[0].address = metaserver_address();
+    servers[0].up = metaserver_api_server_stats(servers[0].stats) == 0;
+
+    struct pfs_cluster_map map;
+    if (!servers[0].up || metaserver_api_cluster_map(map) == -1) return servers;
+    for (size_t id = 0; id < map.addresses.size(); id++) {
+        ServerPoll server;
+        server.role = "fileserver";
+        server.address = map.addresses[id];
+        server.up = map.states[id] == PFS_MEMBER_UP && fileserver_api_stats(server.address, server.stats) == 0;
+        servers.push_back(server);
+    }
+    return servers;
+}
+
+/* What was recorded between two snapshots of a histogram; the max stays the all-time one */
+static LatencyHistogram histogram_delta(const LatencyHistogram& now, const LatencyHistogram& before) {
+    LatencyHistogram delta = now;
+    for (int b = 0; b < LatencyHistogram::BUCKETS; b++) delta.counts[b] -= std::min(before.counts[b], now.counts[b]);
+    delta.count -= std::min(before.count, now.count);
+    delta.total_ns -= std::min(before.total_ns, now.total_ns);
+    return delta;
+}
+
+template <typename T>
+static const T* find_named(const std::vector<T>& items, const std::string& name, std::string T::*field) {
+    for (const T& item : items) if (item.*field == name) return &item;
+    return nullptr;
+}
+
+static void print_server(FILE *out, const ServerPoll& server, const ServerPoll *before, double seconds) {
+    if (!server.up) {
+        fprintf(out, "%s %s: down\n\n", server.role.c_str(), server.address.c_str());
+        return;
+    }
+    const struct pfs_server_stats& stats = server.stats;
+    fprintf(out, "%s %s: up %lus", server.role.c_str(), server.address.c_str(), (unsigned long) stats.uptime_sec);
+    for (const auto& [name, value] : stats.values) fprintf(out, "  %s %g", name.c_str(), value);
+    fprintf(out, "\n");
+
+    fprintf(out, "  %-20s %10s %9s %10s %10s %12s %12s\n", "rpc", "req/s", "in-flight", "p50 us", "p99 us", "in B/s", "out B/s");
+    for (const struct pfs_rpc_timing& rpc : stats.rpcs) {
+        const struct pfs_rpc_timing *prev = before ? find_named(before->stats.rpcs, rpc.rpc, &pfs_rpc_timing::rpc) : nullptr;
+        LatencyHistogram latency = prev ? histogram_delta(rpc.latency, prev->latency) : rpc.latency;
+        if (latency.count == 0 && rpc.in_flight == 0) continue;
+        uint64_t bytes_in = rpc.bytes_in - (prev ? prev->bytes_in : 0), bytes_out = rpc.bytes_out - (prev ? prev->bytes_out : 0);
+        fprintf(out, "  %-20s %10.1f %9ld %10.1f %10.1f %12.0f %12.0f\n", rpc.rpc.c_str(), latency.count / seconds, (long) rpc.in_flight,
+                latency.percentile_ns(0.50) / 1e3, latency.percentile_ns(0.99) / 1e3, bytes_in / seconds, bytes_out / seconds);
+    }
+
+    bool header = false;
+    for (const struct pfs_caller_stats& client : stats.clients) {
+        const struct pfs_caller_stats *prev = before ? find_named(before->stats.clients, client.client, &pfs_caller_stats::client) : nullptr;
+        uint64_t calls = client.calls - (prev ? prev->calls : 0);
+        if (calls == 0) continue;
+        if (!header) fprintf(out, "  %-20s %10s %9s %10s %10s %12s %12s\n", "client", "req/s", "", "mean us", "", "in B/s", "out B/s");
+        header = true;
+        uint64_t total_us = client.total_us - (prev ? prev->total_us : 0);
+        fprintf(out, "  %-20s %10.1f %9s %10.1f %10s %12.0f %12.0f\n", client.client.c_str(), calls / seconds, "", (double) total_us / calls, "",
+                (client.bytes_in - (prev ? prev->bytes_in : 0)) / seconds, (client.bytes_out - (prev ? prev->bytes_out : 0)) / seconds);
+    }
+
+    if (!stats.files.empty()) fprintf(out, "  %-30s %8s %14s %12s\n", "contended file", "tokens", "token requests", "revocations");
+    for (const struct pfs_file_contention& file : stats.files) {
+        fprintf(out, "  %-30s %8lu %14lu %12lu\n", file.filename.c_str(), (unsigned long) file.tokens,
+                (unsigned long) file.token_requests, (unsigned long) file.revocations);
+    }
+    fprintf(out, "\n");
+}
+
+/* ------------------------------- Prometheus -------------------------------- */
+
+struct Family {
+    std::string name, type, help;
+    std::vector<std::string> samples;
+};
+
+/* Families in the order they were first used; a metric's samples must be listed together */
+struct Exposition {
+    std::vector<Family> families;
+
+    /* suffix is for the _bucket, _sum and _count samples of a histogram */
+    void add(const std::string& name, const char *type, const char *help, const std::string& labels, double value,
+             const char *suffix = "") {
+        Family *family = nullptr;
+        for (Family& f : families) if (f.name == name) family = &f;
+        if (!family) {
+            families.push_back({name, type, help, {}});
+            family = &families.back();
+        }
+        char number[64];
+        snprintf(number, sizeof(number), "%.17g", value);
+        family->samples.push_back(name + suffix + "{" + labels + "} " + number);
+    }
+};
+
+static std::string escape_label(const std::string& value) {
+    std::string out;
+    for (char c : value) {
+        if (c == '\\' || c == '"') out += '\\';
+        if (c == '\n') { out += "\\n"; continue; }
+        out += c;
+    }
+    return out;
+}
+
+static std::string label(const char *name, const std::string& value) {
+    return std::string(name) + "=\"" + escape_label(value) + "\"";
+}
+
+// Upper bounds of the exported latency buckets, in seconds
+static const double LATENCY_BOUNDS[] = {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+static const char *LATENCY_HELP = "Time in the RPC handler";
+
+static void export_server(Exposition& e, const ServerPoll& server) {
+    std::string labels = label("role", server.role) + "," + label("server", server.address);
+    e.add("pfs_up", "gauge", "Whether the server answered its last GetStats", labels, server.up);
+    if (!server.up) return;
+    const struct pfs_server_stats& stats = server.stats;
+    e.add("pfs_uptime_seconds", "gauge", "Time since the server started", labels, stats.uptime_sec);
+
+    for (const struct pfs_rpc_timing& rpc : stats.rpcs) {
+        std::string l = labels + "," + label("rpc", rpc.rpc);
+        e.add("pfs_rpc_calls_total", "counter", "RPCs served", l, rpc.calls);
+        e.add("pfs_rpc_in_flight", "gauge", "RPCs being served", l, rpc.in_flight);
+        e.add("pfs_rpc_request_bytes_total", "counter", "Bytes of request messages", l, rpc.bytes_in);
+        e.add("pfs_rpc_reply_bytes_total", "counter", "Bytes of reply messages", l, rpc.bytes_out);
+        // An HDR bucket counts towards a bound once all of it is below; the export rounds up by at most 1/16
+        uint64_t cumulative = 0;
+        int b = 0;
+        for (double bound : LATENCY_BOUNDS) {
+            uint64_t bound_ns = (uint64_t) (bound * 1e9);
+            for (; b < LatencyHistogram::BUCKETS && LatencyHistogram::bucket_high(b) <= bound_ns; b++) cumulative += rpc.latency.counts[b];
+            char le[32];
+            snprintf(le, sizeof(le), "%g", bound);
+            e.add("pfs_rpc_latency_seconds", "histogram", LATENCY_HELP, l + "," + label("le", le), cumulative, "_bucket");
+        }
+        e.add("pfs_rpc_latency_seconds", "histogram", LATENCY_HELP, l + "," + label("le", "+Inf"), rpc.latency.count, "_bucket");
+        e.add("pfs_rpc_latency_seconds", "histogram", LATENCY_HELP, l, rpc.latency.total_ns / 1e9, "_sum");
+        e.add("pfs_rpc_latency_seconds", "histogram", LATENCY_HELP, l, rpc.latency.count, "_count");
+    }
+
+    for (const struct pfs_caller_stats& client : stats.clients) {
+        std::string l = labels + "," + label("client", client.client);
+        e.add("pfs_client_calls_total", "counter", "RPCs served per caller", l, client.calls);
+        e.add("pfs_client_handler_seconds_total", "counter", "Time in the RPC handlers per caller", l, client.total_us / 1e6);
+        e.add("pfs_client_request_bytes_total", "counter", "Bytes of request messages per caller", l, client.bytes_in);
+        e.add("pfs_client_reply_bytes_total", "counter", "Bytes of reply messages per caller", l, client.bytes_out);
+    }
+
+    for (const auto& [name, value] : stats.values) {
+        bool counter = name.size() > 6 && name.compare(name.size() - 6, 6, "_total") == 0;
+        e.add("pfs_" + server.role + "_" + name, counter ? "counter" : "gauge", "From the server's GetStats", labels, value);
+    }
+
+    for (const struct pfs_file_contention& file : stats.files) {
+        std::string l = labels + "," + label("file", file.filename);
+        e.add("pfs_file_tokens", "gauge", "Tokens held on one of the most contended files", l, file.tokens);
+        e.add("pfs_file_token_requests_total", "counter", "Token requests for one of the most contended files", l, file.token_requests);
+        e.add("pfs_file_revocations_total", "counter", "Tokens revoked on one of the most contended files", l, file.revocations);
+    }
+}
+
+/* Writes next to path and renames, so a scraper never reads a half-written file. Returns 0 or -1 */
+static int write_prometheus(const std::string& path, const std::vector<ServerPoll>& servers) {
+    Exposition e;
+    for (const ServerPoll& server : servers) export_server(e, server);
+
+    std::string tmp = path + ".tmp";
+    FILE *out = fopen(tmp.c_str(), "w");
+    if (!out) {
+        perror(tmp.c_str());
+        return -1;
+    }
+    for (const Family& family : e.families) {
+        fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", family.name.c_str(), family.help.c_str(), family.name.c_str(), family.type.c_str());
+        for (const std::string& sample : family.samples) fprintf(out, "%s\n", sample.c_str());
+    }
+    if (fclose(out) != 0 || rename(tmp.c_str(), path.c_str()) != 0) {
+        perror(path.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Options o;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:n:p:qVh")) != -1) {
+        switch (opt) {
+            case 'i': o.interval = atof(optarg); break;
+            case 'n': o.polls = atoi(optarg); break;
+            case 'p': o.prometheus = optarg; break;
+            case 'q': o.quiet = true; break;
+            case 'V': o.verbose = true; break;
+            default: print_usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (o.interval <= 0 || o.polls < 0 || (o.quiet && o.prometheus.empty())) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // The table goes to the real stdout, the client library's output nowhere
+    FILE *out = stdout;
+    if (!o.verbose) {
+        out = fdopen(dup(STDOUT_FILENO), "w");
+        if (!out || !freopen("/dev/null", "w", stdout)) return 1;
+    }
+
+    std::map<std::string, ServerPoll> previous; // by address
+    Clock::time_point last = Clock::now();
+    for (int poll = 0; o.polls == 0 || poll < o.polls; poll++) {
+        if (poll > 0) std::this_thread::sleep_until(last + std::chrono::duration<double>(o.interval));
+        Clock::time_point now = Clock::now();
+        double elapsed = std::chrono::duration<double>(now - last).count();
+        last = now;
+        std::vector<ServerPoll> servers = poll_servers();
+
+        if (!o.quiet) {
+            for (const ServerPoll& server : servers) {
+                auto it = previous.find(server.address);
+                const ServerPoll *before = it != previous.end() && it->second.up ? &it->second : nullptr;
+                // A restarted server starts over, rates then cover its whole uptime
+                if (before && before->stats.uptime_sec > server.stats.uptime_sec) before = nullptr;
+                double seconds = before ? elapsed : std::max<double>(1, server.stats.uptime_sec);
+                print_server(out, server, before, seconds);
+            }
+            fflush(out);
+        }
+        if (!o.prometheus.empty()) write_prometheus(o.prometheus, servers);
+        for (const ServerPoll& server : servers) previous[server.address] = server;
+    }
+    return 0;
+}
@@ -0,0 +1,223 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "pfs_common/pfs_config.hpp"
+#include "pfs_common/pfs_common.hpp"
+#include "pfs_common/pfs_log.hpp"
+#include "pfs_common/pfs_trace.hpp"
+#include "pfs_metaserver/pfs_metaserver_api.hpp"
+#include "pfs_fileserver/pfs_fileserver_api.hpp"
+
+/*
+    Merges the trace spans of a cluster into one timeline. Spans come from the GetTrace RPC of
+    the metaserver and of every fileserver in the cluster map, and from the files clients
+    traced with PFS_TRACE wrote when they exited (given as arguments). Writes them as Chrome
+    trace event JSON, which chrome://tracing and ui.perfetto.dev open: a process per server
+    and client, a slice per span, and an arrow from every RPC to the handler that served it.
+    Then prints the slowest traces as trees of spans, marking the critical path: at every
+    level the child that finished last, the one its parent was waiting for at the end.
+
+    Usage: ./pfs_trace [options] [pfs_trace_<pid>.bin ...], -h lists them. Needs pfs_list.txt
+    or $PFS_LIST, like any client.
+ */
+
+struct Options {
+    std::string output = "pfs_trace.json";
+    uint64_t trace_id = 0;      // 0: every trace
+    int slowest = 3;
+    bool verbose = false;
+};
+
+struct Process {
+    std::string label;
+    uint32_t pid = 0;
+    std::vector<TraceSpan> spans;
+};
+
+/* Servers by address, clients by pid */
+static std::string label(const Process& process) {
+    return process.label == "client" ? "client " + std::to_string(process.pid) : process.label;
+}
+
+/* A span and where it was recorded */
+struct Node {
+    const TraceSpan* span;
+    int process;
+    std::vector<const Node*> children;
+};
+
+static void print_usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [options] [client trace files]\n"
+            "  -o <file>       where to write the JSON timeline (pfs_trace.json)\n"
+            "  -t <trace id>   only this trace, in hex as printed\n"
+            "  -s <n>          print the n slowest traces (3)\n"
+            "  -V              keep the client library's output\n",
+            program);
+}
+
+static std::vector<Process> collect(const Options& o, const std::vector<std::string>& files) {
+    std::vector<Process> processes;
+    Process meta;
+    if (metaserver_api_trace(o.trace_id, meta.spans, meta.pid) == 0) {
+        meta.label = "metaserver";
+        processes.push_back(meta);
+    }
+    struct pfs_cluster_map map;
+    if (metaserver_api_cluster_map(map) == 0) {
+        for (size_t id = 0; id < map.addresses.size(); id++) {
+            if (map.states[id] != PFS_MEMBER_UP) continue;
+            Process server;
+            if (fileserver_api_trace(map.addresses[id], o.trace_id, server.spans, server.pid) == -1) continue;
+            server.label = "fileserver " + map.addresses[id];
+            processes.push_back(server);
+        }
+    }
+    for (const std::string& file : files) {
+        Process client;
+        if (trace_read_file(file, client.spans, client.pid) == -1) continue;
+        if (o.trace_id != 0) {
+            client.spans.erase(std::remove_if(client.spans.begin(), client.spans.end(),
+                                              [&](const TraceSpan& span) { return span.trace_id != o.trace_id; }),
+                               client.spans.end());
+        }
+        client.label = "client";
+        processes.push_back(client);
+    }
+    return processes;
+}
+
+static std::string hex(uint64_t id) {
+    char out[20];
+    snprintf(out, sizeof(out), "%016llx", (unsigned long long) id);
+    return out;
+}
+
+static std::string json_string(const std::string& value) {
+    std::string out = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\') out += '\\';
+        if ((unsigned char) c < 0x20) continue;
+        out += c;
+    }
+    return out + "\"";
+}
+
+/* Chrome trace event format, times in microseconds since the first span */
+static int write_json(const std::string& path, const std::vector<Process>& processes,
+                      const std::unordered_map<uint64_t, Node>& nodes, int64_t origin_ns) {
+    FILE *out = fopen(path.c_str(), "w");
+    if (!out) {
+        perror(path.c_str());
+        return -1;
+    }
+    auto us = [&](int64_t ns) { return (ns - origin_ns) / 1e3; };
+    fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    const char *separator = "";
+    for (size_t p = 0; p < processes.size(); p++) {
+        std::string name = processes[p].label + " (pid " + std::to_string(processes[p].pid) + ")";
+        fprintf(out, "%s{\"ph\": \"M\", \"name\": \"process_name\", \"pid\": %zu, \"args\": {\"name\": %s}}", separator, p + 1,
+                json_string(name).c_str());
+        separator = ",\n";
+        for (const TraceSpan& span : processes[p].spans) {
+            fprintf(out, ",\n{\"ph\": \"X\", \"cat\": \"pfs\", \"name\": %s, \"pid\": %zu, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, "
+                         "\"args\": {\"trace\": \"%s\", \"span\": \"%s\", \"parent\": \"%s\"}}",
+                    json_string(span.name).c_str(), p + 1, span.tid, us(span.start_ns), (span.end_ns - span.start_ns) / 1e3,
+                    hex(span.trace_id).c_str(), hex(span.span_id).c_str(), hex(span.parent_id).c_str());
+            // An arrow from the caller to a span of another process
+            auto parent = nodes.find(span.parent_id);
+            if (parent == nodes.end() || parent->second.process == (int) p) continue;
+            fprintf(out, ",\n{\"ph\": \"s\", \"cat\": \"rpc\", \"name\": \"rpc\", \"id\": \"%s\", \"pid\": %d, \"tid\": %u, \"ts\": %.3f}",
+                    hex(span.span_id).c_str(), parent->second.process + 1, parent->second.span->tid, us(span.start_ns));
+            fprintf(out, ",\n{\"ph\": \"f\", \"bp\": \"e\", \"cat\": \"rpc\", \"name\": \"rpc\", \"id\": \"%s\", \"pid\": %zu, \"tid\": %u, \"ts\": %.3f}",
+                    hex(span.span_id).c_str(), p + 1, span.tid, us(span.start_ns));
+        }
+    }
+    fprintf(out, "\n]}\n");
+    if (fclose(out) != 0) {
+        perror(path.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+static void print_tree(const Node& node, const std::vector<Process>& processes, int64_t trace_start, int depth, bool critical) {
+    const TraceSpan& span = *node.span;
+    printf("%c %*s%-*s %-28s +%9.3f ms %9.3f ms\n", critical ? '*' : ' ', depth * 2, "", 32 - depth * 2, span.name,
+           label(processes[node.process]).c_str(), (span.start_ns - trace_start) / 1e6, (span.end_ns - span.start_ns) / 1e6);
+    const Node *last = nullptr;
+    for (const Node *child : node.children) {
+        if (!last || child->span->end_ns > last->span->end_ns) last = child;
+    }
+    for (const Node *child : node.children) print_tree(*child, processes, trace_start, depth + 1, critical && child == last);
+}
+
+int main(int argc, char *argv[]) {
+    Options o;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:t:s:Vh")) != -1) {
+        switch (opt) {
+            case 'o': o.output = optarg; break;
+            case 't': o.trace_id = strtoull(optarg, nullptr, 16); break;
+            case 's': o.slowest = atoi(optarg); break;
+            case 'V': o.verbose = true; break;
+            default: print_usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    std::vector<std::string> files(argv + optind, argv + argc);
+
+    // The report goes to the real stdout, the client library's output nowhere
+    int report_fd = dup(STDOUT_FILENO);
+    if (!o.verbose && !freopen("/dev/null", "w", stdout)) return 1;
+    std::vector<Process> processes = collect(o, files);
+    pfs_log_flush();
+    fflush(stdout);
+    dup2(report_fd, STDOUT_FILENO);
+
+    std::unordered_map<uint64_t, Node> nodes; // by span id
+    int64_t origin_ns = INT64_MAX;
+    size_t total = 0;
+    for (size_t p = 0; p < processes.size(); p++) {
+        for (const TraceSpan& span : processes[p].spans) {
+            nodes[span.span_id] = Node{&span, (int) p, {}};
+            origin_ns = std::min(origin_ns, span.start_ns);
+        }
+        total += processes[p].spans.size();
+    }
+    if (total == 0) {
+        fprintf(stderr, "No spans found. Were the clients run with PFS_TRACE set?\n");
+        return 1;
+    }
+
+    // Spans whose parent wasn't recorded (or was overwritten) are roots of their own
+    std::vector<const Node*> roots;
+    for (auto& [id, node] : nodes) {
+        auto parent = nodes.find(node.span->parent_id);
+        if (node.span->parent_id != 0 && parent != nodes.end()) parent->second.children.push_back(&node);
+        else roots.push_back(&node);
+    }
+    for (auto& [id, node] : nodes) {
+        std::sort(node.children.begin(), node.children.end(),
+                  [](const Node *a, const Node *b) { return a->span->start_ns < b->span->start_ns; });
+    }
+    std::sort(roots.begin(), roots.end(), [](const Node *a, const Node *b) {
+        return a->span->end_ns - a->span->start_ns > b->span->end_ns - b->span->start_ns;
+    });
+
+    if (write_json(o.output, processes, nodes, origin_ns) == -1) return 1;
+    printf("%zu spans of %zu processes written to %s\n", total, processes.size(), o.output.c_str());
+    for (int i = 0; i < o.slowest && i < (int) roots.size(); i++) {
+        const TraceSpan& root = *roots[i]->span;
+        printf("\ntrace %s, %.3f ms, * marks the critical path\n", hex(root.trace_id).c_str(), (root.end_ns - root.start_ns) / 1e6);
+        print_tree(*roots[i], processes, root.start_ns, 0, true);
+    }
+    return 0;
+}